@@ -19,6 +19,7 @@
 
 #include "chess/Bcgn.h"
 #include "chess/GameClassification.h"
+#include "chess/MoveGenerator.h"
 #include "chess/Pgn.h"
 #include "chess/San.h"
 
@@ -31,8 +32,10 @@
 #include "persistence/pos_db/epsilon/DatabaseFormatEpsilonSmeared.h"
 #include "persistence/pos_db/Database.h"
 #include "persistence/pos_db/DatabaseFactory.h"
+#include "persistence/pos_db/PositionTable.h"
 #include "persistence/pos_db/Query.h"
 
+#include "util/AllocationCounter.h"
 #include "util/MemoryAmount.h"
 
 #include "Configuration.h"
@@ -41,14 +44,19 @@
 #include "ConsoleApp.h"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <map>
 #include <memory>
+#include <optional>
 #include <queue>
+#include <random>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <string_view>
@@ -129,8 +137,11 @@ namespace command_line_app
         g_factory.registerDatabaseSchema<persistence::db_delta::Database>();
         g_factory.registerDatabaseSchema<persistence::db_delta_smeared::Database>();
         g_factory.registerDatabaseSchema<persistence::db_epsilon::Database>();
+        g_factory.registerDatabaseSchema<persistence::db_epsilon_48::Database>();
         g_factory.registerDatabaseSchema<persistence::db_epsilon_smeared::Database>();
 
+        g_factory.registerDatabaseConversion<persistence::db_epsilon::Database, persistence::db_epsilon_48::Database>();
+
         return g_factory;
     }();
 
@@ -362,6 +373,45 @@ namespace command_line_app
         );
     }
 
+    static void convertDbImpl(
+        const std::filesystem::path& path,
+        const std::string& schema,
+        const std::filesystem::path& destination,
+        const std::vector<std::filesystem::path>& temps
+    )
+    {
+        assertDirectoryEmpty(destination);
+
+        const auto sourceSchema = readSchemaOfDatabase(path);
+        const auto* converter = g_factory.tryGetConverter(sourceSchema, schema);
+        if (converter == nullptr)
+        {
+            throw Exception("Databases can't be converted from " + sourceSchema + " to " + schema + ".");
+        }
+
+        converter->convert(path, destination, temps);
+    }
+
+    static void convertDb(args::Subparser& parser)
+    {
+        args::Group requiredArgs(parser, "required arguments", args::Group::Validators::All);
+        args::Positional<std::string> input(requiredArgs, "path", "The path to the database to convert.");
+        args::ValueFlag<std::string> schema(requiredArgs, "schema", "The schema (format/type) of the new database", { "schema" });
+        args::ValueFlag<std::string> output(requiredArgs, "path", "The output directory", { 'o', "output" });
+
+        args::ValueFlagList<std::string> temp(parser, "path", "Temporary directory to use for decompressing data files", { "temp" });
+
+        parser.Parse();
+
+        std::vector<std::filesystem::path> temps;
+        for (auto&& t : temp)
+        {
+            temps.emplace_back(t);
+        }
+
+        convertDbImpl(args::get(input), args::get(schema), args::get(output), temps);
+    }
+
     static std::uint32_t receiveLength(const char* str)
     {
         constexpr std::uint32_t xorValue = 3173045653u;
@@ -389,15 +439,10 @@ namespace command_line_app
 
     // 4 bytes of size S in little endian
     // 4 bytes of size S xored with 3173045653u (for verification)
-    // then S bytes
-    static void sendMessage(
-        const TcpConnection::Ptr& session,
-        std::string message
-    )
+    static std::string encodeLength(std::uint32_t size)
     {
         constexpr std::uint32_t xorValue = 3173045653u;
 
-        std::uint32_t size = static_cast<std::uint32_t>(message.size());
         std::uint32_t xoredSize = size ^ xorValue;
 
         std::string sizeStr;
@@ -410,8 +455,18 @@ namespace command_line_app
         sizeStr += static_cast<char>(xoredSize % 256); xoredSize /= 256;
         sizeStr += static_cast<char>(xoredSize % 256); xoredSize /= 256;
         sizeStr += static_cast<char>(xoredSize);
+        return sizeStr;
+    }
+
+    // The encoded length, then the message.
+    static void sendMessage(
+        const TcpConnection::Ptr& session,
+        std::string_view message
+    )
+    {
+        const std::string sizeStr = encodeLength(static_cast<std::uint32_t>(message.size()));
         session->send(sizeStr.c_str(), sizeStr.size());
-        session->send(message.c_str(), message.size());
+        session->send(message.data(), message.size());
     }
 
     struct MessageReceiver
@@ -483,7 +538,10 @@ namespace command_line_app
             query::Request request = json;
             if (request.isValid())
             {
-                auto response = nlohmann::json(db.executeQuery(request)).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+                // Keeps the output buffer between requests.
+                static thread_local query::ResponseWriter writer;
+
+                auto response = writer.write(db.executeQuery(request));
                 Logger::instance().logInfo("Handled valid request. Response size: ", response.size());
                 sendMessage(session, response);
                 return;
@@ -500,7 +558,12 @@ namespace command_line_app
         sendMessage(session, std::move(errorJson));
     }
 
-    static void tcpImpl(const std::filesystem::path& path, std::uint16_t port)
+    // Serves the port on the local host. Received messages are handled one at a time,
+    // in the order they arrive, by handleMessage(session, message) on a separate thread.
+    // Returns when handleMessage returns true or, if exitOnInput is set,
+    // when "exit" is entered on the standard input.
+    template <typename FuncT>
+    static void serveTcp(std::uint16_t port, std::size_t numNetworkThreads, bool exitOnInput, FuncT&& handleMessage)
     {
         struct Operation
         {
@@ -508,57 +571,54 @@ namespace command_line_app
             std::string data;
         };
 
-        // TODO: Make it so only one connection is allowed.
-        //       Or better, have one db per session
-
         std::queue<Operation> operations;
+        bool stopped = false;
         std::condition_variable anyOperations;
         std::mutex mutex;
 
-        auto db = loadDatabase(path);
-
         auto server = TcpService::Create();
         auto listenThread = ListenThread::Create(false, "127.0.0.1", port, [&](TcpSocket::Ptr socket) {
             socket->setNodelay();
 
-            auto enterCallback = [&mutex, &anyOperations, &operations, &db](const TcpConnection::Ptr& session) {
+            auto enterCallback = [&mutex, &anyOperations, &operations](const TcpConnection::Ptr& session) {
                 Logger::instance().logInfo("TCP connection from ", session->getIP());
 
                 session->setDataCallback(
-                    [&mutex, &anyOperations, &operations, &db, session, messageReceiver = MessageReceiver()]
-                (const char* buffer, size_t len) mutable {
-                    try
-                    {
-                        auto messages = messageReceiver.onDataReceived(buffer, len);
-                        for (auto&& message : messages)
+                    [&mutex, &anyOperations, &operations, session, messageReceiver = MessageReceiver()]
+                    (const char* buffer, size_t len) mutable {
+                        try
                         {
-                            std::unique_lock lock(mutex);
-                            operations.emplace(Operation{ session, std::move(message) });
+                            auto messages = messageReceiver.onDataReceived(buffer, len);
+                            for (auto&& message : messages)
+                            {
+                                std::unique_lock lock(mutex);
+                                operations.emplace(Operation{ session, std::move(message) });
+                            }
+                            if (!messages.empty())
+                            {
+                                anyOperations.notify_one();
+                            }
                         }
-                        if (!messages.empty())
+                        catch (Exception& ex)
                         {
-                            anyOperations.notify_one();
+                            auto errorJson = nlohmann::json::object({ {"error", ex.what() } }).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+                            sendMessage(session, errorJson);
                         }
-                    }
-                    catch (Exception& ex)
-                    {
-                        sendMessage(session, std::string("{\"error\":\"") + ex.what() + "\"");
-                    }
 
-                    return len;
-                });
+                        return len;
+                    });
 
                 session->setDisConnectCallback([](const TcpConnection::Ptr& session) {
-                });
+                    });
             };
 
             server->addTcpConnection(std::move(socket),
                 brynet::net::TcpService::AddSocketOption::AddEnterCallback(enterCallback),
                 brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(1024 * 1024));
-        });
+            });
 
         listenThread->startListen();
-        server->startWorkerThread(1);
+        server->startWorkerThread(numNetworkThreads);
 
         EventLoop mainloop;
 
@@ -566,26 +626,247 @@ namespace command_line_app
             for (;;)
             {
                 std::unique_lock lock(mutex);
-                anyOperations.wait(lock, [&operations]() {return !operations.empty(); });
+                anyOperations.wait(lock, [&operations, &stopped]() { return stopped || !operations.empty(); });
+                if (stopped)
+                {
+                    return;
+                }
 
                 auto operation = std::move(operations.front());
                 operations.pop();
 
                 lock.unlock();
 
-                handleTcpRequest(*db, operation.session, operation.data.c_str(), operation.data.size());
+                if (handleMessage(operation.session, operation.data))
+                {
+                    lock.lock();
+                    stopped = true;
+                    return;
+                }
             }
-        });
+            });
 
-        for (;;)
+        if (exitOnInput)
         {
+            // When the input is closed the server runs until stopped by a message.
             std::string line;
-            std::getline(std::cin, line);
-            if (line == "exit"sv)
+            while (std::getline(std::cin, line))
             {
-                return;
+                if (line == "exit"sv)
+                {
+                    {
+                        std::unique_lock lock(mutex);
+                        stopped = true;
+                    }
+                    anyOperations.notify_one();
+                    break;
+                }
+            }
+        }
+
+        // The current message is handled to the end.
+        workerThread.join();
+
+        // No more messages can be queued after this.
+        listenThread->stopListen();
+        server->stopWorkerThread();
+    }
+
+    static void tcpImpl(const std::filesystem::path& path, std::uint16_t port)
+    {
+        // TODO: Make it so only one connection is allowed.
+        //       Or better, have one db per session
+
+        auto db = loadDatabase(path);
+
+        serveTcp(port, 1, true, [&db](const TcpConnection::Ptr& session, const std::string& data) {
+            handleTcpRequest(*db, session, data.c_str(), data.size());
+            return false;
+            });
+    }
+
+    // A server in the --open mode that the router forwards queries to.
+    // The connection is blocking, the router waits for the whole response.
+    struct RouterBackend
+    {
+        using SocketType = decltype(brynet::net::base::Connect(false, std::string{}, 0));
+
+        std::string host;
+        std::uint16_t port;
+        SocketType socket = INVALID_SOCKET;
+
+        [[nodiscard]] std::string address() const
+        {
+            return host + ":" + std::to_string(port);
+        }
+
+        void disconnect()
+        {
+            if (socket != INVALID_SOCKET)
+            {
+                brynet::net::base::SocketClose(socket);
+                socket = INVALID_SOCKET;
+            }
+        }
+
+        // Reconnects once if the connection was dropped since the last request.
+        [[nodiscard]] std::string request(const std::string& message)
+        {
+            if (socket != INVALID_SOCKET)
+            {
+                try
+                {
+                    return exchange(message);
+                }
+                catch (Exception&)
+                {
+                    disconnect();
+                }
+            }
+
+            socket = brynet::net::base::Connect(false, host, port);
+            if (socket == INVALID_SOCKET)
+            {
+                throw Exception("Cannot connect to " + address());
+            }
+            brynet::net::base::SocketNodelay(socket);
+
+            try
+            {
+                return exchange(message);
+            }
+            catch (Exception&)
+            {
+                disconnect();
+                throw;
+            }
+        }
+
+    private:
+        [[nodiscard]] std::string exchange(const std::string& message)
+        {
+            sendAll(encodeLength(static_cast<std::uint32_t>(message.size())));
+            sendAll(message);
+
+            char lengthBuffer[8];
+            receiveAll(lengthBuffer, sizeof(lengthBuffer));
+            const std::uint32_t length = receiveLength(lengthBuffer);
+            if (length == 0)
+            {
+                throw Exception("Invalid response length from " + address());
+            }
+
+            std::string response(length, '\0');
+            receiveAll(response.data(), response.size());
+            return response;
+        }
+
+        void sendAll(const std::string& data)
+        {
+            for (std::size_t sent = 0; sent < data.size();)
+            {
+                const int n = ::send(socket, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+                if (n <= 0)
+                {
+                    throw Exception("Cannot send to " + address());
+                }
+                sent += n;
             }
         }
+
+        void receiveAll(char* buffer, std::size_t size)
+        {
+            for (std::size_t received = 0; received < size;)
+            {
+                const int n = ::recv(socket, buffer + received, static_cast<int>(size - received), 0);
+                if (n <= 0)
+                {
+                    throw Exception("Connection to " + address() + " closed");
+                }
+                received += n;
+            }
+        }
+    };
+
+    // Forwards the query to all backends at once and merges their responses.
+    // The backends hold different games (for example time ranges) or different
+    // positions (hash range shards), so the counts of each position are summed.
+    // The time each backend took, including the transfer, is added to the response.
+    static void handleTcpRouterRequest(
+        std::vector<RouterBackend>& backends,
+        const TcpConnection::Ptr& session,
+        const char* data,
+        std::size_t len
+    )
+    {
+        auto datastr = std::string(data, len);
+        Logger::instance().logInfo("Received data: ", datastr);
+
+        query::Request request;
+        try
+        {
+            request = nlohmann::json::parse(datastr).get<query::Request>();
+        }
+        catch (...)
+        {
+            Logger::instance().logInfo("Error parsing request");
+        }
+
+        if (!request.isValid())
+        {
+            Logger::instance().logInfo("Invalid request");
+
+            auto errorJson = nlohmann::json::object({ {"error", "InvalidRequest" } }).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+            sendMessage(session, std::move(errorJson));
+            return;
+        }
+
+        std::vector<std::string> addresses;
+        for (auto&& backend : backends)
+        {
+            addresses.emplace_back(backend.address());
+        }
+
+        const auto merged = query::routeRequestJson(datastr, addresses, [&backends](std::size_t i, const std::string& message) {
+            return backends[i].request(message);
+            });
+
+        if (merged.contains("error"))
+        {
+            Logger::instance().logError("Backend ", merged["backend"].get<std::string>(), " failed: ", merged["error"].get<std::string>());
+        }
+
+        auto response = merged.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        Logger::instance().logInfo("Handled request. Response size: ", response.size());
+        sendMessage(session, response);
+    }
+
+    static void tcpRouterImpl(std::vector<RouterBackend> backends, std::uint16_t port)
+    {
+        // Backends are only used by the thread handling messages, one request at a time.
+        serveTcp(port, 1, true, [&backends](const TcpConnection::Ptr& session, const std::string& data) {
+            handleTcpRouterRequest(backends, session, data.c_str(), data.size());
+            return false;
+            });
+
+        for (auto&& backend : backends)
+        {
+            backend.disconnect();
+        }
+    }
+
+    [[nodiscard]] static RouterBackend parseRouterBackend(const std::string& address)
+    {
+        const auto colon = address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            throw Exception("Invalid backend address " + address + ", expected host:port.");
+        }
+
+        RouterBackend backend;
+        backend.host = address.substr(0, colon);
+        backend.port = static_cast<std::uint16_t>(std::stoi(address.substr(colon + 1)));
+        return backend;
     }
 
     static void sendProgressFinished(const TcpConnection::Ptr& session, std::string operation, nlohmann::json additionalData = nlohmann::json::object())
@@ -964,9 +1245,12 @@ namespace command_line_app
     {
         assertDatabaseOpen(db);
 
+        // Keeps the output buffer between requests.
+        static thread_local query::ResponseWriter writer;
+
         query::Request request = json["query"];
         auto response = db->executeQuery(request);
-        auto responseStr = nlohmann::json(response).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        auto responseStr = writer.write(response);
 
         Logger::instance().logInfo("Handled valid request. Response size: ", responseStr.size());
 
@@ -1713,81 +1997,14 @@ namespace command_line_app
 
     static void tcpImpl(std::uint16_t port)
     {
-        struct Operation
-        {
-            TcpConnection::Ptr session;
-            std::string data;
-        };
-
         // TODO: Make it so only one connection is allowed.
         //       Or better, have one db per session
 
         std::unique_ptr<persistence::Database> db = nullptr;
 
-        std::queue<Operation> operations;
-        std::condition_variable anyOperations;
-        std::mutex mutex;
-
-        auto server = TcpService::Create();
-        auto listenThread = ListenThread::Create(false, "127.0.0.1", port, [&](TcpSocket::Ptr socket) {
-            socket->setNodelay();
-
-            auto enterCallback = [&mutex, &anyOperations, &operations, &db](const TcpConnection::Ptr& session) {
-                Logger::instance().logInfo("TCP connection from ", session->getIP());
-
-                session->setDataCallback(
-                    [&mutex, &anyOperations, &operations, &db, session, messageReceiver = MessageReceiver()]
-                    (const char* buffer, size_t len) mutable {
-                        try
-                        {
-                            auto messages = messageReceiver.onDataReceived(buffer, len);
-                            for (auto&& message : messages)
-                            {
-                                std::unique_lock lock(mutex);
-                                operations.emplace(Operation{ session, std::move(message) });
-                            }
-                            if (!messages.empty())
-                            {
-                                anyOperations.notify_one();
-                            }
-                        }
-                        catch (Exception& ex)
-                        {
-                            sendMessage(session, std::string("{\"error\":\"") + ex.what() + "\"");
-                        }
-
-                        return len;
-                    });
-
-                session->setDisConnectCallback([](const TcpConnection::Ptr& session) {
-                    });
-            };
-
-            server->addTcpConnection(std::move(socket),
-                brynet::net::TcpService::AddSocketOption::AddEnterCallback(enterCallback),
-                brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(1024 * 1024));
+        serveTcp(port, 3, false, [&db](const TcpConnection::Ptr& session, const std::string& data) {
+            return handleTcpCommand(db, session, data.c_str(), data.size());
             });
-
-        listenThread->startListen();
-        server->startWorkerThread(3);
-
-        EventLoop mainloop;
-
-        for (;;)
-        {
-            std::unique_lock lock(mutex);
-            anyOperations.wait(lock, [&operations]() {return !operations.empty(); });
-
-            auto operation = std::move(operations.front());
-            operations.pop();
-
-            lock.unlock();
-
-            if (handleTcpCommand(db, operation.session, operation.data.c_str(), operation.data.size()))
-            {
-                break;
-            }
-        }
     }
 
     static void tcp(args::Subparser& parser)
@@ -1796,7 +2013,8 @@ namespace command_line_app
         args::ValueFlag<std::uint16_t> port(requiredArgs, "port", "The local port to use", { "port" });
 
         args::ValueFlag<std::string> open(parser, "path", "Optional database path. If specified it will only allow queries to be made.", { "open" });
-        
+        args::ValueFlagList<std::string> route(parser, "host:port", "Run as a router that forwards queries to these servers (started with --open) and merges the results.", { "route" });
+
         parser.Parse();
 
 #if defined(__clang__)
@@ -1804,7 +2022,23 @@ namespace command_line_app
 #else
 
         auto portValue = args::get(port);
-        if (open.Get() != "")
+        if (!route.Get().empty())
+        {
+            if (open.Get() != "")
+            {
+                throw Exception("--open and --route can't be used together.");
+            }
+
+            std::vector<RouterBackend> backends;
+            for (auto&& address : route)
+            {
+                backends.emplace_back(parseRouterBackend(address));
+            }
+
+            Logger::instance().logInfo(std::string("Running TCP router on port ") + std::to_string(portValue));
+            tcpRouterImpl(std::move(backends), portValue);
+        }
+        else if (open.Get() != "")
         {
             Logger::instance().logInfo(std::string("Running TCP with open database on port ") + std::to_string(portValue));
             tcpImpl(args::get(open), portValue);
@@ -2093,6 +2327,450 @@ namespace command_line_app
         }
     }
 
+    template <typename ReaderT>
+    static std::vector<persistence::db_epsilon::Key> gatherKeys(const std::filesystem::path& path, std::size_t memory)
+    {
+        std::vector<persistence::db_epsilon::Key> keys;
+        ReaderT reader(path, memory);
+        for (auto&& game : reader)
+        {
+            for (auto&& position : game.positions())
+            {
+                keys.emplace_back(PositionWithZobrist(position));
+            }
+        }
+        return keys;
+    }
+
+    template <typename IndexT, typename KeyT, typename FuncT>
+    static void benchIndexSearchImpl(const char* name, const IndexT& index, const std::vector<KeyT>& queries, FuncT&& search)
+    {
+        // warmup
+        std::size_t checksum = 0;
+        for (auto&& key : queries)
+        {
+            checksum += search(index, key).first.it;
+        }
+
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        for (auto&& key : queries)
+        {
+            checksum += search(index, key).first.it;
+        }
+        const auto t1 = std::chrono::high_resolution_clock::now();
+        const double time = (t1 - t0).count() / 1e9;
+
+        std::cout << std::setw(12) << name << ": "
+            << time * 1e9 / queries.size() << " ns/query "
+            << "(checksum " << checksum << ")\n";
+    }
+
+    template <typename ReaderT>
+    static void benchIndexSearch(const std::filesystem::path& path, std::size_t memory, std::size_t granularity)
+    {
+        using KeyType = persistence::db_epsilon::Key;
+        using CompareT = KeyType::CompareLessWithoutReverseMove;
+
+        auto keys = gatherKeys<ReaderT>(path, memory);
+        if (keys.size() < 2)
+        {
+            throw std::runtime_error("Not enough positions to benchmark.");
+        }
+
+        // Half of the positions go to the index, queries are made
+        // with the rest (in game order) so that there are both hits and misses.
+        const std::size_t numIndexed = keys.size() / 2;
+        std::vector<KeyType> queries(keys.begin() + numIndexed, keys.end());
+        keys.resize(numIndexed);
+        std::sort(keys.begin(), keys.end(), CompareT{});
+
+        const auto toArithmetic = [](const KeyType& key) {
+            return (static_cast<std::uint64_t>(key.hash()[0]) << 32) | key.hash()[1];
+        };
+
+        auto binaryIndex = ext::makeIndex(keys, granularity, CompareT{});
+        auto modelIndex = ext::makeIndex(keys, granularity, CompareT{});
+        modelIndex.buildModel(16, toArithmetic);
+        auto eytzingerIndex = ext::makeIndex(keys, granularity, CompareT{});
+        eytzingerIndex.buildEytzingerLayout();
+
+        std::cout << keys.size() << " indexed positions, "
+            << binaryIndex.size() << " index entries, "
+            << queries.size() << " queries\n";
+
+        benchIndexSearchImpl("binary", binaryIndex, queries, [](auto&& index, auto&& key) {
+            return index.equal_range(key);
+            });
+        benchIndexSearchImpl("model", modelIndex, queries, [&toArithmetic](auto&& index, auto&& key) {
+            return index.equal_range(key, toArithmetic);
+            });
+        benchIndexSearchImpl("eytzinger", eytzingerIndex, queries, [](auto&& index, auto&& key) {
+            return index.equal_range(key);
+            });
+    }
+
+    static void benchIndex(args::Subparser& parser)
+    {
+        args::Group requiredArgs(parser, "required arguments", args::Group::Validators::All);
+        args::Positional<std::string> input(requiredArgs, "input path", "The path to a PGN or BCGN file.");
+        args::ValueFlag<std::size_t> granularity(parser, "granularity", "The maximum number of entries per index range. Default 1024.", { "granularity" }, 1024);
+
+        parser.Parse();
+
+        const std::filesystem::path path = args::get(input);
+        if (path.extension() == ".pgn")
+        {
+            benchIndexSearch<pgn::LazyPgnFileReader>(path, pgnParserMemory.bytes(), args::get(granularity));
+        }
+        else if (path.extension() == ".bcgn")
+        {
+            benchIndexSearch<bcgn::BcgnFileReader>(path, bcgnParserMemory.bytes(), args::get(granularity));
+        }
+        else
+        {
+            throwInvalidArguments();
+        }
+    }
+
+    template <typename ReaderT>
+    static std::vector<persistence::pos_db::PositionRecord> gatherPositionRecords(const std::filesystem::path& path, std::size_t memory)
+    {
+        std::vector<persistence::pos_db::PositionRecord> records;
+        ReaderT reader(path, memory);
+        for (auto&& game : reader)
+        {
+            for (auto&& position : game.positions())
+            {
+                const persistence::db_epsilon::Key key{ PositionWithZobrist(position) };
+                records.push_back({ persistence::pos_db::detail::positionHashOf(key), position.compress() });
+            }
+        }
+        return records;
+    }
+
+    template <typename ReaderT>
+    static void benchPositionTableImpl(const std::filesystem::path& path, const std::filesystem::path& tablePath, std::size_t memory)
+    {
+        using namespace persistence::pos_db;
+
+        auto records = gatherPositionRecords<ReaderT>(path, memory);
+        if (records.size() < 2)
+        {
+            throw std::runtime_error("Not enough positions to benchmark.");
+        }
+
+        // Half of the positions go to the table, queries are made
+        // with the rest (in game order) so that there are both hits and misses.
+        const std::size_t numStored = records.size() / 2;
+        std::vector<PositionRecord> queries(records.begin() + numStored, records.end());
+        records.resize(numStored);
+        sortDistinctPositionRecords(records);
+
+        {
+            PositionTableWriter writer(tablePath);
+            writer.append(records);
+            writer.end();
+
+            std::cout << writer.numRecords() << " distinct positions in the table, "
+                << writer.numCollisions() << " hash collisions, "
+                << queries.size() << " queries\n";
+        }
+
+        {
+            const PositionTable table(ext::ImmutableSpan<PositionRecord>(ext::ImmutableBinaryFile(ext::Pooled{}, tablePath)));
+
+            // warmup
+            std::size_t numFound = 0;
+            for (auto&& query : queries)
+            {
+                numFound += table.contains(query.hash, query.position);
+            }
+
+            numFound = 0;
+            const auto t0 = std::chrono::high_resolution_clock::now();
+            for (auto&& query : queries)
+            {
+                numFound += table.contains(query.hash, query.position);
+            }
+            const auto t1 = std::chrono::high_resolution_clock::now();
+            const double time = (t1 - t0).count() / 1e9;
+
+            std::cout << time * 1e9 / queries.size() << " ns/lookup, "
+                << table.size() * sizeof(PositionRecord) << " bytes, "
+                << numFound << " queried positions found\n";
+        }
+
+        std::filesystem::remove(tablePath);
+    }
+
+    static void benchPositionTable(args::Subparser& parser)
+    {
+        args::Group requiredArgs(parser, "required arguments", args::Group::Validators::All);
+        args::Positional<std::string> input(requiredArgs, "input path", "The path to a PGN or BCGN file.");
+        args::ValueFlag<std::string> output(requiredArgs, "path", "The path of the temporary position table file", { 'o', "output" });
+
+        parser.Parse();
+
+        const std::filesystem::path path = args::get(input);
+        if (path.extension() == ".pgn")
+        {
+            benchPositionTableImpl<pgn::LazyPgnFileReader>(path, args::get(output), pgnParserMemory.bytes());
+        }
+        else if (path.extension() == ".bcgn")
+        {
+            benchPositionTableImpl<bcgn::BcgnFileReader>(path, args::get(output), bcgnParserMemory.bytes());
+        }
+        else
+        {
+            throwInvalidArguments();
+        }
+    }
+
+    template <typename ReaderT>
+    static std::vector<std::string> gatherFens(const std::filesystem::path& path, std::size_t memory, std::size_t count)
+    {
+        std::vector<std::string> fens;
+        ReaderT reader(path, memory);
+        for (auto&& game : reader)
+        {
+            for (auto&& position : game.positions())
+            {
+                if (fens.size() >= count)
+                {
+                    return fens;
+                }
+
+                fens.emplace_back(position.fen());
+            }
+        }
+        return fens;
+    }
+
+    static void benchEloBandsQueries(
+        persistence::Database& db,
+        const std::vector<std::string>& fens,
+        std::optional<std::uint16_t> minElo
+    )
+    {
+        std::size_t bytesSearched = 0;
+        for (auto&& [partitionName, files] : db.mergableFiles())
+        {
+            // Partitions other than elo bands are always searched.
+            const auto band = persistence::pos_db::detail::EloBand::fromPartitionName(partitionName);
+            if (minElo.has_value() && band.has_value() && !band->intersects(*minElo, std::numeric_limits<std::uint16_t>::max(), false))
+            {
+                continue;
+            }
+
+            for (auto&& file : files)
+            {
+                bytesSearched += file.sizeBytes;
+            }
+        }
+
+        std::size_t numGames = 0;
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        for (auto&& fen : fens)
+        {
+            query::Request query;
+            query.token = "bench";
+            query.positions.emplace_back(query::RootPosition{ fen, std::nullopt });
+            query.levels = { GameLevel::Human };
+            query.results = { GameResult::WhiteWin, GameResult::BlackWin, GameResult::Draw };
+            query.fetchingOptions[query::Select::All] = query::AdditionalFetchingOptions{ false, false, false, false, false };
+            if (minElo.has_value())
+            {
+                query::QueryFilters filters{};
+                filters.minElo = minElo;
+                query.filters = filters;
+            }
+
+            auto response = db.executeQuery(query);
+            for (auto&& [origin, entry] : response.results.front().resultsBySelect.at(query::Select::All).root)
+            {
+                numGames += entry.count;
+            }
+        }
+        const auto t1 = std::chrono::high_resolution_clock::now();
+        const double time = (t1 - t0).count() / 1e9;
+
+        std::cout << std::setw(12) << (minElo.has_value() ? "min_elo " + std::to_string(*minElo) : std::string("unfiltered")) << ": "
+            << time * 1e6 / fens.size() << " us/query, "
+            << bytesSearched << " bytes of data files searched "
+            << "(" << numGames << " games)\n";
+    }
+
+    template <typename ReaderT>
+    static void benchEloBandsImpl(
+        const std::filesystem::path& path,
+        const std::filesystem::path& destination,
+        std::size_t memory,
+        std::size_t numQueries,
+        std::uint16_t minElo
+    )
+    {
+        {
+            persistence::ImportableFiles files;
+            files.emplace_back(path, GameLevel::Human);
+            createImpl(persistence::db_delta::Database::schema(), destination, files);
+        }
+
+        auto db = instantiateDatabase(persistence::db_delta::Database::schema(), destination);
+        for (auto&& [partitionName, files] : db->mergableFiles())
+        {
+            std::size_t size = 0;
+            for (auto&& file : files)
+            {
+                size += file.sizeBytes;
+            }
+            std::cout << partitionName << ": " << files.size() << " files, " << size << " bytes\n";
+        }
+
+        const auto fens = gatherFens<ReaderT>(path, memory, numQueries);
+
+        // warmup
+        benchEloBandsQueries(*db, fens, std::nullopt);
+
+        benchEloBandsQueries(*db, fens, std::nullopt);
+        benchEloBandsQueries(*db, fens, minElo);
+    }
+
+    static void benchEloBands(args::Subparser& parser)
+    {
+        args::Group requiredArgs(parser, "required arguments", args::Group::Validators::All);
+        args::Positional<std::string> input(requiredArgs, "input path", "The path to a PGN or BCGN file.");
+        args::ValueFlag<std::string> output(requiredArgs, "path", "The directory for the db_delta database that is created", { 'o', "output" });
+        args::ValueFlag<std::size_t> numQueries(parser, "queries", "The number of positions to query, taken from the games in order. Default 1000.", { "queries" }, 1000);
+        args::ValueFlag<std::uint16_t> minElo(parser, "min_elo", "The minimal elo of the filtered queries. Default 2200.", { "min_elo" }, 2200);
+
+        parser.Parse();
+
+        const std::filesystem::path path = args::get(input);
+        if (path.extension() == ".pgn")
+        {
+            benchEloBandsImpl<pgn::LazyPgnFileReader>(path, args::get(output), pgnParserMemory.bytes(), args::get(numQueries), args::get(minElo));
+        }
+        else if (path.extension() == ".bcgn")
+        {
+            benchEloBandsImpl<bcgn::BcgnFileReader>(path, args::get(output), bcgnParserMemory.bytes(), args::get(numQueries), args::get(minElo));
+        }
+        else
+        {
+            throwInvalidArguments();
+        }
+    }
+
+    // A response with all children of positions from random games,
+    // with first and last games for each.
+    [[nodiscard]] static query::Response makeBenchResponse(std::size_t numRoots)
+    {
+        std::mt19937_64 rng(1234);
+
+        query::Response response;
+        response.query.token = "bench";
+        response.query.levels = { GameLevel::Human, GameLevel::Engine, GameLevel::Server };
+        response.query.results = { GameResult::WhiteWin, GameResult::BlackWin, GameResult::Draw };
+        response.query.fetchingOptions[query::Select::All] = query::AdditionalFetchingOptions{ true, true, true, true, true };
+
+        auto makeHeader = [&rng]() {
+            return persistence::GameHeader(
+                rng() % 100000000,
+                GameResult::WhiteWin,
+                Date(static_cast<std::uint16_t>(1990 + rng() % 30), static_cast<std::uint8_t>(1 + rng() % 12), static_cast<std::uint8_t>(1 + rng() % 28)),
+                Eco('A' + rng() % 5, static_cast<std::uint8_t>(rng() % 100)),
+                static_cast<std::uint16_t>(rng() % 200),
+                "Rated Blitz game",
+                "Player" + std::to_string(rng() % 100000),
+                "Player" + std::to_string(rng() % 100000)
+            );
+        };
+
+        auto fillEntries = [&](query::SegregatedEntries& entries) {
+            for (auto&& level : response.query.levels)
+            {
+                for (auto&& result : response.query.results)
+                {
+                    auto& entry = entries.emplace(level, result, rng() % 100000).second;
+                    entry.firstGame = makeHeader();
+                    entry.lastGame = makeHeader();
+                }
+            }
+        };
+
+        Position position = Position::startPosition();
+        while (response.results.size() < numRoots)
+        {
+            auto moves = movegen::generateLegalMoves(position);
+            if (moves.empty())
+            {
+                position = Position::startPosition();
+                continue;
+            }
+
+            const query::RootPosition root{ position.fen(), std::nullopt };
+            response.query.positions.emplace_back(root);
+            auto& subresult = response.results.emplace_back(root).resultsBySelect[query::Select::All];
+            fillEntries(subresult.root);
+            for (auto&& move : moves)
+            {
+                fillEntries(subresult.children[move]);
+            }
+
+            position.doMove(moves[rng() % moves.size()]);
+        }
+
+        return response;
+    }
+
+    template <typename FuncT>
+    static void benchResponseImpl(const char* name, std::size_t numIterations, FuncT&& serialize)
+    {
+        // warmup
+        std::size_t size = serialize();
+
+        const auto allocationsBefore = util::numAllocations();
+        const auto t0 = std::chrono::high_resolution_clock::now();
+        for (std::size_t i = 0; i < numIterations; ++i)
+        {
+            size = serialize();
+        }
+        const auto t1 = std::chrono::high_resolution_clock::now();
+        const auto allocationsAfter = util::numAllocations();
+        const double time = (t1 - t0).count() / 1e9;
+
+        std::cout << std::setw(12) << name << ": "
+            << time * 1e3 / numIterations << " ms/response, ";
+        if (allocationsBefore.has_value())
+        {
+            std::cout << static_cast<double>(*allocationsAfter - *allocationsBefore) / numIterations << " allocations/response, ";
+        }
+        std::cout << size << " bytes\n";
+    }
+
+    static void benchResponse(args::Subparser& parser)
+    {
+        args::ValueFlag<std::size_t> numRoots(parser, "roots", "The number of root positions in the response. Default 50.", { "roots" }, 50);
+        args::ValueFlag<std::size_t> numIterations(parser, "iterations", "The number of times the response is serialized. Default 20.", { "iterations" }, 20);
+
+        parser.Parse();
+
+        const query::Response response = makeBenchResponse(args::get(numRoots));
+
+        if (!util::numAllocations().has_value())
+        {
+            std::cout << "Allocations are not counted. Build with COUNT_ALLOCATIONS defined to count them.\n";
+        }
+
+        benchResponseImpl("json", args::get(numIterations), [&response]() {
+            return nlohmann::json(response).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace).size();
+            });
+
+        query::ResponseWriter writer;
+        benchResponseImpl("writer", args::get(numIterations), [&response, &writer]() {
+            return writer.write(response).size();
+            });
+    }
+
     template <typename ReaderT>
     static void statsImpl(const std::filesystem::path& path, std::size_t memory)
     {
@@ -2511,11 +3189,16 @@ namespace command_line_app
         args::Command create(commands, "create", "Create a database from input files", &create);
         args::Command append(commands, "append", "Append files to an already existing database", &append);
         args::Command merge(commands, "merge", "Merge (optimize) files of an already existing database", &merge);
+        args::Command convertDb(commands, "convert_db", "Convert a database to another schema without reimporting the games", &convertDb);
         args::Command tcp(commands, "tcp", "Run a local TCP server allowing other processes to execute commands", &tcp);
         args::Command convert(commands, "convert", "Convert between PGN, BCGN file formats", &convert);
         args::Command countGames(commands, "count_games", "Count games in a PGN/BCGN file", &countGames);
         args::Command stats(commands, "stats", "Calculate statistics for a PGN/BCGN file", &stats);
         args::Command bench(commands, "bench", "Benchmark processing speed of PGN/BCGN file", &bench);
+        args::Command benchIndex(commands, "bench_index", "Benchmark index search methods using positions from a PGN/BCGN file", &benchIndex);
+        args::Command benchEloBands(commands, "bench_elo_bands", "Benchmark queries with an elo filter on a db_delta created from a PGN/BCGN file", &benchEloBands);
+        args::Command benchPositionTable(commands, "bench_position_table", "Benchmark lookups in the position table used by verify_positions, with positions from a PGN/BCGN file", &benchPositionTable);
+        args::Command benchResponse(commands, "bench_response", "Benchmark serialization of a large query response", &benchResponse);
         args::Command interactive(commands, "interactive", "Launch an interactive, stateful command line for extended operation.", &interactive);
         args::Command verify(commands, "verify", "Very a PGN/BCGN file.", &verify);
         args::Command epdDump(commands, "epd_dump", "Various stuff about EPD position files", &epdDump);
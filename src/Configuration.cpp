@@ -147,30 +147,83 @@ namespace cfg
 
     "db_beta" : {
         "index_granularity" : 1024,
+        "index_search" : "model",
+        "index_model_max_error" : 16,
+        "filter_bits_per_key" : 10,
+        "compress_data_files" : false,
+        "verify_positions" : false,
         "merge_writer_buffer_size" : "4MiB",
         "pgn_parser_memory" : "4MiB",
-        "bcgn_parser_memory" : "4MiB"
+        "bcgn_parser_memory" : "4MiB",
+        "query_arena_memory" : "1MiB",
+        "header_buffer_memory" : "4MiB",
+        "elo_bands" : [],
+        "shard_paths" : []
     },
 
     "db_delta" : {
         "index_granularity" : 1024,
+        "index_search" : "model",
+        "index_model_max_error" : 16,
+        "filter_bits_per_key" : 10,
+        "compress_data_files" : false,
+        "verify_positions" : false,
         "merge_writer_buffer_size" : "4MiB",
         "pgn_parser_memory" : "4MiB",
-        "bcgn_parser_memory" : "4MiB"
+        "bcgn_parser_memory" : "4MiB",
+        "query_arena_memory" : "1MiB",
+        "header_buffer_memory" : "4MiB",
+        "index_players" : false,
+        "elo_bands" : [],
+        "shard_paths" : []
     },
 
     "db_epsilon" : {
         "index_granularity" : 1024,
+        "index_search" : "model",
+        "index_model_max_error" : 16,
+        "filter_bits_per_key" : 10,
+        "compress_data_files" : false,
+        "verify_positions" : false,
         "merge_writer_buffer_size" : "4MiB",
         "pgn_parser_memory" : "4MiB",
-        "bcgn_parser_memory" : "4MiB"
+        "bcgn_parser_memory" : "4MiB",
+        "query_arena_memory" : "1MiB",
+        "header_buffer_memory" : "4MiB",
+        "elo_bands" : [],
+        "shard_paths" : []
+    },
+
+    "db_epsilon_48" : {
+        "index_granularity" : 1024,
+        "index_search" : "model",
+        "index_model_max_error" : 16,
+        "filter_bits_per_key" : 10,
+        "compress_data_files" : true,
+        "verify_positions" : false,
+        "merge_writer_buffer_size" : "4MiB",
+        "pgn_parser_memory" : "4MiB",
+        "bcgn_parser_memory" : "4MiB",
+        "query_arena_memory" : "1MiB",
+        "header_buffer_memory" : "4MiB",
+        "elo_bands" : [],
+        "shard_paths" : []
     },
 
     "db_epsilon_smeared_b" : {
         "index_granularity" : 1024,
+        "index_search" : "model",
+        "index_model_max_error" : 16,
+        "filter_bits_per_key" : 10,
+        "compress_data_files" : false,
+        "verify_positions" : false,
         "merge_writer_buffer_size" : "4MiB",
         "pgn_parser_memory" : "4MiB",
-        "bcgn_parser_memory" : "4MiB"
+        "bcgn_parser_memory" : "4MiB",
+        "query_arena_memory" : "1MiB",
+        "header_buffer_memory" : "4MiB",
+        "elo_bands" : [],
+        "shard_paths" : []
     }
 },
 
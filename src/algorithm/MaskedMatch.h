@@ -0,0 +1,256 @@
+#pragma once
+
+#include "intrin/Intrinsics.h"
+
+#include "util/Assert.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define MASKED_MATCH_USE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MASKED_MATCH_USE_SSE2
+#endif
+
+// Compares the first 16 bytes of records against a key under two masks at once.
+// The records and the key are viewed as four 32 bit words.
+// Record i matches under a mask if (record_i & mask) == (key & mask).
+// The results are bitsets with one bit per record, record i is
+// at bit (i % 64) of word (i / 64). Both outputs must have space
+// for at least (count + 63) / 64 words.
+// With AVX2 8 records are compared per iteration, with SSE2 4.
+// Records can also be given as four separate columns of words,
+// then each iteration loads consecutive words of every column.
+struct MaskedMatch128
+{
+    using Words = std::array<std::uint32_t, 4>;
+
+    MaskedMatch128(const Words& key, const Words& maskA, const Words& maskB) :
+        m_key(key),
+        m_maskA(maskA),
+        m_maskB(maskB)
+    {
+    }
+
+    [[nodiscard]] static constexpr std::size_t numWordsFor(std::size_t count)
+    {
+        return (count + 63) / 64;
+    }
+
+    void operator()(
+        const void* records,
+        std::size_t count,
+        std::size_t stride,
+        std::uint64_t* matchesA,
+        std::uint64_t* matchesB
+        ) const
+    {
+        ASSERT(stride >= sizeof(Words));
+
+        const unsigned char* bytes = static_cast<const unsigned char*>(records);
+
+#if defined(MASKED_MATCH_USE_AVX2)
+        const __m256i key = broadcast(m_key);
+        const __m256i maskA = broadcast(m_maskA);
+        const __m256i maskB = broadcast(m_maskB);
+        const __m256i zero = _mm256_setzero_si256();
+#elif defined(MASKED_MATCH_USE_SSE2)
+        const __m128i key = load(m_key.data());
+        const __m128i maskA = load(m_maskA.data());
+        const __m128i maskB = load(m_maskB.data());
+        const __m128i zero = _mm_setzero_si128();
+#endif
+
+        for (std::size_t base = 0; base < count; base += 64)
+        {
+            const std::size_t n = std::min<std::size_t>(64, count - base);
+            const unsigned char* chunk = bytes + base * stride;
+
+            std::uint64_t bitsA = 0;
+            std::uint64_t bitsB = 0;
+            std::size_t i = 0;
+
+#if defined(MASKED_MATCH_USE_AVX2)
+            for (; i + 8 <= n; i += 8)
+            {
+                for (std::size_t j = 0; j < 8; j += 2)
+                {
+                    const __m256i v = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(load(chunk + (i + j) * stride)),
+                        load(chunk + (i + j + 1) * stride),
+                        1
+                    );
+                    const __m256i diff = _mm256_xor_si256(v, key);
+
+                    bitsA |= pairMatches(_mm256_and_si256(diff, maskA), zero) << (i + j);
+                    bitsB |= pairMatches(_mm256_and_si256(diff, maskB), zero) << (i + j);
+                }
+            }
+#elif defined(MASKED_MATCH_USE_SSE2)
+            for (; i + 4 <= n; i += 4)
+            {
+                for (std::size_t j = 0; j < 4; ++j)
+                {
+                    const __m128i diff = _mm_xor_si128(load(chunk + (i + j) * stride), key);
+
+                    bitsA |= singleMatches(_mm_and_si128(diff, maskA), zero) << (i + j);
+                    bitsB |= singleMatches(_mm_and_si128(diff, maskB), zero) << (i + j);
+                }
+            }
+#endif
+
+            for (; i < n; ++i)
+            {
+                Words words;
+                std::memcpy(words.data(), chunk + i * stride, sizeof(Words));
+
+                bitsA |= static_cast<std::uint64_t>(matchesScalar(words, m_maskA)) << i;
+                bitsB |= static_cast<std::uint64_t>(matchesScalar(words, m_maskB)) << i;
+            }
+
+            matchesA[base / 64] = bitsA;
+            matchesB[base / 64] = bitsB;
+        }
+    }
+
+    // Word w of record i is columns[w * columnStride + i].
+    void matchColumns(
+        const std::uint32_t* columns,
+        std::size_t columnStride,
+        std::size_t count,
+        std::uint64_t* matchesA,
+        std::uint64_t* matchesB
+        ) const
+    {
+        ASSERT(count <= columnStride);
+
+#if defined(MASKED_MATCH_USE_AVX2)
+        __m256i key[4];
+        __m256i maskA[4];
+        __m256i maskB[4];
+        for (std::size_t w = 0; w < 4; ++w)
+        {
+            key[w] = _mm256_set1_epi32(static_cast<int>(m_key[w]));
+            maskA[w] = _mm256_set1_epi32(static_cast<int>(m_maskA[w]));
+            maskB[w] = _mm256_set1_epi32(static_cast<int>(m_maskB[w]));
+        }
+        const __m256i zero = _mm256_setzero_si256();
+#elif defined(MASKED_MATCH_USE_SSE2)
+        __m128i key[4];
+        __m128i maskA[4];
+        __m128i maskB[4];
+        for (std::size_t w = 0; w < 4; ++w)
+        {
+            key[w] = _mm_set1_epi32(static_cast<int>(m_key[w]));
+            maskA[w] = _mm_set1_epi32(static_cast<int>(m_maskA[w]));
+            maskB[w] = _mm_set1_epi32(static_cast<int>(m_maskB[w]));
+        }
+        const __m128i zero = _mm_setzero_si128();
+#endif
+
+        for (std::size_t base = 0; base < count; base += 64)
+        {
+            const std::size_t n = std::min<std::size_t>(64, count - base);
+
+            std::uint64_t bitsA = 0;
+            std::uint64_t bitsB = 0;
+            std::size_t i = 0;
+
+#if defined(MASKED_MATCH_USE_AVX2)
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256i diffA = zero;
+                __m256i diffB = zero;
+                for (std::size_t w = 0; w < 4; ++w)
+                {
+                    const __m256i diff = _mm256_xor_si256(load256(columns + w * columnStride + base + i), key[w]);
+                    diffA = _mm256_or_si256(diffA, _mm256_and_si256(diff, maskA[w]));
+                    diffB = _mm256_or_si256(diffB, _mm256_and_si256(diff, maskB[w]));
+                }
+
+                bitsA |= static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diffA, zero)))) << i;
+                bitsB |= static_cast<std::uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(diffB, zero)))) << i;
+            }
+#elif defined(MASKED_MATCH_USE_SSE2)
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128i diffA = zero;
+                __m128i diffB = zero;
+                for (std::size_t w = 0; w < 4; ++w)
+                {
+                    const __m128i diff = _mm_xor_si128(load(columns + w * columnStride + base + i), key[w]);
+                    diffA = _mm_or_si128(diffA, _mm_and_si128(diff, maskA[w]));
+                    diffB = _mm_or_si128(diffB, _mm_and_si128(diff, maskB[w]));
+                }
+
+                bitsA |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diffA, zero)))) << i;
+                bitsB |= static_cast<std::uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diffB, zero)))) << i;
+            }
+#endif
+
+            for (; i < n; ++i)
+            {
+                Words words;
+                for (std::size_t w = 0; w < 4; ++w)
+                {
+                    words[w] = columns[w * columnStride + base + i];
+                }
+
+                bitsA |= static_cast<std::uint64_t>(matchesScalar(words, m_maskA)) << i;
+                bitsB |= static_cast<std::uint64_t>(matchesScalar(words, m_maskB)) << i;
+            }
+
+            matchesA[base / 64] = bitsA;
+            matchesB[base / 64] = bitsB;
+        }
+    }
+
+private:
+    Words m_key;
+    Words m_maskA;
+    Words m_maskB;
+
+    [[nodiscard]] bool matchesScalar(const Words& words, const Words& mask) const
+    {
+        return
+            ((words[0] ^ m_key[0]) & mask[0]) == 0
+            && ((words[1] ^ m_key[1]) & mask[1]) == 0
+            && ((words[2] ^ m_key[2]) & mask[2]) == 0
+            && ((words[3] ^ m_key[3]) & mask[3]) == 0;
+    }
+
+#if defined(MASKED_MATCH_USE_AVX2) || defined(MASKED_MATCH_USE_SSE2)
+    [[nodiscard]] static __m128i load(const void* ptr)
+    {
+        return _mm_loadu_si128(static_cast<const __m128i*>(ptr));
+    }
+#endif
+
+#if defined(MASKED_MATCH_USE_AVX2)
+    [[nodiscard]] static __m256i load256(const void* ptr)
+    {
+        return _mm256_loadu_si256(static_cast<const __m256i*>(ptr));
+    }
+
+    [[nodiscard]] static __m256i broadcast(const Words& words)
+    {
+        return _mm256_broadcastsi128_si256(load(words.data()));
+    }
+
+    // Returns 2 bits, one for each 128 bit lane that is all zeros.
+    [[nodiscard]] static std::uint64_t pairMatches(__m256i masked, __m256i zero)
+    {
+        const int halves = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(masked, zero)));
+        const int both = halves & (halves >> 1) & 0b0101;
+        return static_cast<std::uint64_t>((both | (both >> 1)) & 0b11);
+    }
+#elif defined(MASKED_MATCH_USE_SSE2)
+    [[nodiscard]] static std::uint64_t singleMatches(__m128i masked, __m128i zero)
+    {
+        return _mm_movemask_epi8(_mm_cmpeq_epi32(masked, zero)) == 0xFFFF;
+    }
+#endif
+};
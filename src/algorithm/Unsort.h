@@ -5,23 +5,27 @@
 #include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <memory_resource>
+#include <numeric>
+#include <type_traits>
 #include <vector>
 
 struct Unsorter
 {
-    explicit Unsorter(std::vector<std::size_t>&& originalIndices) :
+    explicit Unsorter(std::pmr::vector<std::size_t>&& originalIndices) :
         m_originalIndices(std::move(originalIndices))
     {
     }
 
-    template <typename T>
-    void operator()(std::vector<T>& values) const
+    // The copy uses the allocator of values.
+    template <typename T, typename AllocT>
+    void operator()(std::vector<T, AllocT>& values) const
     {
         const std::size_t size = values.size();
 
         ASSERT(size == m_originalIndices.size());
 
-        std::vector<T> cpy(values.size());
+        std::vector<T, AllocT> cpy(values.size(), values.get_allocator());
         for (std::size_t i = 0; i < size; ++i)
         {
             cpy[m_originalIndices[i]] = std::move(values[i]);
@@ -31,31 +35,46 @@ struct Unsorter
     }
 
 private:
-    std::vector<std::size_t> m_originalIndices;
+    std::pmr::vector<std::size_t> m_originalIndices;
 };
 
 namespace detail
 {
+    // The permutations of pmr vectors use the same memory resource,
+    // other vectors use the default one.
+    template <typename T, typename AllocT>
+    [[nodiscard]] std::pmr::memory_resource* memoryResourceOf(const std::vector<T, AllocT>& vec)
+    {
+        if constexpr (std::is_same_v<AllocT, std::pmr::polymorphic_allocator<T>>)
+        {
+            return vec.get_allocator().resource();
+        }
+        else
+        {
+            return std::pmr::get_default_resource();
+        }
+    }
+
     // https://stackoverflow.com/a/17074810/3763139
 
-    template <typename T, typename Compare>
-    static std::vector<std::size_t> sort_permutation(
-        const std::vector<T>& vec,
+    template <typename T, typename AllocT, typename Compare>
+    static std::pmr::vector<std::size_t> sort_permutation(
+        const std::vector<T, AllocT>& vec,
         Compare& compare)
     {
-        std::vector<std::size_t> p(vec.size());
+        std::pmr::vector<std::size_t> p(vec.size(), memoryResourceOf(vec));
         std::iota(p.begin(), p.end(), 0);
         std::sort(p.begin(), p.end(),
             [&](std::size_t i, std::size_t j) { return compare(vec[i], vec[j]); });
         return p;
     }
 
-    template <typename T>
+    template <typename T, typename AllocT>
     static void apply_permutation_in_place(
-        std::vector<T>& vec,
-        const std::vector<std::size_t>& p)
+        std::vector<T, AllocT>& vec,
+        const std::pmr::vector<std::size_t>& p)
     {
-        std::vector<std::uint8_t> done(vec.size());
+        std::pmr::vector<std::uint8_t> done(vec.size(), p.get_allocator());
         for (std::size_t i = 0; i < vec.size(); ++i)
         {
             if (done[i])
@@ -76,8 +95,8 @@ namespace detail
     }
 }
 
-template <typename T, typename CompareT = std::less<>>
-[[nodiscard]] Unsorter reversibleSort(std::vector<T> & values, CompareT cmp = CompareT{})
+template <typename T, typename AllocT, typename CompareT = std::less<>>
+[[nodiscard]] Unsorter reversibleSort(std::vector<T, AllocT>& values, CompareT cmp = CompareT{})
 {
     auto perm = detail::sort_permutation(values, cmp);
 
@@ -86,8 +105,8 @@ template <typename T, typename CompareT = std::less<>>
     return Unsorter(std::move(perm));
 }
 
-template <typename T, typename U, typename CompareT = std::less<>>
-[[nodiscard]] Unsorter reversibleZipSort(std::vector<T>& keys, std::vector<U>& values, CompareT cmp = CompareT{})
+template <typename T, typename AllocT, typename U, typename AllocU, typename CompareT = std::less<>>
+[[nodiscard]] Unsorter reversibleZipSort(std::vector<T, AllocT>& keys, std::vector<U, AllocU>& values, CompareT cmp = CompareT{})
 {
     auto perm = detail::sort_permutation(keys, cmp);
 
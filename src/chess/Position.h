@@ -1072,6 +1072,14 @@ struct PositionWithZobrist : public Position
         Board::place(piece, sq, m_zobrist);
     }
 
+    // Mixes a constant into the hash. Since the hash is only
+    // ever updated with xor the salt persists through moves.
+    // Positions with different salts have unrelated hashes.
+    constexpr void saltZobrist(ZobristKey salt)
+    {
+        m_zobrist ^= salt;
+    }
+
     ReverseMove doMove(const Move& move);
 
     constexpr void undoMove(const ReverseMove& reverseMove) = delete;
@@ -234,7 +234,7 @@ namespace movegen
             }
         };
 
-        [[nodiscard]] CandidateEpSquares candidateEpSquaresForReverseMove(
+        [[nodiscard]] inline CandidateEpSquares candidateEpSquaresForReverseMove(
             const Board& board, 
             Color sideToDoEp, 
             const Move& rm
@@ -339,7 +339,7 @@ namespace movegen
             CastlingRights ifRookUncapture;
         };
 
-        [[nodiscard]] CastlingRightsByUncapture updateCastlingRightsForReverseMove(
+        [[nodiscard]] inline CastlingRightsByUncapture updateCastlingRightsForReverseMove(
             CastlingRights minCastlingRights,
             const Board& board,
             Color sideToUnmove,
@@ -442,7 +442,7 @@ namespace movegen
             return { castlingRightsIfNotRookCapture, castlingRightsIfRookCapture };
         }
 
-        [[nodiscard]] FixedVector<CastlingRights, 16> allCastlingRightsBetween(
+        [[nodiscard]] inline FixedVector<CastlingRights, 16> allCastlingRightsBetween(
             CastlingRights min,
             CastlingRights max
         )
@@ -508,7 +508,7 @@ namespace movegen
         // checks whether given a `undoMove`, `epSquare`, and `uncapturedPiece`
         // if we undid the `undoMove` and uncaptured `uncapturedPiece` would the 
         // `epSquare` be a valid en-passant target.
-        [[nodiscard]] auto makeTimeTravelEpSquareValidityChecker(const Position& pos)
+        [[nodiscard]] inline auto makeTimeTravelEpSquareValidityChecker(const Position& pos)
         {
             return [] (const Move& undoMove, Square epSquare, Piece uncapturedPiece)
             {
@@ -369,6 +369,11 @@ namespace bit
             m_numBitsRead += n;
         }
 
+        [[nodiscard]] size_type numBitsRead() const
+        {
+            return m_numBitsRead;
+        }
+
     private:
         const BitStreamType* m_bitStream;
         size_type m_numBitsRead;
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "util/Assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// A bloom filter where all probes for a single key land in one
+// 512 bit (cache line sized) block. This makes each query
+// touch only one cache line at the cost of a slightly higher
+// false positive rate compared to a classic bloom filter.
+// The keys are expected to be uniformly distributed hashes,
+// but they are remixed anyway so that structured keys work too.
+// The whole filter, including the header, is stored in one
+// vector of 64 bit words so it can be persisted as is.
+struct BlockedBloomFilter
+{
+    static constexpr std::size_t numWordsPerBlock = 8;
+    static constexpr std::size_t numBitsPerBlock = numWordsPerBlock * 64;
+    static constexpr std::size_t numBitsPerProbe = 9;
+    static constexpr std::size_t maxNumProbes = 64 / numBitsPerProbe;
+
+    BlockedBloomFilter() :
+        m_data(headerSize, 0)
+    {
+    }
+
+    BlockedBloomFilter(std::size_t expectedNumKeys, std::size_t numBitsPerKey) :
+        m_data{}
+    {
+        ASSERT(numBitsPerKey > 0);
+
+        const std::size_t numBits = std::max<std::size_t>(expectedNumKeys, 1) * numBitsPerKey;
+        const std::size_t numBlocks = (numBits + numBitsPerBlock - 1) / numBitsPerBlock;
+
+        // ln(2) * bits per key is optimal for a classic bloom filter.
+        // Blocking shifts the optimum slightly down.
+        const std::size_t numProbes = std::clamp<std::size_t>(numBitsPerKey * 2 / 3, 1, maxNumProbes);
+
+        m_data.resize(headerSize + numBlocks * numWordsPerBlock, 0);
+        m_data[numKeysHeaderOffset] = 0;
+        m_data[numBlocksHeaderOffset] = numBlocks;
+        m_data[numProbesHeaderOffset] = numProbes;
+    }
+
+    BlockedBloomFilter(std::vector<std::uint64_t>&& data) :
+        m_data(std::move(data))
+    {
+        if (m_data.size() < headerSize
+            || m_data.size() != headerSize + m_data[numBlocksHeaderOffset] * numWordsPerBlock
+            || m_data[numProbesHeaderOffset] > maxNumProbes)
+        {
+            throw std::runtime_error("Invalid bloom filter data.");
+        }
+    }
+
+    void insert(std::uint64_t key)
+    {
+        const std::uint64_t h = mix(key);
+        std::uint64_t* block = blockFor(h);
+
+        std::uint64_t probes = mix(h);
+        for (std::size_t i = 0; i < numProbes(); ++i)
+        {
+            const std::size_t bit = probes & (numBitsPerBlock - 1);
+            block[bit / 64] |= std::uint64_t(1) << (bit % 64);
+            probes >>= numBitsPerProbe;
+        }
+
+        m_data[numKeysHeaderOffset] += 1;
+    }
+
+    // Returns false only if the key was certainly never inserted.
+    // An empty (default constructed) filter contains everything.
+    [[nodiscard]] bool mayContain(std::uint64_t key) const
+    {
+        // Same as numBlocks() == 0, but the compiler can see
+        // that no block is read past the header.
+        if (m_data.size() == headerSize)
+        {
+            return true;
+        }
+
+        const std::uint64_t h = mix(key);
+        const std::uint64_t* block = blockFor(h);
+
+        std::uint64_t probes = mix(h);
+        for (std::size_t i = 0; i < numProbes(); ++i)
+        {
+            const std::size_t bit = probes & (numBitsPerBlock - 1);
+            if (!(block[bit / 64] & (std::uint64_t(1) << (bit % 64))))
+            {
+                return false;
+            }
+            probes >>= numBitsPerProbe;
+        }
+
+        return true;
+    }
+
+    [[nodiscard]] std::size_t numKeys() const
+    {
+        return m_data[numKeysHeaderOffset];
+    }
+
+    [[nodiscard]] std::size_t numBlocks() const
+    {
+        return m_data[numBlocksHeaderOffset];
+    }
+
+    [[nodiscard]] std::size_t numProbes() const
+    {
+        return m_data[numProbesHeaderOffset];
+    }
+
+    [[nodiscard]] const std::uint64_t* data() const
+    {
+        return m_data.data();
+    }
+
+    // In number of 64 bit words.
+    [[nodiscard]] std::size_t size() const
+    {
+        return m_data.size();
+    }
+
+private:
+    // Padded to a whole block so that blocks stay aligned
+    // relative to the start of the data.
+    static constexpr std::size_t headerSize = numWordsPerBlock;
+    static constexpr std::size_t numKeysHeaderOffset = 0;
+    static constexpr std::size_t numBlocksHeaderOffset = 1;
+    static constexpr std::size_t numProbesHeaderOffset = 2;
+
+    std::vector<std::uint64_t> m_data;
+
+    [[nodiscard]] static std::uint64_t mix(std::uint64_t h)
+    {
+        // splitmix64 finalizer
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
+
+    [[nodiscard]] std::size_t blockIndexFor(std::uint64_t h) const
+    {
+        // Maps the upper 32 bits uniformly onto [0, numBlocks) without division.
+        return static_cast<std::size_t>(((h >> 32) * numBlocks()) >> 32);
+    }
+
+    [[nodiscard]] std::uint64_t* blockFor(std::uint64_t h)
+    {
+        return m_data.data() + headerSize + blockIndexFor(h) * numWordsPerBlock;
+    }
+
+    [[nodiscard]] const std::uint64_t* blockFor(std::uint64_t h) const
+    {
+        return m_data.data() + headerSize + blockIndexFor(h) * numWordsPerBlock;
+    }
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+#include "util/Assert.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Maps strings to dense integer ids and back.
+// Ids are assigned in order of insertion and never change,
+// so they can be stored elsewhere in place of the strings.
+// The persisted form contains the strings sorted and front coded
+// in blocks of blockSize strings - the first string of each block
+// is stored whole and every following one only stores the length
+// of the prefix shared with the previous one and the remaining suffix.
+// Lookups by string binary search the first strings of the blocks.
+// Lookups by id go through a table mapping ids to sorted positions.
+// Strings inserted since construction are kept separately
+// until the dictionary is serialized again.
+struct FrontCodedDictionary
+{
+    using IdType = std::uint32_t;
+
+    static constexpr IdType invalidId = std::numeric_limits<IdType>::max();
+
+    static constexpr std::size_t blockSize = 16;
+
+    FrontCodedDictionary() :
+        FrontCodedDictionary(serializeSorted({}))
+    {
+    }
+
+    FrontCodedDictionary(std::vector<char>&& data) :
+        m_data(std::move(data)),
+        m_numPersisted(0),
+        m_numBlocks(0),
+        m_blocksBegin(0)
+    {
+        if (m_data.size() < headerSize)
+        {
+            throw std::runtime_error("Invalid dictionary data.");
+        }
+
+        const std::uint64_t numPersisted = readAt<std::uint64_t>(m_data.data(), numStringsHeaderOffset);
+        const std::uint64_t numBlocks = readAt<std::uint64_t>(m_data.data(), numBlocksHeaderOffset);
+        if (numPersisted >= invalidId
+            || numBlocks != (numPersisted + blockSize - 1) / blockSize
+            || m_data.size() < headerSize + numBlocks * sizeof(std::uint64_t) + numPersisted * 2 * sizeof(IdType))
+        {
+            throw std::runtime_error("Invalid dictionary data.");
+        }
+
+        m_numPersisted = static_cast<std::size_t>(numPersisted);
+        m_numBlocks = static_cast<std::size_t>(numBlocks);
+        m_blocksBegin = headerSize + m_numBlocks * sizeof(std::uint64_t) + m_numPersisted * 2 * sizeof(IdType);
+    }
+
+    FrontCodedDictionary(const FrontCodedDictionary&) = delete;
+    FrontCodedDictionary(FrontCodedDictionary&&) = default;
+
+    FrontCodedDictionary& operator=(const FrontCodedDictionary&) = delete;
+    FrontCodedDictionary& operator=(FrontCodedDictionary&&) = default;
+
+    // Returns the id of the string, inserting it if it's not present.
+    [[nodiscard]] IdType insert(std::string_view str)
+    {
+        const IdType id = find(str);
+        if (id != invalidId)
+        {
+            return id;
+        }
+
+        if (size() >= invalidId - 1)
+        {
+            throw std::runtime_error("Too many strings in the dictionary.");
+        }
+
+        const IdType newId = static_cast<IdType>(size());
+        m_pendingStrings.emplace_back(str);
+        m_pendingIds.emplace(m_pendingStrings.back(), newId);
+        return newId;
+    }
+
+    // Returns invalidId if the string is not present.
+    [[nodiscard]] IdType find(std::string_view str) const
+    {
+        auto it = m_pendingIds.find(str);
+        if (it != m_pendingIds.end())
+        {
+            return it->second;
+        }
+
+        return findPersisted(str);
+    }
+
+    [[nodiscard]] std::string at(IdType id) const
+    {
+        ASSERT(id < size());
+
+        if (id >= m_numPersisted)
+        {
+            return m_pendingStrings[id - m_numPersisted];
+        }
+
+        const std::size_t rank = readAt<IdType>(m_data.data(), idToRankOffset() + id * sizeof(IdType));
+
+        std::string str;
+        BlockReader reader(*this, rank / blockSize);
+        for (std::size_t i = 0; i <= rank % blockSize; ++i)
+        {
+            reader.next(str);
+        }
+        return str;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return m_numPersisted + m_pendingStrings.size();
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // Whether there are strings that are not in the persisted form yet.
+    [[nodiscard]] bool hasPendingStrings() const
+    {
+        return !m_pendingStrings.empty();
+    }
+
+    // Pending strings have the highest ids.
+    [[nodiscard]] std::size_t numPendingStrings() const
+    {
+        return m_pendingStrings.size();
+    }
+
+    // Returns the persisted form of all strings, including the pending ones.
+    [[nodiscard]] std::vector<char> serialize() const
+    {
+        if (!hasPendingStrings())
+        {
+            return m_data;
+        }
+
+        std::vector<std::pair<std::string, IdType>> strings;
+        strings.reserve(size());
+        for (std::size_t block = 0; block < m_numBlocks; ++block)
+        {
+            std::string str;
+            BlockReader reader(*this, block);
+            const std::size_t firstRank = block * blockSize;
+            const std::size_t lastRank = std::min(firstRank + blockSize, m_numPersisted);
+            for (std::size_t rank = firstRank; rank < lastRank; ++rank)
+            {
+                reader.next(str);
+                strings.emplace_back(str, readAt<IdType>(m_data.data(), rankToIdOffset() + rank * sizeof(IdType)));
+            }
+        }
+
+        for (std::size_t i = 0; i < m_pendingStrings.size(); ++i)
+        {
+            strings.emplace_back(m_pendingStrings[i], static_cast<IdType>(m_numPersisted + i));
+        }
+
+        std::sort(strings.begin(), strings.end());
+
+        return serializeSorted(strings);
+    }
+
+private:
+    static constexpr std::size_t headerSize = 16;
+    static constexpr std::size_t numStringsHeaderOffset = 0;
+    static constexpr std::size_t numBlocksHeaderOffset = 8;
+
+    // Layout of the persisted form:
+    // header
+    // numBlocks x 8B offsets of blocks (relative to the beginning of the first block)
+    // numStrings x 4B id -> sorted position
+    // numStrings x 4B sorted position -> id
+    // front coded blocks
+    std::vector<char> m_data;
+    std::size_t m_numPersisted;
+    std::size_t m_numBlocks;
+    std::size_t m_blocksBegin;
+
+    // Deque so that the views used as keys remain valid.
+    std::deque<std::string> m_pendingStrings;
+    std::unordered_map<std::string_view, IdType> m_pendingIds;
+
+    struct BlockReader
+    {
+        BlockReader(const FrontCodedDictionary& dict, std::size_t block) :
+            m_ptr(dict.m_data.data() + dict.m_blocksBegin + readAt<std::uint64_t>(dict.m_data.data(), headerSize + block * sizeof(std::uint64_t))),
+            m_isFirst(true)
+        {
+        }
+
+        // Replaces str with the next string in the block.
+        // For the first string in the block str can be anything.
+        void next(std::string& str)
+        {
+            const std::size_t prefixLength = m_isFirst ? 0 : readVarint(m_ptr);
+            const std::size_t suffixLength = readVarint(m_ptr);
+            str.resize(prefixLength);
+            str.append(m_ptr, suffixLength);
+            m_ptr += suffixLength;
+            m_isFirst = false;
+        }
+
+    private:
+        const char* m_ptr;
+        bool m_isFirst;
+    };
+
+    [[nodiscard]] std::size_t idToRankOffset() const
+    {
+        return headerSize + m_numBlocks * sizeof(std::uint64_t);
+    }
+
+    [[nodiscard]] std::size_t rankToIdOffset() const
+    {
+        return idToRankOffset() + m_numPersisted * sizeof(IdType);
+    }
+
+    [[nodiscard]] IdType findPersisted(std::string_view str) const
+    {
+        if (m_numPersisted == 0)
+        {
+            return invalidId;
+        }
+
+        // Find the last block with the first string not greater than str.
+        std::size_t lo = 0;
+        std::size_t hi = m_numBlocks;
+        std::string first;
+        while (hi - lo > 1)
+        {
+            const std::size_t mid = lo + (hi - lo) / 2;
+            BlockReader(*this, mid).next(first);
+            if (std::string_view(first) <= str)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        std::string current;
+        BlockReader reader(*this, lo);
+        const std::size_t firstRank = lo * blockSize;
+        const std::size_t lastRank = std::min(firstRank + blockSize, m_numPersisted);
+        for (std::size_t rank = firstRank; rank < lastRank; ++rank)
+        {
+            reader.next(current);
+            if (current == str)
+            {
+                return readAt<IdType>(m_data.data(), rankToIdOffset() + rank * sizeof(IdType));
+            }
+            else if (str < current)
+            {
+                break;
+            }
+        }
+
+        return invalidId;
+    }
+
+    [[nodiscard]] static std::vector<char> serializeSorted(const std::vector<std::pair<std::string, IdType>>& strings)
+    {
+        const std::size_t numStrings = strings.size();
+        const std::size_t numBlocks = (numStrings + blockSize - 1) / blockSize;
+
+        std::vector<char> blocks;
+        std::vector<std::uint64_t> blockOffsets;
+        blockOffsets.reserve(numBlocks);
+        for (std::size_t rank = 0; rank < numStrings; ++rank)
+        {
+            const std::string& str = strings[rank].first;
+            if (rank % blockSize == 0)
+            {
+                blockOffsets.emplace_back(blocks.size());
+                writeVarint(blocks, str.size());
+                blocks.insert(blocks.end(), str.begin(), str.end());
+            }
+            else
+            {
+                const std::string& prev = strings[rank - 1].first;
+                const std::size_t prefixLength = std::mismatch(prev.begin(), prev.end(), str.begin(), str.end()).first - prev.begin();
+                writeVarint(blocks, prefixLength);
+                writeVarint(blocks, str.size() - prefixLength);
+                blocks.insert(blocks.end(), str.begin() + prefixLength, str.end());
+            }
+        }
+
+        std::vector<char> data(headerSize + numBlocks * sizeof(std::uint64_t) + numStrings * 2 * sizeof(IdType));
+        writeAt<std::uint64_t>(data.data(), numStringsHeaderOffset, numStrings);
+        writeAt<std::uint64_t>(data.data(), numBlocksHeaderOffset, numBlocks);
+
+        char* ptr = data.data() + headerSize;
+        for (std::size_t block = 0; block < numBlocks; ++block)
+        {
+            writeAt<std::uint64_t>(ptr, block * sizeof(std::uint64_t), blockOffsets[block]);
+        }
+
+        ptr += numBlocks * sizeof(std::uint64_t);
+        for (std::size_t rank = 0; rank < numStrings; ++rank)
+        {
+            const IdType id = strings[rank].second;
+            ASSERT(id < numStrings);
+            writeAt<IdType>(ptr, id * sizeof(IdType), static_cast<IdType>(rank));
+            writeAt<IdType>(ptr, (numStrings + rank) * sizeof(IdType), id);
+        }
+
+        data.insert(data.end(), blocks.begin(), blocks.end());
+
+        return data;
+    }
+
+    template <typename T>
+    [[nodiscard]] static T readAt(const char* data, std::size_t offset)
+    {
+        T value;
+        std::memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    static void writeAt(char* data, std::size_t offset, T value)
+    {
+        std::memcpy(data + offset, &value, sizeof(T));
+    }
+
+    // 7 bits per byte, the highest bit indicates that more bytes follow.
+    static void writeVarint(std::vector<char>& out, std::size_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.emplace_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        out.emplace_back(static_cast<char>(value));
+    }
+
+    [[nodiscard]] static std::size_t readVarint(const char*& ptr)
+    {
+        std::size_t value = 0;
+        for (std::size_t shift = 0;; shift += 7)
+        {
+            const auto byte = static_cast<unsigned char>(*ptr++);
+            value |= static_cast<std::size_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return value;
+            }
+        }
+    }
+};
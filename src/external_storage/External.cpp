@@ -9,9 +9,11 @@
 #include <atomic>
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <future>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <numeric>
@@ -21,6 +23,17 @@
 #include <type_traits>
 #include <vector>
 
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace ext
 {
     namespace detail::except
@@ -769,6 +782,158 @@ namespace ext
         return m_size;
     }
 
+    MemoryMappedFile::MemoryMappedFile(std::filesystem::path path) :
+        m_path(std::move(path)),
+        m_data(nullptr),
+        m_size(0)
+    {
+#if defined(_WIN32)
+
+        // Other processes may remove or replace the file while it's mapped,
+        // the view keeps the old contents.
+        HANDLE file = CreateFileW(
+            m_path.c_str(),
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS,
+            nullptr
+        );
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        m_size = static_cast<std::size_t>(size.QuadPart);
+        if (m_size == 0)
+        {
+            // Empty files cannot be mapped.
+            CloseHandle(file);
+            return;
+        }
+
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr)
+        {
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        // The view keeps the mapping alive.
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr)
+        {
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        m_data = static_cast<const std::byte*>(view);
+
+#else
+
+        const int fd = ::open(m_path.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        m_size = static_cast<std::size_t>(st.st_size);
+        if (m_size == 0)
+        {
+            ::close(fd);
+            return;
+        }
+
+        void* view = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED)
+        {
+            detail::except::throwOpenException(m_path, "mmap");
+        }
+
+        m_data = static_cast<const std::byte*>(view);
+
+#endif
+    }
+
+    MemoryMappedFile::MemoryMappedFile(MemoryMappedFile&& other) noexcept :
+        m_path(std::move(other.m_path)),
+        m_data(other.m_data),
+        m_size(other.m_size)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    MemoryMappedFile& MemoryMappedFile::operator=(MemoryMappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            unmap();
+
+            m_path = std::move(other.m_path);
+            m_data = other.m_data;
+            m_size = other.m_size;
+
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+
+        return *this;
+    }
+
+    MemoryMappedFile::~MemoryMappedFile()
+    {
+        unmap();
+    }
+
+    [[nodiscard]] const std::filesystem::path& MemoryMappedFile::path() const
+    {
+        return m_path;
+    }
+
+    [[nodiscard]] const std::byte* MemoryMappedFile::data() const
+    {
+        return m_data;
+    }
+
+    [[nodiscard]] std::size_t MemoryMappedFile::size() const
+    {
+        return m_size;
+    }
+
+    void MemoryMappedFile::unmap() noexcept
+    {
+        if (m_data == nullptr)
+        {
+            return;
+        }
+
+#if defined(_WIN32)
+        UnmapViewOfFile(m_data);
+#else
+        ::munmap(const_cast<std::byte*>(m_data), m_size);
+#endif
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+
     BinaryOutputFile::BinaryOutputFile(std::filesystem::path path, OutputMode mode) :
         m_file(std::make_shared<detail::File>(std::move(path), mode == OutputMode::Append ? m_openmodeAppend : m_openmodeTruncate)),
         m_threadPool(&detail::ThreadPool::instance(m_file->path()))
@@ -1052,4 +1217,164 @@ namespace ext
     }
 
     const MemoryAmount defaultIndexBuilderMemoryAmount = cfg::g_config["ext"]["index"]["builder_buffer_size"].get<MemoryAmount>();
+
+    PiecewiseLinearModel::PiecewiseLinearModel() :
+        m_maxError(0),
+        m_size(0),
+        m_segments{}
+    {
+    }
+
+    PiecewiseLinearModel::PiecewiseLinearModel(std::size_t maxError, std::size_t size, std::vector<Segment>&& segments) :
+        m_maxError(maxError),
+        m_size(size),
+        m_segments(std::move(segments))
+    {
+    }
+
+    PiecewiseLinearModel::PiecewiseLinearModel(const std::vector<std::uint64_t>& words) :
+        PiecewiseLinearModel()
+    {
+        // maxError, size, then segments
+        constexpr std::size_t headerSize = 2;
+        constexpr std::size_t wordsPerSegment = sizeof(Segment) / sizeof(std::uint64_t);
+
+        if (words.size() < headerSize || (words.size() - headerSize) % wordsPerSegment != 0)
+        {
+            throw Exception("Invalid piecewise linear model data.");
+        }
+
+        m_maxError = static_cast<std::size_t>(words[0]);
+        m_size = static_cast<std::size_t>(words[1]);
+        m_segments.resize((words.size() - headerSize) / wordsPerSegment);
+        std::memcpy(m_segments.data(), words.data() + headerSize, m_segments.size() * sizeof(Segment));
+    }
+
+    [[nodiscard]] std::vector<std::uint64_t> PiecewiseLinearModel::serialize() const
+    {
+        constexpr std::size_t headerSize = 2;
+        constexpr std::size_t wordsPerSegment = sizeof(Segment) / sizeof(std::uint64_t);
+
+        std::vector<std::uint64_t> words(headerSize + m_segments.size() * wordsPerSegment);
+        words[0] = m_maxError;
+        words[1] = m_size;
+        std::memcpy(words.data() + headerSize, m_segments.data(), m_segments.size() * sizeof(Segment));
+
+        return words;
+    }
+
+    [[nodiscard]] bool PiecewiseLinearModel::empty() const
+    {
+        return m_segments.empty();
+    }
+
+    [[nodiscard]] std::size_t PiecewiseLinearModel::maxError() const
+    {
+        return m_maxError;
+    }
+
+    [[nodiscard]] std::size_t PiecewiseLinearModel::numSegments() const
+    {
+        return m_segments.size();
+    }
+
+    [[nodiscard]] std::size_t PiecewiseLinearModel::predict(std::uint64_t key) const
+    {
+        ASSERT(!empty());
+
+        // Find the last segment with firstKey <= key.
+        auto it = std::upper_bound(
+            m_segments.begin(),
+            m_segments.end(),
+            key,
+            [](std::uint64_t lhs, const Segment& rhs) { return lhs < rhs.firstKey; }
+        );
+
+        if (it == m_segments.begin())
+        {
+            return 0;
+        }
+
+        const auto next = it;
+        const Segment& segment = *--it;
+
+        // The prediction can't be outside of the span of the segment.
+        const double upperBound = static_cast<double>(next == m_segments.end() ? m_size : next->firstIdx);
+        const double prediction = static_cast<double>(segment.firstIdx) + segment.slope * static_cast<double>(key - segment.firstKey);
+
+        return static_cast<std::size_t>(std::min(prediction, upperBound) + 0.5);
+    }
+
+    PiecewiseLinearModelBuilder::PiecewiseLinearModelBuilder(std::size_t maxError) :
+        m_maxError(maxError),
+        m_size(0),
+        m_segments{},
+        m_lastKey(0),
+        m_minSlope(0.0),
+        m_maxSlope(std::numeric_limits<double>::infinity())
+    {
+    }
+
+    void PiecewiseLinearModelBuilder::append(std::uint64_t key)
+    {
+        const std::size_t idx = m_size++;
+
+        if (m_segments.empty())
+        {
+            m_segments.push_back({ key, idx, 0.0 });
+            m_lastKey = key;
+            return;
+        }
+
+        ASSERT(key >= m_lastKey);
+
+        // Only the first occurrence of each key is modeled.
+        if (key == m_lastKey)
+        {
+            return;
+        }
+
+        m_lastKey = key;
+
+        const auto& segment = m_segments.back();
+        const double dx = static_cast<double>(key - segment.firstKey);
+        const double dy = static_cast<double>(idx - segment.firstIdx);
+        const double eps = static_cast<double>(m_maxError);
+        const double minSlope = (dy - eps) / dx;
+        const double maxSlope = (dy + eps) / dx;
+
+        if (minSlope > m_maxSlope || maxSlope < m_minSlope)
+        {
+            // The point doesn't fit into the cone, start a new segment at it.
+            closeSegment();
+            m_segments.push_back({ key, idx, 0.0 });
+            m_minSlope = 0.0;
+            m_maxSlope = std::numeric_limits<double>::infinity();
+        }
+        else
+        {
+            m_minSlope = std::max(m_minSlope, minSlope);
+            m_maxSlope = std::min(m_maxSlope, maxSlope);
+        }
+    }
+
+    [[nodiscard]] PiecewiseLinearModel PiecewiseLinearModelBuilder::end()
+    {
+        if (!m_segments.empty())
+        {
+            closeSegment();
+        }
+
+        return PiecewiseLinearModel(m_maxError, m_size, std::move(m_segments));
+    }
+
+    void PiecewiseLinearModelBuilder::closeSegment()
+    {
+        // Any slope inside the cone satisfies the error bound for all points
+        // of the segment. A segment with only one point has an unbounded cone.
+        m_segments.back().slope =
+            m_maxSlope == std::numeric_limits<double>::infinity()
+            ? 0.0
+            : (m_minSlope + m_maxSlope) * 0.5;
+    }
 }
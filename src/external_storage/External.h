@@ -1,5 +1,7 @@
 #pragma once
 
+#include "intrin/Intrinsics.h"
+
 #include "util/Assert.h"
 #include "util/Buffer.h"
 #include "util/MemoryAmount.h"
@@ -7,12 +9,14 @@
 #include <algorithm>
 #include <atomic>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <future>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -509,6 +513,35 @@ namespace ext
         std::size_t m_size;
     };
 
+    // Read only view of a whole file mapped into the address space.
+    // Pages are loaded by the OS on first access and are shared
+    // between all processes mapping the same file.
+    struct MemoryMappedFile
+    {
+        MemoryMappedFile(std::filesystem::path path);
+
+        MemoryMappedFile(const MemoryMappedFile&) = delete;
+        MemoryMappedFile(MemoryMappedFile&& other) noexcept;
+        MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+        MemoryMappedFile& operator=(MemoryMappedFile&& other) noexcept;
+
+        ~MemoryMappedFile();
+
+        [[nodiscard]] const std::filesystem::path& path() const;
+
+        // nullptr for empty files
+        [[nodiscard]] const std::byte* data() const;
+
+        [[nodiscard]] std::size_t size() const;
+
+    private:
+        std::filesystem::path m_path;
+        const std::byte* m_data;
+        std::size_t m_size;
+
+        void unmap() noexcept;
+    };
+
     enum struct OutputMode
     {
         Truncate,
@@ -2336,6 +2369,12 @@ namespace ext
             );
     }
 
+    // Same as above but only needs the number of elements of each input.
+    [[nodiscard]] inline std::size_t merge_assess_work(const std::vector<std::size_t>& inSizes)
+    {
+        return detail::merge::merge_assess_work(std::begin(inSizes), std::end(inSizes));
+    }
+
     template <typename T, typename CompT = std::less<>>
     void merge(
         const MergePlan& plan,
@@ -2382,6 +2421,69 @@ namespace ext
             );
     }
 
+    // Piecewise linear approximation of the mapping from a key (projected
+    // onto an unsigned integer) to the position of its first occurrence
+    // in a sorted sequence. For keys that were present during construction
+    // the prediction is at most maxError() away from the true position.
+    // For absent keys it's at most maxError() + 1 away from the insertion point,
+    // unless the sequence contains many duplicates.
+    // An empty model has no segments and is not used for predictions.
+    struct PiecewiseLinearModel
+    {
+        struct Segment
+        {
+            std::uint64_t firstKey;
+            std::uint64_t firstIdx;
+            double slope;
+        };
+
+        static_assert(sizeof(Segment) == 3 * sizeof(std::uint64_t));
+
+        PiecewiseLinearModel();
+
+        PiecewiseLinearModel(std::size_t maxError, std::size_t size, std::vector<Segment>&& segments);
+
+        // Inverse of serialize().
+        PiecewiseLinearModel(const std::vector<std::uint64_t>& words);
+
+        [[nodiscard]] std::vector<std::uint64_t> serialize() const;
+
+        [[nodiscard]] bool empty() const;
+
+        [[nodiscard]] std::size_t maxError() const;
+
+        [[nodiscard]] std::size_t numSegments() const;
+
+        // Returns a position in [0, size].
+        [[nodiscard]] std::size_t predict(std::uint64_t key) const;
+
+    private:
+        std::size_t m_maxError;
+        std::size_t m_size;
+        std::vector<Segment> m_segments;
+    };
+
+    // Builds the model in a single pass using the shrinking cone algorithm.
+    // Keys must be appended in non-decreasing order.
+    struct PiecewiseLinearModelBuilder
+    {
+        PiecewiseLinearModelBuilder(std::size_t maxError);
+
+        void append(std::uint64_t key);
+
+        [[nodiscard]] PiecewiseLinearModel end();
+
+    private:
+        std::size_t m_maxError;
+        std::size_t m_size;
+        std::vector<PiecewiseLinearModel::Segment> m_segments;
+        std::uint64_t m_lastKey;
+        double m_minSlope;
+        double m_maxSlope;
+
+        void closeSegment();
+    };
+
     template <typename RandomIterT, typename T = typename RandomIterT::value_type>
     struct IterValuePair
     {
@@ -2436,6 +2538,81 @@ namespace ext
         }
     };
 
+    // Upper bounds of ranges from a RangeIndex stored in Eytzinger (BFS) order.
+    // A lower bound search over it goes down an implicit binary tree
+    // where the children of the node k are 2k and 2k+1. Descendants a few levels
+    // down are contiguous, so they can be prefetched before they are needed,
+    // which hides most of the cache misses of a plain binary search.
+    template <typename KeyType, typename CompareT>
+    struct EytzingerLayout
+    {
+        EytzingerLayout() = default;
+
+        EytzingerLayout(const RangeIndexEntry<KeyType, CompareT>* entries, std::size_t size) :
+            m_highValues(size + 1),
+            m_sortedIndices(size + 1)
+        {
+            // Index 0 is unused, the root is at 1.
+            std::size_t i = 0;
+            fill(entries, size, i, 1);
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            return m_highValues.size() <= 1;
+        }
+
+        // Returns the sorted index of the first range whose highValue
+        // is not less than the key, or the number of ranges if there is none.
+        [[nodiscard]] std::size_t lowerBound(const KeyType& key) const
+        {
+            const std::size_t n = m_highValues.size() - 1;
+            const KeyType* values = m_highValues.data();
+
+            std::size_t k = 1;
+            while (k <= n)
+            {
+                intrin::prefetch(values + (k << prefetchDepth));
+                k = 2 * k + CompareT{}(values[k], key);
+            }
+
+            // Remove the trailing right turns and the last left turn
+            // to get to the node where we last went left.
+            k >>= intrin::lsb(~k) + 1;
+
+            return k == 0 ? n : m_sortedIndices[k];
+        }
+
+    private:
+        // The number of levels ahead for which the
+        // descendants still fit in one cache line.
+        static constexpr std::size_t prefetchDepth = []() {
+            std::size_t depth = 0;
+            while (((std::size_t(2) << depth) * sizeof(KeyType)) <= 64)
+            {
+                ++depth;
+            }
+            return depth;
+        }();
+
+        std::vector<KeyType> m_highValues;
+        std::vector<std::size_t> m_sortedIndices;
+
+        void fill(const RangeIndexEntry<KeyType, CompareT>* entries, std::size_t size, std::size_t& i, std::size_t k)
+        {
+            if (k > size)
+            {
+                return;
+            }
+
+            fill(entries, size, i, 2 * k);
+            m_highValues[k] = entries[i].highValue;
+            m_sortedIndices[k] = i;
+            ++i;
+            fill(entries, size, i, 2 * k + 1);
+        }
+    };
+
     template <typename KeyType, typename CompareT>
     struct RangeIndex
     {
@@ -2444,59 +2621,227 @@ namespace ext
         using EntryType = RangeIndexEntry<KeyType, CompareT>;
         using IterValueType = IterValuePair<std::size_t, KeyType>;
 
-        RangeIndex() = default;
+        RangeIndex() :
+            m_entries{},
+            m_mapping{},
+            m_mappingOffset(0),
+            m_numMappedEntries(0),
+            m_model{},
+            m_eytzinger{}
+        {
+        }
 
         RangeIndex(std::vector<RangeIndexEntry<KeyType, CompareT>>&& entries) :
-            m_entries(std::move(entries))
+            m_entries(std::move(entries)),
+            m_mapping{},
+            m_mappingOffset(0),
+            m_numMappedEntries(0),
+            m_model{},
+            m_eytzinger{}
         {
         }
 
-        [[nodiscard]] auto begin() const
+        RangeIndex(std::vector<RangeIndexEntry<KeyType, CompareT>>&& entries, PiecewiseLinearModel&& model) :
+            m_entries(std::move(entries)),
+            m_mapping{},
+            m_mappingOffset(0),
+            m_numMappedEntries(0),
+            m_model(std::move(model)),
+            m_eytzinger{}
         {
-            return m_entries.cbegin();
         }
 
-        [[nodiscard]] auto end() const
+        // Entries are not copied, they are accessed directly from the mapping.
+        // The offset must be suitably aligned for EntryType.
+        RangeIndex(std::shared_ptr<const MemoryMappedFile> mapping, std::size_t offset, std::size_t numEntries) :
+            m_entries{},
+            m_mapping(std::move(mapping)),
+            m_mappingOffset(offset),
+            m_numMappedEntries(numEntries),
+            m_model{},
+            m_eytzinger{}
         {
-            return m_entries.cend();
+            ASSERT(m_mappingOffset % alignof(EntryType) == 0);
+            ASSERT(m_mappingOffset + m_numMappedEntries * sizeof(EntryType) <= m_mapping->size());
         }
 
-        [[nodiscard]] auto cbegin() const
+        [[nodiscard]] const EntryType* begin() const
         {
-            return m_entries.cbegin();
+            return data();
         }
 
-        [[nodiscard]] auto cend() const
+        [[nodiscard]] const EntryType* end() const
         {
-            return m_entries.cend();
+            return data() + size();
+        }
+
+        [[nodiscard]] const EntryType* cbegin() const
+        {
+            return begin();
+        }
+
+        [[nodiscard]] const EntryType* cend() const
+        {
+            return end();
         }
 
         [[nodiscard]] const RangeIndexEntry<KeyType, CompareT>* data() const
         {
+            if (m_mapping != nullptr)
+            {
+                return reinterpret_cast<const EntryType*>(m_mapping->data() + m_mappingOffset);
+            }
+
             return m_entries.data();
         }
 
         [[nodiscard]] std::size_t size() const
         {
+            if (m_mapping != nullptr)
+            {
+                return m_numMappedEntries;
+            }
+
             return m_entries.size();
         }
 
+        [[nodiscard]] bool isMemoryMapped() const
+        {
+            return m_mapping != nullptr;
+        }
+
+        [[nodiscard]] const PiecewiseLinearModel& model() const
+        {
+            return m_model;
+        }
+
+        void setModel(PiecewiseLinearModel&& model)
+        {
+            m_model = std::move(model);
+        }
+
+        // Makes equal_range search a copy of the range bounds in Eytzinger order.
+        // Requires the whole index to be read.
+        void buildEytzingerLayout()
+        {
+            m_eytzinger = EytzingerLayout<KeyType, CompareT>(data(), size());
+        }
+
+        // ToArithmeticT must map keys onto std::uint64_t preserving the order
+        // (but not necessarily strictly).
+        template <typename ToArithmeticT>
+        void buildModel(std::size_t maxError, ToArithmeticT&& toArithmetic)
+        {
+            PiecewiseLinearModelBuilder builder(maxError);
+            for (auto&& entry : *this)
+            {
+                builder.append(toArithmetic(entry.lowValue));
+            }
+            m_model = builder.end();
+        }
+
         // end is returned when there is no range with the given key
         [[nodiscard]] std::pair<IterValueType, IterValueType> equal_range(const KeyType& key) const
         {
-            const auto end = m_entries.back().high + 1;
+            auto [a, b] = findRanges(key);
+
+            return makeRange(a, b, key);
+        }
+
+        // Same as above, but if the index has a model then it's used instead to
+        // narrow down the binary search to a few entries around the prediction.
+        // toArithmetic must be the same mapping that was used to build the model.
+        template <typename ToArithmeticT>
+        [[nodiscard]] std::pair<IterValueType, IterValueType> equal_range(const KeyType& key, ToArithmeticT&& toArithmetic) const
+        {
+            auto [a, b] = findRanges(key, std::forward<ToArithmeticT>(toArithmetic));
+
+            return makeRange(a, b, key);
+        }
+
+        // Positions [first, last) in the index of the ranges that may contain the key.
+        // The range is empty when the key certainly doesn't exist in the data.
+        template <typename ToArithmeticT>
+        [[nodiscard]] std::pair<std::size_t, std::size_t> rangePositions(const KeyType& key, ToArithmeticT&& toArithmetic) const
+        {
+            auto [a, b] = findRanges(key, std::forward<ToArithmeticT>(toArithmetic));
 
             auto cmp = CompareT{};
+            if (a == b || cmp(key, a->lowValue) || cmp((b - 1)->highValue, key))
+            {
+                return { 0, 0 };
+            }
+
+            return { static_cast<std::size_t>(a - begin()), static_cast<std::size_t>(b - begin()) };
+        }
+
+    private:
+        // Either owned entries or a mapping is used. Never both.
+        std::vector<RangeIndexEntry<KeyType, CompareT>> m_entries;
+        std::shared_ptr<const MemoryMappedFile> m_mapping;
+        std::size_t m_mappingOffset;
+        std::size_t m_numMappedEntries;
+        PiecewiseLinearModel m_model;
+        EytzingerLayout<KeyType, CompareT> m_eytzinger;
+
+        // Find a range entry that contains the key or, if there is none, get
+        // the next range.
+        [[nodiscard]] std::pair<const EntryType*, const EntryType*> findRanges(const KeyType& key) const
+        {
+            if (!m_eytzinger.empty())
+            {
+                // Ranges are disjoint so at most one range can contain the key.
+                // It's the first one that doesn't end before the key.
+                const auto a = begin() + m_eytzinger.lowerBound(key);
+                const auto b = (a != end() && !CompareT{}(key, a->lowValue)) ? a + 1 : a;
+
+                return { a, b };
+            }
+
+            return std::equal_range(begin(), end(), key);
+        }
+
+        template <typename ToArithmeticT>
+        [[nodiscard]] std::pair<const EntryType*, const EntryType*> findRanges(const KeyType& key, ToArithmeticT&& toArithmetic) const
+        {
+            if (m_model.empty())
+            {
+                return findRanges(key);
+            }
 
-            // Find a range entry that contains keys[i] or, if there is none, get
-            // the next range.
-            auto [a, b] = std::equal_range(m_entries.begin(), m_entries.end(), key);
+            // +1 for absent keys, +1 for rounding
+            const std::size_t radius = m_model.maxError() + 2;
+            const std::size_t mid = m_model.predict(toArithmetic(key));
+            const std::size_t low = mid > radius ? mid - radius : 0;
+            const std::size_t high = std::min(size(), mid + radius + 1);
+
+            const auto windowBegin = begin() + low;
+            const auto windowEnd = begin() + high;
+            auto [a, b] = std::equal_range(windowBegin, windowEnd, key);
+
+            // The model is only a hint. If the found range touches
+            // the edge of the window then it may extend beyond it.
+            if ((a == windowBegin && windowBegin != begin())
+                || (b == windowEnd && windowEnd != end()))
+            {
+                std::tie(a, b) = std::equal_range(begin(), end(), key);
+            }
+
+            return { a, b };
+        }
+
+        template <typename IterT>
+        [[nodiscard]] std::pair<IterValueType, IterValueType> makeRange(IterT a, IterT b, const KeyType& key) const
+        {
+            const auto end = data()[size() - 1].high + 1;
+
+            auto cmp = CompareT{};
 
             KeyType lowValue{}, highValue{};
             std::size_t low = end;
             std::size_t high = end;
 
-            if (b == m_entries.begin() || a == m_entries.end())
+            if (b == begin() || a == begin() + size())
             {
                 // All values are greater (or lower).
                 // We keep the low and high pointing to end - this skips the search.
@@ -2526,11 +2871,93 @@ namespace ext
 
             return { { low, lowValue }, { high, highValue } };
         }
+    };
 
-    private:
-        std::vector<RangeIndexEntry<KeyType, CompareT>> m_entries;
+    // Index files start with this header, padded so that entries
+    // following it are aligned, which allows mapping them directly.
+    struct RangeIndexFileHeader
+    {
+        static constexpr std::uint64_t expectedMagic = 0x5844495845474E52ull; // "RNGEXIDX"
+        static constexpr std::uint64_t currentVersion = 1;
+
+        std::uint64_t magic;
+        std::uint64_t version;
+        std::uint64_t entrySize;
+        std::uint64_t numEntries;
+        std::uint64_t reserved[4];
     };
 
+    static_assert(sizeof(RangeIndexFileHeader) == 64);
+
+    // The file is written under a temporary name and renamed over the old one,
+    // so processes that have the old file mapped keep seeing it whole.
+    // Truncating a mapped file in place would make their reads fault.
+    template <typename KeyType, typename CompareT>
+    void writeRangeIndex(const std::filesystem::path& path, const RangeIndex<KeyType, CompareT>& index)
+    {
+        using EntryType = typename RangeIndex<KeyType, CompareT>::EntryType;
+
+        static_assert(std::is_trivially_copyable_v<EntryType>);
+        static_assert(sizeof(RangeIndexFileHeader) % alignof(EntryType) == 0);
+
+        RangeIndexFileHeader header{};
+        header.magic = RangeIndexFileHeader::expectedMagic;
+        header.version = RangeIndexFileHeader::currentVersion;
+        header.entrySize = sizeof(EntryType);
+        header.numEntries = index.size();
+
+        auto tmpPath = path;
+        tmpPath += "_tmp";
+
+        {
+            BinaryOutputFile file(tmpPath, OutputMode::Truncate);
+            (void)file.append(reinterpret_cast<const std::byte*>(&header), sizeof(RangeIndexFileHeader), 1);
+            (void)file.append(reinterpret_cast<const std::byte*>(index.data()), sizeof(EntryType), index.size());
+        }
+
+        std::filesystem::rename(tmpPath, path);
+    }
+
+    // Doesn't read anything, the entries are paged in on demand.
+    // Index files without the header (from before it was introduced)
+    // are plain arrays of entries, so they can be mapped too.
+    template <typename KeyType, typename CompareT>
+    [[nodiscard]] RangeIndex<KeyType, CompareT> mapRangeIndex(const std::filesystem::path& path)
+    {
+        using EntryType = typename RangeIndex<KeyType, CompareT>::EntryType;
+
+        auto file = std::make_shared<const MemoryMappedFile>(path);
+
+        RangeIndexFileHeader header{};
+        if (file->size() >= sizeof(RangeIndexFileHeader))
+        {
+            std::memcpy(&header, file->data(), sizeof(RangeIndexFileHeader));
+        }
+
+        if (header.magic == RangeIndexFileHeader::expectedMagic)
+        {
+            if (header.version != RangeIndexFileHeader::currentVersion
+                || header.entrySize != sizeof(EntryType)
+                || sizeof(RangeIndexFileHeader) + header.numEntries * sizeof(EntryType) != file->size())
+            {
+                throw Exception("Invalid index file " + path.string());
+            }
+
+            const std::size_t numEntries = static_cast<std::size_t>(header.numEntries);
+            return RangeIndex<KeyType, CompareT>(std::move(file), sizeof(RangeIndexFileHeader), numEntries);
+        }
+        else
+        {
+            if (file->size() % sizeof(EntryType) != 0)
+            {
+                throw Exception("Invalid index file " + path.string());
+            }
+
+            const std::size_t numEntries = file->size() / sizeof(EntryType);
+            return RangeIndex<KeyType, CompareT>(std::move(file), 0, numEntries);
+        }
+    }
+
     namespace detail::equal_range
     {
         [[nodiscard]] std::pair<std::size_t, std::size_t> neighbourhood(
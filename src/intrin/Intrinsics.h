@@ -172,4 +172,13 @@ namespace intrin
 
 #endif
 }
-#endif
\ No newline at end of file
+#endif
+
+namespace intrin
+{
+    // Only a hint, it's fine to prefetch an address that is not valid.
+    inline void prefetch(const void* ptr)
+    {
+        _mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+    }
+}
@@ -0,0 +1,582 @@
+#pragma once
+
+#include "coding/BitStream.h"
+#include "coding/Coding.h"
+
+#include "external_storage/External.h"
+
+#include "util/ArithmeticUtility.h"
+#include "util/Assert.h"
+#include "util/Meta.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace persistence
+{
+    namespace pos_db
+    {
+        // Codes blocks of consecutive entries of a sorted data file.
+        // Each entry is viewed as an array of 32 bit words and every word
+        // position (column) of a block is coded with the method that
+        // gives the least bits for this block. Entries are sorted by the hash,
+        // so its most significant words only change by a small amount between
+        // consecutive entries and all words of the hash repeat for entries
+        // of the same position. Counts and similar fields are small values.
+        // Entries of a block are close in the order so the leading bits
+        // of the hash that they all share are only stored once per block,
+        // and differences between consecutive hashes can be stored as
+        // a fixed number of low bits and the rest in unary.
+        // Blocks don't depend on each other so any one can be decoded alone.
+        template <typename EntryT>
+        struct EntryBlockCodec
+        {
+            static_assert(std::is_trivially_copyable_v<EntryT>);
+            static_assert(sizeof(EntryT) % sizeof(std::uint32_t) == 0);
+
+            static constexpr std::size_t numColumns = sizeof(EntryT) / sizeof(std::uint32_t);
+
+            enum struct ColumnCoding : std::uint32_t
+            {
+                // The 32 bits as they are.
+                Raw,
+
+                // The value with Elias delta coding.
+                Value,
+
+                // The zigzag coded difference from the same word
+                // of the previous entry with Elias delta coding.
+                DeltaFromPreviousEntry,
+
+                // The zigzag coded difference from the previous
+                // word of the same entry with Elias delta coding.
+                DeltaFromPreviousWord,
+
+                // One bit telling whether the word is the same as in the
+                // previous entry, followed by the raw 32 bits if it's not.
+                RepeatOrRaw,
+
+                // The length and the value of the longest prefix
+                // shared by all words of the column, once for the block,
+                // followed by the remaining bits of every word.
+                SharedPrefix,
+
+                // The zigzag coded difference from the same word of the
+                // previous entry with Rice coding. The number of low bits
+                // stored directly is chosen for the block.
+                RiceDeltaFromPreviousEntry
+            };
+
+            static constexpr std::size_t numColumnCodings = 7;
+            static constexpr std::size_t columnCodingBits = 3;
+            static constexpr std::size_t sharedPrefixLengthBits = 6;
+            static constexpr std::size_t riceParameterBits = 6;
+            static constexpr std::size_t maxRiceParameter = 33;
+
+            using Words = std::array<std::uint32_t, numColumns>;
+
+            // Appends the coded block to out.
+            static void encode(const EntryT* entries, std::size_t count, std::vector<std::byte>& out)
+            {
+                std::vector<Words> words(count);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    std::memcpy(words[i].data(), &entries[i], sizeof(EntryT));
+                }
+
+                bit::BitStream<> bs;
+
+                std::array<ColumnCoding, numColumns> codings{};
+                std::array<std::size_t, numColumns> sharedPrefixLengths{};
+                std::array<std::size_t, numColumns> riceParameters{};
+                for (std::size_t c = 0; c < numColumns; ++c)
+                {
+                    sharedPrefixLengths[c] = sharedPrefixLength(words, c);
+                    riceParameters[c] = riceParameter(words, c);
+                    codings[c] = chooseColumnCoding(words, c, sharedPrefixLengths[c], riceParameters[c]);
+                    bs.writeBits(static_cast<std::uint64_t>(codings[c]), columnCodingBits);
+                }
+
+                // Columns go one after another, this way the previous word
+                // of an entry is always known when decoding a column.
+                for (std::size_t c = 0; c < numColumns; ++c)
+                {
+                    const std::size_t suffixLength = 32 - sharedPrefixLengths[c];
+                    if (codings[c] == ColumnCoding::SharedPrefix)
+                    {
+                        bs.writeBits(sharedPrefixLengths[c], sharedPrefixLengthBits);
+                        bs.writeBits(static_cast<std::uint64_t>(words[0][c]) >> suffixLength, sharedPrefixLengths[c]);
+                    }
+                    else if (codings[c] == ColumnCoding::RiceDeltaFromPreviousEntry)
+                    {
+                        bs.writeBits(riceParameters[c], riceParameterBits);
+                    }
+
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        const std::uint32_t word = words[i][c];
+                        const std::uint32_t previousEntryWord = i == 0 ? 0 : words[i - 1][c];
+                        const std::uint32_t previousWord = c == 0 ? 0 : words[i][c - 1];
+
+                        switch (codings[c])
+                        {
+                        case ColumnCoding::Raw:
+                            bs.writeBits(word, 32);
+                            break;
+
+                        case ColumnCoding::Value:
+                            bit::EliasDeltaCoding{}.compress(bs, static_cast<std::uint64_t>(word));
+                            break;
+
+                        case ColumnCoding::DeltaFromPreviousEntry:
+                            bit::EliasDeltaCoding{}.compress(bs, zigzagDifference(word, previousEntryWord));
+                            break;
+
+                        case ColumnCoding::DeltaFromPreviousWord:
+                            bit::EliasDeltaCoding{}.compress(bs, zigzagDifference(word, previousWord));
+                            break;
+
+                        case ColumnCoding::RepeatOrRaw:
+                            if (i != 0 && word == previousEntryWord)
+                            {
+                                bs.writeBit(false);
+                            }
+                            else
+                            {
+                                bs.writeBit(true);
+                                bs.writeBits(word, 32);
+                            }
+                            break;
+
+                        case ColumnCoding::SharedPrefix:
+                            bs.writeBits(word, suffixLength);
+                            break;
+
+                        case ColumnCoding::RiceDeltaFromPreviousEntry:
+                            writeRice(bs, zigzagDifference(word, previousEntryWord), riceParameters[c]);
+                            break;
+                        }
+                    }
+                }
+
+                const std::size_t offset = out.size();
+                out.resize(offset + bs.numBytes());
+                bs.getBytes(out.data() + offset);
+            }
+
+            // The number of entries is not stored in the block,
+            // it has to be known from elsewhere.
+            // scratch is only used to avoid allocations for every block.
+            static void decode(const std::byte* data, std::size_t size, std::size_t count, EntryT* out, bit::BitStream<>& scratch)
+            {
+                auto* bytes = reinterpret_cast<std::byte*>(out);
+                auto load = [bytes](std::size_t i, std::size_t c) {
+                    std::uint32_t word;
+                    std::memcpy(&word, bytes + i * sizeof(EntryT) + c * sizeof(std::uint32_t), sizeof(std::uint32_t));
+                    return word;
+                };
+                auto store = [bytes](std::size_t i, std::size_t c, std::uint32_t word) {
+                    std::memcpy(bytes + i * sizeof(EntryT) + c * sizeof(std::uint32_t), &word, sizeof(std::uint32_t));
+                };
+
+                scratch.setBytes(data, size);
+                bit::BitStreamSequentialReader<bit::BitStream<>> reader(scratch);
+
+                const auto codings = readColumnCodings(reader);
+                for (std::size_t c = 0; c < numColumns; ++c)
+                {
+                    decodeColumn(reader, codings[c], c, count, load, store);
+                }
+            }
+
+            // Decodes a block into columns, word i of column c goes
+            // to columns[c * columnStride + i]. The columns are stored in the block
+            // one after another so decoding can stop after any column, without
+            // reading the rest, and continue later from where it stopped.
+            // The same columns have to be passed every time.
+            struct ColumnDecoder
+            {
+                ColumnDecoder(const std::byte* data, std::size_t size, std::size_t count) :
+                    m_data(data),
+                    m_size(size),
+                    m_count(count),
+                    m_codings{},
+                    m_numDecodedColumns(0),
+                    m_numBitsRead(0)
+                {
+                }
+
+                [[nodiscard]] std::size_t numDecodedColumns() const
+                {
+                    return m_numDecodedColumns;
+                }
+
+                // scratch is only used to avoid allocations for every block.
+                void decodeColumns(std::size_t numColumnsToDecode, std::uint32_t* columns, std::size_t columnStride, bit::BitStream<>& scratch)
+                {
+                    ASSERT(m_numDecodedColumns + numColumnsToDecode <= numColumns);
+                    ASSERT(m_count <= columnStride);
+
+                    scratch.setBytes(m_data, m_size);
+                    bit::BitStreamSequentialReader<bit::BitStream<>> reader(scratch);
+                    if (m_numBitsRead == 0)
+                    {
+                        m_codings = readColumnCodings(reader);
+                    }
+                    else
+                    {
+                        reader.skipBits(m_numBitsRead);
+                    }
+
+                    auto load = [columns, columnStride](std::size_t i, std::size_t c) {
+                        return columns[c * columnStride + i];
+                    };
+                    auto store = [columns, columnStride](std::size_t i, std::size_t c, std::uint32_t word) {
+                        columns[c * columnStride + i] = word;
+                    };
+
+                    for (std::size_t c = m_numDecodedColumns; c < m_numDecodedColumns + numColumnsToDecode; ++c)
+                    {
+                        decodeColumn(reader, m_codings[c], c, m_count, load, store);
+                    }
+
+                    m_numDecodedColumns += numColumnsToDecode;
+                    m_numBitsRead = reader.numBitsRead();
+                }
+
+            private:
+                const std::byte* m_data;
+                std::size_t m_size;
+                std::size_t m_count;
+                std::array<ColumnCoding, numColumns> m_codings;
+                std::size_t m_numDecodedColumns;
+                std::size_t m_numBitsRead;
+            };
+
+            // Makes entry i from all columns decoded by a ColumnDecoder.
+            [[nodiscard]] static EntryT entryFromColumns(const std::uint32_t* columns, std::size_t columnStride, std::size_t i)
+            {
+                Words words;
+                for (std::size_t c = 0; c < numColumns; ++c)
+                {
+                    words[c] = columns[c * columnStride + i];
+                }
+
+                EntryT entry;
+                std::memcpy(&entry, words.data(), sizeof(EntryT));
+                return entry;
+            }
+
+        private:
+            template <typename ReaderT>
+            [[nodiscard]] static std::array<ColumnCoding, numColumns> readColumnCodings(ReaderT& reader)
+            {
+                std::array<ColumnCoding, numColumns> codings{};
+                for (std::size_t c = 0; c < numColumns; ++c)
+                {
+                    codings[c] = static_cast<ColumnCoding>(reader.readBits(columnCodingBits));
+                }
+                return codings;
+            }
+
+            template <typename ReaderT, typename LoadT, typename StoreT>
+            static void decodeColumn(ReaderT& reader, ColumnCoding coding, std::size_t c, std::size_t count, LoadT&& load, StoreT&& store)
+            {
+                switch (coding)
+                {
+                case ColumnCoding::Raw:
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        store(i, c, static_cast<std::uint32_t>(reader.readBits(32)));
+                    }
+                    break;
+
+                case ColumnCoding::Value:
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        store(i, c, static_cast<std::uint32_t>(readEliasDelta(reader)));
+                    }
+                    break;
+
+                case ColumnCoding::DeltaFromPreviousEntry:
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        const std::uint32_t previousEntryWord = i == 0 ? 0 : load(i - 1, c);
+                        store(i, c, unzigzagDifference(readEliasDelta(reader), previousEntryWord));
+                    }
+                    break;
+
+                case ColumnCoding::DeltaFromPreviousWord:
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        const std::uint32_t previousWord = c == 0 ? 0 : load(i, c - 1);
+                        store(i, c, unzigzagDifference(readEliasDelta(reader), previousWord));
+                    }
+                    break;
+
+                case ColumnCoding::RepeatOrRaw:
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        if (reader.readBit())
+                        {
+                            store(i, c, static_cast<std::uint32_t>(reader.readBits(32)));
+                        }
+                        else
+                        {
+                            store(i, c, load(i - 1, c));
+                        }
+                    }
+                    break;
+
+                case ColumnCoding::SharedPrefix:
+                {
+                    const std::size_t prefixLength = static_cast<std::size_t>(reader.readBits(sharedPrefixLengthBits));
+                    if (prefixLength > 32)
+                    {
+                        throw std::runtime_error("Invalid shared prefix length in a compressed block.");
+                    }
+
+                    const std::size_t suffixLength = 32 - prefixLength;
+                    const std::uint32_t prefix = static_cast<std::uint32_t>(reader.readBits(prefixLength) << suffixLength);
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        store(i, c, prefix | static_cast<std::uint32_t>(reader.readBits(suffixLength)));
+                    }
+                    break;
+                }
+
+                case ColumnCoding::RiceDeltaFromPreviousEntry:
+                {
+                    const std::size_t parameter = static_cast<std::size_t>(reader.readBits(riceParameterBits));
+                    if (parameter > maxRiceParameter)
+                    {
+                        throw std::runtime_error("Invalid rice parameter in a compressed block.");
+                    }
+
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        const std::uint32_t previousEntryWord = i == 0 ? 0 : load(i - 1, c);
+                        store(i, c, unzigzagDifference(readRice(reader, parameter), previousEntryWord));
+                    }
+                    break;
+                }
+
+                default:
+                    throw std::runtime_error("Invalid column coding in a compressed block.");
+                }
+            }
+
+            [[nodiscard]] static std::uint64_t zigzagDifference(std::uint32_t word, std::uint32_t base)
+            {
+                const std::int64_t diff = static_cast<std::int64_t>(word) - static_cast<std::int64_t>(base);
+                return (static_cast<std::uint64_t>(diff) << 1) ^ static_cast<std::uint64_t>(diff >> 63);
+            }
+
+            [[nodiscard]] static std::uint32_t unzigzagDifference(std::uint64_t zigzag, std::uint32_t base)
+            {
+                const std::uint64_t diff = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+                return static_cast<std::uint32_t>(base + diff);
+            }
+
+            template <typename ReaderT>
+            [[nodiscard]] static std::uint64_t readEliasDelta(ReaderT& reader)
+            {
+                return bit::EliasDeltaCoding{}.decompress(reader, util::meta::Type<std::uint64_t>{});
+            }
+
+            // The quotient in unary (zeros terminated by a one), then the remainder.
+            template <typename BitStreamT>
+            static void writeRice(BitStreamT& bs, std::uint64_t value, std::size_t parameter)
+            {
+                for (std::uint64_t quotient = value >> parameter; quotient != 0;)
+                {
+                    const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(quotient, 64));
+                    bs.writeBit(false, n);
+                    quotient -= n;
+                }
+                bs.writeBit(true);
+                bs.writeBits(value, parameter);
+            }
+
+            template <typename ReaderT>
+            [[nodiscard]] static std::uint64_t readRice(ReaderT& reader, std::size_t parameter)
+            {
+                const std::uint64_t quotient = reader.skipBitsWhileEqualTo(false);
+                (void)reader.readBit();
+                return (quotient << parameter) | reader.readBits(parameter);
+            }
+
+            [[nodiscard]] static std::size_t eliasDeltaSize(std::uint64_t value)
+            {
+                const std::uint64_t n = floorLog2(value + 1);
+                const std::uint64_t l = floorLog2(n + 1);
+                return static_cast<std::size_t>(n + 2 * l + 1);
+            }
+
+            [[nodiscard]] static std::size_t sharedPrefixLength(const std::vector<Words>& words, std::size_t c)
+            {
+                std::uint32_t differentBits = 0;
+                for (std::size_t i = 1; i < words.size(); ++i)
+                {
+                    differentBits |= words[i][c] ^ words[0][c];
+                }
+
+                return differentBits == 0 ? 32 : 31 - floorLog2(differentBits);
+            }
+
+            [[nodiscard]] static std::size_t riceSize(const std::vector<Words>& words, std::size_t c, std::size_t parameter)
+            {
+                std::size_t size = riceParameterBits + (parameter + 1) * words.size();
+                for (std::size_t i = 0; i < words.size(); ++i)
+                {
+                    const std::uint32_t previousEntryWord = i == 0 ? 0 : words[i - 1][c];
+                    size += static_cast<std::size_t>(zigzagDifference(words[i][c], previousEntryWord) >> parameter);
+                }
+                return size;
+            }
+
+            // The size is convex in the parameter so the search stops
+            // as soon as it starts growing.
+            [[nodiscard]] static std::size_t riceParameter(const std::vector<Words>& words, std::size_t c)
+            {
+                std::size_t best = 0;
+                std::size_t bestSize = riceSize(words, c, 0);
+                for (std::size_t parameter = 1; parameter <= maxRiceParameter; ++parameter)
+                {
+                    const std::size_t size = riceSize(words, c, parameter);
+                    if (size >= bestSize)
+                    {
+                        break;
+                    }
+
+                    best = parameter;
+                    bestSize = size;
+                }
+                return best;
+            }
+
+            [[nodiscard]] static ColumnCoding chooseColumnCoding(const std::vector<Words>& words, std::size_t c, std::size_t prefixLength, std::size_t parameter)
+            {
+                std::array<std::size_t, numColumnCodings> sizes{};
+                sizes[static_cast<std::size_t>(ColumnCoding::Raw)] = 32 * words.size();
+                sizes[static_cast<std::size_t>(ColumnCoding::SharedPrefix)] = sharedPrefixLengthBits + prefixLength + (32 - prefixLength) * words.size();
+                sizes[static_cast<std::size_t>(ColumnCoding::RiceDeltaFromPreviousEntry)] = riceSize(words, c, parameter);
+                if (c == 0)
+                {
+                    sizes[static_cast<std::size_t>(ColumnCoding::DeltaFromPreviousWord)] = std::numeric_limits<std::size_t>::max();
+                }
+
+                for (std::size_t i = 0; i < words.size(); ++i)
+                {
+                    const std::uint32_t word = words[i][c];
+                    const std::uint32_t previousEntryWord = i == 0 ? 0 : words[i - 1][c];
+
+                    sizes[static_cast<std::size_t>(ColumnCoding::Value)] += eliasDeltaSize(word);
+                    sizes[static_cast<std::size_t>(ColumnCoding::DeltaFromPreviousEntry)] += eliasDeltaSize(zigzagDifference(word, previousEntryWord));
+                    if (c != 0)
+                    {
+                        sizes[static_cast<std::size_t>(ColumnCoding::DeltaFromPreviousWord)] += eliasDeltaSize(zigzagDifference(word, words[i][c - 1]));
+                    }
+                    sizes[static_cast<std::size_t>(ColumnCoding::RepeatOrRaw)] += (i != 0 && word == previousEntryWord) ? 1 : 33;
+                }
+
+                std::size_t best = 0;
+                for (std::size_t i = 1; i < numColumnCodings; ++i)
+                {
+                    if (sizes[i] < sizes[best])
+                    {
+                        best = i;
+                    }
+                }
+
+                return static_cast<ColumnCoding>(best);
+            }
+        };
+
+        // Locations of the blocks of a block compressed data file.
+        // Block i occupies bytes [offsets[i], offsets[i + 1]) of the data file.
+        // Persisted as a sequence of 64 bit words -
+        // the number of entries followed by the offsets.
+        struct BlockTable
+        {
+            std::uint64_t numEntries = 0;
+            std::vector<std::uint64_t> offsets{ 0 };
+
+            [[nodiscard]] std::size_t numBlocks() const
+            {
+                return offsets.size() - 1;
+            }
+
+            [[nodiscard]] std::size_t dataSize() const
+            {
+                return static_cast<std::size_t>(offsets.back());
+            }
+
+            [[nodiscard]] std::vector<std::uint64_t> toWords() const
+            {
+                std::vector<std::uint64_t> words;
+                words.reserve(offsets.size() + 1);
+                words.emplace_back(numEntries);
+                words.insert(words.end(), offsets.begin(), offsets.end());
+                return words;
+            }
+
+            [[nodiscard]] static BlockTable fromWords(const std::vector<std::uint64_t>& words)
+            {
+                if (words.size() < 2 || words[1] != 0)
+                {
+                    throw std::runtime_error("Invalid block table.");
+                }
+
+                BlockTable table;
+                table.numEntries = words[0];
+                table.offsets.assign(words.begin() + 1, words.end());
+                return table;
+            }
+        };
+
+        // Writes a data file block by block. The caller decides where blocks
+        // end, data files use one block for each range of their index.
+        template <typename EntryT>
+        struct BlockCompressedFileWriter
+        {
+            BlockCompressedFileWriter(const std::filesystem::path& path) :
+                m_file(path),
+                m_table{},
+                m_buffer{}
+            {
+            }
+
+            void append(const EntryT* entries, std::size_t count)
+            {
+                m_buffer.clear();
+                EntryBlockCodec<EntryT>::encode(entries, count, m_buffer);
+                (void)m_file.append(m_buffer.data(), 1, m_buffer.size());
+
+                m_table.numEntries += count;
+                m_table.offsets.emplace_back(m_table.offsets.back() + m_buffer.size());
+            }
+
+            [[nodiscard]] BlockTable end()
+            {
+                m_file.flush();
+                return std::move(m_table);
+            }
+
+        private:
+            ext::BinaryOutputFile m_file;
+            BlockTable m_table;
+            std::vector<std::byte> m_buffer;
+        };
+    }
+}
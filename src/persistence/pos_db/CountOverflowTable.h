@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace persistence
+{
+    namespace pos_db
+    {
+        // The count of the entries with the given key.
+        template <typename KeyT>
+        struct CountOverflowRecord
+        {
+            KeyT key;
+            std::uint64_t count;
+        };
+
+        // Counts of entries of a data file that don't fit in the count of the entry.
+        // The entries only have a marker and their counts are looked up here by the key.
+        // Only very frequent positions get here so the table is small and
+        // it is kept in memory. Records are sorted by the full key, one for each key.
+        template <typename KeyT>
+        struct CountOverflowTable
+        {
+            using RecordType = CountOverflowRecord<KeyT>;
+
+            static_assert(std::is_trivially_copyable_v<KeyT>);
+            static_assert(sizeof(KeyT) % sizeof(std::uint32_t) == 0);
+
+            // Records are stored field by field, so that the padding of the record is not written.
+            static constexpr std::size_t numKeyWords = sizeof(KeyT) / sizeof(std::uint32_t);
+            static constexpr std::size_t numRecordWords = numKeyWords + 2;
+
+            CountOverflowTable() = default;
+
+            // The records don't have to be sorted. Counts of equal keys are summed.
+            explicit CountOverflowTable(std::vector<RecordType> records) :
+                m_records(std::move(records))
+            {
+                normalize();
+            }
+
+            [[nodiscard]] static CountOverflowTable fromWords(const std::vector<std::uint32_t>& words)
+            {
+                std::vector<RecordType> records(words.size() / numRecordWords);
+                for (std::size_t i = 0; i < records.size(); ++i)
+                {
+                    const std::uint32_t* recordWords = words.data() + i * numRecordWords;
+                    std::memcpy(&records[i].key, recordWords, sizeof(KeyT));
+                    records[i].count =
+                        static_cast<std::uint64_t>(recordWords[numKeyWords])
+                        | (static_cast<std::uint64_t>(recordWords[numKeyWords + 1]) << 32);
+                }
+
+                return CountOverflowTable(std::move(records));
+            }
+
+            [[nodiscard]] std::vector<std::uint32_t> toWords() const
+            {
+                std::vector<std::uint32_t> words(m_records.size() * numRecordWords);
+                for (std::size_t i = 0; i < m_records.size(); ++i)
+                {
+                    std::uint32_t* recordWords = words.data() + i * numRecordWords;
+                    std::memcpy(recordWords, &m_records[i].key, sizeof(KeyT));
+                    recordWords[numKeyWords] = static_cast<std::uint32_t>(m_records[i].count);
+                    recordWords[numKeyWords + 1] = static_cast<std::uint32_t>(m_records[i].count >> 32);
+                }
+
+                return words;
+            }
+
+            [[nodiscard]] bool empty() const
+            {
+                return m_records.empty();
+            }
+
+            [[nodiscard]] std::size_t size() const
+            {
+                return m_records.size();
+            }
+
+            [[nodiscard]] const std::vector<RecordType>& records() const
+            {
+                return m_records;
+            }
+
+            // Sums the counts of the other table into this one.
+            void add(const CountOverflowTable& other)
+            {
+                if (other.empty())
+                {
+                    return;
+                }
+
+                m_records.insert(m_records.end(), other.m_records.begin(), other.m_records.end());
+                normalize();
+            }
+
+            // Zero if the key is not in the table.
+            [[nodiscard]] std::uint64_t count(const KeyT& key) const
+            {
+                auto it = std::lower_bound(m_records.begin(), m_records.end(), key, [](const RecordType& record, const KeyT& k) {
+                    return typename KeyT::CompareLessFull{}(record.key, k);
+                    });
+
+                if (it == m_records.end() || !typename KeyT::CompareEqualFull{}(it->key, key))
+                {
+                    return 0;
+                }
+
+                return it->count;
+            }
+
+        private:
+            std::vector<RecordType> m_records;
+
+            void normalize()
+            {
+                std::stable_sort(m_records.begin(), m_records.end(), [](const RecordType& lhs, const RecordType& rhs) {
+                    return typename KeyT::CompareLessFull{}(lhs.key, rhs.key);
+                    });
+
+                auto write = m_records.begin();
+                for (auto read = m_records.begin(); read != m_records.end(); ++read)
+                {
+                    if (write != m_records.begin() && typename KeyT::CompareEqualFull{}(std::prev(write)->key, read->key))
+                    {
+                        std::prev(write)->count += read->count;
+                    }
+                    else
+                    {
+                        *write++ = *read;
+                    }
+                }
+
+                m_records.erase(write, m_records.end());
+            }
+        };
+    }
+}
@@ -306,6 +306,7 @@ namespace persistence
 
         j["allows_filtering_by_month_range"] = manifest.allowsFilteringByMonthRange;
         j["month_filter_granularity"] = manifest.monthFilterGranularity;
+        j["filters_months_by_data_file"] = manifest.filtersMonthsByDataFile;
 
         j["max_bytes_per_position"] = manifest.maxBytesPerPosition;
 
@@ -177,6 +177,10 @@ namespace persistence
         bool allowsFilteringByMonthRange;
         std::uint64_t monthFilterGranularity;
 
+        // Month filters skip whole data files with no games from the requested months,
+        // but all games of the searched files are counted (see Response::exactMonths).
+        bool filtersMonthsByDataFile;
+
         std::uint64_t maxBytesPerPosition;
         std::optional<double> estimatedAverageBytesPerPosition;
 
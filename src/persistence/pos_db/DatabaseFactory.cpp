@@ -26,4 +26,12 @@ namespace persistence
 
         return manifests;
     }
+
+    [[nodiscard]] const DatabaseConverterBase* DatabaseFactory::tryGetConverter(const std::string& fromSchema, const std::string& toSchema) const
+    {
+        auto it = m_converters.find({ fromSchema, toSchema });
+        if (it == m_converters.end()) return nullptr;
+
+        return it->second.get();
+    }
 }
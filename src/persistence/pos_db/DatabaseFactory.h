@@ -6,6 +6,8 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace persistence
 {
@@ -32,6 +34,33 @@ namespace persistence
         }
     };
 
+    struct DatabaseConverterBase
+    {
+        // Creates the database at `to` from the database at `from`.
+        virtual void convert(
+            const std::filesystem::path& from,
+            const std::filesystem::path& to,
+            const std::vector<std::filesystem::path>& temporaryDirs
+        ) const = 0;
+
+        virtual ~DatabaseConverterBase() {};
+    };
+
+    template <typename FromDatabaseT, typename ToDatabaseT>
+    struct SpecificDatabaseConverter : DatabaseConverterBase
+    {
+        void convert(
+            const std::filesystem::path& from,
+            const std::filesystem::path& to,
+            const std::vector<std::filesystem::path>& temporaryDirs
+        ) const override
+        {
+            FromDatabaseT fromDb(from);
+            ToDatabaseT toDb(to);
+            toDb.convertFrom(fromDb, temporaryDirs);
+        }
+    };
+
     struct DatabaseFactory
     {
         DatabaseFactory() = default;
@@ -42,13 +71,25 @@ namespace persistence
             m_factories[DatabaseT::schema()] = std::make_unique<SpecificDatabaseFactory<DatabaseT>>();
         }
 
+        // Only formats whose entries can be derived from the entries
+        // of the other format can be registered, see convert_db.
+        template <typename FromDatabaseT, typename ToDatabaseT>
+        void registerDatabaseConversion()
+        {
+            m_converters[{ FromDatabaseT::schema(), ToDatabaseT::schema() }] = std::make_unique<SpecificDatabaseConverter<FromDatabaseT, ToDatabaseT>>();
+        }
+
         [[nodiscard]] std::unique_ptr<Database> tryInstantiateBySchema(const std::string& key, const std::filesystem::path& path) const;
 
         [[nodiscard]] const SpecificDatabaseFactoryBase& at(const std::string& key) const;
 
         [[nodiscard]] std::map<std::string, DatabaseSupportManifest> supportManifests() const;
 
+        // Returns nullptr if there is no conversion between the schemas.
+        [[nodiscard]] const DatabaseConverterBase* tryGetConverter(const std::string& fromSchema, const std::string& toSchema) const;
+
     private:
         std::map<std::string, std::unique_ptr<SpecificDatabaseFactoryBase>> m_factories;
+        std::map<std::pair<std::string, std::string>, std::unique_ptr<DatabaseConverterBase>> m_converters;
     };
 }
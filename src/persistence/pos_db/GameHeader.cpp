@@ -5,30 +5,63 @@
 
 #include <cstdint>
 #include <limits>
+#include <string>
 #include <string_view>
 
 #include "json/json.hpp"
 
 namespace persistence
 {
+    GameHeader::GameHeader(const allocator_type& alloc) :
+        m_event(alloc),
+        m_white(alloc),
+        m_black(alloc)
+    {
+    }
+
     GameHeader::GameHeader(
         std::uint64_t gameIdx,
         GameResult result,
         Date date,
         Eco eco,
         std::uint16_t plyCount,
-        std::string event,
-        std::string white,
-        std::string black
+        std::string_view event,
+        std::string_view white,
+        std::string_view black,
+        const allocator_type& alloc
     ) :
         m_gameIdx(gameIdx),
         m_result(result),
         m_date(date),
         m_eco(eco),
         m_plyCount(plyCount),
-        m_event(std::move(event)),
-        m_white(std::move(white)),
-        m_black(std::move(black))
+        m_event(event, alloc),
+        m_white(white, alloc),
+        m_black(black, alloc)
+    {
+    }
+
+    GameHeader::GameHeader(const GameHeader& other, const allocator_type& alloc) :
+        m_gameIdx(other.m_gameIdx),
+        m_result(other.m_result),
+        m_date(other.m_date),
+        m_eco(other.m_eco),
+        m_plyCount(other.m_plyCount),
+        m_event(other.m_event, alloc),
+        m_white(other.m_white, alloc),
+        m_black(other.m_black, alloc)
+    {
+    }
+
+    GameHeader::GameHeader(GameHeader&& other, const allocator_type& alloc) :
+        m_gameIdx(other.m_gameIdx),
+        m_result(other.m_result),
+        m_date(other.m_date),
+        m_eco(other.m_eco),
+        m_plyCount(other.m_plyCount),
+        m_event(std::move(other.m_event), alloc),
+        m_white(std::move(other.m_white), alloc),
+        m_black(std::move(other.m_black), alloc)
     {
     }
 
@@ -57,17 +90,17 @@ namespace persistence
         return m_plyCount;
     }
 
-    [[nodiscard]] const std::string& GameHeader::event() const
+    [[nodiscard]] std::string_view GameHeader::event() const
     {
         return m_event;
     }
 
-    [[nodiscard]] const std::string& GameHeader::white() const
+    [[nodiscard]] std::string_view GameHeader::white() const
     {
         return m_white;
     }
 
-    [[nodiscard]] const std::string& GameHeader::black() const
+    [[nodiscard]] std::string_view GameHeader::black() const
     {
         return m_black;
     }
@@ -79,9 +112,9 @@ namespace persistence
             { "result", toString(GameResultPgnFormat{}, data.m_result) },
             { "date", data.m_date.toString() },
             { "eco", data.m_eco.toString() },
-            { "event", data.m_event },
-            { "white", data.m_white },
-            { "black", data.m_black }
+            { "event", std::string(data.m_event) },
+            { "white", std::string(data.m_white) },
+            { "black", std::string(data.m_black) }
         };
 
         if (data.m_plyCount.has_value())
@@ -122,8 +155,8 @@ namespace persistence
             }
         }
 
-        j["event"].get_to(data.m_event);
-        j["white"].get_to(data.m_white);
-        j["black"].get_to(data.m_black);
+        data.m_event = j["event"].get_ref<const std::string&>();
+        data.m_white = j["white"].get_ref<const std::string&>();
+        data.m_black = j["black"].get_ref<const std::string&>();
     }
 }
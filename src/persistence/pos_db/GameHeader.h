@@ -13,43 +13,56 @@
 #include <cstdint>
 #include <filesystem>
 #include <limits>
+#include <memory_resource>
+#include <string>
 #include <string_view>
+#include <type_traits>
 
 #include "json/json.hpp"
 
 namespace persistence
 {
+    // Headers of query results keep their names in the memory of the response.
     struct GameHeader
     {
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+
         GameHeader() = default;
 
+        explicit GameHeader(const allocator_type& alloc);
+
         GameHeader(
             std::uint64_t gameIdx,
             GameResult result,
             Date date,
             Eco eco,
             std::uint16_t plyCount,
-            std::string event,
-            std::string white,
-            std::string black
+            std::string_view event,
+            std::string_view white,
+            std::string_view black,
+            const allocator_type& alloc = {}
         );
 
         GameHeader(const GameHeader& other) = default;
         GameHeader(GameHeader&& other) = default;
 
+        GameHeader(const GameHeader& other, const allocator_type& alloc);
+        GameHeader(GameHeader&& other, const allocator_type& alloc);
+
         GameHeader& operator=(const GameHeader& other) = default;
         GameHeader& operator=(GameHeader&& other) = default;
 
-        template <typename PackedGameHeaderT>
-        explicit GameHeader(const PackedGameHeaderT& header) :
+        // Allocators must not be taken for packed headers.
+        template <typename PackedGameHeaderT, typename = decltype(PackedGameHeaderT::unknownPlyCount)>
+        explicit GameHeader(const PackedGameHeaderT& header, const allocator_type& alloc = {}) :
             m_gameIdx(header.gameIdx()),
             m_result(header.result()),
             m_date(header.date()),
             m_eco(header.eco()),
             m_plyCount(std::nullopt),
-            m_event(header.event()),
-            m_white(header.white()),
-            m_black(header.black())
+            m_event(header.event(), alloc),
+            m_white(header.white(), alloc),
+            m_black(header.black(), alloc)
         {
             if (header.plyCount() != PackedGameHeaderT::unknownPlyCount)
             {
@@ -86,11 +99,11 @@ namespace persistence
 
         [[nodiscard]] std::optional<std::uint16_t> plyCount() const;
 
-        [[nodiscard]] const std::string& event() const;
+        [[nodiscard]] std::string_view event() const;
 
-        [[nodiscard]] const std::string& white() const;
+        [[nodiscard]] std::string_view white() const;
 
-        [[nodiscard]] const std::string& black() const;
+        [[nodiscard]] std::string_view black() const;
 
         friend void to_json(nlohmann::json& j, const GameHeader& data);
 
@@ -102,8 +115,8 @@ namespace persistence
         Date m_date;
         Eco m_eco;
         std::optional<std::uint16_t> m_plyCount;
-        std::string m_event;
-        std::string m_white;
-        std::string m_black;
+        std::pmr::string m_event;
+        std::pmr::string m_white;
+        std::pmr::string m_black;
     };
 }
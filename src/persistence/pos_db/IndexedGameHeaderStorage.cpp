@@ -2,19 +2,187 @@
 
 #include "algorithm/Unsort.h"
 
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 namespace persistence
 {
+    namespace detail
+    {
+        [[nodiscard]] HeaderLayout detectHeaderLayout(const std::filesystem::path& headerPath, const std::filesystem::path& namesPath)
+        {
+            if (std::filesystem::exists(headerPath) && !std::filesystem::exists(namesPath))
+            {
+                return HeaderLayout::Packed;
+            }
+
+            return HeaderLayout::Compact;
+        }
+
+        // Reads the given byte ranges from the file. Ranges that are close
+        // to each other are read together. All reads are scheduled at once
+        // and then awaited. The ranges must be sorted by their beginning.
+        // Everything is allocated from the memory resource of the ranges.
+        struct CoalescedReads
+        {
+            std::pmr::vector<char> buffer;
+
+            // Position in the buffer of the beginning of each range.
+            std::pmr::vector<std::size_t> positions;
+        };
+
+        [[nodiscard]] CoalescedReads readCoalesced(
+            ext::Vector<char>& file,
+            const std::pmr::vector<std::uint64_t>& begins,
+            const std::pmr::vector<std::uint64_t>& ends,
+            std::size_t maxGap
+        )
+        {
+            std::pmr::memory_resource* resource = begins.get_allocator().resource();
+
+            ASSERT(begins.size() == ends.size());
+            ASSERT(std::is_sorted(begins.begin(), begins.end()));
+
+            struct CoalescedRead
+            {
+                std::size_t begin;
+                std::size_t end;
+                std::size_t bufferOffset;
+            };
+
+            const std::size_t numRanges = begins.size();
+
+            std::pmr::vector<CoalescedRead> reads(resource);
+            std::pmr::vector<std::size_t> readIndices(resource);
+            readIndices.reserve(numRanges);
+            std::size_t bufferSize = 0;
+            for (std::size_t i = 0; i < numRanges; ++i)
+            {
+                if (!reads.empty() && begins[i] <= reads.back().end + maxGap)
+                {
+                    reads.back().end = std::max<std::size_t>(reads.back().end, ends[i]);
+                }
+                else
+                {
+                    if (!reads.empty())
+                    {
+                        bufferSize += reads.back().end - reads.back().begin;
+                    }
+
+                    reads.push_back({ begins[i], ends[i], bufferSize });
+                }
+
+                readIndices.emplace_back(reads.size() - 1);
+            }
+
+            if (!reads.empty())
+            {
+                bufferSize += reads.back().end - reads.back().begin;
+            }
+
+            CoalescedReads result{ std::pmr::vector<char>(resource), std::pmr::vector<std::size_t>(resource) };
+            result.buffer.resize(bufferSize);
+            std::pmr::vector<std::future<std::size_t>> futures(resource);
+            futures.reserve(reads.size());
+
+            file.flush();
+            for (auto&& read : reads)
+            {
+                futures.emplace_back(file.readNoFlush(
+                    ext::Async{},
+                    result.buffer.data() + read.bufferOffset,
+                    read.begin,
+                    read.end - read.begin
+                ));
+            }
+
+            for (auto&& future : futures)
+            {
+                (void)future.get();
+            }
+
+            result.positions.reserve(numRanges);
+            for (std::size_t i = 0; i < numRanges; ++i)
+            {
+                const auto& read = reads[readIndices[i]];
+                result.positions.emplace_back(read.bufferOffset + (begins[i] - read.begin));
+            }
+
+            return result;
+        }
+
+        // Writes the data to a temporary file and renames it over the file,
+        // so that an interrupted write doesn't leave it truncated.
+        template <typename T>
+        void replaceFile(const std::filesystem::path& path, const std::vector<T>& data, const std::string& what)
+        {
+            auto tmpPath = path;
+            tmpPath += "_tmp";
+
+            const std::size_t written = ext::writeFile<T>(tmpPath, data.data(), data.size());
+            if (written != data.size())
+            {
+                std::filesystem::remove(tmpPath);
+                throw std::runtime_error("Cannot write " + what + " to " + path.string());
+            }
+
+            std::filesystem::rename(tmpPath, path);
+        }
+    }
+
     template <typename PackedGameHeaderT>
-    IndexedGameHeaderStorage<PackedGameHeaderT>::IndexedGameHeaderStorage(std::filesystem::path path, MemoryAmount memory, std::string name) :
+    IndexedGameHeaderStorage<PackedGameHeaderT>::IndexedGameHeaderStorage(std::filesystem::path path, MemoryAmount memory, std::string name, bool indexPlayers) :
         // here we use operator, to create directories before we try to
         // create files there
         m_name(std::move(name)),
         m_path((std::filesystem::create_directories(path), std::move(path))),
         m_headerPath(std::move((m_path / headerPath) += m_name)),
         m_indexPath(std::move((m_path / indexPath) += m_name)),
+        m_namesPath(std::move((m_path / namesPath) += m_name)),
+        m_layout(detail::detectHeaderLayout(m_headerPath, m_namesPath)),
         m_header({ m_headerPath, ext::OutputMode::Append }, util::DoubleBuffer<char>(ext::numObjectsPerBufferUnit<char>(std::max(memory.bytes(), minMemory.bytes()), 4))),
-        m_index({ m_indexPath, ext::OutputMode::Append }, util::DoubleBuffer<std::size_t>(ext::numObjectsPerBufferUnit<std::size_t>(std::max(memory.bytes(), minMemory.bytes()), 4)))
+        m_index({ m_indexPath, ext::OutputMode::Append }, util::DoubleBuffer<std::size_t>(ext::numObjectsPerBufferUnit<std::size_t>(std::max(memory.bytes(), minMemory.bytes()), 4))),
+        m_names{},
+        m_namesLogPath(std::move((m_path / namesLogPath) += m_name)),
+        m_numNamesWritten(0),
+        m_playersPath(std::move((m_path / playersPath) += m_name)),
+        m_hasPlayerIndex(false),
+        m_hasPendingPlayers(false),
+        m_players{}
     {
+        if (m_layout == HeaderLayout::Compact)
+        {
+            if (std::filesystem::exists(m_namesPath))
+            {
+                m_names = FrontCodedDictionary(ext::readFile<char>(m_namesPath));
+                readNamesLog();
+            }
+            else
+            {
+                // The file has to exist from the start for the layout to be detected correctly.
+                std::filesystem::remove(m_namesLogPath);
+                writeNames(m_namesPath);
+            }
+
+            // The index can only be started for an empty storage,
+            // otherwise it would miss the games already present.
+            m_hasPlayerIndex = std::filesystem::exists(m_playersPath);
+            if (m_hasPlayerIndex)
+            {
+                m_players = ext::readFile<std::uint64_t>(m_playersPath);
+            }
+            else if (indexPlayers && nextGameId() == 0)
+            {
+                writePlayers(m_playersPath);
+                m_hasPlayerIndex = true;
+            }
+        }
     }
 
     template <typename PackedGameHeaderT>
@@ -56,6 +224,17 @@ namespace persistence
     template <typename PackedGameHeaderT>
     void IndexedGameHeaderStorage<PackedGameHeaderT>::flush()
     {
+        // Names go first so that flushed headers don't refer to names
+        // that are not in the files.
+        if (m_layout == HeaderLayout::Compact)
+        {
+            flushNames();
+        }
+        if (m_hasPendingPlayers)
+        {
+            writePlayers(m_playersPath);
+            m_hasPendingPlayers = false;
+        }
         m_header.flush();
         m_index.flush();
     }
@@ -65,6 +244,19 @@ namespace persistence
     {
         m_header.clear();
         m_index.clear();
+        if (m_layout == HeaderLayout::Compact)
+        {
+            m_names = FrontCodedDictionary{};
+            writeNames(m_namesPath);
+            std::filesystem::remove(m_namesLogPath);
+            m_numNamesWritten = 0;
+        }
+        if (m_hasPlayerIndex)
+        {
+            m_players.clear();
+            m_hasPendingPlayers = false;
+            writePlayers(m_playersPath);
+        }
     }
 
     template <typename PackedGameHeaderT>
@@ -76,21 +268,34 @@ namespace persistence
         newIndexPath += m_name;
         std::filesystem::copy_file(m_headerPath, newHeaderPath, std::filesystem::copy_options::overwrite_existing);
         std::filesystem::copy_file(m_indexPath, newIndexPath, std::filesystem::copy_options::overwrite_existing);
+        if (m_layout == HeaderLayout::Compact)
+        {
+            std::filesystem::path newNamesPath = path / namesPath;
+            newNamesPath += m_name;
+            writeNames(newNamesPath);
+
+            // The copy has all names in the names file.
+            std::filesystem::path newNamesLogPath = path / namesLogPath;
+            newNamesLogPath += m_name;
+            std::filesystem::remove(newNamesLogPath);
+        }
+        if (m_hasPlayerIndex)
+        {
+            std::filesystem::path newPlayersPath = path / playersPath;
+            newPlayersPath += m_name;
+            writePlayers(newPlayersPath);
+        }
     }
 
     template <typename PackedGameHeaderT>
-    [[nodiscard]] std::vector<PackedGameHeaderT> IndexedGameHeaderStorage<PackedGameHeaderT>::queryByOffsets(std::vector<std::uint64_t> offsets)
+    [[nodiscard]] std::pmr::vector<PackedGameHeaderT> IndexedGameHeaderStorage<PackedGameHeaderT>::queryByOffsets(std::pmr::vector<std::uint64_t> offsets)
     {
-        const std::size_t numKeys = offsets.size();
-
         auto unsort = reversibleSort(offsets);
 
-        std::vector<PackedGameHeaderT> headers;
-        headers.reserve(numKeys);
-        for (std::size_t i = 0; i < numKeys; ++i)
-        {
-            headers.emplace_back(m_header, offsets[i]);
-        }
+        std::pmr::vector<PackedGameHeaderT> headers =
+            m_layout == HeaderLayout::Compact
+            ? queryCompactByOffsets(offsets)
+            : queryPackedByOffsets(offsets);
 
         unsort(headers);
 
@@ -98,13 +303,13 @@ namespace persistence
     }
 
     template <typename PackedGameHeaderT>
-    [[nodiscard]] std::vector<PackedGameHeaderT> IndexedGameHeaderStorage<PackedGameHeaderT>::queryByIndices(std::vector<std::uint64_t> keys)
+    [[nodiscard]] std::pmr::vector<PackedGameHeaderT> IndexedGameHeaderStorage<PackedGameHeaderT>::queryByIndices(std::pmr::vector<std::uint64_t> keys)
     {
         const std::size_t numKeys = keys.size();
 
         auto unsort = reversibleSort(keys);
 
-        std::vector<std::size_t> offsets;
+        std::pmr::vector<std::uint64_t> offsets(keys.get_allocator());
         offsets.reserve(numKeys);
         for (auto& key : keys)
         {
@@ -113,7 +318,7 @@ namespace persistence
 
         unsort(offsets);
 
-        return queryByOffsets(offsets);
+        return queryByOffsets(std::move(offsets));
     }
 
     template <typename PackedGameHeaderT>
@@ -122,6 +327,32 @@ namespace persistence
         return static_cast<std::uint32_t>(m_index.size());
     }
 
+    template <typename PackedGameHeaderT>
+    [[nodiscard]] HeaderLayout IndexedGameHeaderStorage<PackedGameHeaderT>::layout() const
+    {
+        return m_layout;
+    }
+
+    template <typename PackedGameHeaderT>
+    [[nodiscard]] bool IndexedGameHeaderStorage<PackedGameHeaderT>::hasPlayerIndex() const
+    {
+        return m_hasPlayerIndex;
+    }
+
+    template <typename PackedGameHeaderT>
+    [[nodiscard]] bool IndexedGameHeaderStorage<PackedGameHeaderT>::hasPlayer(std::string_view name) const
+    {
+        ASSERT(m_hasPlayerIndex);
+
+        const auto id = m_names.find(name);
+        if (id == FrontCodedDictionary::invalidId || id / 64 >= m_players.size())
+        {
+            return false;
+        }
+
+        return (m_players[id / 64] >> (id % 64)) & 1;
+    }
+
     template <typename PackedGameHeaderT>
     HeaderEntryLocation IndexedGameHeaderStorage<PackedGameHeaderT>::addHeader(const pgn::UnparsedGame& game)
     {
@@ -151,11 +382,200 @@ namespace persistence
     {
         const std::uint64_t gameIdx = entry.gameIdx();
         const std::uint64_t headerSizeBytes = m_header.size();
-        m_header.append(entry.data(), entry.size());
+        if (m_layout == HeaderLayout::Compact)
+        {
+            const CompactGameHeaderType compact(
+                entry,
+                m_names.insert(entry.event()),
+                m_names.insert(entry.white()),
+                m_names.insert(entry.black())
+            );
+            m_header.append(reinterpret_cast<const char*>(&compact), sizeof(CompactGameHeaderType));
+
+            if (m_hasPlayerIndex)
+            {
+                addPlayer(compact.whiteId());
+                addPlayer(compact.blackId());
+            }
+        }
+        else
+        {
+            m_header.append(entry.data(), entry.size());
+        }
         m_index.emplace_back(headerSizeBytes);
         return { headerSizeBytes, gameIdx };
     }
 
+    template <typename PackedGameHeaderT>
+    void IndexedGameHeaderStorage<PackedGameHeaderT>::writeNames(const std::filesystem::path& path) const
+    {
+        detail::replaceFile(path, m_names.serialize(), "names");
+    }
+
+    // The log holds the names with ids from the size of the names file
+    // up, each as 1B length followed by the name.
+    // A name cut short by an interrupted flush is dropped
+    // and the names file is rewritten, so that appending can continue.
+    // Names that are already in the names file (when the file was
+    // rewritten but the log wasn't removed yet) keep their ids.
+    template <typename PackedGameHeaderT>
+    void IndexedGameHeaderStorage<PackedGameHeaderT>::readNamesLog()
+    {
+        if (std::filesystem::exists(m_namesLogPath))
+        {
+            const std::vector<char> log = ext::readFile<char>(m_namesLogPath);
+            std::size_t offset = 0;
+            while (offset < log.size())
+            {
+                const std::size_t length = static_cast<unsigned char>(log[offset]);
+                if (offset + 1 + length > log.size())
+                {
+                    break;
+                }
+
+                (void)m_names.insert(std::string_view(log.data() + offset + 1, length));
+                offset += 1 + length;
+            }
+
+            if (offset != log.size())
+            {
+                m_names = FrontCodedDictionary(m_names.serialize());
+                writeNames(m_namesPath);
+                std::filesystem::remove(m_namesLogPath);
+            }
+        }
+
+        m_numNamesWritten = m_names.size();
+    }
+
+    // The names file is only rewritten when the log would hold more names
+    // than the file, so on average each name is written a constant number of times.
+    template <typename PackedGameHeaderT>
+    void IndexedGameHeaderStorage<PackedGameHeaderT>::flushNames()
+    {
+        if (m_names.size() == m_numNamesWritten)
+        {
+            return;
+        }
+
+        if (m_names.numPendingStrings() > m_names.size() - m_names.numPendingStrings())
+        {
+            m_names = FrontCodedDictionary(m_names.serialize());
+            writeNames(m_namesPath);
+            std::filesystem::remove(m_namesLogPath);
+        }
+        else
+        {
+            appendNamesToLog(m_numNamesWritten);
+        }
+
+        m_numNamesWritten = m_names.size();
+    }
+
+    template <typename PackedGameHeaderT>
+    void IndexedGameHeaderStorage<PackedGameHeaderT>::appendNamesToLog(std::size_t firstId) const
+    {
+        std::vector<char> data;
+        for (std::size_t id = firstId; id < m_names.size(); ++id)
+        {
+            const std::string name = m_names.at(static_cast<FrontCodedDictionary::IdType>(id));
+            ASSERT(name.size() <= std::numeric_limits<std::uint8_t>::max());
+
+            data.emplace_back(static_cast<char>(name.size()));
+            data.insert(data.end(), name.begin(), name.end());
+        }
+
+        ext::BinaryOutputFile log(m_namesLogPath, ext::OutputMode::Append);
+        const std::size_t written = log.append(reinterpret_cast<const std::byte*>(data.data()), 1, data.size());
+        if (written != data.size())
+        {
+            throw std::runtime_error("Cannot write names to " + m_namesLogPath.string());
+        }
+        log.flush();
+    }
+
+    template <typename PackedGameHeaderT>
+    void IndexedGameHeaderStorage<PackedGameHeaderT>::addPlayer(FrontCodedDictionary::IdType id)
+    {
+        if (id / 64 >= m_players.size())
+        {
+            m_players.resize(id / 64 + 1, 0);
+        }
+
+        const std::uint64_t bit = std::uint64_t(1) << (id % 64);
+        if (!(m_players[id / 64] & bit))
+        {
+            m_players[id / 64] |= bit;
+            m_hasPendingPlayers = true;
+        }
+    }
+
+    template <typename PackedGameHeaderT>
+    void IndexedGameHeaderStorage<PackedGameHeaderT>::writePlayers(const std::filesystem::path& path) const
+    {
+        detail::replaceFile(path, m_players, "players");
+    }
+
+    template <typename PackedGameHeaderT>
+    [[nodiscard]] std::pmr::vector<PackedGameHeaderT> IndexedGameHeaderStorage<PackedGameHeaderT>::queryPackedByOffsets(const std::pmr::vector<std::uint64_t>& offsets)
+    {
+        // We don't know the sizes of the headers before reading them
+        // so we read the maximal size, clipped to the end of the file.
+        const std::size_t fileSize = m_header.size();
+        std::pmr::vector<std::uint64_t> ends(offsets.get_allocator());
+        ends.reserve(offsets.size());
+        for (auto&& offset : offsets)
+        {
+            ends.emplace_back(std::min<std::uint64_t>(offset + sizeof(PackedGameHeaderT), fileSize));
+        }
+
+        const auto reads = detail::readCoalesced(m_header, offsets, ends, maxCoalescedReadGap);
+
+        std::pmr::vector<PackedGameHeaderT> headers(offsets.get_allocator());
+        headers.reserve(offsets.size());
+        for (std::size_t i = 0; i < offsets.size(); ++i)
+        {
+            headers.emplace_back(reads.buffer.data() + reads.positions[i], ends[i] - offsets[i]);
+        }
+
+        return headers;
+    }
+
+    template <typename PackedGameHeaderT>
+    [[nodiscard]] std::pmr::vector<PackedGameHeaderT> IndexedGameHeaderStorage<PackedGameHeaderT>::queryCompactByOffsets(const std::pmr::vector<std::uint64_t>& offsets)
+    {
+        const std::size_t numKeys = offsets.size();
+
+        std::pmr::vector<std::uint64_t> ends(offsets.get_allocator());
+        ends.reserve(numKeys);
+        for (auto&& offset : offsets)
+        {
+            ends.emplace_back(offset + sizeof(CompactGameHeaderType));
+        }
+
+        const auto headerReads = detail::readCoalesced(m_header, offsets, ends, maxCoalescedReadGap);
+
+        std::pmr::vector<CompactGameHeaderType> compactHeaders(numKeys, offsets.get_allocator());
+        for (std::size_t i = 0; i < numKeys; ++i)
+        {
+            std::memcpy(&compactHeaders[i], headerReads.buffer.data() + headerReads.positions[i], sizeof(CompactGameHeaderType));
+        }
+
+        std::pmr::vector<PackedGameHeaderT> headers(offsets.get_allocator());
+        headers.reserve(numKeys);
+        for (auto&& header : compactHeaders)
+        {
+            headers.emplace_back(
+                header,
+                m_names.at(header.eventId()),
+                m_names.at(header.whiteId()),
+                m_names.at(header.blackId())
+            );
+        }
+
+        return headers;
+    }
+
     template <typename PackedGameHeaderT>
     [[nodiscard]] std::uint64_t IndexedGameHeaderStorage<PackedGameHeaderT>::nextId() const
     {
@@ -5,13 +5,19 @@
 #include "chess/Bcgn.h"
 #include "chess/Pgn.h"
 
+#include "data_structure/FrontCodedDictionary.h"
+
 #include "external_storage/External.h"
 
 #include "util/MemoryAmount.h"
 
 #include <cstdint>
 #include <filesystem>
+#include <memory_resource>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <vector>
 
 namespace persistence
 {
@@ -21,19 +27,45 @@ namespace persistence
         std::uint64_t index;
     };
 
+    enum struct HeaderLayout
+    {
+        // Whole PackedGameHeader objects are stored in the header file.
+        Packed,
+
+        // CompactGameHeader objects are stored in the header file
+        // and the strings are stored in the names dictionary file.
+        Compact
+    };
+
+    // Headers are always returned as PackedGameHeaderT objects,
+    // regardless of the layout used on disk. New storages use the
+    // compact layout. Storages that have a header file but no
+    // names file were created with the packed layout,
+    // and they continue using it.
     template <typename PackedGameHeaderT>
     struct IndexedGameHeaderStorage
     {
         using GameIndexType = typename PackedGameHeaderT::GameIndexType;
         using PackedGameHeaderType = PackedGameHeaderT;
+        using CompactGameHeaderType = CompactGameHeader<GameIndexType>;
 
         static inline const std::filesystem::path headerPath = "header";
         static inline const std::filesystem::path indexPath = "index";
+        static inline const std::filesystem::path namesPath = "names";
+        static inline const std::filesystem::path namesLogPath = "names_log";
+        static inline const std::filesystem::path playersPath = "players";
 
         static constexpr MemoryAmount defaultMemory = MemoryAmount::mebibytes(4);
         static constexpr MemoryAmount minMemory = MemoryAmount::kibibytes(1);
 
-        IndexedGameHeaderStorage(std::filesystem::path path, MemoryAmount memory = defaultMemory, std::string name = "");
+        // Headers that start at most this many bytes after the
+        // end of the previous one are fetched in the same read.
+        static constexpr std::size_t maxCoalescedReadGap = 4096;
+
+        // If indexPlayers is true and the storage is empty then the games
+        // of each player are indexed. This is only possible with the compact layout.
+        // Once the index exists it is maintained regardless of indexPlayers.
+        IndexedGameHeaderStorage(std::filesystem::path path, MemoryAmount memory = defaultMemory, std::string name = "", bool indexPlayers = false);
 
         IndexedGameHeaderStorage(const IndexedGameHeaderStorage&) = delete;
         IndexedGameHeaderStorage(IndexedGameHeaderStorage&&) noexcept = default;
@@ -56,20 +88,47 @@ namespace persistence
 
         void replicateTo(const std::filesystem::path& path) const;
 
-        [[nodiscard]] std::vector<PackedGameHeaderType> queryByOffsets(std::vector<std::uint64_t> offsets);
+        // The headers and all temporaries are allocated from the memory resource of the offsets.
+        [[nodiscard]] std::pmr::vector<PackedGameHeaderType> queryByOffsets(std::pmr::vector<std::uint64_t> offsets);
 
-        [[nodiscard]] std::vector<PackedGameHeaderType> queryByIndices(std::vector<std::uint64_t> keys);
+        // The headers and all temporaries are allocated from the memory resource of the keys.
+        [[nodiscard]] std::pmr::vector<PackedGameHeaderType> queryByIndices(std::pmr::vector<std::uint64_t> keys);
 
         [[nodiscard]] std::uint64_t numGames() const;
 
+        [[nodiscard]] HeaderLayout layout() const;
+
+        [[nodiscard]] bool hasPlayerIndex() const;
+
+        // Whether the name appeared as white or black in any header.
+        // Requires the player index.
+        [[nodiscard]] bool hasPlayer(std::string_view name) const;
+
     private:
         std::string m_name;
         std::filesystem::path m_path;
         std::filesystem::path m_headerPath;
         std::filesystem::path m_indexPath;
+        std::filesystem::path m_namesPath;
+        HeaderLayout m_layout;
         ext::Vector<char> m_header;
         ext::Vector<std::size_t> m_index;
 
+        // Only used with the compact layout. Event and player names.
+        // It is kept in memory whole. Names added since the names file
+        // was written are appended to the log on flush.
+        FrontCodedDictionary m_names;
+        std::filesystem::path m_namesLogPath;
+        std::size_t m_numNamesWritten;
+
+        // Only used with the compact layout, and only if enabled.
+        // One bit for each name id, set if the name is a player's.
+        // It is kept in memory whole and rewritten on flush.
+        std::filesystem::path m_playersPath;
+        bool m_hasPlayerIndex;
+        bool m_hasPendingPlayers;
+        std::vector<std::uint64_t> m_players;
+
         HeaderEntryLocation addHeader(const pgn::UnparsedGame& game, std::uint16_t plyCount);
         HeaderEntryLocation addHeader(const pgn::UnparsedGame& game);
         HeaderEntryLocation addHeader(const bcgn::UnparsedBcgnGame& game);
@@ -77,6 +136,22 @@ namespace persistence
 
         HeaderEntryLocation addHeader(const PackedGameHeaderType& entry);
 
+        void writeNames(const std::filesystem::path& path) const;
+
+        void readNamesLog();
+
+        void flushNames();
+
+        void appendNamesToLog(std::size_t firstId) const;
+
+        void addPlayer(FrontCodedDictionary::IdType id);
+
+        void writePlayers(const std::filesystem::path& path) const;
+
+        [[nodiscard]] std::pmr::vector<PackedGameHeaderType> queryPackedByOffsets(const std::pmr::vector<std::uint64_t>& offsets);
+
+        [[nodiscard]] std::pmr::vector<PackedGameHeaderType> queryCompactByOffsets(const std::pmr::vector<std::uint64_t>& offsets);
+
         [[nodiscard]] std::uint64_t nextId() const;
     };
 
@@ -1,17 +1,25 @@
 #pragma once
 
+#include "BlockCompressedEntries.h"
+#include "CountOverflowTable.h"
 #include "Database.h"
 #include "EntryConstructionParameters.h"
 #include "IndexedGameHeaderStorage.h"
+#include "PositionTable.h"
 #include "Query.h"
 
+#include "algorithm/MaskedMatch.h"
 #include "algorithm/Unsort.h"
 
 #include "chess/Bcgn.h"
 #include "chess/Chess.h"
+#include "chess/Date.h"
 #include "chess/GameClassification.h"
 #include "chess/Position.h"
 #include "chess/San.h"
+#include "chess/detail/ParserBits.h"
+
+#include "data_structure/BlockedBloomFilter.h"
 
 #include "enum/EnumArray.h"
 
@@ -23,14 +31,26 @@
 #include "Logger.h"
 
 #include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <execution>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace persistence
@@ -39,6 +59,22 @@ namespace persistence
     {
         namespace detail
         {
+            template <typename T>
+            struct HasEqualityMasks
+            {
+            private:
+                using Yes = char;
+                using No = Yes[2];
+
+                template<typename C> static constexpr auto Test(void*)
+                    -> decltype(C::equalWithReverseMoveMask, C::equalWithoutReverseMoveMask, Yes{});
+
+                template<typename> static constexpr No& Test(...);
+
+            public:
+                static constexpr bool value = sizeof(Test<T>(0)) == sizeof(Yes);
+            };
+
             template <typename T>
             struct HasEloDiff
             {
@@ -242,6 +278,280 @@ namespace persistence
                 using type = typename T::SmearedEntryType;
             };
 
+            // Entries with a count that may not fit have a marker value
+            // of the count meaning that it's in the count overflow table.
+            template<typename T, typename = void>
+            struct HasCountOverflow
+            {
+                static constexpr bool value = false;
+            };
+
+            template<typename T>
+            struct HasCountOverflow<T, void_t<decltype(T::overflowCount)>>
+            {
+                static constexpr bool value = true;
+            };
+
+            // All formats store the upper 64 bits of the zobrist key
+            // at the front of the hash. This is the part that identifies
+            // the position, regardless of the reverse move, level, and result.
+            template <typename KeyT>
+            [[nodiscard]] std::uint64_t positionHashOf(const KeyT& key)
+            {
+                const auto& hash = key.hash();
+                using HashPartType = std::decay_t<decltype(hash[0])>;
+
+                if constexpr (sizeof(HashPartType) == sizeof(std::uint64_t))
+                {
+                    return hash[0];
+                }
+                else
+                {
+                    static_assert(sizeof(HashPartType) == sizeof(std::uint32_t));
+
+                    return (static_cast<std::uint64_t>(hash[0]) << 32) | hash[1];
+                }
+            }
+
+            // How the range index of a data file is searched.
+            // Binary - plain binary search over the index entries.
+            // Model - binary search in a window predicted by a piecewise linear model.
+            // Eytzinger - branchless search over a copy of the range bounds in BFS order.
+            enum struct IndexSearch
+            {
+                Binary,
+                Model,
+                Eytzinger
+            };
+
+            [[nodiscard]] inline IndexSearch parseIndexSearch(const std::string& str)
+            {
+                if (str == "binary") return IndexSearch::Binary;
+                if (str == "model") return IndexSearch::Model;
+                if (str == "eytzinger") return IndexSearch::Eytzinger;
+
+                throw std::runtime_error("Invalid index search type: " + str);
+            }
+
+            // Range of months of the games that contributed entries to a data file,
+            // in months since year 0. Games with unknown year are only flagged.
+            // Used to skip whole files that can't match a month range filter.
+            struct MonthRange
+            {
+                std::uint32_t min = std::numeric_limits<std::uint32_t>::max();
+                std::uint32_t max = 0;
+                bool hasUnknown = false;
+
+                // The range assumed for files that don't have it stored.
+                [[nodiscard]] static MonthRange any()
+                {
+                    return { 0, std::numeric_limits<std::uint32_t>::max(), true };
+                }
+
+                [[nodiscard]] static MonthRange fromWords(const std::vector<std::uint32_t>& words)
+                {
+                    if (words.size() != 3)
+                    {
+                        return any();
+                    }
+
+                    return { words[0], words[1], words[2] != 0 };
+                }
+
+                [[nodiscard]] std::array<std::uint32_t, 3> toWords() const
+                {
+                    return { min, max, static_cast<std::uint32_t>(hasUnknown) };
+                }
+
+                // A known year with unknown month covers the whole year.
+                void add(const Date& date)
+                {
+                    if (date.year() == 0)
+                    {
+                        hasUnknown = true;
+                    }
+                    else if (date.month() == 0)
+                    {
+                        add(date.year() * 12u, date.year() * 12u + 11u);
+                    }
+                    else
+                    {
+                        const std::uint32_t month = date.monthSinceYear0();
+                        add(month, month);
+                    }
+                }
+
+                void add(std::uint32_t first, std::uint32_t last)
+                {
+                    min = std::min(min, first);
+                    max = std::max(max, last);
+                }
+
+                void add(const MonthRange& other)
+                {
+                    add(other.min, other.max);
+                    hasUnknown = hasUnknown || other.hasUnknown;
+                }
+
+                // No game with a known date was added.
+                [[nodiscard]] bool isEmpty() const
+                {
+                    return min > max;
+                }
+
+                [[nodiscard]] bool intersects(std::uint32_t first, std::uint32_t last, bool includeUnknown) const
+                {
+                    return (includeUnknown && hasUnknown) || (!isEmpty() && min <= last && first <= max);
+                }
+
+                // Whether all games are from the requested months.
+                [[nodiscard]] bool isWithin(std::uint32_t first, std::uint32_t last, bool includeUnknown) const
+                {
+                    return (isEmpty() || (first <= min && max <= last)) && (includeUnknown || !hasUnknown);
+                }
+            };
+
+            // A range of average elo of the players of a game. Games with unknown
+            // elo form a separate band. Each band has its own partition named
+            // after it, so the bands of an existing database don't depend
+            // on the current configuration.
+            struct EloBand
+            {
+                bool isUnknown;
+                std::uint16_t min;
+                std::uint16_t max;
+
+                [[nodiscard]] static EloBand unknown()
+                {
+                    return { true, 0, 0 };
+                }
+
+                // Bounds are the lowest elos of the bands, sorted.
+                // The first band always starts at 0.
+                [[nodiscard]] static EloBand of(std::uint16_t averageElo, const std::vector<std::uint16_t>& bounds)
+                {
+                    const auto it = std::upper_bound(bounds.begin(), bounds.end(), averageElo);
+                    const std::uint16_t min = it == bounds.begin() ? 0 : *std::prev(it);
+                    const std::uint16_t max = it == bounds.end() ? std::numeric_limits<std::uint16_t>::max() : *it - 1;
+                    return { false, min, max };
+                }
+
+                [[nodiscard]] static std::optional<EloBand> fromPartitionName(const std::string& name)
+                {
+                    constexpr std::string_view prefix = "elo_";
+
+                    if (name == unknown().partitionName())
+                    {
+                        return unknown();
+                    }
+
+                    if (name.rfind(prefix, 0) != 0)
+                    {
+                        return {};
+                    }
+
+                    const auto separator = name.find('_', prefix.size());
+                    if (separator == std::string::npos)
+                    {
+                        return {};
+                    }
+
+                    const auto min = parser_bits::tryParseUInt16(std::string_view(name).substr(prefix.size(), separator - prefix.size()));
+                    const auto max = parser_bits::tryParseUInt16(std::string_view(name).substr(separator + 1));
+                    if (!min.has_value() || !max.has_value() || *min > *max)
+                    {
+                        return {};
+                    }
+
+                    // The number parser doesn't reject non-digits.
+                    const EloBand band{ false, *min, *max };
+                    if (band.partitionName() != name)
+                    {
+                        return {};
+                    }
+
+                    return band;
+                }
+
+                [[nodiscard]] std::string partitionName() const
+                {
+                    if (isUnknown)
+                    {
+                        return "elo_unknown";
+                    }
+
+                    return "elo_" + std::to_string(min) + "_" + std::to_string(max);
+                }
+
+                [[nodiscard]] bool intersects(std::uint16_t first, std::uint16_t last, bool includeUnknown) const
+                {
+                    if (isUnknown)
+                    {
+                        return includeUnknown;
+                    }
+
+                    return min <= last && first <= max;
+                }
+
+                // Whether all games of the band pass the filter.
+                [[nodiscard]] bool isWithin(std::uint16_t first, std::uint16_t last, bool includeUnknown) const
+                {
+                    if (isUnknown)
+                    {
+                        return includeUnknown;
+                    }
+
+                    return first <= min && max <= last;
+                }
+
+                [[nodiscard]] friend bool operator==(const EloBand& lhs, const EloBand& rhs) noexcept
+                {
+                    return lhs.isUnknown == rhs.isUnknown && lhs.min == rhs.min && lhs.max == rhs.max;
+                }
+            };
+
+            [[nodiscard]] inline std::vector<std::uint16_t> normalizeEloBandBounds(std::vector<std::uint16_t> bounds)
+            {
+                std::sort(bounds.begin(), bounds.end());
+                bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+                return bounds;
+            }
+
+            // Shards hold consecutive ranges of position hashes of equal size,
+            // selected by the top 32 bits of the hash. With 2^k shards
+            // this is the same as selecting by the top k bits.
+            [[nodiscard]] inline std::size_t shardOfPositionHash(std::uint64_t hash, std::size_t numShards)
+            {
+                return static_cast<std::size_t>(((hash >> 32) * numShards) >> 32);
+            }
+
+            // Salt mixed into position hashes of the copies of entries stored
+            // for each player of a game, used by the player filter.
+            // It has to be stable across runs so it's derived only from the name
+            // (a FNV-1a hash of at most maxPlayerNameLength chars) and the color.
+            [[nodiscard]] inline ZobristKey playerSalt(std::string_view name, Color color)
+            {
+                constexpr std::size_t maxPlayerNameLength = 255;
+                constexpr std::uint64_t prime = 0x100000001b3ull;
+
+                std::uint64_t high = 0xcbf29ce484222325ull ^ ordinal(color);
+                std::uint64_t low = 0x84222325cbf29ce4ull ^ ordinal(color);
+                for (char c : name.substr(0, maxPlayerNameLength))
+                {
+                    high = (high ^ static_cast<unsigned char>(c)) * prime;
+                    low = (low ^ static_cast<unsigned char>(c)) * prime + high;
+                }
+
+                // FNV-1a mixes the last bytes poorly, finish with splitmix64.
+                auto mix = [](std::uint64_t x) {
+                    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+                    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+                    return x ^ (x >> 31);
+                };
+
+                return ZobristKey{ mix(high), mix(low) };
+            }
+
             template<typename T, bool HasHeadersV = false>
             struct GetGameIndexType
             {
@@ -282,6 +592,8 @@ namespace persistence
             static constexpr bool allowsFilteringByEloRange = detail::AllowsFilteringByEloRange<EntryType>::value;
             static constexpr bool allowsFilteringByMonthRange = detail::AllowsFilteringByMonthRange<EntryType>::value;
 
+            static constexpr bool hasCountOverflow = detail::HasCountOverflow<PersistedEntryType>::value;
+
             static constexpr bool needsElo = hasEloDiff || hasWhiteElo || hasBlackElo || allowsFilteringByEloRange;
 
             static constexpr bool needsDate = allowsFilteringByMonthRange;
@@ -297,6 +609,7 @@ namespace persistence
             static constexpr const char* name = TraitsT::name;
 
             static_assert(!(usesGameIndex && usesGameOffset), "Only one type of game reference can be used.");
+            static_assert(!(hasCountOverflow && hasSmearedEntry), "Smeared entries have unlimited counts.");
 
             using GameIndexType = typename detail::GetGameIndexType<EntryType>::type;
 
@@ -320,15 +633,79 @@ namespace persistence
             using KeyCompareLessWithoutReverseMove = typename KeyT::CompareLessWithoutReverseMove;
             using KeyCompareLessFull = typename KeyT::CompareLessFull;
 
-            using PositionStats = EnumArray<query::Select, EnumArray2<GameLevel, GameResult, EntryType>>;
-            using RetractionsStats = std::map<
+            // Statistics accumulated from entries. The count is summed separately
+            // in 64 bits, because the count of an entry may be in the count overflow
+            // table and the sum may not fit in the count of an entry.
+            struct AccumulatedEntry
+            {
+                AccumulatedEntry() :
+                    m_entry{},
+                    m_count(0)
+                {
+                }
+
+                void combine(const EntryType& entry, std::uint64_t count)
+                {
+                    if constexpr (hasCountOverflow)
+                    {
+                        // Don't let the overflow marker wrap the count of the entry.
+                        EntryType withoutCount = entry;
+                        withoutCount.setCount(0);
+                        m_entry.combine(withoutCount);
+                    }
+                    else
+                    {
+                        m_entry.combine(entry);
+                    }
+
+                    m_count += count;
+                }
+
+                void combine(const AccumulatedEntry& other)
+                {
+                    m_entry.combine(other.m_entry);
+                    m_count += other.m_count;
+                }
+
+                // Everything but the count, which is only valid through count().
+                [[nodiscard]] const EntryType& entry() const
+                {
+                    return m_entry;
+                }
+
+                [[nodiscard]] std::uint64_t count() const
+                {
+                    return m_count;
+                }
+
+            private:
+                EntryType m_entry;
+                std::uint64_t m_count;
+            };
+
+            using PositionStats = EnumArray<query::Select, EnumArray2<GameLevel, GameResult, AccumulatedEntry>>;
+            // Temporaries of a query are allocated from a per query arena.
+            using RetractionsStats = std::pmr::map<
                 ReverseMove,
-                EnumArray2<GameLevel, GameResult, EntryType>,
+                EnumArray2<GameLevel, GameResult, AccumulatedEntry>,
                 ReverseMoveCompareLess
             >;
 
+            using QueryKeys = std::pmr::vector<KeyT>;
+            using QueryPositionStats = std::pmr::vector<PositionStats>;
+            using QueryRetractionsStats = std::pmr::vector<RetractionsStats>;
+
             using Index = ext::RangeIndex<KeyT, typename PersistedEntryType::CompareLessWithoutReverseMove>;
 
+            using CountOverflowTableType = CountOverflowTable<KeyT>;
+            using CountOverflowRecordType = typename CountOverflowTableType::RecordType;
+
+            using Filter = BlockedBloomFilter;
+
+            static constexpr auto keyToArithmetic = [](const KeyT& key) {
+                return detail::positionHashOf(key);
+            };
+
             [[nodiscard]] static std::filesystem::path dataFilePathToIndexPath(const std::filesystem::path& dataFilePath)
             {
                 auto cpy = dataFilePath;
@@ -336,70 +713,685 @@ namespace persistence
                 return cpy;
             }
 
+            [[nodiscard]] static std::filesystem::path dataFilePathToIndexModelPath(const std::filesystem::path& dataFilePath)
+            {
+                auto cpy = dataFilePath;
+                cpy += "_index_model";
+                return cpy;
+            }
+
+            // Builds the auxiliary structure used by the configured index search.
+            static void prepareIndex(Index& index)
+            {
+                if (index.size() == 0)
+                {
+                    return;
+                }
+
+                switch (m_indexSearch)
+                {
+                case detail::IndexSearch::Model:
+                    if (m_indexModelMaxError != 0)
+                    {
+                        index.buildModel(m_indexModelMaxError, keyToArithmetic);
+                    }
+                    break;
+
+                case detail::IndexSearch::Eytzinger:
+                    index.buildEytzingerLayout();
+                    break;
+
+                case detail::IndexSearch::Binary:
+                    break;
+                }
+            }
+
+            // The index entries are memory mapped, so nothing is read
+            // until the OS pages in the parts that are accessed.
             [[nodiscard]] static auto readIndexOfDataFile(const std::filesystem::path& dataFilePath)
             {
                 auto indexPath = dataFilePathToIndexPath(dataFilePath);
-                return Index(ext::readFile<typename Index::EntryType>(indexPath));
+                auto modelPath = dataFilePathToIndexModelPath(dataFilePath);
+
+                Index index = ext::mapRangeIndex<KeyT, CompareLessWithoutReverseMove>(indexPath);
+                if (m_indexSearch == detail::IndexSearch::Model && std::filesystem::exists(modelPath))
+                {
+                    index.setModel(ext::PiecewiseLinearModel(ext::readFile<std::uint64_t>(modelPath)));
+                }
+                else
+                {
+                    // Older databases don't have the model persisted, but it's cheap to build.
+                    prepareIndex(index);
+                }
+
+                return index;
             }
 
             static void writeIndexOfDataFile(const std::filesystem::path& dataFilePath, const Index& index)
             {
                 auto indexPath = dataFilePathToIndexPath(dataFilePath);
-                (void)ext::writeFile<typename Index::EntryType>(indexPath, index.data(), index.size());
+                ext::writeRangeIndex(indexPath, index);
+
+                if (!index.model().empty())
+                {
+                    auto modelPath = dataFilePathToIndexModelPath(dataFilePath);
+                    const auto words = index.model().serialize();
+                    (void)ext::writeFile<std::uint64_t>(modelPath, words.data(), words.size());
+                }
             }
 
-            [[nodiscard]] static std::string fileIdToName(std::uint32_t id)
+            [[nodiscard]] static std::filesystem::path dataFilePathToFilterPath(const std::filesystem::path& dataFilePath)
             {
-                return std::to_string(id);
+                auto cpy = dataFilePath;
+                cpy += "_filter";
+                return cpy;
             }
 
-            [[nodiscard]] static std::filesystem::path pathOfDataFileWithId(const std::filesystem::path& directory, std::uint32_t id)
+            // Databases created before filters were introduced don't have them.
+            // In that case we return an empty filter which doesn't reject anything.
+            [[nodiscard]] static Filter readFilterOfDataFile(const std::filesystem::path& dataFilePath)
             {
-                return directory / fileIdToName(id);
+                auto filterPath = dataFilePathToFilterPath(dataFilePath);
+                if (!std::filesystem::exists(filterPath))
+                {
+                    return Filter{};
+                }
+
+                return Filter(ext::readFile<std::uint64_t>(filterPath));
             }
 
-            [[nodiscard]] static std::uint32_t fileNameToId(const std::string& s)
+            static void writeFilterOfDataFile(const std::filesystem::path& dataFilePath, const Filter& filter)
             {
-                return std::stoi(s);
+                auto filterPath = dataFilePathToFilterPath(dataFilePath);
+                (void)ext::writeFile<std::uint64_t>(filterPath, filter.data(), filter.size());
             }
 
-            [[nodiscard]] static std::uint32_t dataFilePathToId(const std::filesystem::path& dataFilePath)
+            [[nodiscard]] static std::filesystem::path dataFilePathToMonthRangePath(const std::filesystem::path& dataFilePath)
             {
-                return fileNameToId(dataFilePath.filename().string());
+                auto cpy = dataFilePath;
+                cpy += "_months";
+                return cpy;
             }
 
-            [[nodiscard]] static bool isPathOfIndex(const std::filesystem::path& path)
+            // Files created before month ranges were introduced may contain any month.
+            [[nodiscard]] static detail::MonthRange readMonthRangeOfDataFile(const std::filesystem::path& dataFilePath)
             {
-                return path.filename().string().find("index") != std::string::npos;
+                auto monthRangePath = dataFilePathToMonthRangePath(dataFilePath);
+                if (!std::filesystem::exists(monthRangePath))
+                {
+                    return detail::MonthRange::any();
+                }
+
+                return detail::MonthRange::fromWords(ext::readFile<std::uint32_t>(monthRangePath));
             }
 
-            [[nodiscard]] static auto makeFilter(const query::Request& query)
+            static void writeMonthRangeOfDataFile(const std::filesystem::path& dataFilePath, const detail::MonthRange& monthRange)
             {
-                const auto filter = query.filters.value_or(query::QueryFilters{});
+                auto monthRangePath = dataFilePathToMonthRangePath(dataFilePath);
+                const auto words = monthRange.toWords();
+                (void)ext::writeFile<std::uint32_t>(monthRangePath, words.data(), words.size());
+            }
 
-                // We use a default filter just so we have simpler logic.
-                // The predicate still always returns true because the original
-                // query doesn't have any filters.
-                const std::uint16_t minElo = filter.minElo.value_or(0);
-                const std::uint16_t maxElo = filter.maxElo.value_or(std::numeric_limits<std::uint16_t>::max());
-                const bool includeUnknownElo = filter.includeUnknownElo;
+            [[nodiscard]] static std::filesystem::path dataFilePathToBlockTablePath(const std::filesystem::path& dataFilePath)
+            {
+                auto cpy = dataFilePath;
+                cpy += "_blocks";
+                return cpy;
+            }
 
-                const std::uint32_t minMonth = filter.minMonthSinceYear0.value_or(0);
-                const std::uint32_t maxMonth = filter.minMonthSinceYear0.value_or(std::numeric_limits<std::uint32_t>::max());
-                const bool includeUnknownMonth = filter.includeUnknownMonth;
+            // Data files are block compressed if and only if they have a block table.
+            [[nodiscard]] static bool isDataFileBlockCompressed(const std::filesystem::path& dataFilePath)
+            {
+                return std::filesystem::exists(dataFilePathToBlockTablePath(dataFilePath));
+            }
 
-                return [
-                        hasFilters = query.filters.has_value(),
-                        minElo, maxElo, includeUnknownElo,
-                        minMonth, maxMonth, includeUnknownMonth
-                    ] (const PersistedEntryType& entry) {
+            [[nodiscard]] static BlockTable readBlockTableOfDataFile(const std::filesystem::path& dataFilePath)
+            {
+                auto blockTablePath = dataFilePathToBlockTablePath(dataFilePath);
+                return BlockTable::fromWords(ext::readFile<std::uint64_t>(blockTablePath));
+            }
 
-                    if (!hasFilters)
-                    {
-                        return true;
-                    }
+            static void writeBlockTable(const std::filesystem::path& blockTablePath, const BlockTable& blockTable)
+            {
+                const auto words = blockTable.toWords();
+                (void)ext::writeFile<std::uint64_t>(blockTablePath, words.data(), words.size());
+            }
 
-                    if constexpr (allowsFilteringByEloRange)
+            [[nodiscard]] static std::filesystem::path dataFilePathToCompressedTmpPath(const std::filesystem::path& dataFilePath)
+            {
+                auto cpy = dataFilePath;
+                cpy += "_blocks_tmp";
+                return cpy;
+            }
+
+            [[nodiscard]] static std::filesystem::path dataFilePathToBlockTableTmpPath(const std::filesystem::path& dataFilePath)
+            {
+                auto cpy = dataFilePath;
+                cpy += "_blocks_table_tmp";
+                return cpy;
+            }
+
+            // The compressed data and its table are written to temporary files first.
+            // The data is renamed over the data file before the table is renamed,
+            // so a raw data file never has a block table next to it.
+            // An interrupted replacement is finished or undone by recoverBlockTableOfDataFile.
+            static void replaceByCompressedDataFile(const std::filesystem::path& dataFilePath, const BlockTable& blockTable)
+            {
+                const auto blockTableTmpPath = dataFilePathToBlockTableTmpPath(dataFilePath);
+                writeBlockTable(blockTableTmpPath, blockTable);
+
+                std::filesystem::rename(dataFilePathToCompressedTmpPath(dataFilePath), dataFilePath);
+                std::filesystem::rename(blockTableTmpPath, dataFilePathToBlockTablePath(dataFilePath));
+            }
+
+            // Removes what is left from an interrupted replaceByCompressedDataFile.
+            // If the compressed data was already renamed then the table is renamed too.
+            // A block table that doesn't match the size of the data file
+            // can't describe it and is removed.
+            static void recoverBlockTableOfDataFile(const std::filesystem::path& dataFilePath)
+            {
+                const auto compressedTmpPath = dataFilePathToCompressedTmpPath(dataFilePath);
+                const auto blockTableTmpPath = dataFilePathToBlockTableTmpPath(dataFilePath);
+                const auto blockTablePath = dataFilePathToBlockTablePath(dataFilePath);
+                const auto dataSize = std::filesystem::file_size(dataFilePath);
+
+                if (std::filesystem::exists(blockTableTmpPath))
+                {
+                    const auto blockTable = BlockTable::fromWords(ext::readFile<std::uint64_t>(blockTableTmpPath));
+                    if (!std::filesystem::exists(compressedTmpPath) && blockTable.dataSize() == dataSize)
+                    {
+                        std::filesystem::rename(blockTableTmpPath, blockTablePath);
+                    }
+                    else
+                    {
+                        std::filesystem::remove(blockTableTmpPath);
+                    }
+                }
+
+                std::filesystem::remove(compressedTmpPath);
+
+                if (std::filesystem::exists(blockTablePath) && readBlockTableOfDataFile(dataFilePath).dataSize() != dataSize)
+                {
+                    Logger::instance().logWarning(": Removing the block table of ", dataFilePath, " because it doesn't match the data file.");
+                    std::filesystem::remove(blockTablePath);
+                }
+            }
+
+            // Writes the entries with one compressed block for each range of the index.
+            static void writeBlockCompressedDataFile(const std::filesystem::path& dataFilePath, const PersistedEntryType* entries, const Index& index)
+            {
+                BlockTable blockTable;
+
+                {
+                    BlockCompressedFileWriter<PersistedEntryType> writer(dataFilePathToCompressedTmpPath(dataFilePath));
+                    for (auto&& range : index)
+                    {
+                        writer.append(entries + range.low, range.high - range.low + 1);
+                    }
+                    blockTable = writer.end();
+                }
+
+                replaceByCompressedDataFile(dataFilePath, blockTable);
+            }
+
+            // Replaces an uncompressed data file by a block compressed one.
+            static void compressDataFile(const std::filesystem::path& dataFilePath, const Index& index)
+            {
+                BlockTable blockTable;
+
+                {
+                    ext::ImmutableSpan<PersistedEntryType> entries(ext::ImmutableBinaryFile(ext::Pooled{}, dataFilePath));
+                    BlockCompressedFileWriter<PersistedEntryType> writer(dataFilePathToCompressedTmpPath(dataFilePath));
+                    std::vector<PersistedEntryType> buffer;
+                    for (auto&& range : index)
+                    {
+                        buffer.resize(range.high - range.low + 1);
+                        (void)entries.read(buffer.data(), range.low, buffer.size());
+                        writer.append(buffer.data(), buffer.size());
+                    }
+                    blockTable = writer.end();
+                }
+
+                replaceByCompressedDataFile(dataFilePath, blockTable);
+            }
+
+            [[nodiscard]] static std::filesystem::path dataFilePathToPositionTablePath(const std::filesystem::path& dataFilePath)
+            {
+                auto cpy = dataFilePath;
+                cpy += "_positions";
+                return cpy;
+            }
+
+            // Only files created with verify_positions have position tables.
+            [[nodiscard]] static std::optional<PositionTable> readPositionTableOfDataFile(const std::filesystem::path& dataFilePath)
+            {
+                auto positionTablePath = dataFilePathToPositionTablePath(dataFilePath);
+                if (!std::filesystem::exists(positionTablePath))
+                {
+                    return std::nullopt;
+                }
+
+                return PositionTable(ext::ImmutableSpan<PositionRecord>(ext::ImmutableBinaryFile(ext::Pooled{}, positionTablePath)));
+            }
+
+            // The records must be sorted and distinct.
+            static void writePositionTableOfDataFile(const std::filesystem::path& dataFilePath, const std::vector<PositionRecord>& records)
+            {
+                PositionTableWriter writer(dataFilePathToPositionTablePath(dataFilePath));
+                writer.append(records);
+                writer.end();
+                logPositionTableCollisions(dataFilePath, writer);
+            }
+
+            static void logPositionTableCollisions(const std::filesystem::path& dataFilePath, const PositionTableWriter& writer)
+            {
+                if (writer.numCollisions() != 0)
+                {
+                    Logger::instance().logWarning(": ", writer.numCollisions(), " positions in ", dataFilePath, " have the same hash as another position in the file. Their statistics are combined.");
+                }
+            }
+
+            [[nodiscard]] static std::filesystem::path dataFilePathToCountOverflowTablePath(const std::filesystem::path& dataFilePath)
+            {
+                auto cpy = dataFilePath;
+                cpy += "_overflow";
+                return cpy;
+            }
+
+            // Only files with counts that don't fit in the entries have it.
+            [[nodiscard]] static CountOverflowTableType readCountOverflowTableOfDataFile(const std::filesystem::path& dataFilePath)
+            {
+                auto countOverflowTablePath = dataFilePathToCountOverflowTablePath(dataFilePath);
+                if (!std::filesystem::exists(countOverflowTablePath))
+                {
+                    return CountOverflowTableType{};
+                }
+
+                return CountOverflowTableType::fromWords(ext::readFile<std::uint32_t>(countOverflowTablePath));
+            }
+
+            static void writeCountOverflowTableOfDataFile(const std::filesystem::path& dataFilePath, const CountOverflowTableType& table)
+            {
+                if (table.empty())
+                {
+                    return;
+                }
+
+                auto countOverflowTablePath = dataFilePathToCountOverflowTablePath(dataFilePath);
+                const auto words = table.toWords();
+                (void)ext::writeFile<std::uint32_t>(countOverflowTablePath, words.data(), words.size());
+            }
+
+            // Removes the data file and all files accompanying it.
+            static void removeDataFile(const std::filesystem::path& dataFilePath)
+            {
+                std::filesystem::remove(dataFilePath);
+                std::filesystem::remove(dataFilePathToIndexPath(dataFilePath));
+                std::filesystem::remove(dataFilePathToIndexModelPath(dataFilePath));
+                std::filesystem::remove(dataFilePathToFilterPath(dataFilePath));
+                std::filesystem::remove(dataFilePathToMonthRangePath(dataFilePath));
+                std::filesystem::remove(dataFilePathToBlockTablePath(dataFilePath));
+                std::filesystem::remove(dataFilePathToPositionTablePath(dataFilePath));
+                std::filesystem::remove(dataFilePathToCountOverflowTablePath(dataFilePath));
+            }
+
+            // Renames the data file and all files accompanying it.
+            // Optional files are only renamed when present.
+            static void renameDataFile(const std::filesystem::path& from, const std::filesystem::path& to)
+            {
+                std::filesystem::rename(from, to);
+                std::filesystem::rename(dataFilePathToIndexPath(from), dataFilePathToIndexPath(to));
+
+                for (auto pathMapping : { dataFilePathToIndexModelPath, dataFilePathToFilterPath, dataFilePathToMonthRangePath, dataFilePathToBlockTablePath, dataFilePathToPositionTablePath, dataFilePathToCountOverflowTablePath })
+                {
+                    if (std::filesystem::exists(pathMapping(from)))
+                    {
+                        std::filesystem::rename(pathMapping(from), pathMapping(to));
+                    }
+                }
+            }
+
+            [[nodiscard]] static std::string fileIdToName(std::uint32_t id)
+            {
+                return std::to_string(id);
+            }
+
+            [[nodiscard]] static std::filesystem::path pathOfDataFileWithId(const std::filesystem::path& directory, std::uint32_t id)
+            {
+                return directory / fileIdToName(id);
+            }
+
+            [[nodiscard]] static std::uint32_t fileNameToId(const std::string& s)
+            {
+                return std::stoi(s);
+            }
+
+            [[nodiscard]] static std::uint32_t dataFilePathToId(const std::filesystem::path& dataFilePath)
+            {
+                return fileNameToId(dataFilePath.filename().string());
+            }
+
+            [[nodiscard]] static bool isPathOfIndex(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("index") != std::string::npos;
+            }
+
+            [[nodiscard]] static bool isPathOfFilter(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("filter") != std::string::npos;
+            }
+
+            [[nodiscard]] static bool isPathOfMonthRange(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("months") != std::string::npos;
+            }
+
+            [[nodiscard]] static bool isPathOfBlockTable(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("blocks") != std::string::npos;
+            }
+
+            [[nodiscard]] static bool isPathOfPositionTable(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("positions") != std::string::npos;
+            }
+
+            [[nodiscard]] static bool isPathOfCountOverflowTable(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("overflow") != std::string::npos;
+            }
+
+            // Uncompressed copy of a block compressed data file used while it is merged or converted.
+            // It is made in the partition directory when there are no temporary directories,
+            // so it must not be taken for a data file if it's left behind.
+            [[nodiscard]] static std::filesystem::path expandedDataFilePath(const std::filesystem::path& dir, const std::string& dataFileName)
+            {
+                return dir / (dataFileName + "_expanded");
+            }
+
+            [[nodiscard]] static bool isPathOfExpandedDataFile(const std::filesystem::path& path)
+            {
+                return path.filename().string().find("expanded") != std::string::npos;
+            }
+
+            // Which entries compare equal to a key with and without the reverse move.
+            // Bit i % 64 of word i / 64 corresponds to the i-th entry.
+            // Entry types that specify the masks of the compared bits
+            // are compared with SIMD, many at a time.
+            struct EntryMatches
+            {
+                explicit EntryMatches(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) :
+                    m_withReverseMove(resource),
+                    m_withoutReverseMove(resource),
+                    m_runStarts(resource)
+                {
+                }
+
+                void compute(const std::pmr::vector<PersistedEntryType>& entries, const KeyT& key)
+                {
+                    const std::size_t numWords = MaskedMatch128::numWordsFor(entries.size());
+                    m_withReverseMove.resize(numWords);
+                    m_withoutReverseMove.resize(numWords);
+
+                    if constexpr (detail::HasEqualityMasks<PersistedEntryType>::value)
+                    {
+                        static_assert(sizeof(PersistedEntryType) >= sizeof(MaskedMatch128::Words));
+                        static_assert(std::is_trivially_copyable_v<KeyT>);
+
+                        MaskedMatch128::Words keyWords{};
+                        std::memcpy(keyWords.data(), &key, std::min(sizeof(KeyT), sizeof(keyWords)));
+
+                        const MaskedMatch128 match(
+                            keyWords,
+                            PersistedEntryType::equalWithReverseMoveMask,
+                            PersistedEntryType::equalWithoutReverseMoveMask
+                        );
+
+                        match(
+                            entries.data(),
+                            entries.size(),
+                            sizeof(PersistedEntryType),
+                            m_withReverseMove.data(),
+                            m_withoutReverseMove.data()
+                        );
+                    }
+                    else
+                    {
+                        std::fill(m_withReverseMove.begin(), m_withReverseMove.end(), 0);
+                        std::fill(m_withoutReverseMove.begin(), m_withoutReverseMove.end(), 0);
+
+                        for (std::size_t i = 0; i < entries.size(); ++i)
+                        {
+                            const std::uint64_t bit = std::uint64_t(1) << (i % 64);
+
+                            if (CompareEqualWithReverseMove{}(entries[i], key))
+                            {
+                                m_withReverseMove[i / 64] |= bit;
+                            }
+
+                            if (CompareEqualWithoutReverseMove{}(entries[i], key))
+                            {
+                                m_withoutReverseMove[i / 64] |= bit;
+                            }
+                        }
+                    }
+                }
+
+                // The same for entries given as columns of 32 bit words, word w of entry i
+                // is columns[w * columnStride + i]. Only the first four words are needed.
+                // Only available for entry types that specify the masks of the compared bits.
+                template <typename T = PersistedEntryType, typename = std::enable_if_t<detail::HasEqualityMasks<T>::value>>
+                void computeFromColumns(const std::uint32_t* columns, std::size_t columnStride, std::size_t count, const KeyT& key)
+                {
+                    static_assert(std::is_trivially_copyable_v<KeyT>);
+
+                    const std::size_t numWords = MaskedMatch128::numWordsFor(count);
+                    m_withReverseMove.resize(numWords);
+                    m_withoutReverseMove.resize(numWords);
+
+                    MaskedMatch128::Words keyWords{};
+                    std::memcpy(keyWords.data(), &key, std::min(sizeof(KeyT), sizeof(keyWords)));
+
+                    const MaskedMatch128 match(
+                        keyWords,
+                        T::equalWithReverseMoveMask,
+                        T::equalWithoutReverseMoveMask
+                    );
+
+                    match.matchColumns(
+                        columns,
+                        columnStride,
+                        count,
+                        m_withReverseMove.data(),
+                        m_withoutReverseMove.data()
+                    );
+                }
+
+                // Whether any entry in [begin, end) is equal to the key without the reverse move.
+                [[nodiscard]] bool anyMatch(std::size_t begin, std::size_t end) const
+                {
+                    for (std::size_t i = begin; i < end;)
+                    {
+                        const std::size_t w = i / 64;
+                        const std::size_t n = std::min<std::size_t>(64 - i % 64, end - i);
+                        const std::uint64_t mask = (n == 64 ? ~std::uint64_t(0) : ((std::uint64_t(1) << n) - 1)) << (i % 64);
+                        if (m_withoutReverseMove[w] & mask)
+                        {
+                            return true;
+                        }
+
+                        i += n;
+                    }
+
+                    return false;
+                }
+
+                // Calls func with the index of each entry belonging
+                // to the given select, in increasing order.
+                template <typename FuncT>
+                void forEach(query::Select select, FuncT&& func) const
+                {
+                    for (std::size_t w = 0; w < m_withReverseMove.size(); ++w)
+                    {
+                        std::uint64_t bits = 0;
+                        switch (select)
+                        {
+                        case query::Select::Continuations:
+                            bits = m_withReverseMove[w];
+                            break;
+
+                        case query::Select::Transpositions:
+                            bits = m_withoutReverseMove[w] & ~m_withReverseMove[w];
+                            break;
+
+                        case query::Select::All:
+                            bits = m_withoutReverseMove[w];
+                            break;
+                        }
+
+                        while (bits)
+                        {
+                            func(w * 64 + intrin::lsb(bits));
+                            bits &= bits - 1;
+                        }
+                    }
+                }
+
+                // Calls func with the index of each entry that is equal to the
+                // key without the reverse move, in increasing order, and whether
+                // it's also equal with the reverse move (it's a continuation).
+                template <typename FuncT>
+                void forEachMatch(FuncT&& func) const
+                {
+                    for (std::size_t w = 0; w < m_withoutReverseMove.size(); ++w)
+                    {
+                        std::uint64_t bits = m_withoutReverseMove[w];
+                        while (bits)
+                        {
+                            const auto bit = intrin::lsb(bits);
+                            func(w * 64 + bit, static_cast<bool>((m_withReverseMove[w] >> bit) & 1));
+                            bits &= bits - 1;
+                        }
+                    }
+                }
+
+                // Marks the matching smeared entries that start an unsmeared entry.
+                // The smeared entries of one unsmeared entry all have the same key,
+                // so they form a run of consecutive matches.
+                // Only for smeared entries, it's a template so that it's not
+                // instantiated with the explicitly instantiated databases.
+                template <typename SmearedEntryT>
+                void computeRunStarts(const std::pmr::vector<SmearedEntryT>& entries)
+                {
+                    m_runStarts.resize(m_withoutReverseMove.size());
+                    for (std::size_t w = 0; w < m_withoutReverseMove.size(); ++w)
+                    {
+                        std::uint64_t runStarts = 0;
+                        std::uint64_t bits = m_withoutReverseMove[w];
+                        while (bits)
+                        {
+                            const auto bit = intrin::lsb(bits);
+                            runStarts |= static_cast<std::uint64_t>(entries[w * 64 + bit].isFirst()) << bit;
+                            bits &= bits - 1;
+                        }
+                        m_runStarts[w] = runStarts;
+                    }
+                }
+
+                // Calls func with the bounds [begin, end) of each run of matches
+                // computed by computeRunStarts, in increasing order, and whether
+                // it's a continuation. Matches before the first run start are skipped,
+                // they belong to an unsmeared entry that was not read in whole.
+                template <typename FuncT>
+                void forEachRun(FuncT&& func) const
+                {
+                    ASSERT(m_runStarts.size() == m_withoutReverseMove.size());
+
+                    const std::size_t numWords = m_withoutReverseMove.size();
+                    for (std::size_t w = 0; w < numWords; ++w)
+                    {
+                        std::uint64_t starts = m_runStarts[w];
+                        while (starts)
+                        {
+                            const auto bit = intrin::lsb(starts);
+                            starts &= starts - 1;
+
+                            // The run ends at the next entry that doesn't
+                            // match or starts another run.
+                            const std::size_t begin = w * 64 + bit;
+                            std::size_t endWord = w;
+                            std::uint64_t boundaries = (~m_withoutReverseMove[w] | m_runStarts[w]) & ~((std::uint64_t(2) << bit) - 1);
+                            while (!boundaries && ++endWord < numWords)
+                            {
+                                boundaries = ~m_withoutReverseMove[endWord] | m_runStarts[endWord];
+                            }
+
+                            const std::size_t end = boundaries ? endWord * 64 + intrin::lsb(boundaries) : numWords * 64;
+                            func(begin, end, static_cast<bool>((m_withReverseMove[w] >> bit) & 1));
+                        }
+                    }
+                }
+
+            private:
+                std::pmr::vector<std::uint64_t> m_withReverseMove;
+                std::pmr::vector<std::uint64_t> m_withoutReverseMove;
+
+                // Only for smeared entries.
+                std::pmr::vector<std::uint64_t> m_runStarts;
+            };
+
+            // Reused for all files searched by a query.
+            struct QueryBuffers
+            {
+                explicit QueryBuffers(std::pmr::memory_resource* resource) :
+                    entries(resource),
+                    blocks(resource),
+                    columns(resource),
+                    decoders(resource),
+                    matches(resource)
+                {
+                }
+
+                std::pmr::vector<PersistedEntryType> entries;
+
+                // Compressed blocks read from block compressed files.
+                std::pmr::vector<std::byte> blocks;
+                bit::BitStream<> bits;
+
+                // Entries of blocks decoded as columns.
+                std::pmr::vector<std::uint32_t> columns;
+                std::pmr::vector<typename EntryBlockCodec<PersistedEntryType>::ColumnDecoder> decoders;
+
+                EntryMatches matches;
+            };
+
+            [[nodiscard]] static auto makeFilter(const query::Request& query)
+            {
+                const auto filter = query.filters.value_or(query::QueryFilters{});
+
+                // We use a default filter just so we have simpler logic.
+                // The predicate still always returns true because the original
+                // query doesn't have any filters.
+                const std::uint16_t minElo = filter.minElo.value_or(0);
+                const std::uint16_t maxElo = filter.maxElo.value_or(std::numeric_limits<std::uint16_t>::max());
+                const bool includeUnknownElo = filter.includeUnknownElo;
+
+                const std::uint32_t minMonth = filter.minMonthSinceYear0.value_or(0);
+                const std::uint32_t maxMonth = filter.maxMonthSinceYear0.value_or(std::numeric_limits<std::uint32_t>::max());
+                const bool includeUnknownMonth = filter.includeUnknownMonth;
+
+                return [
+                        hasFilters = query.filters.has_value(),
+                        minElo, maxElo, includeUnknownElo,
+                        minMonth, maxMonth, includeUnknownMonth
+                    ] (const PersistedEntryType& entry) {
+
+                    if (!hasFilters)
+                    {
+                        return true;
+                    }
+
+                    if constexpr (allowsFilteringByEloRange)
                     {
                         if (!entry.isInEloRange(minElo, maxElo, includeUnknownElo))
                         {
@@ -435,6 +1427,134 @@ namespace persistence
 
             static inline std::size_t m_indexGranularity = cfg::g_config["persistence"][name]["index_granularity"].get<std::size_t>();
             static inline MemoryAmount m_mergeWriterBufferSize = cfg::g_config["persistence"][name]["merge_writer_buffer_size"].get<MemoryAmount>();
+            static inline detail::IndexSearch m_indexSearch = detail::parseIndexSearch(cfg::g_config["persistence"][name]["index_search"].get<std::string>());
+            static inline std::size_t m_indexModelMaxError = cfg::g_config["persistence"][name]["index_model_max_error"].get<std::size_t>();
+            static inline std::size_t m_filterBitsPerKey = cfg::g_config["persistence"][name]["filter_bits_per_key"].get<std::size_t>();
+            static inline bool m_compressDataFiles = cfg::g_config["persistence"][name]["compress_data_files"].get<bool>();
+            static inline bool m_verifyPositions = cfg::g_config["persistence"][name]["verify_positions"].get<bool>();
+
+            // Builds a filter over position hashes of entries appended in order.
+            // Entries for the same position are adjacent so each position
+            // is inserted only once, which keeps numKeys() exact.
+            struct FilterBuilder
+            {
+                FilterBuilder(std::size_t expectedNumKeys) :
+                    m_filter(m_filterBitsPerKey > 0 ? Filter(expectedNumKeys, m_filterBitsPerKey) : Filter{}),
+                    m_lastHash{},
+                    m_isEmpty(true)
+                {
+                }
+
+                void append(const PersistedEntryType& entry)
+                {
+                    if (m_filterBitsPerKey == 0)
+                    {
+                        return;
+                    }
+
+                    const std::uint64_t hash = detail::positionHashOf(entry.key());
+                    if (m_isEmpty || hash != m_lastHash)
+                    {
+                        m_filter.insert(hash);
+                        m_lastHash = hash;
+                        m_isEmpty = false;
+                    }
+                }
+
+                // Writes the filter next to the data file if filters are enabled.
+                void end(const std::filesystem::path& dataFilePath)
+                {
+                    if (m_filterBitsPerKey == 0)
+                    {
+                        return;
+                    }
+
+                    writeFilterOfDataFile(dataFilePath, m_filter);
+                }
+
+            private:
+                Filter m_filter;
+                std::uint64_t m_lastHash;
+                bool m_isEmpty;
+            };
+
+            // Sums the counts of equal entries when they are combined.
+            // The table has the sum of the overflowed counts of all combined files,
+            // so it's added once for a key, on the first entry with an overflowed count.
+            // Does nothing for formats without count overflow.
+            struct CountAccumulator
+            {
+                explicit CountAccumulator(const CountOverflowTableType& countOverflows) :
+                    m_countOverflows(&countOverflows),
+                    m_count(0),
+                    m_hasOverflowedCount(false)
+                {
+                }
+
+                void start(const PersistedEntryType& entry)
+                {
+                    m_count = 0;
+                    m_hasOverflowedCount = false;
+                    add(entry);
+                }
+
+                void add(const PersistedEntryType& entry)
+                {
+                    if constexpr (hasCountOverflow)
+                    {
+                        if (!entry.hasOverflowedCount())
+                        {
+                            m_count += entry.count();
+                        }
+                        else if (!m_hasOverflowedCount)
+                        {
+                            m_count += m_countOverflows->count(entry.key());
+                            m_hasOverflowedCount = true;
+                        }
+                    }
+                }
+
+                [[nodiscard]] std::uint64_t count() const
+                {
+                    return m_count;
+                }
+
+            private:
+                const CountOverflowTableType* m_countOverflows;
+                std::uint64_t m_count;
+                bool m_hasOverflowedCount;
+            };
+
+            // Sets the counts of entries appended in order, the ones that don't fit
+            // in the entry are marked as overflowed and go to the count overflow table.
+            // Does nothing for formats without count overflow.
+            struct CountOverflowTableBuilder
+            {
+                void append(PersistedEntryType& entry, const CountAccumulator& counts)
+                {
+                    if constexpr (hasCountOverflow)
+                    {
+                        if (counts.count() >= PersistedEntryType::overflowCount)
+                        {
+                            entry.setCount(PersistedEntryType::overflowCount);
+                            m_records.push_back(CountOverflowRecordType{ entry.key(), counts.count() });
+                        }
+                        else
+                        {
+                            entry.setCount(static_cast<std::remove_cv_t<decltype(PersistedEntryType::overflowCount)>>(counts.count()));
+                        }
+                    }
+                }
+
+                // Writes the table next to the data file if any count overflowed.
+                void end(const std::filesystem::path& dataFilePath)
+                {
+                    writeCountOverflowTableOfDataFile(dataFilePath, CountOverflowTableType(std::move(m_records)));
+                }
+
+            private:
+                std::vector<CountOverflowRecordType> m_records;
+            };
 
             struct File
             {
@@ -445,30 +1565,26 @@ namespace persistence
                 File& operator=(File&&) noexcept = default;
 
                 File(std::filesystem::path path) :
-                    m_entries({ ext::Pooled{}, std::move(path) }),
+                    m_file(ext::Pooled{}, std::move(path)),
                     m_index{makeIndexGetter()},
-                    m_id(dataFilePathToId(m_entries.path()))
-                {
-                }
-
-                File(ext::ImmutableSpan<PersistedEntryType>&& entries) :
-                    m_entries(std::move(entries)),
-                    m_index{makeIndexGetter()},
-                    m_id(dataFilePathToId(m_entries.path()))
+                    m_filter{makeFilterGetter()},
+                    m_monthRange{makeMonthRangeGetter()},
+                    m_positionTable{makePositionTableGetter()},
+                    m_countOverflowTable{makeCountOverflowTableGetter()},
+                    m_blockTable(readBlockTable()),
+                    m_id(dataFilePathToId(m_file.path()))
                 {
                 }
 
                 File(std::filesystem::path path, Index&& index) :
-                    m_entries({ ext::Pooled{}, std::move(path) }),
-                    m_index(std::move(index)),
-                    m_id(dataFilePathToId(m_entries.path()))
-                {
-                }
-
-                File(ext::ImmutableSpan<PersistedEntryType>&& entries, Index&& index) :
-                    m_entries(std::move(entries)),
+                    m_file(ext::Pooled{}, std::move(path)),
                     m_index(std::move(index)),
-                    m_id(dataFilePathToId(m_entries.path()))
+                    m_filter{makeFilterGetter()},
+                    m_monthRange{makeMonthRangeGetter()},
+                    m_positionTable{makePositionTableGetter()},
+                    m_countOverflowTable{makeCountOverflowTableGetter()},
+                    m_blockTable(readBlockTable()),
+                    m_id(dataFilePathToId(m_file.path()))
                 {
                 }
 
@@ -489,173 +1605,457 @@ namespace persistence
 
                 [[nodiscard]] MergableFile mergableInfo() const
                 {
-                    return { name(), m_entries.size_bytes() };
+                    return { name(), m_file.size() };
                 }
 
                 [[nodiscard]] const std::filesystem::path& path() const
                 {
-                    return m_entries.path();
+                    return m_file.path();
                 }
 
-                [[nodiscard]] PersistedEntryType at(std::size_t idx) const
+                [[nodiscard]] bool isBlockCompressed() const
                 {
-                    return m_entries[idx];
+                    return m_blockTable.has_value();
+                }
+
+                // Only for files that are not block compressed.
+                [[nodiscard]] ext::ImmutableSpan<PersistedEntryType> entries() const
+                {
+                    ASSERT(!isBlockCompressed());
+
+                    return ext::ImmutableSpan<PersistedEntryType>(m_file);
+                }
+
+                [[nodiscard]] std::size_t numEntries() const
+                {
+                    if (isBlockCompressed())
+                    {
+                        return static_cast<std::size_t>(m_blockTable->numEntries);
+                    }
+
+                    return m_file.size() / sizeof(PersistedEntryType);
+                }
+
+                // The size of the entries when not compressed.
+                [[nodiscard]] std::size_t uncompressedSize() const
+                {
+                    return numEntries() * sizeof(PersistedEntryType);
+                }
+
+                // Writes the entries of a block compressed file uncompressed,
+                // so that they can be merged.
+                void expandTo(const std::filesystem::path& outFilePath) const
+                {
+                    ASSERT(isBlockCompressed());
+
+                    ext::BinaryOutputFile outFile(outFilePath);
+                    std::vector<std::byte> block;
+                    std::vector<PersistedEntryType> entries;
+                    bit::BitStream<> bits;
+                    for (auto&& range : *m_index)
+                    {
+                        const std::size_t i = &range - m_index->begin();
+                        const std::size_t offset = static_cast<std::size_t>(m_blockTable->offsets[i]);
+                        block.resize(static_cast<std::size_t>(m_blockTable->offsets[i + 1]) - offset);
+                        (void)m_file.read(block.data(), offset, 1, block.size());
+
+                        entries.resize(range.high - range.low + 1);
+                        EntryBlockCodec<PersistedEntryType>::decode(block.data(), block.size(), entries.size(), entries.data(), bits);
+                        (void)outFile.append(reinterpret_cast<const std::byte*>(entries.data()), sizeof(PersistedEntryType), entries.size());
+                    }
+                }
+
+                [[nodiscard]] const detail::MonthRange& monthRange() const
+                {
+                    return *m_monthRange;
+                }
+
+                // Whether the month filter selects either all or none of the games
+                // of this file. Otherwise games from other months are counted too.
+                [[nodiscard]] bool matchesMonthFilterExactly(const query::Request& query) const
+                {
+                    if (!mayMatchMonthFilter(query))
+                    {
+                        return true;
+                    }
+
+                    const auto& filters = *query.filters;
+                    return m_monthRange->isWithin(
+                        filters.minMonthSinceYear0.value_or(0),
+                        filters.maxMonthSinceYear0.value_or(std::numeric_limits<std::uint32_t>::max()),
+                        filters.includeUnknownMonth
+                    );
                 }
 
-                [[nodiscard]] const ext::ImmutableSpan<PersistedEntryType>& entries() const
+                [[nodiscard]] const std::optional<PositionTable>& positionTable() const
                 {
-                    return m_entries;
+                    return *m_positionTable;
                 }
 
+                [[nodiscard]] const CountOverflowTableType& countOverflowTable() const
+                {
+                    return *m_countOverflowTable;
+                }
+
+                // An upper bound on the number of distinct positions in this file.
+                [[nodiscard]] std::size_t maxNumPositions() const
+                {
+                    if (m_filter->numBlocks() == 0)
+                    {
+                        return numEntries();
+                    }
+
+                    return m_filter->numKeys();
+                }
+
+                // Only the queries [begin, end) are executed.
+                // If retractionsStats is not empty then retractions of root
+                // positions are accumulated from the same entries.
                 void executeQuery(
                     const query::Request& query,
-                    const std::vector<KeyT>& keys,
+                    const QueryKeys& keys,
                     const query::PositionQueries& queries,
-                    std::vector<PositionStats>& stats
+                    QueryPositionStats& stats,
+                    QueryRetractionsStats& retractionsStats,
+                    QueryBuffers& buffers,
+                    std::size_t begin,
+                    std::size_t end
                 )
                 {
                     ASSERT(queries.size() == stats.size());
                     ASSERT(queries.size() == keys.size());
+                    ASSERT(retractionsStats.empty() || queries.size() == retractionsStats.size());
+                    ASSERT(begin <= end && end <= queries.size());
 
-                    std::vector<PersistedEntryType> buffer;
-                    for (std::size_t i = 0; i < queries.size(); ++i)
+                    if (!mayMatchMonthFilter(query))
+                    {
+                        return; // no game in this file is from the requested months
+                    }
+
+                    auto& buffer = buffers.entries;
+                    auto& matches = buffers.matches;
+                    for (std::size_t i = begin; i < end; ++i)
                     {
                         auto& key = keys[i];
-                        auto [a, b] = m_index->equal_range(key);
+                        if (!m_filter->mayContain(detail::positionHashOf(key)))
+                        {
+                            continue; // the filter guarantees that the position is not in this file
+                        }
 
-                        const std::size_t count = b.it - a.it;
-                        if (count == 0) continue; // the range is empty, the value certainly does not exist
+                        if (m_verifyPositions && !mayContainPosition(key, queries[i].position))
+                        {
+                            continue; // the entries with this hash are of other positions
+                        }
 
-                        buffer.resize(count);
-                        (void)m_entries.read(buffer.data(), a.it, count);
-                        accumulateStatsFromEntries(buffer, query, key, queries[i].origin, stats[i]);
-                    }
-                }
+                        if (isBlockCompressed())
+                        {
+                            const auto [first, last] = m_index->rangePositions(key, keyToArithmetic);
+                            if (first == last) continue; // the range is empty, the value certainly does not exist
 
-                void queryRetractions(
-                    const query::Request& query,
-                    const Position& pos,
-                    RetractionsStats& retractionsStats
-                )
-                {
-                    const auto key = KeyT(PositionWithZobrist(pos));
-                    auto [a, b] = m_index->equal_range(key);
+                            if (!readMatchingBlocks(first, last, key, buffers)) continue; // no entry of the blocks matches
+                        }
+                        else
+                        {
+                            auto [a, b] = m_index->equal_range(key, keyToArithmetic);
 
-                    const std::size_t count = b.it - a.it;
-                    if (count == 0) return; // the range is empty, the value certainly does not exist
+                            const std::size_t count = b.it - a.it;
+                            if (count == 0) continue; // the range is empty, the value certainly does not exist
 
-                    std::vector<PersistedEntryType> buffer(count);
-                    (void)m_entries.read(buffer.data(), a.it, count);
-                    accumulateRetractionsStatsFromEntries(buffer, query, pos, key, retractionsStats);
+                            buffer.resize(count);
+                            (void)entries().read(buffer.data(), a.it, count);
+                            matches.compute(buffer, key);
+                        }
+
+                        if constexpr (hasSmearedEntry)
+                        {
+                            matches.computeRunStarts(buffer);
+                        }
+
+                        accumulateStatsFromEntries(buffer, matches, query, queries[i].origin, stats[i]);
+
+                        // Retractions only depend on entries equal without the reverse move,
+                        // and these were all read for the root key.
+                        if (!retractionsStats.empty() && queries[i].origin == query::PositionQueryOrigin::Root)
+                        {
+                            accumulateRetractionsStatsFromEntries(buffer, matches, query, queries[i].position, retractionsStats[i]);
+                        }
+                    }
                 }
 
             private:
-                ext::ImmutableSpan<PersistedEntryType> m_entries;
+                ext::ImmutableBinaryFile m_file;
                 util::LazyCached<Index> m_index;
+                util::LazyCached<Filter> m_filter;
+                util::LazyCached<detail::MonthRange> m_monthRange;
+                util::LazyCached<std::optional<PositionTable>> m_positionTable;
+                util::LazyCached<CountOverflowTableType> m_countOverflowTable;
+                std::optional<BlockTable> m_blockTable;
                 std::uint32_t m_id;
 
-                auto makeIndexGetter() const
-                {
-                    return [path = m_entries.path()]() -> Index{
-                        return readIndexOfDataFile(path);
-                    };
+                auto makeIndexGetter() const
+                {
+                    return [path = m_file.path()]() -> Index{
+                        return readIndexOfDataFile(path);
+                    };
+                }
+
+                auto makeFilterGetter() const
+                {
+                    return [path = m_file.path()]() -> Filter{
+                        return readFilterOfDataFile(path);
+                    };
+                }
+
+                auto makeMonthRangeGetter() const
+                {
+                    return [path = m_file.path()]() -> detail::MonthRange{
+                        return readMonthRangeOfDataFile(path);
+                    };
+                }
+
+                auto makePositionTableGetter() const
+                {
+                    return [path = m_file.path()]() -> std::optional<PositionTable>{
+                        return readPositionTableOfDataFile(path);
+                    };
+                }
+
+                auto makeCountOverflowTableGetter() const
+                {
+                    return [path = m_file.path()]() -> CountOverflowTableType{
+                        return readCountOverflowTableOfDataFile(path);
+                    };
+                }
+
+                // The table is only read when an entry with an overflowed count is found.
+                // Not for smeared entries, it's a template so that it's not
+                // instantiated with the explicitly instantiated databases.
+                template <typename NonSmearedEntryT>
+                [[nodiscard]] std::uint64_t countOf(const NonSmearedEntryT& entry) const
+                {
+                    if constexpr (hasCountOverflow)
+                    {
+                        if (entry.hasOverflowedCount())
+                        {
+                            return m_countOverflowTable->count(entry.key());
+                        }
+                    }
+
+                    return entry.count();
+                }
+
+                // Files without a position table may contain any position.
+                [[nodiscard]] bool mayContainPosition(const KeyT& key, const Position& position) const
+                {
+                    const auto& positionTable = *m_positionTable;
+                    return !positionTable.has_value() || positionTable->contains(detail::positionHashOf(key), position.compress());
+                }
+
+                [[nodiscard]] std::optional<BlockTable> readBlockTable() const
+                {
+                    if (!isDataFileBlockCompressed(m_file.path()))
+                    {
+                        return std::nullopt;
+                    }
+
+                    return readBlockTableOfDataFile(m_file.path());
+                }
+
+                // Reads the blocks [first, last) into buffers.entries and computes
+                // the matches of the key. Returns whether there are any.
+                // Blocks correspond to the ranges of the index.
+                // When entries can be matched by masks the blocks are decoded into
+                // columns, the leading columns are matched first, only blocks
+                // with matches are decoded further, and only matching entries
+                // are put together. Other entries are left unspecified.
+                [[nodiscard]] bool readMatchingBlocks(std::size_t first, std::size_t last, const KeyT& key, QueryBuffers& buffers) const
+                {
+                    using Codec = EntryBlockCodec<PersistedEntryType>;
+
+                    const auto* ranges = m_index->begin();
+                    const std::size_t low = ranges[first].low;
+                    const std::size_t high = ranges[last - 1].high + 1;
+
+                    const auto& offsets = m_blockTable->offsets;
+                    const std::size_t begin = static_cast<std::size_t>(offsets[first]);
+                    const std::size_t end = static_cast<std::size_t>(offsets[last]);
+
+                    auto& blocks = buffers.blocks;
+                    blocks.resize(end - begin);
+                    (void)m_file.read(blocks.data(), begin, 1, blocks.size());
+
+                    auto& entries = buffers.entries;
+                    entries.resize(high - low);
+
+                    auto blockData = [&](std::size_t i) {
+                        return blocks.data() + (static_cast<std::size_t>(offsets[i]) - begin);
+                    };
+                    auto blockSize = [&](std::size_t i) {
+                        return static_cast<std::size_t>(offsets[i + 1] - offsets[i]);
+                    };
+                    auto blockCount = [&](std::size_t i) {
+                        return ranges[i].high - ranges[i].low + 1;
+                    };
+
+                    if constexpr (detail::HasEqualityMasks<PersistedEntryType>::value)
+                    {
+                        constexpr std::size_t numKeyColumns = std::tuple_size_v<MaskedMatch128::Words>;
+
+                        const std::size_t columnStride = high - low;
+                        auto& columns = buffers.columns;
+                        columns.resize(Codec::numColumns * columnStride);
+
+                        auto& decoders = buffers.decoders;
+                        decoders.clear();
+                        for (std::size_t i = first; i < last; ++i)
+                        {
+                            auto& decoder = decoders.emplace_back(blockData(i), blockSize(i), blockCount(i));
+                            decoder.decodeColumns(numKeyColumns, columns.data() + (ranges[i].low - low), columnStride, buffers.bits);
+                        }
+
+                        buffers.matches.computeFromColumns(columns.data(), columnStride, columnStride, key);
+
+                        bool anyMatch = false;
+                        for (std::size_t i = first; i < last; ++i)
+                        {
+                            if (!buffers.matches.anyMatch(ranges[i].low - low, ranges[i].high + 1 - low))
+                            {
+                                continue;
+                            }
+
+                            decoders[i - first].decodeColumns(Codec::numColumns - numKeyColumns, columns.data() + (ranges[i].low - low), columnStride, buffers.bits);
+                            anyMatch = true;
+                        }
+
+                        buffers.matches.forEachMatch([&](std::size_t i, bool) {
+                            entries[i] = Codec::entryFromColumns(columns.data(), columnStride, i);
+                            });
+
+                        return anyMatch;
+                    }
+                    else
+                    {
+                        for (std::size_t i = first; i < last; ++i)
+                        {
+                            Codec::decode(blockData(i), blockSize(i), blockCount(i), entries.data() + (ranges[i].low - low), buffers.bits);
+                        }
+
+                        buffers.matches.compute(entries, key);
+                        return true;
+                    }
+                }
+
+                // Only looks at the month range if the filter restricts months,
+                // otherwise games with unknown dates would be skipped.
+                [[nodiscard]] bool mayMatchMonthFilter(const query::Request& query) const
+                {
+                    if (!query.filters.has_value())
+                    {
+                        return true;
+                    }
+
+                    const auto& filters = *query.filters;
+                    if (!filters.minMonthSinceYear0.has_value() && !filters.maxMonthSinceYear0.has_value())
+                    {
+                        return true;
+                    }
+
+                    return m_monthRange->intersects(
+                        filters.minMonthSinceYear0.value_or(0),
+                        filters.maxMonthSinceYear0.value_or(std::numeric_limits<std::uint32_t>::max()),
+                        filters.includeUnknownMonth
+                    );
                 }
 
                 void accumulateStatsFromEntries(
-                    const std::vector<PersistedEntryType>& entries,
+                    const std::pmr::vector<PersistedEntryType>& entries,
+                    const EntryMatches& matches,
                     const query::Request& query,
-                    const KeyT& key,
                     query::PositionQueryOrigin origin,
                     PositionStats& stats
                 )
                 {
-                    auto filter = makeFilter(query);
-
+                    EnumArray<query::Select, bool> isRequested{};
+                    bool anyRequested = false;
                     for (auto&& [select, fetch] : query.fetchingOptions)
                     {
-                        auto&& statsForThisSelect = stats[select];
-
                         if (origin == query::PositionQueryOrigin::Child && !fetch.fetchChildren)
                         {
                             continue;
                         }
 
-                        if constexpr (hasSmearedEntry)
-                        {
-                            EntryType unsmeared{};
-                            bool first = true;
-                            std::uint32_t nextPos = 0;
+                        isRequested[select] = true;
+                        anyRequested = true;
+                    }
+
+                    if (!anyRequested)
+                    {
+                        return;
+                    }
+
+                    auto filter = makeFilter(query);
 
-                            for (auto&& entry : entries)
+                    // Each matching entry is visited once and added to all requested
+                    // selects it belongs to. Every entry is either a continuation
+                    // or a transposition, and always belongs to All.
+                    if constexpr (hasSmearedEntry)
+                    {
+                        // All smeared entries of a run have the same key, level, and result.
+                        matches.forEachRun([&](std::size_t begin, std::size_t end, bool isContinuation) {
+                            auto&& entry = entries[begin];
+                            if (!filter(entry))
                             {
-                                if (
-                                    (
-                                        (select == query::Select::Continuations && CompareEqualWithReverseMove{}(entry, key))
-                                        || (select == query::Select::Transpositions && CompareEqualWithoutReverseMove{}(entry, key) && !CompareEqualWithReverseMove{}(entry, key))
-                                        || (select == query::Select::All && CompareEqualWithoutReverseMove{}(entry, key))
-                                    )
-                                    && filter(entry)
-                                   )
-                                {
-                                    if (entry.isFirst())
-                                    {
-                                        if (first)
-                                        {
-                                            // nothing was read yet
-                                            first = false;
-                                        }
-                                        else
-                                        {
-                                            const auto level = unsmeared.level();
-                                            const auto result = unsmeared.result();
-                                            statsForThisSelect[level][result].combine(unsmeared);
-                                        }
+                                return;
+                            }
 
-                                        unsmeared = EntryType(entry);
-                                        nextPos = 1;
-                                    }
-                                    else
-                                    {
-                                        unsmeared.add(entry, nextPos++);
-                                    }
-                                }
+                            const EntryType unsmeared(entries.data() + begin, end - begin);
+                            const GameLevel level = unsmeared.level();
+                            const GameResult result = unsmeared.result();
+
+                            const auto select = isContinuation ? query::Select::Continuations : query::Select::Transpositions;
+                            if (isRequested[select])
+                            {
+                                stats[select][level][result].combine(unsmeared, unsmeared.count());
                             }
 
-                            if (!first)
+                            if (isRequested[query::Select::All])
                             {
-                                const auto level = unsmeared.level();
-                                const auto result = unsmeared.result();
-                                statsForThisSelect[level][result].combine(unsmeared);
+                                stats[query::Select::All][level][result].combine(unsmeared, unsmeared.count());
                             }
-                        }
-                        else
-                        {
-                            for (auto&& entry : entries)
+                            });
+                    }
+                    else
+                    {
+                        matches.forEachMatch([&](std::size_t i, bool isContinuation) {
+                            auto&& entry = entries[i];
+                            if (!filter(entry))
                             {
-                                const GameLevel level = entry.level();
-                                const GameResult result = entry.result();
+                                return;
+                            }
 
-                                if (
-                                    (
-                                        (select == query::Select::Continuations && CompareEqualWithReverseMove{}(entry, key))
-                                        || (select == query::Select::Transpositions && CompareEqualWithoutReverseMove{}(entry, key) && !CompareEqualWithReverseMove{}(entry, key))
-                                        || (select == query::Select::All && CompareEqualWithoutReverseMove{}(entry, key))
-                                    )
-                                    && filter(entry)
-                                   )
-                                {
-                                    statsForThisSelect[level][result].combine(entry);
-                                }
+                            const GameLevel level = entry.level();
+                            const GameResult result = entry.result();
+                            const std::uint64_t count = countOf(entry);
+
+                            const auto select = isContinuation ? query::Select::Continuations : query::Select::Transpositions;
+                            if (isRequested[select])
+                            {
+                                stats[select][level][result].combine(entry, count);
                             }
-                        }
+
+                            if (isRequested[query::Select::All])
+                            {
+                                stats[query::Select::All][level][result].combine(entry, count);
+                            }
+                            });
                     }
                 }
 
                 void accumulateRetractionsStatsFromEntries(
-                    const std::vector<PersistedEntryType>& entries,
+                    const std::pmr::vector<PersistedEntryType>& entries,
+                    const EntryMatches& matches,
                     const query::Request& query,
                     const Position& pos,
-                    const KeyT& key,
                     RetractionsStats& retractionsStats
                 )
                 {
@@ -665,68 +2065,30 @@ namespace persistence
 
                         if constexpr (hasSmearedEntry)
                         {
-                            EntryType unsmeared{};
-                            bool first = true;
-                            std::uint32_t nextPos = 0;
-
-                            for (auto&& entry : entries)
-                            {
-                                if (
-                                    !CompareEqualWithoutReverseMove{}(entry, key)
-                                    || !filter(entry)
-                                    )
+                            matches.forEachRun([&](std::size_t begin, std::size_t end, bool) {
+                                auto&& entry = entries[begin];
+                                if (!filter(entry))
                                 {
-                                    continue;
+                                    return;
                                 }
 
                                 const ReverseMove rmove = entry.reverseMove(pos);
                                 if (rmove.isNull())
                                 {
-                                    continue;
-                                }
-
-                                if (entry.isFirst())
-                                {
-                                    if (first)
-                                    {
-                                        // nothing was read yet
-                                        first = false;
-                                    }
-                                    else
-                                    {
-                                        const auto level = unsmeared.level();
-                                        const auto result = unsmeared.result();
-                                        const auto rmove = unsmeared.reverseMove(pos);
-                                        retractionsStats[rmove][level][result].combine(unsmeared);
-                                    }
-
-                                    unsmeared = EntryType(entry);
-                                    nextPos = 1;
-                                }
-                                else
-                                {
-                                    unsmeared.add(entry, nextPos++);
+                                    return;
                                 }
-                            }
 
-                            if (!first)
-                            {
-                                const auto level = unsmeared.level();
-                                const auto result = unsmeared.result();
-                                const auto rmove = unsmeared.reverseMove(pos);
-                                retractionsStats[rmove][level][result].combine(unsmeared);
-                            }
+                                const EntryType unsmeared(entries.data() + begin, end - begin);
+                                retractionsStats[rmove][unsmeared.level()][unsmeared.result()].combine(unsmeared, unsmeared.count());
+                                });
                         }
                         else
                         {
-                            for (auto&& entry : entries)
-                            {
-                                if (
-                                    !CompareEqualWithoutReverseMove{}(entry, key)
-                                    || !filter(entry)
-                                    )
+                            matches.forEachMatch([&](std::size_t i, bool) {
+                                auto&& entry = entries[i];
+                                if (!filter(entry))
                                 {
-                                    continue;
+                                    return;
                                 }
 
                                 const GameLevel level = entry.level();
@@ -735,11 +2097,11 @@ namespace persistence
 
                                 if (rmove.isNull())
                                 {
-                                    continue;
+                                    return;
                                 }
 
-                                retractionsStats[rmove][level][result].combine(entry);
-                            }
+                                retractionsStats[rmove][level][result].combine(entry, countOf(entry));
+                                });
                         }
                     }
                 }
@@ -781,15 +2143,19 @@ namespace persistence
             private:
                 struct Job
                 {
-                    Job(std::filesystem::path path, std::vector<PersistedEntryType>&& buffer, std::promise<Index>&& promise) :
+                    Job(std::filesystem::path path, std::vector<PersistedEntryType>&& buffer, std::vector<PositionRecord>&& positions, std::promise<Index>&& promise) :
                         path(std::move(path)),
                         buffer(std::move(buffer)),
+                        positions(std::move(positions)),
                         promise(std::move(promise))
                     {
                     }
 
                     std::filesystem::path path;
                     std::vector<PersistedEntryType> buffer;
+                    // Empty if positions are not verified.
+                    std::vector<PositionRecord> positions;
+                    CountOverflowTableBuilder countOverflowBuilder;
                     std::promise<Index> promise;
                 };
 
@@ -821,13 +2187,13 @@ namespace persistence
                     waitForCompletion();
                 }
 
-                [[nodiscard]] std::future<Index> scheduleUnordered(const std::filesystem::path& path, std::vector<PersistedEntryType>&& elements)
+                [[nodiscard]] std::future<Index> scheduleUnordered(const std::filesystem::path& path, std::vector<PersistedEntryType>&& elements, std::vector<PositionRecord>&& positions)
                 {
                     std::unique_lock<std::mutex> lock(m_mutex);
 
                     std::promise<Index> promise;
                     std::future<Index> future = promise.get_future();
-                    m_sortQueue.emplace(path, std::move(elements), std::move(promise));
+                    m_sortQueue.emplace(path, std::move(elements), std::move(positions), std::move(promise));
 
                     lock.unlock();
                     m_sortQueueNotEmpty.notify_one();
@@ -902,7 +2268,8 @@ namespace persistence
 
                         lock.unlock();
 
-                        prepareData(job.buffer);
+                        prepareData(job.buffer, job.countOverflowBuilder);
+                        sortDistinctPositionRecords(job.positions);
 
                         lock.lock();
                         m_writeQueue.emplace(std::move(job));
@@ -931,13 +2298,41 @@ namespace persistence
 
                         lock.unlock();
 
+                        if (!job.positions.empty())
+                        {
+                            writePositionTableOfDataFile(job.path, job.positions);
+                            job.positions = {};
+                        }
+
                         Index index = ext::makeIndex(job.buffer, m_indexGranularity, CompareLessWithoutReverseMove{}, [](const PersistedEntryType& entry) {
                             return entry.key();
                             });
+                        prepareIndex(index);
                         writeIndexOfDataFile(job.path, index);
-                        job.promise.set_value(std::move(index));
 
-                        (void)ext::writeFile(job.path, job.buffer.data(), job.buffer.size());
+                        // The buffer is sorted so we know the number of distinct positions
+                        // before building the filter.
+                        FilterBuilder filterBuilder(countDistinctPositions(job.buffer));
+                        for (auto&& entry : job.buffer)
+                        {
+                            filterBuilder.append(entry);
+                        }
+                        filterBuilder.end(job.path);
+                        job.countOverflowBuilder.end(job.path);
+
+                        if (m_compressDataFiles)
+                        {
+                            // The file is opened with the block table read when the
+                            // index is received, so it has to be written before that.
+                            writeBlockCompressedDataFile(job.path, job.buffer.data(), index);
+                            job.promise.set_value(std::move(index));
+                        }
+                        else
+                        {
+                            job.promise.set_value(std::move(index));
+
+                            (void)ext::writeFile(job.path, job.buffer.data(), job.buffer.size());
+                        }
 
                         job.buffer.clear();
 
@@ -949,6 +2344,22 @@ namespace persistence
                     }
                 }
 
+                [[nodiscard]] static std::size_t countDistinctPositions(const std::vector<PersistedEntryType>& buffer)
+                {
+                    std::size_t count = 0;
+                    std::uint64_t lastHash = 0;
+                    for (auto&& entry : buffer)
+                    {
+                        const std::uint64_t hash = detail::positionHashOf(entry.key());
+                        if (count == 0 || hash != lastHash)
+                        {
+                            ++count;
+                            lastHash = hash;
+                        }
+                    }
+                    return count;
+                }
+
                 void sort(std::vector<PersistedEntryType>& buffer)
                 {
                     auto cmp = CompareLessFull{};
@@ -956,7 +2367,7 @@ namespace persistence
                 }
 
                 // works analogously to std::unique but also combines equal values
-                void combine(std::vector<PersistedEntryType>& buffer)
+                void combine(std::vector<PersistedEntryType>& buffer, CountOverflowTableBuilder& countOverflowBuilder)
                 {
                     if (buffer.empty()) return;
 
@@ -980,8 +2391,9 @@ namespace persistence
                             const auto& nextSmeared = *read++;
                             if (cmp(nextSmeared, lastSmeared))
                             {
-                                // same
-                                accumulator.add(nextSmeared, 0);
+                                // same, entries of new games are not smeared yet
+                                // so each of them is a whole run
+                                accumulator.combine(EntryType(&nextSmeared, 1));
                             }
                             else
                             {
@@ -1009,26 +2421,40 @@ namespace persistence
                     }
                     else
                     {
+                        // Entries of new games don't have overflowed counts.
+                        const CountOverflowTableType noCountOverflows{};
+                        CountAccumulator counts(noCountOverflows);
+                        counts.start(*write);
+
                         while (++read != end)
                         {
                             if (cmp(*write, *read))
                             {
                                 write->combine(*read);
+                                counts.add(*read);
                             }
-                            else if (++write != read) // we don't want to copy onto itself
+                            else
                             {
-                                *write = *read;
+                                countOverflowBuilder.append(*write, counts);
+                                counts.start(*read);
+
+                                if (++write != read) // we don't want to copy onto itself
+                                {
+                                    *write = *read;
+                                }
                             }
                         }
 
+                        countOverflowBuilder.append(*write, counts);
+
                         buffer.erase(std::next(write), buffer.end());
                     }
                 }
 
-                void prepareData(std::vector<PersistedEntryType>& buffer)
+                void prepareData(std::vector<PersistedEntryType>& buffer, CountOverflowTableBuilder& countOverflowBuilder)
                 {
                     sort(buffer);
-                    combine(buffer);
+                    combine(buffer, countOverflowBuilder);
                 }
             };
 
@@ -1049,29 +2475,25 @@ namespace persistence
 
                 void executeQuery(
                     const query::Request& query,
-                    const std::vector<KeyT>& keys,
+                    const QueryKeys& keys,
                     const query::PositionQueries& queries,
-                    std::vector<PositionStats>& stats)
+                    QueryPositionStats& stats,
+                    QueryRetractionsStats& retractionsStats,
+                    QueryBuffers& buffers,
+                    std::size_t begin,
+                    std::size_t end)
                 {
                     for (auto&& file : m_files)
                     {
-                        file->executeQuery(query, keys, queries, stats);
+                        file->executeQuery(query, keys, queries, stats, retractionsStats, buffers, begin, end);
                     }
                 }
 
-                [[nodiscard]] RetractionsStats queryRetractions(
-                    const query::Request& query,
-                    const Position& pos
-                )
+                [[nodiscard]] bool matchesMonthFilterExactly(const query::Request& query) const
                 {
-                    RetractionsStats retractionsStats;
-
-                    for (auto&& file : m_files)
-                    {
-                        file->queryRetractions(query, pos, retractionsStats);
-                    }
-
-                    return retractionsStats;
+                    return std::all_of(m_files.begin(), m_files.end(), [&query](auto&& file) {
+                        return file->matchesMonthFilterExactly(query);
+                        });
                 }
 
                 void mergeAll(
@@ -1128,11 +2550,11 @@ namespace persistence
 
                 // Uses the passed id.
                 // It is required that the file with this id doesn't exist already.
-                void storeUnordered(AsyncStorePipeline& pipeline, std::vector<PersistedEntryType>&& entries)
+                void storeUnordered(AsyncStorePipeline& pipeline, std::vector<PersistedEntryType>&& entries, std::vector<PositionRecord>&& positions, const detail::MonthRange& monthRange)
                 {
                     ASSERT(!m_path.empty());
 
-                    addFutureFile(pipeline, std::move(entries));
+                    addFutureFile(pipeline, std::move(entries), std::move(positions), monthRange);
                 }
 
                 void collectFutureFiles()
@@ -1158,10 +2580,7 @@ namespace persistence
                         auto path = m_files.back()->path();
                         m_files.pop_back();
 
-                        std::filesystem::remove(path);
-
-                        auto indexPath = dataFilePathToIndexPath(path);
-                        std::filesystem::remove(indexPath);
+                        removeDataFile(path);
                     }
                 }
 
@@ -1170,6 +2589,76 @@ namespace persistence
                     return m_files.empty() && m_futureFiles.empty();
                 }
 
+                template <typename FuncT>
+                void forEachFile(FuncT&& func) const
+                {
+                    for (auto&& file : m_files)
+                    {
+                        func(static_cast<const File&>(*file));
+                    }
+                }
+
+                // Writes the entries of a data file of another format, converted
+                // with the constructor of PersistedEntryType, to a file with the same id.
+                // It is required that the file with this id doesn't exist already.
+                template <typename SourceEntryT, typename SourceFileT>
+                void convertFile(const SourceFileT& file, const std::vector<std::filesystem::path>& temporaryDirs)
+                {
+                    ASSERT(!m_path.empty());
+
+                    const auto outFilePath = pathOfDataFileWithId(m_path, file.id());
+
+                    // Block compressed files are converted from uncompressed copies.
+                    std::filesystem::path expandedPath;
+                    if (file.isBlockCompressed())
+                    {
+                        const auto expandDir = temporaryDirs.empty() ? m_path : temporaryDirs[0];
+                        expandedPath = expandedDataFilePath(expandDir, file.name());
+                        file.expandTo(expandedPath);
+                    }
+
+                    // Formats with count overflow are only converted from formats
+                    // of the same kind, with keys that can be converted.
+                    CountOverflowTableType countOverflows;
+                    if constexpr (hasCountOverflow)
+                    {
+                        std::vector<CountOverflowRecordType> records;
+                        for (auto&& record : file.countOverflowTable().records())
+                        {
+                            records.push_back(CountOverflowRecordType{ KeyT(record.key), record.count });
+                        }
+                        countOverflows = CountOverflowTableType(std::move(records));
+                    }
+
+                    Index index = convertEntriesIntoFile(
+                        expandedPath.empty()
+                            ? file.entries()
+                            : ext::ImmutableSpan<SourceEntryT>(ext::ImmutableBinaryFile(ext::Pooled{}, expandedPath)),
+                        countOverflows,
+                        outFilePath,
+                        file.maxNumPositions()
+                    );
+
+                    if (!expandedPath.empty())
+                    {
+                        std::filesystem::remove(expandedPath);
+                    }
+
+                    writeMonthRangeOfDataFile(outFilePath, file.monthRange());
+
+                    if (m_verifyPositions && file.positionTable().has_value())
+                    {
+                        convertPositionTableIntoFile(*file.positionTable(), outFilePath);
+                    }
+
+                    if (m_compressDataFiles)
+                    {
+                        compressDataFile(outFilePath, index);
+                    }
+
+                    addFile(std::make_unique<File>(outFilePath, std::move(index)));
+                }
+
             private:
                 std::filesystem::path m_path;
                 std::vector<std::unique_ptr<File>> m_files;
@@ -1240,12 +2729,57 @@ namespace persistence
                         return entry.key();
                     };
                     ext::IndexBuilder<PersistedEntryType, CompareLessWithoutReverseMove, decltype(extractKey)> ib(m_indexGranularity, {}, extractKey);
+
+                    // The merged file can't have more positions than the inputs combined.
+                    // It has to be computed before the input files are possibly removed.
+                    std::size_t maxNumPositions = 0;
+                    for (auto&& file : files)
+                    {
+                        maxNumPositions += file->maxNumPositions();
+                    }
+                    FilterBuilder filterBuilder(maxNumPositions);
+
+                    detail::MonthRange monthRange{};
+                    for (auto&& file : files)
+                    {
+                        monthRange.add(file->monthRange());
+                    }
+
+                    CountOverflowTableType countOverflows;
+                    if constexpr (hasCountOverflow)
+                    {
+                        for (auto&& file : files)
+                        {
+                            countOverflows.add(file->countOverflowTable());
+                        }
+                    }
+                    CountAccumulator counts(countOverflows);
+                    CountOverflowTableBuilder countOverflowBuilder;
+
+                    if (m_verifyPositions)
+                    {
+                        mergePositionTablesIntoFile(files, outFilePath);
+                    }
+
+                    // Block compressed files are merged from uncompressed copies.
+                    std::vector<std::filesystem::path> expandedFilesPaths;
                     {
                         std::vector<ext::ImmutableSpan<PersistedEntryType>> spans;
                         spans.reserve(files.size());
                         for (auto&& file : files)
                         {
-                            spans.emplace_back(file->entries());
+                            if (file->isBlockCompressed())
+                            {
+                                const auto expandDir = temporaryDirs.empty() ? outFilePath.parent_path() : temporaryDirs[0];
+                                std::filesystem::path expandedPath = expandedDataFilePath(expandDir, file->name());
+                                file->expandTo(expandedPath);
+                                spans.emplace_back(ext::ImmutableBinaryFile(ext::Pooled{}, expandedPath));
+                                expandedFilesPaths.emplace_back(std::move(expandedPath));
+                            }
+                            else
+                            {
+                                spans.emplace_back(file->entries());
+                            }
                         }
 
                         const std::size_t totalFileSize = ext::bytesInSpans(spans);
@@ -1257,56 +2791,33 @@ namespace persistence
                             ext::BackInserter<PersistedEntryType> out(outFile, util::DoubleBuffer<PersistedEntryType>(outBufferSize));
 
                             bool first = true;
-                            auto accumulator = []() {
-                                if constexpr (hasSmearedEntry) return EntryType{};
-                                else return PersistedEntryType{};
-                            }();
+                            PersistedEntryType accumulator{};
                             auto append = [&]() {
                                 if constexpr (hasSmearedEntry)
                                 {
-                                    return[
+                                    // The merge is stable so the smeared entries of an unsmeared
+                                    // entry stay together. Unsmeared entries of different files
+                                    // are not combined, so the smeared entries are written
+                                    // as they are, without decoding them.
+                                    return [
                                         &ib,
-                                        &out,
-                                        &accumulator,
-                                        &first,
-                                        lastSmeared = PersistedEntryType{}, 
-                                        nextPos = 0,
-                                        cmp = CompareEqualFull{}
-                                    ](const PersistedEntryType& nextSmeared) mutable {
-                                        if (nextSmeared.isFirst())
-                                        {
-                                            if (first)
-                                            {
-                                                // we have nothing to write yet
-                                                // accumulator is empty
-                                                first = false;
-                                            }
-                                            else
-                                            {
-                                                for (auto e : accumulator)
-                                                {
-                                                    out.emplace(e);
-                                                    ib.append(&e, 1);
-                                                }
-                                            }
-                                            accumulator = EntryType(nextSmeared);
-                                            lastSmeared = nextSmeared;
-                                            nextPos = 1;
-                                        }
-                                        else /* if (cmp(lastSmeared, entry)) */ // we know that they are equal because an entry with isFirst() always starts a new key
-                                        {
-                                            ASSERT(nextPos != 0);
-
-                                            accumulator.add(nextSmeared, nextPos++);
-                                        }
+                                        &filterBuilder,
+                                        &out
+                                    ](const PersistedEntryType& smeared) {
+                                        out.emplace(smeared);
+                                        ib.append(&smeared, 1);
+                                        filterBuilder.append(smeared);
                                     };
                                 }
                                 else
                                 {
                                     return [
                                         &ib,
+                                        &filterBuilder,
+                                        &countOverflowBuilder,
                                         &out, 
                                         &accumulator,
+                                        &counts,
                                         &first,
                                         cmp = CompareEqualFull{}
                                     ](const PersistedEntryType& entry) mutable {
@@ -1314,16 +2825,21 @@ namespace persistence
                                         {
                                             first = false;
                                             accumulator = entry;
+                                            counts.start(entry);
                                         }
                                         else if (cmp(accumulator, entry))
                                         {
                                             accumulator.combine(entry);
+                                            counts.add(entry);
                                         }
                                         else
                                         {
+                                            countOverflowBuilder.append(accumulator, counts);
                                             out.emplace(accumulator);
                                             ib.append(&accumulator, 1);
+                                            filterBuilder.append(accumulator);
                                             accumulator = entry;
+                                            counts.start(entry);
                                         }
                                     };
                                 }
@@ -1341,12 +2857,12 @@ namespace persistence
                                 const std::filesystem::path copyDestinationDir = plan.passes[0].readDir;
                                 std::vector<std::filesystem::path> copiedFilesPaths;
                                 copiedFilesPaths.reserve(files.size());
-                                for (auto&& file : files)
+                                for (std::size_t i = 0; i < files.size(); ++i)
                                 {
-                                    const std::size_t size = file->entries().size_bytes();
+                                    const std::size_t size = spans[i].size_bytes();
 
-                                    std::filesystem::path destinationPath = copyDestinationDir / file->path().filename();
-                                    std::filesystem::copy_file(file->path(), destinationPath);
+                                    std::filesystem::path destinationPath = copyDestinationDir / files[i]->path().filename();
+                                    std::filesystem::copy_file(spans[i].path(), destinationPath);
                                     copiedFilesPaths.emplace_back(std::move(destinationPath));
 
                                     internalProgress.workDone += size;
@@ -1432,29 +2948,174 @@ namespace persistence
                                 }
                             }
 
-                            if (!first) // if we did anything, ie. accumulator holds something from merge
+                            if constexpr (!hasSmearedEntry)
                             {
-                                if constexpr (hasSmearedEntry)
+                                if (!first) // if we did anything, ie. accumulator holds something from merge
                                 {
-                                    for (auto e : accumulator)
-                                    {
-                                        out.emplace(e);
-                                        ib.append(&e, 1);
-                                    }
+                                    countOverflowBuilder.append(accumulator, counts);
+                                    out.emplace(accumulator);
+                                    ib.append(&accumulator, 1);
+                                    filterBuilder.append(accumulator);
+                                }
+                            }
+                        }
+                    }
+
+                    for (auto&& path : expandedFilesPaths)
+                    {
+                        std::filesystem::remove(path);
+                    }
+
+                    Index index = ib.end();
+                    prepareIndex(index);
+                    writeIndexOfDataFile(outFilePath, index);
+                    filterBuilder.end(outFilePath);
+                    countOverflowBuilder.end(outFilePath);
+                    writeMonthRangeOfDataFile(outFilePath, monthRange);
+
+                    if (m_compressDataFiles)
+                    {
+                        compressDataFile(outFilePath, index);
+                    }
+
+                    return index;
+                }
+
+                // The merged file only has a position table if all files have one,
+                // otherwise it wouldn't know all its positions.
+                // Has to be done before the files are possibly removed.
+                void mergePositionTablesIntoFile(const std::vector<File*>& files, const std::filesystem::path& outFilePath)
+                {
+                    std::vector<ext::ImmutableSpan<PositionRecord>> positionTables;
+                    positionTables.reserve(files.size());
+                    for (auto&& file : files)
+                    {
+                        const auto& positionTable = file->positionTable();
+                        if (!positionTable.has_value())
+                        {
+                            return;
+                        }
+
+                        positionTables.emplace_back(positionTable->records());
+                    }
+
+                    PositionTableWriter writer(dataFilePathToPositionTablePath(outFilePath));
+                    mergePositionTables(positionTables, writer);
+                    writer.end();
+                    logPositionTableCollisions(outFilePath, writer);
+                }
+
+                // The converted entries have to be ordered by position the same way
+                // as the source entries, so that only the entries of a single position
+                // have to be sorted again (and combined, if they became equal).
+                // It is the case when the conversion only drops information.
+                template <typename SourceEntryT>
+                [[nodiscard]] Index convertEntriesIntoFile(
+                    const ext::ImmutableSpan<SourceEntryT>& entries,
+                    const CountOverflowTableType& countOverflows,
+                    const std::filesystem::path& outFilePath,
+                    std::size_t maxNumPositions
+                )
+                {
+                    auto extractKey = [](const PersistedEntryType& entry) {
+                        return entry.key();
+                    };
+                    ext::IndexBuilder<PersistedEntryType, CompareLessWithoutReverseMove, decltype(extractKey)> ib(m_indexGranularity, {}, extractKey);
+
+                    FilterBuilder filterBuilder(maxNumPositions);
+                    CountAccumulator counts(countOverflows);
+                    CountOverflowTableBuilder countOverflowBuilder;
+
+                    {
+                        ext::BinaryOutputFile outFile(outFilePath);
+
+                        const std::size_t outBufferSize = ext::numObjectsPerBufferUnit<PersistedEntryType>(m_mergeWriterBufferSize.bytes(), 4);
+                        ext::BackInserter<PersistedEntryType> out(outFile, util::DoubleBuffer<PersistedEntryType>(outBufferSize));
+
+                        auto emit = [&](PersistedEntryType& entry) {
+                            countOverflowBuilder.append(entry, counts);
+                            out.emplace(entry);
+                            ib.append(&entry, 1);
+                            filterBuilder.append(entry);
+                        };
+
+                        // Entries of the same position.
+                        std::vector<PersistedEntryType> group;
+                        auto flushGroup = [&]() {
+                            std::sort(group.begin(), group.end(), CompareLessFull{});
+
+                            auto accumulator = group.front();
+                            counts.start(accumulator);
+                            for (std::size_t i = 1; i < group.size(); ++i)
+                            {
+                                if (CompareEqualFull{}(accumulator, group[i]))
+                                {
+                                    accumulator.combine(group[i]);
+                                    counts.add(group[i]);
                                 }
                                 else
                                 {
-                                    out.emplace(accumulator);
-                                    ib.append(&accumulator, 1);
+                                    emit(accumulator);
+                                    accumulator = group[i];
+                                    counts.start(accumulator);
+                                }
+                            }
+                            emit(accumulator);
+
+                            group.clear();
+                        };
+
+                        const std::size_t inBufferSize = ext::numObjectsPerBufferUnit<SourceEntryT>(m_mergeWriterBufferSize.bytes(), 4);
+                        const auto end = entries.end_seq();
+                        for (auto it = entries.begin_seq(util::DoubleBuffer<SourceEntryT>(inBufferSize)); it != end; ++it)
+                        {
+                            const PersistedEntryType entry(*it);
+                            if (!group.empty() && !CompareEqualWithoutReverseMove{}(group.front(), entry))
+                            {
+                                if (!CompareLessWithoutReverseMove{}(group.front(), entry))
+                                {
+                                    throw std::runtime_error("The conversion doesn't preserve the order of the entries.");
                                 }
+
+                                flushGroup();
                             }
+
+                            group.emplace_back(entry);
                         }
+
+                        if (!group.empty())
+                        {
+                            flushGroup();
+                        }
+
+                        out.flush();
                     }
 
-                    Index index = ib.end();
-                    writeIndexOfDataFile(outFilePath, index);
+                    Index index = ib.end();
+                    prepareIndex(index);
+                    writeIndexOfDataFile(outFilePath, index);
+                    filterBuilder.end(outFilePath);
+                    countOverflowBuilder.end(outFilePath);
+
+                    return index;
+                }
+
+                // The hashes in position tables depend on the format,
+                // so the records are rehashed from the positions.
+                void convertPositionTableIntoFile(const PositionTable& table, const std::filesystem::path& outFilePath)
+                {
+                    std::vector<PositionRecord> records;
+                    records.reserve(table.size());
+
+                    const auto end = table.records().end_seq();
+                    for (auto it = table.records().begin_seq(); it != end; ++it)
+                    {
+                        const PositionWithZobrist position(it->position.decompress());
+                        records.push_back(PositionRecord{ detail::positionHashOf(KeyT(position)), it->position });
+                    }
 
-                    return index;
+                    sortDistinctPositionRecords(records);
+                    writePositionTableOfDataFile(outFilePath, records);
                 }
 
                 void mergeFiles(
@@ -1467,7 +3128,7 @@ namespace persistence
                     auto groups = ext::groupConsecutiveSpans(
                         files,
                         temporarySpace,
-                        [](File* file) { return file->entries().size_bytes(); }
+                        [](File* file) { return file->uncompressedSize(); }
                     );
 
                     // assess total work
@@ -1480,13 +3141,13 @@ namespace persistence
                         }
                         else
                         {
-                            std::vector<ext::ImmutableSpan<PersistedEntryType>> spans;
-                            spans.reserve(filesInGroup.size());
+                            std::vector<std::size_t> sizes;
+                            sizes.reserve(filesInGroup.size());
                             for (auto&& file : filesInGroup)
                             {
-                                spans.emplace_back(file->entries());
+                                sizes.emplace_back(file->numEntries());
                             }
-                            totalWork += ext::merge_assess_work(spans);
+                            totalWork += ext::merge_assess_work(sizes);
                         }
                     }
 
@@ -1538,8 +3199,7 @@ namespace persistence
                     // Now we can safely rename after old ones are removed.
                     auto newFilePath = outFilePath;
                     newFilePath.replace_filename(std::to_string(id));
-                    std::filesystem::rename(outFilePath, newFilePath);
-                    std::filesystem::rename(dataFilePathToIndexPath(outFilePath), dataFilePathToIndexPath(newFilePath));
+                    renameDataFile(outFilePath, newFilePath);
 
                     addFile(std::make_unique<File>(newFilePath, std::move(index)));
                 }
@@ -1560,12 +3220,10 @@ namespace persistence
                         if (it == m_files.end()) continue;
 
                         auto path = (*it)->path();
-                        auto indexPath = dataFilePathToIndexPath(path);
 
                         m_files.erase(it);
 
-                        std::filesystem::remove(path);
-                        std::filesystem::remove(indexPath);
+                        removeDataFile(path);
                     }
 
                     m_lastId = 0;
@@ -1627,7 +3285,7 @@ namespace persistence
                             continue;
                         }
 
-                        if (isPathOfIndex(entry.path()))
+                        if (isPathOfIndex(entry.path()) || isPathOfFilter(entry.path()) || isPathOfMonthRange(entry.path()) || isPathOfBlockTable(entry.path()) || isPathOfPositionTable(entry.path()) || isPathOfCountOverflowTable(entry.path()) || isPathOfExpandedDataFile(entry.path()))
                         {
                             continue;
                         }
@@ -1637,6 +3295,7 @@ namespace persistence
                             continue;
                         }
 
+                        recoverBlockTableOfDataFile(entry.path());
                         addFile(entry.path());
                     }
                 }
@@ -1654,19 +3313,25 @@ namespace persistence
                     m_files.emplace_back(std::move(file));
                 }
 
-                void addFutureFile(AsyncStorePipeline& pipeline, std::vector<PersistedEntryType>&& entries)
+                void addFutureFile(AsyncStorePipeline& pipeline, std::vector<PersistedEntryType>&& entries, std::vector<PositionRecord>&& positions, const detail::MonthRange& monthRange)
                 {
                     const std::uint32_t id = nextId();
                     auto path = pathOfDataFileWithId(m_path, id);
                     m_lastId = std::max(m_lastId, id);
-                    m_futureFiles.emplace_back(pipeline.scheduleUnordered(path, std::move(entries)), path);
+                    writeMonthRangeOfDataFile(path, monthRange);
+                    m_futureFiles.emplace_back(pipeline.scheduleUnordered(path, std::move(entries), std::move(positions)), path);
                 }
             };
 
         private:
             using BaseType = persistence::Database;
 
+            // A database is converted from the partitions of a database of another format.
+            template <typename, typename, typename>
+            friend struct OrderedEntrySetPositionDatabase;
+
             static inline const std::filesystem::path partitionDirectory = "data";
+            static inline const std::filesystem::path shardsFilename = "shards";
 
             static inline const DatabaseManifestModel m_manifest = { name, TraitsT::version, true };
 
@@ -1681,13 +3346,23 @@ namespace persistence
             static inline const MemoryAmount m_headerBufferMemory = cfg::g_config["persistence"][name]["header_buffer_memory"].get<MemoryAmount>();
             static inline const MemoryAmount m_pgnParserMemory = cfg::g_config["persistence"][name]["pgn_parser_memory"].get<MemoryAmount>();
             static inline const MemoryAmount m_bcgnParserMemory = cfg::g_config["persistence"][name]["bcgn_parser_memory"].get<MemoryAmount>();
+            static inline const MemoryAmount m_queryArenaMemory = cfg::g_config["persistence"][name]["query_arena_memory"].get<MemoryAmount>();
+
+            // The player index is kept with the game headers, so it needs game indices.
+            static inline const bool m_indexPlayers = usesGameIndex && cfg::g_config["persistence"][name]["index_players"].get<bool>();
+
+            // Empty if new games are not partitioned by elo.
+            static inline const std::vector<std::uint16_t> m_eloBandBounds = detail::normalizeEloBandBounds(cfg::g_config["persistence"][name]["elo_bands"].get<std::vector<std::uint16_t>>());
+
+            // Empty if new databases are not sharded.
+            static inline const std::vector<std::string> m_shardPaths = cfg::g_config["persistence"][name]["shard_paths"].get<std::vector<std::string>>();
 
         public:
             OrderedEntrySetPositionDatabase(std::filesystem::path path) :
                 BaseType(path, m_manifest, supportManifest()),
                 m_path(path),
-                m_headers(makeHeaders(path, m_headerBufferMemory)),
-                m_partition(path / partitionDirectory)
+                m_headers(makeHeaders(path, m_headerBufferMemory, m_indexPlayers)),
+                m_shards(makeShards(path))
             {
             }
 
@@ -1739,6 +3414,7 @@ namespace persistence
 
                     manifest.allowsFilteringByMonthRange = TraitsT::allowsFilteringByMonthRange;
                     manifest.monthFilterGranularity = TraitsT::monthFilterGranularity;
+                    manifest.filtersMonthsByDataFile = true;
 
                     manifest.maxBytesPerPosition = TraitsT::maxBytesPerPosition;
                     manifest.estimatedAverageBytesPerPosition = TraitsT::estimatedAverageBytesPerPosition;
@@ -1767,7 +3443,9 @@ namespace persistence
                         header->clear();
                     }
                 }
-                m_partition.clear();
+                forEachPartition([](Partition& partition) {
+                    partition.clear();
+                    });
             }
 
             const std::filesystem::path& path() const override
@@ -1781,44 +3459,171 @@ namespace persistence
 
                 disableUnsupportedQueryFeatures(query);
 
-                query::PositionQueries posQueries = query::gatherPositionQueries(query);
-                auto keys = getKeys(posQueries);
-                std::vector<PositionStats> stats(posQueries.size());
+                // Everything that doesn't end up in the response is allocated
+                // from the arena and released at once. The initial buffer is
+                // reused by all queries, so usually nothing is allocated
+                // from the heap for them.
+                if (m_queryArenaBuffer.size() != m_queryArenaMemory.bytes())
+                {
+                    m_queryArenaBuffer.resize(m_queryArenaMemory.bytes());
+                }
+                std::pmr::monotonic_buffer_resource arena(m_queryArenaBuffer.data(), m_queryArenaBuffer.size());
+
+                query::PositionQueries posQueries = query::gatherPositionQueries(query, &arena);
+                const std::size_t numPositionQueries = posQueries.size();
+
+                // The results, with the names in game headers, are allocated from
+                // memory that is owned by the response and released with it.
+                // It's sized for the expected results, so it usually takes
+                // a single allocation. Otherwise it grows geometrically.
+                auto resultsMemory = std::make_unique<std::pmr::monotonic_buffer_resource>(
+                    estimateResultsMemory(query, numPositionQueries)
+                );
+
+                // With the player filter the positions are looked up with their hashes
+                // salted for the player (see importImpl). When both colors are requested
+                // every position is queried once for each and the results are merged afterwards.
+                const std::vector<ZobristKey> playerSalts = getPlayerSalts(query);
+                for (std::size_t i = 1; i < playerSalts.size(); ++i)
+                {
+                    posQueries.insert(posQueries.end(), posQueries.begin(), posQueries.begin() + numPositionQueries);
+                }
+
+                auto keys = getKeys(posQueries, playerSalts, &arena);
+                QueryPositionStats stats(posQueries.size(), &arena);
+
+                // Retractions are gathered for root positions
+                // in the same pass as the position stats.
+                QueryRetractionsStats retractionsStats(&arena);
+                if constexpr (hasReverseMove)
+                {
+                    if (query.retractionsFetchingOptions.has_value())
+                    {
+                        retractionsStats.resize(posQueries.size());
+                    }
+                }
 
                 auto cmp = KeyCompareLessWithReverseMove{};
                 auto unsort = reversibleZipSort(keys, posQueries, cmp);
 
-                m_partition.executeQuery(query, keys, posQueries, stats);
+                // The keys are sorted, so the keys of each shard are consecutive.
+                QueryBuffers buffers(&arena);
+                std::size_t begin = 0;
+                for (std::size_t shardIndex = 0; shardIndex < m_shards.size(); ++shardIndex)
+                {
+                    std::size_t end = begin;
+                    while (end < keys.size() && detail::shardOfPositionHash(detail::positionHashOf(keys[end]), m_shards.size()) == shardIndex)
+                    {
+                        ++end;
+                    }
+
+                    if (begin != end)
+                    {
+                        forEachQueriedPartition(m_shards[shardIndex], query, [&](Partition& partition) {
+                            partition.executeQuery(query, keys, posQueries, stats, retractionsStats, buffers, begin, end);
+                            });
+                    }
+
+                    begin = end;
+                }
+                ASSERT(begin == keys.size());
+
+                if (playerSalts.size() > 1)
+                {
+                    unsort(stats);
+                    if (!retractionsStats.empty())
+                    {
+                        unsort(retractionsStats);
+                    }
+
+                    mergePlayerColorStats(numPositionQueries, stats, retractionsStats);
+
+                    // PositionQuery is not default constructible so it can't be unsorted.
+                    posQueries = query::gatherPositionQueries(query, &arena);
+                }
 
-                auto results = segregatePositionStats(query, posQueries, stats);
+                auto results = segregatePositionStats(query, posQueries, stats, &arena, resultsMemory.get());
 
                 // We have to either unsort both results and posQueries, or none.
                 // unflatten only needs relative order of results and posQueries to match
                 // So we don't unsort any.
                 auto unflattened = query::unflatten(std::move(results), query, posQueries);
 
-                if constexpr (hasReverseMove)
+                if (!retractionsStats.empty())
                 {
-                    if (query.retractionsFetchingOptions.has_value())
+                    for (std::size_t i = 0; i < posQueries.size(); ++i)
+                    {
+                        if (posQueries[i].origin != query::PositionQueryOrigin::Root)
+                        {
+                            continue;
+                        }
+
+                        auto segregated = segregateRetractionsStats(
+                            query,
+                            std::move(retractionsStats[i]),
+                            &arena,
+                            resultsMemory.get()
+                        );
+
+                        unflattened[posQueries[i].rootId].retractionsResults.retractions = std::move(segregated);
+                    }
+                }
+
+                // Month filters only skip whole files, so it's reported
+                // whether the searched files had games from other months.
+                std::optional<bool> exactMonths;
+                if (query.filters.has_value() && (query.filters->minMonthSinceYear0.has_value() || query.filters->maxMonthSinceYear0.has_value()))
+                {
+                    exactMonths = true;
+                    for (auto&& shard : m_shards)
+                    {
+                        forEachQueriedPartition(shard, query, [&](Partition& partition) {
+                            if (!partition.matchesMonthFilterExactly(query))
+                            {
+                                exactMonths = false;
+                            }
+                            });
+                    }
+                }
+
+                // Elo filters only skip whole bands and games imported without
+                // bands are always searched, so it's reported whether
+                // the searched partitions had games from other elos.
+                std::optional<bool> exactElo;
+                if (query.filters.has_value() && (query.filters->minElo.has_value() || query.filters->maxElo.has_value()))
+                {
+                    const auto& filters = *query.filters;
+                    const std::uint16_t first = filters.minElo.value_or(0);
+                    const std::uint16_t last = filters.maxElo.value_or(std::numeric_limits<std::uint16_t>::max());
+
+                    exactElo = true;
+                    for (auto&& shard : m_shards)
                     {
-                        for (auto&& resultForRoot : unflattened)
+                        if (!shard.partition.empty())
                         {
-                            auto queried = m_partition.queryRetractions(
-                                query,
-                                *resultForRoot.position.tryGet()
-                            );
+                            exactElo = false;
+                        }
 
-                            auto segregated = segregateRetractionsStats(
-                                query,
-                                std::move(queried)
-                            );
+                        for (auto&& eloPartition : shard.eloPartitions)
+                        {
+                            const auto& band = eloPartition.band;
+                            if (eloPartition.partition->empty() || !band.intersects(first, last, filters.includeUnknownElo))
+                            {
+                                continue;
+                            }
 
-                            resultForRoot.retractionsResults.retractions = std::move(segregated);
+                            if (!band.isWithin(first, last, filters.includeUnknownElo))
+                            {
+                                exactElo = false;
+                            }
                         }
                     }
                 }
 
-                return { std::move(query), std::move(unflattened) };
+                query::Response response(std::move(resultsMemory), std::move(query), std::move(unflattened));
+                response.exactMonths = exactMonths;
+                response.exactElo = exactElo;
+                return response;
             }
 
             void mergeAll(
@@ -1844,7 +3649,38 @@ namespace persistence
                     }
                 };
 
-                m_partition.mergeAll(temporaryDirs, temporarySpace, progressReport);
+                // Shards are usually on different drives, so they are merged concurrently.
+                // Merges of different partitions use the same names for temporary files,
+                // so this is only possible when they are placed in the partition directories.
+                if (m_shards.size() > 1 && temporaryDirs.empty())
+                {
+                    std::mutex progressMutex;
+                    auto synchronizedProgressReport = [&progressMutex, &progressReport](const ext::Progress& report) {
+                        std::unique_lock<std::mutex> progressLock(progressMutex);
+                        progressReport(report);
+                    };
+
+                    std::vector<std::future<void>> merges;
+                    for (auto&& shard : m_shards)
+                    {
+                        merges.emplace_back(std::async(std::launch::async, [&]() {
+                            forEachPartitionOfShard(shard, [&](Partition& partition) {
+                                partition.mergeAll(temporaryDirs, temporarySpace, synchronizedProgressReport);
+                                });
+                            }));
+                    }
+
+                    for (auto&& merge : merges)
+                    {
+                        merge.get();
+                    }
+                }
+                else
+                {
+                    forEachPartition([&](Partition& partition) {
+                        partition.mergeAll(temporaryDirs, temporarySpace, progressReport);
+                        });
+                }
 
                 Logger::instance().logInfo(": Finalizing...");
                 Logger::instance().logInfo(": Completed.");
@@ -1860,7 +3696,15 @@ namespace persistence
             {
                 std::unique_lock<std::mutex> lock(m_mutex);
 
-                if (m_partition.name() != partitionName)
+                Partition* partition = nullptr;
+                forEachNamedPartition([&partition, &partitionName](const std::string& name, Partition& p) {
+                    if (name == partitionName)
+                    {
+                        partition = &p;
+                    }
+                    });
+
+                if (partition == nullptr)
                 {
                     throw std::runtime_error("Parititon with name '" + partitionName + "' not found.");
                 }
@@ -1880,7 +3724,7 @@ namespace persistence
                     }
                 };
 
-                m_partition.mergeFiles(temporaryDirs, temporarySpace, filenames, progressReport);
+                partition->mergeFiles(temporaryDirs, temporarySpace, filenames, progressReport);
 
                 Logger::instance().logInfo(": Finalizing...");
                 Logger::instance().logInfo(": Completed.");
@@ -1896,195 +3740,562 @@ namespace persistence
 
                 const std::size_t numSortingThreads = std::clamp(std::thread::hardware_concurrency(), 2u, 3u) - 1u;
 
-                if (files.empty())
+                if (files.empty())
+                {
+                    return {};
+                }
+
+                std::size_t totalSize = 0;
+                std::size_t totalSizeProcessed = 0;
+                for (auto&& file : files)
+                {
+                    totalSize += std::filesystem::file_size(file.path());
+                }
+
+                // One for each partition the entries are being imported to.
+                const std::size_t numBuffers = numImportBuckets();
+
+                const std::size_t numAdditionalBuffers = 1 + numSortingThreads;
+
+                const std::size_t bucketSize =
+                    ext::numObjectsPerBufferUnit<PersistedEntryType>(
+                        memory,
+                        numBuffers + numAdditionalBuffers
+                        );
+
+                AsyncStorePipeline pipeline(
+                    createBuffers<PersistedEntryType>(numBuffers + numAdditionalBuffers, bucketSize),
+                    numSortingThreads
+                );
+
+                Logger::instance().logInfo(": Importing files...");
+                ImportStats stats = importImpl(
+                    pipeline,
+                    files,
+                    [&progressCallback, &totalSize, &totalSizeProcessed](auto&& file) {
+                        totalSizeProcessed += std::filesystem::file_size(file);
+                        Logger::instance().logInfo(
+                            ":     ",
+                            static_cast<int>(static_cast<double>(totalSizeProcessed) / totalSize * 100.0),
+                            "% - completed ",
+                            file,
+                            "."
+                        );
+
+                        if (progressCallback)
+                        {
+                            ImportProgressReport report{
+                                totalSizeProcessed,
+                                totalSize,
+                                file
+                            };
+                            progressCallback(report);
+                        }
+                    });
+                Logger::instance().logInfo(": Finalizing...");
+
+                pipeline.waitForCompletion();
+
+                flush();
+
+                Logger::instance().logInfo(": Completed.");
+
+                const auto total = stats.total();
+                Logger::instance().logInfo(": Imported ", total.numGames, " games with ", total.numPositions, " positions. Skipped ", total.numSkippedGames, " games.");
+
+                BaseType::addStats(stats);
+
+                return stats;
+            }
+
+            [[nodiscard]] std::map<std::string, std::vector<MergableFile>> mergableFiles() const override
+            {
+                std::map<std::string, std::vector<MergableFile>> files;
+
+                forEachNamedPartition([&files](const std::string& name, const Partition& partition) {
+                    files[name] = partition.mergableFiles();
+                    });
+
+                return files;
+            }
+
+            void flush() override
+            {
+                collectFutureFiles();
+
+                if constexpr (hasGameHeaders)
+                {
+                    for (auto& header : m_headers)
+                    {
+                        header->flush();
+                    }
+                }
+            }
+
+            // Fills this database, which has to be empty, with the entries of a database
+            // of another format, for example one with more hash bits. Data files are converted
+            // one by one, so the partitions and files stay the same and no sorting is needed.
+            // Game headers are not converted, so this format can't have them.
+            template <typename SourceDatabaseT>
+            void convertFrom(const SourceDatabaseT& source, const std::vector<std::filesystem::path>& temporaryDirs)
+            {
+                using SourceEntryType = typename SourceDatabaseT::PersistedEntryType;
+
+                static_assert(std::is_constructible_v<PersistedEntryType, const SourceEntryType&>, "Entries of the source format can't be converted to this format.");
+                static_assert(!hasSmearedEntry, "Smeared entries can't be converted to.");
+                static_assert(!SourceDatabaseT::hasCountOverflow || hasCountOverflow, "Overflowed counts can't be converted to this format.");
+                static_assert(!hasGameHeaders, "Game headers can't be converted.");
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                bool isEmpty = true;
+                forEachPartition([&isEmpty](const Partition& partition) {
+                    isEmpty = isEmpty && partition.empty();
+                    });
+                if (!isEmpty)
+                {
+                    throw std::runtime_error("The destination database is not empty.");
+                }
+
+                if (source.m_shards.size() != m_shards.size())
+                {
+                    throw std::runtime_error("The destination database has a different number of shards.");
+                }
+
+                std::size_t totalNumEntries = 0;
+                source.forEachPartition([&totalNumEntries](const auto& partition) {
+                    partition.forEachFile([&totalNumEntries](const auto& file) {
+                        totalNumEntries += file.numEntries();
+                        });
+                    });
+
+                Logger::instance().logInfo(": Converting files...");
+
+                std::size_t numEntriesDone = 0;
+                auto convertPartition = [&](const auto& sourcePartition, Partition& partition) {
+                    sourcePartition.forEachFile([&](const auto& file) {
+                        partition.template convertFile<SourceEntryType>(file, temporaryDirs);
+
+                        numEntriesDone += file.numEntries();
+                        Logger::instance().logInfo(
+                            ":     ",
+                            static_cast<int>(static_cast<double>(numEntriesDone) / std::max<std::size_t>(totalNumEntries, 1) * 100.0),
+                            "% - completed ",
+                            file.path(),
+                            "."
+                        );
+                        });
+                };
+
+                // Shards are selected by the top bits of the hash, which
+                // are the same in both formats, so entries stay in the same shard.
+                for (std::size_t i = 0; i < m_shards.size(); ++i)
+                {
+                    auto& sourceShard = source.m_shards[i];
+                    auto& shard = m_shards[i];
+
+                    convertPartition(sourceShard.partition, shard.partition);
+                    for (auto&& eloPartition : sourceShard.eloPartitions)
+                    {
+                        convertPartition(*eloPartition.partition, getOrCreateEloPartition(shard, eloPartition.band));
+                    }
+                }
+
+                ImportStats stats;
+                for (GameLevel level : values<GameLevel>())
+                {
+                    SingleGameLevelImportStats levelStats{};
+                    static_cast<SingleGameLevelDatabaseStats&>(levelStats) = source.stats()[level];
+                    stats.add(levelStats, level);
+                }
+                BaseType::addStats(stats);
+
+                Logger::instance().logInfo(": Completed.");
+            }
+
+
+        private:
+            std::filesystem::path m_path;
+
+            // TODO: don't include them when !hasGameHeaders
+            EnumArray<GameLevel, std::unique_ptr<IndexedGameHeaderStorageType>> m_headers;
+
+            // Initial buffer of the arena of temporaries of a query.
+            // Only used with m_mutex locked.
+            std::vector<std::byte> m_queryArenaBuffer;
+
+            struct EloPartition
+            {
+                detail::EloBand band;
+                std::unique_ptr<Partition> partition;
+            };
+
+            // Each shard is a directory with the data files of a range of position hashes,
+            // see shard_paths in the configuration. A database without shards
+            // has one shard in its own directory.
+            struct Shard
+            {
+                std::filesystem::path path;
+
+                // Holds all games when they are not partitioned by elo.
+                Partition partition;
+
+                // Partitions of games by the average elo of the players, see elo_bands
+                // in the configuration. Created when the first game of the band is imported.
+                std::vector<EloPartition> eloPartitions;
+            };
+
+            std::vector<Shard> m_shards;
+
+            std::mutex m_mutex;
+            [[nodiscard]] EnumArray<GameLevel, std::unique_ptr<IndexedGameHeaderStorageType>> makeHeaders(const std::filesystem::path& path, MemoryAmount headerBufferMemory, bool indexPlayers)
+            {
+                if constexpr (hasGameHeaders)
+                {
+                    return {
+                        std::make_unique<IndexedGameHeaderStorageType>(path, headerBufferMemory, m_headerNames[values<GameLevel>()[0]], indexPlayers),
+                        std::make_unique<IndexedGameHeaderStorageType>(path, headerBufferMemory, m_headerNames[values<GameLevel>()[1]], indexPlayers),
+                        std::make_unique<IndexedGameHeaderStorageType>(path, headerBufferMemory, m_headerNames[values<GameLevel>()[2]], indexPlayers)
+                    };
+                }
+                else
+                {
+                    return {};
+                }
+            }
+
+            void collectFutureFiles()
+            {
+                forEachPartition([](Partition& partition) {
+                    partition.collectFutureFiles();
+                    });
+            }
+
+            template <typename FuncT>
+            static void forEachPartitionOfShard(Shard& shard, FuncT&& func)
+            {
+                func(shard.partition);
+                for (auto&& eloPartition : shard.eloPartitions)
+                {
+                    func(*eloPartition.partition);
+                }
+            }
+
+            template <typename FuncT>
+            static void forEachPartitionOfShard(const Shard& shard, FuncT&& func)
+            {
+                func(shard.partition);
+                for (auto&& eloPartition : shard.eloPartitions)
+                {
+                    func(static_cast<const Partition&>(*eloPartition.partition));
+                }
+            }
+
+            template <typename FuncT>
+            void forEachPartition(FuncT&& func)
+            {
+                for (auto&& shard : m_shards)
                 {
-                    return {};
+                    forEachPartitionOfShard(shard, func);
                 }
+            }
 
-                std::size_t totalSize = 0;
-                std::size_t totalSizeProcessed = 0;
-                for (auto&& file : files)
+            template <typename FuncT>
+            void forEachPartition(FuncT&& func) const
+            {
+                for (auto&& shard : m_shards)
                 {
-                    totalSize += std::filesystem::file_size(file.path());
+                    forEachPartitionOfShard(shard, func);
                 }
+            }
 
-                const std::size_t numBuffers = 1;
+            // Partitions of different shards have the same names,
+            // so with more than one shard the names are prefixed with the shard index.
+            template <typename FuncT>
+            void forEachNamedPartition(FuncT&& func) const
+            {
+                for (std::size_t i = 0; i < m_shards.size(); ++i)
+                {
+                    const std::string prefix = m_shards.size() > 1 ? std::to_string(i) + "/" : "";
+                    forEachPartitionOfShard(m_shards[i], [&](const Partition& partition) {
+                        func(prefix + partition.name(), partition);
+                        });
+                }
+            }
 
-                const std::size_t numAdditionalBuffers = 1 + numSortingThreads;
+            template <typename FuncT>
+            void forEachNamedPartition(FuncT&& func)
+            {
+                for (std::size_t i = 0; i < m_shards.size(); ++i)
+                {
+                    const std::string prefix = m_shards.size() > 1 ? std::to_string(i) + "/" : "";
+                    forEachPartitionOfShard(m_shards[i], [&](Partition& partition) {
+                        func(prefix + partition.name(), partition);
+                        });
+                }
+            }
 
-                const std::size_t bucketSize =
-                    ext::numObjectsPerBufferUnit<PersistedEntryType>(
-                        memory,
-                        numBuffers + numAdditionalBuffers
-                        );
+            // Skips elo partitions with bands outside of the elo filter.
+            // The main partition can't be filtered this way and is always queried.
+            template <typename FuncT>
+            static void forEachQueriedPartition(Shard& shard, const query::Request& query, FuncT&& func)
+            {
+                func(shard.partition);
 
-                AsyncStorePipeline pipeline(
-                    createBuffers<PersistedEntryType>(numBuffers + numAdditionalBuffers, bucketSize),
-                    numSortingThreads
-                );
+                const bool hasEloFilter =
+                    query.filters.has_value()
+                    && (query.filters->minElo.has_value() || query.filters->maxElo.has_value());
 
-                Logger::instance().logInfo(": Importing files...");
-                ImportStats stats = importImpl(
-                    pipeline,
-                    files,
-                    [&progressCallback, &totalSize, &totalSizeProcessed](auto&& file) {
-                        totalSizeProcessed += std::filesystem::file_size(file);
-                        Logger::instance().logInfo(
-                            ":     ",
-                            static_cast<int>(static_cast<double>(totalSizeProcessed) / totalSize * 100.0),
-                            "% - completed ",
-                            file,
-                            "."
+                for (auto&& eloPartition : shard.eloPartitions)
+                {
+                    if (hasEloFilter)
+                    {
+                        const auto& filters = *query.filters;
+                        const bool intersects = eloPartition.band.intersects(
+                            filters.minElo.value_or(0),
+                            filters.maxElo.value_or(std::numeric_limits<std::uint16_t>::max()),
+                            filters.includeUnknownElo
                         );
 
-                        if (progressCallback)
+                        if (!intersects)
                         {
-                            ImportProgressReport report{
-                                totalSizeProcessed,
-                                totalSize,
-                                file
-                            };
-                            progressCallback(report);
+                            continue;
                         }
-                    });
-                Logger::instance().logInfo(": Finalizing...");
-
-                pipeline.waitForCompletion();
+                    }
 
-                flush();
+                    func(*eloPartition.partition);
+                }
+            }
 
-                Logger::instance().logInfo(": Completed.");
+            [[nodiscard]] static std::vector<EloPartition> discoverEloPartitions(const std::filesystem::path& path)
+            {
+                std::vector<EloPartition> partitions;
 
-                const auto total = stats.total();
-                Logger::instance().logInfo(": Imported ", total.numGames, " games with ", total.numPositions, " positions. Skipped ", total.numSkippedGames, " games.");
+                for (auto& entry : std::filesystem::directory_iterator(path))
+                {
+                    if (!entry.is_directory())
+                    {
+                        continue;
+                    }
 
-                BaseType::addStats(stats);
+                    const auto band = detail::EloBand::fromPartitionName(entry.path().filename().string());
+                    if (band.has_value())
+                    {
+                        partitions.push_back({ *band, std::make_unique<Partition>(entry.path()) });
+                    }
+                }
 
-                return stats;
+                return partitions;
             }
 
-            [[nodiscard]] std::map<std::string, std::vector<MergableFile>> mergableFiles() const override
+            // The shard directories of a database are chosen when it is created
+            // and stored in the shards file, so they don't depend on the current configuration.
+            // Databases without the file have a single shard in their own directory.
+            [[nodiscard]] static std::vector<std::filesystem::path> readOrCreateShardPaths(const std::filesystem::path& path)
             {
-                std::map<std::string, std::vector<MergableFile>> files;
+                const auto shardsFilePath = path / shardsFilename;
+                if (std::filesystem::exists(shardsFilePath))
+                {
+                    std::ifstream file(shardsFilePath);
+                    const auto json = nlohmann::json::parse(file);
 
-                files[m_partition.name()] = m_partition.mergableFiles();
+                    std::vector<std::filesystem::path> paths;
+                    for (auto&& shardPath : json.get<std::vector<std::string>>())
+                    {
+                        paths.emplace_back(shardPath);
+                    }
 
-                return files;
-            }
+                    if (paths.empty())
+                    {
+                        throw std::runtime_error("The shards file " + shardsFilePath.string() + " is empty.");
+                    }
 
-            void flush() override
-            {
-                collectFutureFiles();
+                    return paths;
+                }
 
-                if constexpr (hasGameHeaders)
+                // Existing databases stay in one shard.
+                if (m_shardPaths.empty() || std::filesystem::exists(path / partitionDirectory))
                 {
-                    for (auto& header : m_headers)
-                    {
-                        header->flush();
-                    }
+                    return { path };
                 }
-            }
 
+                // Two shards can be on the same drive, so the index
+                // is a part of the name.
+                auto databaseName = path.filename();
+                if (databaseName.empty())
+                {
+                    databaseName = path.parent_path().filename();
+                }
 
-        private:
-            std::filesystem::path m_path;
+                std::vector<std::filesystem::path> paths;
+                std::vector<std::string> pathStrings;
+                for (std::size_t i = 0; i < m_shardPaths.size(); ++i)
+                {
+                    auto shardPath = std::filesystem::absolute(std::filesystem::path(m_shardPaths[i]) / (databaseName.string() + "_" + std::to_string(i)));
+                    if (std::filesystem::exists(shardPath) && !std::filesystem::is_empty(shardPath))
+                    {
+                        throw std::runtime_error("The shard directory " + shardPath.string() + " is not empty.");
+                    }
 
-            // TODO: don't include them when !hasGameHeaders
-            EnumArray<GameLevel, std::unique_ptr<IndexedGameHeaderStorageType>> m_headers;
+                    pathStrings.emplace_back(shardPath.string());
+                    paths.emplace_back(std::move(shardPath));
+                }
 
-            // We only have one partition for this format
-            Partition m_partition;
+                std::ofstream file(shardsFilePath);
+                file << nlohmann::json(pathStrings).dump(4);
 
-            std::mutex m_mutex;
-            [[nodiscard]] EnumArray<GameLevel, std::unique_ptr<IndexedGameHeaderStorageType>> makeHeaders(const std::filesystem::path& path, MemoryAmount headerBufferMemory)
+                return paths;
+            }
+
+            [[nodiscard]] static std::vector<Shard> makeShards(const std::filesystem::path& path)
             {
-                if constexpr (hasGameHeaders)
+                std::vector<Shard> shards;
+                for (auto&& shardPath : readOrCreateShardPaths(path))
                 {
-                    return {
-                        std::make_unique<IndexedGameHeaderStorageType>(path, headerBufferMemory, m_headerNames[values<GameLevel>()[0]]),
-                        std::make_unique<IndexedGameHeaderStorageType>(path, headerBufferMemory, m_headerNames[values<GameLevel>()[1]]),
-                        std::make_unique<IndexedGameHeaderStorageType>(path, headerBufferMemory, m_headerNames[values<GameLevel>()[2]])
-                    };
+                    // The partition creates the directory of the shard.
+                    Partition partition(shardPath / partitionDirectory);
+                    auto eloPartitions = discoverEloPartitions(shardPath);
+                    shards.push_back(Shard{ shardPath, std::move(partition), std::move(eloPartitions) });
                 }
-                else
+
+                return shards;
+            }
+
+            [[nodiscard]] static Partition& getOrCreateEloPartition(Shard& shard, const detail::EloBand& band)
+            {
+                for (auto&& eloPartition : shard.eloPartitions)
                 {
-                    return {};
+                    if (eloPartition.band == band)
+                    {
+                        return *eloPartition.partition;
+                    }
                 }
+
+                shard.eloPartitions.push_back({ band, std::make_unique<Partition>(shard.path / band.partitionName()) });
+                return *shard.eloPartitions.back().partition;
             }
 
-            void collectFutureFiles()
+            // Without elo bands everything goes to the main partition.
+            // Otherwise there is one bucket for each band and one for unknown elo.
+            [[nodiscard]] static std::size_t numEloBuckets()
             {
-                m_partition.collectFutureFiles();
+                return m_eloBandBounds.empty() ? 1 : m_eloBandBounds.size() + 2;
             }
 
-            [[nodiscard]] std::vector<PackedGameHeaderType> queryHeadersByOffsets(const std::vector<std::uint64_t>& offsets, GameLevel level)
+            // Each shard has its own elo buckets.
+            [[nodiscard]] std::size_t numImportBuckets() const
             {
-                return m_headers[level]->queryByOffsets(offsets);
+                return m_shards.size() * numEloBuckets();
             }
 
-            template <typename DestinationT>
-            [[nodiscard]] std::vector<GameHeader> queryHeadersByOffsets(const std::vector<std::uint64_t>& offsets, const std::vector<DestinationT>& destinations)
+            [[nodiscard]] std::size_t importBucketIndex(const EntryConstructionParameters& params, std::uint64_t positionHash) const
             {
-                EnumArray<GameLevel, std::vector<std::uint64_t>> offsetsByLevel;
-                EnumArray<GameLevel, std::vector<std::size_t>> indices;
+                const std::size_t shardIndex = detail::shardOfPositionHash(positionHash, m_shards.size());
+                return shardIndex * numEloBuckets() + eloBucketIndex(params);
+            }
 
-                for (std::size_t i = 0; i < offsets.size(); ++i)
+            [[nodiscard]] static std::size_t eloBucketIndex(const EntryConstructionParameters& params)
+            {
+                if (m_eloBandBounds.empty())
                 {
-                    offsetsByLevel[destinations[i].level].emplace_back(offsets[i]);
-                    indices[destinations[i].level].emplace_back(i);
+                    return 0;
                 }
 
-                EnumArray<GameLevel, std::vector<PackedGameHeaderType>> packedHeadersByLevel;
-                for (GameLevel level : values<GameLevel>())
+                // we know either none or both are present
+                if (!params.whiteElo)
                 {
-                    packedHeadersByLevel[level] = queryHeadersByOffsets(offsetsByLevel[level], level);
+                    return 0;
                 }
 
-                std::vector<GameHeader> headers(offsets.size());
+                const std::uint16_t averageElo = static_cast<std::uint16_t>((static_cast<std::uint32_t>(params.whiteElo) + params.blackElo) / 2);
+                return 1 + (std::upper_bound(m_eloBandBounds.begin(), m_eloBandBounds.end(), averageElo) - m_eloBandBounds.begin());
+            }
+
+            [[nodiscard]] Partition& importBucketPartition(std::size_t bucketIndex, const EntryConstructionParameters& params)
+            {
+                auto& shard = m_shards[bucketIndex / numEloBuckets()];
+                const std::size_t eloBucket = bucketIndex % numEloBuckets();
 
-                for (GameLevel level : values<GameLevel>())
+                if (m_eloBandBounds.empty())
                 {
-                    const auto size = offsetsByLevel[level].size();
-                    for (std::size_t i = 0; i < size; ++i)
-                    {
-                        headers[indices[level][i]] = packedHeadersByLevel[level][i];
-                    }
+                    return shard.partition;
                 }
 
-                return headers;
-            }
+                if (eloBucket == 0)
+                {
+                    return getOrCreateEloPartition(shard, detail::EloBand::unknown());
+                }
 
-            [[nodiscard]] std::vector<PackedGameHeaderType> queryHeadersByIndices(const std::vector<std::uint64_t>& indices, GameLevel level)
-            {
-                return m_headers[level]->queryByIndices(indices);
+                const std::uint16_t averageElo = static_cast<std::uint16_t>((static_cast<std::uint32_t>(params.whiteElo) + params.blackElo) / 2);
+                return getOrCreateEloPartition(shard, detail::EloBand::of(averageElo, m_eloBandBounds));
             }
 
+            // The headers go to the response, so their names are allocated from
+            // the memory of the results. Temporaries use the memory of the offsets.
             template <typename DestinationT>
-            [[nodiscard]] std::vector<GameHeader> queryHeadersByIndices(const std::vector<std::uint64_t>& indices, const std::vector<DestinationT>& destinations)
+            [[nodiscard]] std::pmr::vector<GameHeader> queryHeadersByOffsets(
+                const std::pmr::vector<std::uint64_t>& offsets,
+                const std::pmr::vector<DestinationT>& destinations,
+                std::pmr::memory_resource* results
+            )
             {
-                EnumArray<GameLevel, std::vector<std::uint64_t>> indicesByLevel;
-                EnumArray<GameLevel, std::vector<std::size_t>> localIndices;
+                std::pmr::memory_resource* temporaries = offsets.get_allocator().resource();
 
-                for (std::size_t i = 0; i < indices.size(); ++i)
-                {
-                    indicesByLevel[destinations[i].level].emplace_back(indices[i]);
-                    localIndices[destinations[i].level].emplace_back(i);
-                }
+                std::pmr::vector<GameHeader> headers(offsets.size(), results);
 
-                EnumArray<GameLevel, std::vector<PackedGameHeaderType>> packedHeadersByLevel;
                 for (GameLevel level : values<GameLevel>())
                 {
-                    packedHeadersByLevel[level] = queryHeadersByIndices(indicesByLevel[level], level);
+                    std::pmr::vector<std::uint64_t> offsetsOfLevel(temporaries);
+                    std::pmr::vector<std::size_t> indices(temporaries);
+
+                    for (std::size_t i = 0; i < offsets.size(); ++i)
+                    {
+                        if (destinations[i].level == level)
+                        {
+                            offsetsOfLevel.emplace_back(offsets[i]);
+                            indices.emplace_back(i);
+                        }
+                    }
+
+                    const auto packedHeaders = m_headers[level]->queryByOffsets(std::move(offsetsOfLevel));
+                    for (std::size_t i = 0; i < indices.size(); ++i)
+                    {
+                        headers[indices[i]] = packedHeaders[i];
+                    }
                 }
 
-                std::vector<GameHeader> headers(indices.size());
+                return headers;
+            }
+
+            template <typename DestinationT>
+            [[nodiscard]] std::pmr::vector<GameHeader> queryHeadersByIndices(
+                const std::pmr::vector<std::uint64_t>& indices,
+                const std::pmr::vector<DestinationT>& destinations,
+                std::pmr::memory_resource* results
+            )
+            {
+                std::pmr::memory_resource* temporaries = indices.get_allocator().resource();
+
+                std::pmr::vector<GameHeader> headers(indices.size(), results);
 
                 for (GameLevel level : values<GameLevel>())
                 {
-                    const auto size = indicesByLevel[level].size();
-                    for (std::size_t i = 0; i < size; ++i)
+                    std::pmr::vector<std::uint64_t> indicesOfLevel(temporaries);
+                    std::pmr::vector<std::size_t> localIndices(temporaries);
+
+                    for (std::size_t i = 0; i < indices.size(); ++i)
+                    {
+                        if (destinations[i].level == level)
+                        {
+                            indicesOfLevel.emplace_back(indices[i]);
+                            localIndices.emplace_back(i);
+                        }
+                    }
+
+                    const auto packedHeaders = m_headers[level]->queryByIndices(std::move(indicesOfLevel));
+                    for (std::size_t i = 0; i < localIndices.size(); ++i)
                     {
-                        headers[localIndices[level][i]] = packedHeadersByLevel[level][i];
+                        headers[localIndices[i]] = packedHeaders[i];
                     }
                 }
 
@@ -2114,54 +4325,66 @@ namespace persistence
                 }
             }
 
+            // The headers are allocated from the memory of the segregated results.
             template <typename SegregatedT, typename DestinationT>
             void assignGameHeaders(
                 SegregatedT& segregated,
-                const std::vector<std::uint64_t>& firstGameIndices,
-                const std::vector<std::uint64_t>& lastGameIndices,
-                const std::vector<std::uint64_t>& firstGameOffsets,
-                const std::vector<std::uint64_t>& lastGameOffsets,
-                const std::vector<DestinationT>& firstGameDestinations,
-                const std::vector<DestinationT>& lastGameDestinations
+                const std::pmr::vector<std::uint64_t>& firstGameIndices,
+                const std::pmr::vector<std::uint64_t>& lastGameIndices,
+                const std::pmr::vector<std::uint64_t>& firstGameOffsets,
+                const std::pmr::vector<std::uint64_t>& lastGameOffsets,
+                const std::pmr::vector<DestinationT>& firstGameDestinations,
+                const std::pmr::vector<DestinationT>& lastGameDestinations
             )
             {
+                std::pmr::memory_resource* results = segregated.get_allocator().resource();
+
                 if constexpr (hasFirstGameIndex)
                 {
-                    query::assignGameHeaders(segregated, firstGameDestinations, queryHeadersByIndices(firstGameIndices, firstGameDestinations));
+                    query::assignGameHeaders(segregated, firstGameDestinations, queryHeadersByIndices(firstGameIndices, firstGameDestinations, results));
                 }
 
                 if constexpr (hasFirstGameOffset)
                 {
-                    query::assignGameHeaders(segregated, firstGameDestinations, queryHeadersByOffsets(firstGameOffsets, firstGameDestinations));
+                    query::assignGameHeaders(segregated, firstGameDestinations, queryHeadersByOffsets(firstGameOffsets, firstGameDestinations, results));
                 }
 
                 if constexpr (hasLastGameIndex)
                 {
-                    query::assignGameHeaders(segregated, lastGameDestinations, queryHeadersByIndices(lastGameIndices, lastGameDestinations));
+                    query::assignGameHeaders(segregated, lastGameDestinations, queryHeadersByIndices(lastGameIndices, lastGameDestinations, results));
                 }
 
                 if constexpr (hasLastGameOffset)
                 {
-                    query::assignGameHeaders(segregated, lastGameDestinations, queryHeadersByOffsets(lastGameOffsets, lastGameDestinations));
+                    query::assignGameHeaders(segregated, lastGameDestinations, queryHeadersByOffsets(lastGameOffsets, lastGameDestinations, results));
                 }
             }
 
+            // The results are allocated from the memory of the response
+            // and the temporaries from the arena of the query.
             [[nodiscard]] query::PositionQueryResults segregatePositionStats(
                 const query::Request& query,
                 const query::PositionQueries& posQueries,
-                std::vector<PositionStats>& stats
+                QueryPositionStats& stats,
+                std::pmr::memory_resource* temporaries,
+                std::pmr::memory_resource* results
             )
             {
                 const query::FetchLookups lookup = query::buildGameHeaderFetchLookup(query);
 
-                query::PositionQueryResults segregated(posQueries.size());
+                query::PositionQueryResults segregated(results);
+                segregated.reserve(posQueries.size());
+                for (std::size_t i = 0; i < posQueries.size(); ++i)
+                {
+                    segregated.emplace_back(query::makeEntriesBySelect(results));
+                }
 
-                std::vector<std::uint64_t> firstGameIndices;
-                std::vector<std::uint64_t> lastGameIndices;
-                std::vector<std::uint64_t> firstGameOffsets;
-                std::vector<std::uint64_t> lastGameOffsets;
-                std::vector<query::GameHeaderDestination> firstGameDestinations;
-                std::vector<query::GameHeaderDestination> lastGameDestinations;
+                std::pmr::vector<std::uint64_t> firstGameIndices(temporaries);
+                std::pmr::vector<std::uint64_t> lastGameIndices(temporaries);
+                std::pmr::vector<std::uint64_t> firstGameOffsets(temporaries);
+                std::pmr::vector<std::uint64_t> lastGameOffsets(temporaries);
+                std::pmr::vector<query::GameHeaderDestination> firstGameDestinations(temporaries);
+                std::pmr::vector<query::GameHeaderDestination> lastGameDestinations(temporaries);
 
                 for (std::size_t i = 0; i < posQueries.size(); ++i)
                 {
@@ -2179,15 +4402,16 @@ namespace persistence
                         {
                             for (GameResult result : query.results)
                             {
-                                auto& entry = stat[select][level][result];
-                                auto& segregatedEntry = segregated[i][select].emplace(level, result, entry.count());
+                                auto& accumulated = stat[select][level][result];
+                                auto& entry = accumulated.entry();
+                                auto& segregatedEntry = segregated[i][select].emplace(level, result, accumulated.count());
 
                                 if constexpr (hasEloDiff) segregatedEntry.second.eloDiff = entry.eloDiff();
                                 if constexpr (hasWhiteElo) segregatedEntry.second.whiteElo = entry.whiteElo();
                                 if constexpr (hasBlackElo) segregatedEntry.second.blackElo = entry.blackElo();
                                 if constexpr (hasCountWithElo) segregatedEntry.second.countWithElo = entry.countWithElo();
 
-                                if (entry.count() > 0)
+                                if (accumulated.count() > 0)
                                 {
                                     if constexpr (hasFirstGame)
                                     {
@@ -2246,36 +4470,39 @@ namespace persistence
             [[nodiscard]] query::RetractionsQueryResults
                 segregateRetractionsStats(
                     const query::Request& query,
-                    RetractionsStats&& unsegregated
+                    RetractionsStats&& unsegregated,
+                    std::pmr::memory_resource* temporaries,
+                    std::pmr::memory_resource* results
                 )
             {
                 const auto& fetching = *query.retractionsFetchingOptions;
 
-                query::RetractionsQueryResults segregated;
+                query::RetractionsQueryResults segregated(results);
 
-                std::vector<std::uint64_t> firstGameIndices;
-                std::vector<std::uint64_t> lastGameIndices;
-                std::vector<std::uint64_t> firstGameOffsets;
-                std::vector<std::uint64_t> lastGameOffsets;
-                std::vector<query::GameHeaderDestinationForRetraction> firstGameDestinations;
-                std::vector<query::GameHeaderDestinationForRetraction> lastGameDestinations;
+                std::pmr::vector<std::uint64_t> firstGameIndices(temporaries);
+                std::pmr::vector<std::uint64_t> lastGameIndices(temporaries);
+                std::pmr::vector<std::uint64_t> firstGameOffsets(temporaries);
+                std::pmr::vector<std::uint64_t> lastGameOffsets(temporaries);
+                std::pmr::vector<query::GameHeaderDestinationForRetraction> firstGameDestinations(temporaries);
+                std::pmr::vector<query::GameHeaderDestinationForRetraction> lastGameDestinations(temporaries);
 
                 for (auto&& [reverseMove, stat] : unsegregated)
                 {
-                    auto segregatedEntries = query::SegregatedEntries();
+                    auto& segregatedEntries = segregated[reverseMove];
                     for (GameLevel level : query.levels)
                     {
                         for (GameResult result : query.results)
                         {
-                            auto& entry = stat[level][result];
-                            auto& segregatedEntry = segregatedEntries.emplace(level, result, entry.count());
+                            auto& accumulated = stat[level][result];
+                            auto& entry = accumulated.entry();
+                            auto& segregatedEntry = segregatedEntries.emplace(level, result, accumulated.count());
 
                             if constexpr (hasEloDiff) segregatedEntry.second.eloDiff = entry.eloDiff();
                             if constexpr (hasWhiteElo) segregatedEntry.second.whiteElo = entry.whiteElo();
                             if constexpr (hasBlackElo) segregatedEntry.second.blackElo = entry.blackElo();
                             if constexpr (hasCountWithElo) segregatedEntry.second.countWithElo = entry.countWithElo();
 
-                            if (entry.count() > 0)
+                            if (accumulated.count() > 0)
                             {
                                 if constexpr (hasFirstGame)
                                 {
@@ -2315,8 +4542,6 @@ namespace persistence
                             }
                         }
                     }
-
-                    segregated[reverseMove] = segregatedEntries;
                 }
 
                 assignGameHeaders(
@@ -2332,41 +4557,238 @@ namespace persistence
                 return segregated;
             }
 
-            [[nodiscard]] std::vector<KeyT> getKeys(const query::PositionQueries& queries)
+            // Enough for the entries of all position queries, each with both games.
+            // Results are only a part of the position queries if children are
+            // not fetched for all selects, and the names may need more memory.
+            [[nodiscard]] static std::size_t estimateResultsMemory(const query::Request& query, std::size_t numPositionQueries)
+            {
+                constexpr std::size_t minResultsMemory = 4 * 1024;
+                constexpr std::size_t entryMemory = sizeof(query::Entry) + 2 * sizeof(GameHeader);
+
+                const std::size_t numEntries =
+                    numPositionQueries
+                    * query.fetchingOptions.size()
+                    * query.levels.size()
+                    * query.results.size();
+
+                return std::max(minResultsMemory, numEntries * entryMemory);
+            }
+
+            // If there are salts then the queries are expected to be
+            // repeated once for each salt, in the same order.
+            [[nodiscard]] QueryKeys getKeys(
+                const query::PositionQueries& queries,
+                const std::vector<ZobristKey>& salts,
+                std::pmr::memory_resource* resource
+            )
             {
-                std::vector<KeyT> keys;
+                const std::size_t numDistinct = salts.empty() ? queries.size() : queries.size() / salts.size();
+
+                QueryKeys keys(resource);
                 keys.reserve(queries.size());
-                for (auto&& q : queries)
+                for (std::size_t i = 0; i < queries.size(); ++i)
                 {
-                    keys.emplace_back(PositionWithZobrist(q.position), q.reverseMove);
+                    auto&& q = queries[i];
+                    PositionWithZobrist pos(q.position);
+                    if (!salts.empty())
+                    {
+                        pos.saltZobrist(salts[i / numDistinct]);
+                    }
+                    keys.emplace_back(pos, q.reverseMove);
                 }
                 return keys;
             }
 
+            // Returns the salts for the player filter of the query,
+            // one for each requested color. Empty if there's no filter.
+            [[nodiscard]] std::vector<ZobristKey> getPlayerSalts(const query::Request& query) const
+            {
+                std::vector<ZobristKey> salts;
+                if (!query.filters.has_value() || !query.filters->player.has_value())
+                {
+                    return salts;
+                }
+
+                if constexpr (usesGameIndex)
+                {
+                    const auto& filters = *query.filters;
+
+                    bool isKnownPlayer = false;
+                    for (auto&& level : query.levels)
+                    {
+                        if (!m_headers[level]->hasPlayerIndex())
+                        {
+                            throw std::runtime_error("The database doesn't have the player index.");
+                        }
+
+                        isKnownPlayer = isKnownPlayer || m_headers[level]->hasPlayer(*filters.player);
+                    }
+
+                    // Names of events are in the same dictionary,
+                    // so only the player index can tell them apart.
+                    if (!isKnownPlayer)
+                    {
+                        throw std::runtime_error("Unknown player " + *filters.player + ".");
+                    }
+
+                    for (Color color : { Color::White, Color::Black })
+                    {
+                        if (!filters.playerColor.has_value() || *filters.playerColor == color)
+                        {
+                            salts.emplace_back(detail::playerSalt(*filters.player, color));
+                        }
+                    }
+
+                    return salts;
+                }
+                else
+                {
+                    throw std::runtime_error("The player filter is not supported by this database format.");
+                }
+            }
+
+            // Combines the stats of the repeated queries into the first numPositionQueries.
+            void mergePlayerColorStats(
+                std::size_t numPositionQueries,
+                QueryPositionStats& stats,
+                QueryRetractionsStats& retractionsStats
+            ) const
+            {
+                for (std::size_t i = numPositionQueries; i < stats.size(); ++i)
+                {
+                    auto& dst = stats[i % numPositionQueries];
+                    for (auto&& select : values<query::Select>())
+                    {
+                        for (auto&& level : values<GameLevel>())
+                        {
+                            for (auto&& result : values<GameResult>())
+                            {
+                                dst[select][level][result].combine(stats[i][select][level][result]);
+                            }
+                        }
+                    }
+                }
+                stats.resize(numPositionQueries);
+
+                if (retractionsStats.empty())
+                {
+                    return;
+                }
+
+                for (std::size_t i = numPositionQueries; i < retractionsStats.size(); ++i)
+                {
+                    auto& dst = retractionsStats[i % numPositionQueries];
+                    for (auto&& [rmove, src] : retractionsStats[i])
+                    {
+                        auto& dstForMove = dst[rmove];
+                        for (auto&& level : values<GameLevel>())
+                        {
+                            for (auto&& result : values<GameResult>())
+                            {
+                                dstForMove[level][result].combine(src[level][result]);
+                            }
+                        }
+                    }
+                }
+                retractionsStats.resize(numPositionQueries);
+            }
+
             ImportStats importImpl(
                 AsyncStorePipeline& pipeline,
                 const ImportableFiles& files,
                 std::function<void(const std::filesystem::path& file)> completionCallback
             )
             {
-                // create buffers
-                std::vector<PersistedEntryType> bucket = pipeline.getEmptyBuffer();
+                using namespace std::literals;
+
+                // create buffers, one for each partition being imported to
+                const std::size_t numBuckets = numImportBuckets();
+                std::vector<std::vector<PersistedEntryType>> buckets;
+                for (std::size_t i = 0; i < numBuckets; ++i)
+                {
+                    buckets.emplace_back(pipeline.getEmptyBuffer());
+                }
+
+                // Positions of the entries in the buckets, only if they are verified.
+                std::vector<std::vector<PositionRecord>> bucketPositions(numBuckets);
+
+                // Partitions the buckets are stored to. Resolved when
+                // the first entry is added to the bucket.
+                std::vector<Partition*> bucketPartitions(numBuckets, nullptr);
+
+                // Months of the games with entries in the buckets
+                // and the date of the game being processed.
+                std::vector<detail::MonthRange> bucketMonths(numBuckets);
+                Date gameDate{};
 
-                auto processPosition = [this, &bucket, &pipeline](
+                // Salts of the players of the current game. Empty if the level
+                // of the game doesn't have the player index.
+                std::vector<ZobristKey> playerSalts;
+
+                auto append = [this, &buckets, &bucketPositions, &bucketPartitions, &bucketMonths, &gameDate, &pipeline](
                     const EntryConstructionParameters& params
                     ) {
-                        bucket.emplace_back(params);
+                        // The shard is selected by the hash of the entry.
+                        const PersistedEntryType entry(params);
+                        const std::uint64_t positionHash = detail::positionHashOf(entry.key());
+
+                        const std::size_t bucketIndex = importBucketIndex(params, positionHash);
+                        auto& bucket = buckets[bucketIndex];
+
+                        if (bucket.empty())
+                        {
+                            bucketPartitions[bucketIndex] = &importBucketPartition(bucketIndex, params);
+                            bucketMonths[bucketIndex] = detail::MonthRange{};
+                        }
+                        bucketMonths[bucketIndex].add(gameDate);
+
+                        bucket.emplace_back(entry);
+
+                        if (m_verifyPositions)
+                        {
+                            bucketPositions[bucketIndex].push_back(PositionRecord{ positionHash, params.position.compress() });
+                        }
 
                         if (bucket.size() == bucket.capacity())
                         {
-                            store(pipeline, bucket);
+                            store(pipeline, *bucketPartitions[bucketIndex], bucket, bucketPositions[bucketIndex], bucketMonths[bucketIndex]);
+                        }
+                };
+
+                // With the player index every position is also stored once for each player,
+                // with the hash salted for the player. Entries only aggregate games,
+                // so there is no other way to tell apart the games of a player.
+                // This triples the number of entries, so the files and merges are 3x bigger.
+                auto processPosition = [&append, &playerSalts](
+                    const EntryConstructionParameters& params
+                    ) {
+                        append(params);
+
+                        for (auto&& salt : playerSalts)
+                        {
+                            EntryConstructionParameters salted = params;
+                            salted.position.saltZobrist(salt);
+                            append(salted);
+                        }
+                };
+
+                auto setPlayerSalts = [this, &playerSalts](GameLevel level, std::string_view whitePlayer, std::string_view blackPlayer) {
+                    playerSalts.clear();
+
+                    if constexpr (usesGameIndex)
+                    {
+                        if (m_headers[level]->hasPlayerIndex())
+                        {
+                            playerSalts.emplace_back(detail::playerSalt(whitePlayer, Color::White));
+                            playerSalts.emplace_back(detail::playerSalt(blackPlayer, Color::Black));
                         }
+                    }
                 };
 
                 ImportStats stats{};
                 EntryConstructionParameters params;
 
-                auto fillCommonStatsAndParamsForGame = [this, &stats, &params] (const auto& game, GameLevel level)
+                auto fillCommonStatsAndParamsForGame = [this, &stats, &params, &gameDate] (const auto& game, GameLevel level)
                 {
                     auto& statsForLevel = stats[level];
 
@@ -2415,6 +4837,7 @@ namespace persistence
                     }
 
                     auto date = game.date();
+                    gameDate = date;
                     if constexpr (needsDate)
                     {
                         params.monthSinceYear0 = date.monthSinceYear0();
@@ -2470,6 +4893,7 @@ namespace persistence
                             params.result = *result;
 
                             fillCommonStatsAndParamsForGame(game, level);
+                            setPlayerSalts(level, game.tag("White"sv), game.tag("Black"sv));
 
                             params.position = game.startPositionWithZobrist();
                             params.reverseMove = {};
@@ -2525,6 +4949,7 @@ namespace persistence
                             auto gameHeader = game.gameHeader();
 
                             fillCommonStatsAndParamsForGame(gameHeader, level);
+                            setPlayerSalts(level, gameHeader.whitePlayer(), gameHeader.blackPlayer());
 
                             params.position = game.startPositionWithZobrist();
                             params.reverseMove = {};
@@ -2559,14 +4984,25 @@ namespace persistence
                 }
 
                 // flush buffers and return them to the pipeline for later use
-                store(pipeline, std::move(bucket));
+                for (std::size_t i = 0; i < numBuckets; ++i)
+                {
+                    if (buckets[i].empty())
+                    {
+                        continue;
+                    }
+
+                    store(pipeline, *bucketPartitions[i], std::move(buckets[i]), std::move(bucketPositions[i]), bucketMonths[i]);
+                }
 
                 return stats;
             }
 
             void store(
                 AsyncStorePipeline& pipeline,
-                std::vector<PersistedEntryType>& entries
+                Partition& partition,
+                std::vector<PersistedEntryType>& entries,
+                std::vector<PositionRecord>& positions,
+                const detail::MonthRange& monthRange
             )
             {
                 if (entries.empty())
@@ -2576,12 +5012,17 @@ namespace persistence
 
                 auto newBuffer = pipeline.getEmptyBuffer();
                 entries.swap(newBuffer);
-                m_partition.storeUnordered(pipeline, std::move(newBuffer));
+                std::vector<PositionRecord> newPositions;
+                positions.swap(newPositions);
+                partition.storeUnordered(pipeline, std::move(newBuffer), std::move(newPositions), monthRange);
             }
 
             void store(
                 AsyncStorePipeline& pipeline,
-                std::vector<PersistedEntryType>&& entries
+                Partition& partition,
+                std::vector<PersistedEntryType>&& entries,
+                std::vector<PositionRecord>&& positions,
+                const detail::MonthRange& monthRange
             )
             {
                 if (entries.empty())
@@ -2589,7 +5030,7 @@ namespace persistence
                     return;
                 }
 
-                m_partition.storeUnordered(pipeline, std::move(entries));
+                partition.storeUnordered(pipeline, std::move(entries), std::move(positions), monthRange);
             }
         };
     }
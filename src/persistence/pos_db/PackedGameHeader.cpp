@@ -1,7 +1,74 @@
 #include "PackedGameHeader.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace persistence
 {
+    template <typename GameIndexT>
+    CompactGameHeader<GameIndexT>::CompactGameHeader(
+        const PackedGameHeader<GameIndexT>& header,
+        NameIdType eventId,
+        NameIdType whiteId,
+        NameIdType blackId
+    ) :
+        m_gameIdx(header.gameIdx()),
+        m_date(header.date()),
+        m_eco(header.eco()),
+        m_plyCount(header.plyCount()),
+        m_result(header.result()),
+        m_nameIds{ eventId, whiteId, blackId }
+    {
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] GameIndexT CompactGameHeader<GameIndexT>::gameIdx() const
+    {
+        return m_gameIdx;
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] GameResult CompactGameHeader<GameIndexT>::result() const
+    {
+        return m_result;
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] Date CompactGameHeader<GameIndexT>::date() const
+    {
+        return m_date;
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] Eco CompactGameHeader<GameIndexT>::eco() const
+    {
+        return m_eco;
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] std::uint16_t CompactGameHeader<GameIndexT>::plyCount() const
+    {
+        return m_plyCount;
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] typename CompactGameHeader<GameIndexT>::NameIdType CompactGameHeader<GameIndexT>::eventId() const
+    {
+        return m_nameIds[0];
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] typename CompactGameHeader<GameIndexT>::NameIdType CompactGameHeader<GameIndexT>::whiteId() const
+    {
+        return m_nameIds[1];
+    }
+
+    template <typename GameIndexT>
+    [[nodiscard]] typename CompactGameHeader<GameIndexT>::NameIdType CompactGameHeader<GameIndexT>::blackId() const
+    {
+        return m_nameIds[2];
+    }
+
     template <typename GameIndexT>
     PackedGameHeader<GameIndexT>::PackedGameHeader(ext::Vector<char>& headers, std::size_t offset) :
         m_gameIdx{},
@@ -19,6 +86,21 @@ namespace persistence
         (void)read;
     }
 
+    template <typename GameIndexT>
+    PackedGameHeader<GameIndexT>::PackedGameHeader(const char* data, std::size_t size) :
+        m_gameIdx{},
+        m_size{},
+        m_result{},
+        m_date{},
+        m_eco{},
+        m_plyCount{},
+        m_packedStrings{}
+    {
+        const std::size_t read = std::min(size, sizeof(PackedGameHeader));
+        std::memcpy(reinterpret_cast<char*>(this), data, read);
+        ASSERT(m_size <= read);
+    }
+
     template <typename GameIndexT>
     PackedGameHeader<GameIndexT>::PackedGameHeader(const pgn::UnparsedGame& game, GameIndexT gameIdx, std::uint16_t plyCount) :
         m_gameIdx(gameIdx),
@@ -75,6 +157,22 @@ namespace persistence
         fillPackedStrings(event, white, black);
     }
 
+    template <typename GameIndexT>
+    PackedGameHeader<GameIndexT>::PackedGameHeader(
+        const CompactGameHeader<GameIndexT>& header,
+        std::string_view event,
+        std::string_view white,
+        std::string_view black
+    ) :
+        m_gameIdx(header.gameIdx()),
+        m_result(header.result()),
+        m_date(header.date()),
+        m_eco(header.eco()),
+        m_plyCount(header.plyCount())
+    {
+        fillPackedStrings(event, white, black);
+    }
+
     template <typename GameIndexT>
     [[nodiscard]] const char* PackedGameHeader<GameIndexT>::data() const
     {
@@ -150,7 +248,7 @@ namespace persistence
         const std::uint8_t whiteSize = static_cast<std::uint8_t>(std::min(white.size(), maxStringLength));
         const std::uint8_t blackSize = static_cast<std::uint8_t>(std::min(black.size(), maxStringLength));
 
-        std::uint8_t i = 0;
+        std::size_t i = 0;
         m_packedStrings[i++] = eventSize;
         event.copy(reinterpret_cast<char*>(&m_packedStrings[i]), eventSize);
         i += eventSize;
@@ -163,9 +261,12 @@ namespace persistence
         black.copy(reinterpret_cast<char*>(&m_packedStrings[i]), blackSize);
         i += blackSize;
 
-        m_size = sizeof(PackedGameHeader) - sizeof(m_packedStrings) + i;
+        m_size = static_cast<std::uint16_t>(sizeof(PackedGameHeader) - sizeof(m_packedStrings) + i);
     }
 
     template struct PackedGameHeader<std::uint32_t>;
     template struct PackedGameHeader<std::uint64_t>;
+
+    template struct CompactGameHeader<std::uint32_t>;
+    template struct CompactGameHeader<std::uint64_t>;
 }
\ No newline at end of file
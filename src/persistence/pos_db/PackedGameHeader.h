@@ -17,6 +17,55 @@
 
 namespace persistence
 {
+    template <typename GameIndexT>
+    struct PackedGameHeader;
+
+    // A header with the strings replaced by ids from a dictionary.
+    // This is what is stored on disk, the dictionary is stored separately.
+    template <typename GameIndexT>
+    struct CompactGameHeader
+    {
+        static_assert(std::is_unsigned_v<GameIndexT>);
+
+        using GameIndexType = GameIndexT;
+        using NameIdType = std::uint32_t;
+
+        CompactGameHeader() = default;
+
+        CompactGameHeader(
+            const PackedGameHeader<GameIndexT>& header,
+            NameIdType eventId,
+            NameIdType whiteId,
+            NameIdType blackId
+        );
+
+        [[nodiscard]] GameIndexType gameIdx() const;
+
+        [[nodiscard]] GameResult result() const;
+
+        [[nodiscard]] Date date() const;
+
+        [[nodiscard]] Eco eco() const;
+
+        [[nodiscard]] std::uint16_t plyCount() const;
+
+        [[nodiscard]] NameIdType eventId() const;
+
+        [[nodiscard]] NameIdType whiteId() const;
+
+        [[nodiscard]] NameIdType blackId() const;
+
+    private:
+        GameIndexType m_gameIdx;
+        Date m_date;
+        Eco m_eco;
+        std::uint16_t m_plyCount;
+        GameResult m_result;
+
+        // event, white, black
+        NameIdType m_nameIds[3];
+    };
+
     template <typename GameIndexT>
     struct PackedGameHeader
     {
@@ -30,6 +79,10 @@ namespace persistence
 
         PackedGameHeader(ext::Vector<char>& headers, std::size_t offset);
 
+        // Constructs from serialized bytes. There may be less than
+        // sizeof(PackedGameHeader) bytes available at the end of the file.
+        PackedGameHeader(const char* data, std::size_t size);
+
         PackedGameHeader(const pgn::UnparsedGame& game, GameIndexType gameIdx, std::uint16_t plyCount);
 
         PackedGameHeader(const pgn::UnparsedGame& game, GameIndexType gameIdx);
@@ -38,6 +91,13 @@ namespace persistence
 
         PackedGameHeader(const bcgn::UnparsedBcgnGame& game, GameIndexType gameIdx);
 
+        PackedGameHeader(
+            const CompactGameHeader<GameIndexT>& header,
+            std::string_view event,
+            std::string_view white,
+            std::string_view black
+        );
+
         [[nodiscard]] const char* data() const;
 
         [[nodiscard]] std::size_t size() const;
@@ -91,6 +151,18 @@ namespace persistence
     static_assert(std::is_trivially_copyable_v<PackedGameHeader32>);
     static_assert(std::is_trivially_copyable_v<PackedGameHeader64>);
 
+    using CompactGameHeader32 = CompactGameHeader<std::uint32_t>;
+    using CompactGameHeader64 = CompactGameHeader<std::uint64_t>;
+
+    static_assert(sizeof(CompactGameHeader32) == 4 + 4 + 2 + 2 + 1 + 3 /* padding */ + 12);
+    static_assert(sizeof(CompactGameHeader64) == 8 + 4 + 2 + 2 + 1 + 3 /* padding */ + 12);
+
+    static_assert(std::is_trivially_copyable_v<CompactGameHeader32>);
+    static_assert(std::is_trivially_copyable_v<CompactGameHeader64>);
+
     extern template struct PackedGameHeader<std::uint32_t>;
     extern template struct PackedGameHeader<std::uint64_t>;
+
+    extern template struct CompactGameHeader<std::uint32_t>;
+    extern template struct CompactGameHeader<std::uint64_t>;
 }
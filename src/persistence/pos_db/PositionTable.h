@@ -0,0 +1,272 @@
+#pragma once
+
+#include "chess/Position.h"
+
+#include "external_storage/External.h"
+
+#include "util/Assert.h"
+#include "util/Buffer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace persistence
+{
+    namespace pos_db
+    {
+        // A position together with the hash that identifies it in the entries.
+        // Positions with the same hash are told apart by comparing the positions.
+        struct PositionRecord
+        {
+            std::uint64_t hash;
+            CompressedPosition position;
+        };
+
+        static_assert(sizeof(PositionRecord) == 32);
+        static_assert(std::is_trivially_copyable_v<PositionRecord>);
+
+        [[nodiscard]] inline bool operator==(const PositionRecord& lhs, const PositionRecord& rhs) noexcept
+        {
+            return lhs.hash == rhs.hash && std::memcmp(&lhs.position, &rhs.position, sizeof(CompressedPosition)) == 0;
+        }
+
+        [[nodiscard]] inline bool operator!=(const PositionRecord& lhs, const PositionRecord& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+        [[nodiscard]] inline bool operator<(const PositionRecord& lhs, const PositionRecord& rhs) noexcept
+        {
+            if (lhs.hash != rhs.hash) return lhs.hash < rhs.hash;
+
+            return std::memcmp(&lhs.position, &rhs.position, sizeof(CompressedPosition)) < 0;
+        }
+
+        // Sorts the records and removes duplicates.
+        inline void sortDistinctPositionRecords(std::vector<PositionRecord>& records)
+        {
+            std::sort(records.begin(), records.end());
+            records.erase(std::unique(records.begin(), records.end()), records.end());
+        }
+
+        // Writes a position table from records appended in order.
+        // Duplicates of the last record are skipped.
+        // Counts the positions that have the same hash as a different position,
+        // these are the hash collisions within the table.
+        struct PositionTableWriter
+        {
+            static constexpr std::size_t bufferSize = 1024;
+
+            explicit PositionTableWriter(const std::filesystem::path& path) :
+                m_file(path),
+                m_out(m_file, util::DoubleBuffer<PositionRecord>(bufferSize)),
+                m_last{},
+                m_numRecords(0),
+                m_numCollisions(0)
+            {
+            }
+
+            PositionTableWriter(const PositionTableWriter&) = delete;
+            PositionTableWriter(PositionTableWriter&&) = delete;
+            PositionTableWriter& operator=(const PositionTableWriter&) = delete;
+            PositionTableWriter& operator=(PositionTableWriter&&) = delete;
+
+            void append(const PositionRecord& record)
+            {
+                if (m_numRecords != 0)
+                {
+                    if (record == m_last)
+                    {
+                        return;
+                    }
+
+                    ASSERT(m_last < record);
+
+                    if (record.hash == m_last.hash)
+                    {
+                        m_numCollisions += 1;
+                    }
+                }
+
+                m_out.push(record);
+                m_last = record;
+                m_numRecords += 1;
+            }
+
+            void append(const std::vector<PositionRecord>& records)
+            {
+                for (auto&& record : records)
+                {
+                    append(record);
+                }
+            }
+
+            void end()
+            {
+                m_out.flush();
+            }
+
+            [[nodiscard]] std::size_t numRecords() const
+            {
+                return m_numRecords;
+            }
+
+            [[nodiscard]] std::size_t numCollisions() const
+            {
+                return m_numCollisions;
+            }
+
+        private:
+            ext::BinaryOutputFile m_file;
+            ext::BackInserter<PositionRecord> m_out;
+            PositionRecord m_last;
+            std::size_t m_numRecords;
+            std::size_t m_numCollisions;
+        };
+
+        // Merges sorted position tables. Records present in
+        // multiple tables are written only once.
+        inline void mergePositionTables(const std::vector<ext::ImmutableSpan<PositionRecord>>& tables, PositionTableWriter& writer)
+        {
+            ASSERT(!tables.empty());
+
+            using IteratorType = decltype(tables.front().begin_seq());
+
+            std::vector<IteratorType> iterators;
+            iterators.reserve(tables.size());
+            for (auto&& table : tables)
+            {
+                iterators.emplace_back(table.begin_seq(util::DoubleBuffer<PositionRecord>(PositionTableWriter::bufferSize)));
+            }
+
+            const auto end = tables.front().end_seq();
+
+            // There are usually only a few tables, so a linear scan is good enough.
+            for (;;)
+            {
+                std::size_t minIndex = iterators.size();
+                for (std::size_t i = 0; i < iterators.size(); ++i)
+                {
+                    if (iterators[i] == end)
+                    {
+                        continue;
+                    }
+
+                    if (minIndex == iterators.size() || *iterators[i] < *iterators[minIndex])
+                    {
+                        minIndex = i;
+                    }
+                }
+
+                if (minIndex == iterators.size())
+                {
+                    break;
+                }
+
+                writer.append(*iterators[minIndex]);
+                ++iterators[minIndex];
+            }
+        }
+
+        // Sorted distinct position records of a data file.
+        // The hashes are uniformly distributed so the records are found
+        // with interpolation search, which usually takes only a few reads.
+        struct PositionTable
+        {
+            explicit PositionTable(ext::ImmutableSpan<PositionRecord> records) :
+                m_records(std::move(records))
+            {
+            }
+
+            [[nodiscard]] std::size_t size() const
+            {
+                return m_records.size();
+            }
+
+            [[nodiscard]] const ext::ImmutableSpan<PositionRecord>& records() const
+            {
+                return m_records;
+            }
+
+            [[nodiscard]] bool contains(std::uint64_t hash, const CompressedPosition& position) const
+            {
+                const PositionRecord key{ hash, position };
+
+                std::array<PositionRecord, windowSize> buffer;
+                for (std::size_t offset = lowerBoundWindow(hash); offset < m_records.size();)
+                {
+                    const std::size_t count = m_records.read(buffer.data(), offset, std::min(buffer.size(), m_records.size() - offset));
+                    if (count == 0)
+                    {
+                        break;
+                    }
+
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        if (buffer[i].hash < hash) continue;
+                        if (buffer[i].hash > hash) return false;
+                        if (buffer[i] == key) return true;
+                    }
+
+                    offset += count;
+                }
+
+                return false;
+            }
+
+        private:
+            static constexpr std::size_t windowSize = 64;
+            static constexpr std::size_t maxInterpolationSteps = 8;
+
+            ext::ImmutableSpan<PositionRecord> m_records;
+
+            // Returns a position such that all records before it have a lower hash
+            // and the first record with the hash, if any, is at most windowSize records later.
+            [[nodiscard]] std::size_t lowerBoundWindow(std::uint64_t hash) const
+            {
+                // Records before low have lower hashes, records from high on don't.
+                // lowHash <= hash <= highHash.
+                std::size_t low = 0;
+                std::size_t high = m_records.size();
+                std::uint64_t lowHash = 0;
+                std::uint64_t highHash = std::numeric_limits<std::uint64_t>::max();
+
+                // Interpolation search degrades on skewed data so after
+                // a few steps we fall back to bisection.
+                for (std::size_t step = 0; high - low > windowSize; ++step)
+                {
+                    std::size_t mid;
+                    if (step < maxInterpolationSteps)
+                    {
+                        const double fraction = static_cast<double>(hash - lowHash) / (static_cast<double>(highHash - lowHash) + 1.0);
+                        mid = std::min(low + static_cast<std::size_t>(fraction * (high - low)), high - 1);
+                    }
+                    else
+                    {
+                        mid = low + (high - low) / 2;
+                    }
+
+                    const std::uint64_t midHash = m_records[mid].hash;
+                    if (midHash < hash)
+                    {
+                        low = mid + 1;
+                        lowHash = midHash;
+                    }
+                    else
+                    {
+                        high = mid;
+                        highHash = midHash;
+                    }
+                }
+
+                return low;
+            }
+        };
+    }
+}
@@ -2,6 +2,7 @@
 
 #include "GameHeader.h"
 
+#include "chess/Date.h"
 #include "chess/Eran.h"
 #include "chess/GameClassification.h"
 #include "chess/MoveGenerator.h"
@@ -12,31 +13,62 @@
 
 #include "util/Assert.h"
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "json/json.hpp"
 
 namespace query
 {
+    RootPosition::RootPosition(std::string_view fen, std::optional<std::string_view> move, const allocator_type& alloc) :
+        fen(fen, alloc)
+    {
+        if (move.has_value())
+        {
+            this->move.emplace(*move, alloc);
+        }
+    }
+
+    RootPosition::RootPosition(const RootPosition& other, const allocator_type& alloc) :
+        fen(other.fen, alloc)
+    {
+        if (other.move.has_value())
+        {
+            move.emplace(*other.move, alloc);
+        }
+    }
+
     void to_json(nlohmann::json& j, const RootPosition& query)
     {
-        j["fen"] = query.fen;
+        j["fen"] = std::string(query.fen);
         if (query.move.has_value())
         {
-            j["move"] = *query.move;
+            j["move"] = std::string(*query.move);
         }
     }
 
     void from_json(const nlohmann::json& j, RootPosition& query)
     {
-        j["fen"].get_to(query.fen);
+        query.fen = j["fen"].get_ref<const std::string&>();
         if (j.contains("move"))
         {
-            query.move = j["move"].get<std::string>();
+            query.move.emplace(j["move"].get_ref<const std::string&>());
         }
         else
         {
@@ -157,6 +189,16 @@ namespace query
 
         j["include_unknown_elo"] = filters.includeUnknownElo;
         j["include_unknown_month"] = filters.includeUnknownMonth;
+
+        if (filters.player.has_value())
+        {
+            j["player"] = *filters.player;
+        }
+
+        if (filters.playerColor.has_value())
+        {
+            j["player_color"] = *filters.playerColor == Color::White ? "white" : "black";
+        }
     }
 
     void from_json(const nlohmann::json& j, QueryFilters& filters)
@@ -190,6 +232,28 @@ namespace query
         {
             filters.includeUnknownMonth = j["include_unknown_month"].get<bool>();
         }
+
+        if (j.contains("player"))
+        {
+            filters.player = j["player"].get<std::string>();
+        }
+
+        if (j.contains("player_color"))
+        {
+            const auto colorStr = j["player_color"].get<std::string>();
+            if (colorStr == "white")
+            {
+                filters.playerColor = Color::White;
+            }
+            else if (colorStr == "black")
+            {
+                filters.playerColor = Color::Black;
+            }
+            else
+            {
+                throw std::runtime_error("Invalid player color: " + colorStr);
+            }
+        }
     }
 
     void to_json(nlohmann::json& j, const Request& query)
@@ -372,6 +436,21 @@ namespace query
         }
     }
 
+    SegregatedEntries::SegregatedEntries(const allocator_type& alloc) :
+        m_entries(alloc)
+    {
+    }
+
+    SegregatedEntries::SegregatedEntries(const SegregatedEntries& other, const allocator_type& alloc) :
+        m_entries(other.m_entries, alloc)
+    {
+    }
+
+    SegregatedEntries::SegregatedEntries(SegregatedEntries&& other, const allocator_type& alloc) :
+        m_entries(std::move(other.m_entries), alloc)
+    {
+    }
+
     void to_json(nlohmann::json& j, const SegregatedEntries& entries)
     {
         j = nlohmann::json::object();
@@ -410,8 +489,42 @@ namespace query
         throw std::out_of_range("");
     }
 
-    ResultForRoot::ResultForRoot(const RootPosition& pos) :
-        position(pos)
+    ResultForRoot::SelectResult::SelectResult(const allocator_type& alloc) :
+        root(alloc),
+        children(alloc)
+    {
+    }
+
+    ResultForRoot::SelectResult::SelectResult(const SelectResult& other, const allocator_type& alloc) :
+        root(other.root, alloc),
+        children(other.children, alloc)
+    {
+    }
+
+    ResultForRoot::SelectResult::SelectResult(SelectResult&& other, const allocator_type& alloc) :
+        root(std::move(other.root), alloc),
+        children(std::move(other.children), alloc)
+    {
+    }
+
+    ResultForRoot::ResultForRoot(const RootPosition& pos, const allocator_type& alloc) :
+        position(pos, alloc),
+        resultsBySelect(alloc),
+        retractionsResults{ RetractionsQueryResults(alloc) }
+    {
+    }
+
+    ResultForRoot::ResultForRoot(const ResultForRoot& other, const allocator_type& alloc) :
+        position(other.position, alloc),
+        resultsBySelect(other.resultsBySelect, alloc),
+        retractionsResults{ RetractionsQueryResults(other.retractionsResults.retractions, alloc) }
+    {
+    }
+
+    ResultForRoot::ResultForRoot(ResultForRoot&& other, const allocator_type& alloc) :
+        position(other.position, alloc),
+        resultsBySelect(std::move(other.resultsBySelect), alloc),
+        retractionsResults{ RetractionsQueryResults(std::move(other.retractionsResults.retractions), alloc) }
     {
     }
 
@@ -460,12 +573,533 @@ namespace query
         }
     }
 
+    Response::Response(
+        std::unique_ptr<std::pmr::memory_resource> memory,
+        Request query,
+        std::pmr::vector<ResultForRoot> results
+    ) :
+        m_memory(std::move(memory)),
+        query(std::move(query)),
+        results(std::move(results))
+    {
+    }
+
     void to_json(nlohmann::json& j, const Response& response)
     {
         j = nlohmann::json{
             { "query", response.query },
             { "results", response.results }
         };
+
+        if (response.exactMonths.has_value())
+        {
+            j["exact_months"] = *response.exactMonths;
+        }
+
+        if (response.exactElo.has_value())
+        {
+            j["exact_elo"] = *response.exactElo;
+        }
+    }
+
+    [[nodiscard]] static Date gameDateOfJson(const nlohmann::json& header)
+    {
+        return Date::tryParse(header["date"].get<std::string>()).value_or(Date{});
+    }
+
+    template <typename IntT>
+    static void addEntryFieldJson(nlohmann::json& into, const nlohmann::json& from, const char* key)
+    {
+        if (from.contains(key))
+        {
+            into[key] = into.value(key, IntT{}) + from[key].get<IntT>();
+        }
+    }
+
+    static void mergeEntryJson(nlohmann::json& into, const nlohmann::json& from)
+    {
+        addEntryFieldJson<std::uint64_t>(into, from, "count");
+        addEntryFieldJson<std::int64_t>(into, from, "elo_diff");
+        addEntryFieldJson<std::uint64_t>(into, from, "count_with_elo");
+        addEntryFieldJson<std::uint64_t>(into, from, "white_elo");
+        addEntryFieldJson<std::uint64_t>(into, from, "black_elo");
+
+        if (from.contains("first_game"))
+        {
+            if (!into.contains("first_game") || gameDateOfJson(from["first_game"]) < gameDateOfJson(into["first_game"]))
+            {
+                into["first_game"] = from["first_game"];
+            }
+        }
+
+        if (from.contains("last_game"))
+        {
+            if (!into.contains("last_game") || !(gameDateOfJson(from["last_game"]) < gameDateOfJson(into["last_game"])))
+            {
+                into["last_game"] = from["last_game"];
+            }
+        }
+    }
+
+    // Results are nested objects keyed by select, move, level, and result,
+    // with entries at the bottom. Entries are recognized by the count.
+    static void mergeResultJson(nlohmann::json& into, const nlohmann::json& from)
+    {
+        if (from.contains("count"))
+        {
+            mergeEntryJson(into, from);
+            return;
+        }
+
+        for (auto&& [key, value] : from.items())
+        {
+            if (!into.contains(key))
+            {
+                into[key] = value;
+            }
+            else if (key != "position")
+            {
+                mergeResultJson(into[key], value);
+            }
+        }
+    }
+
+    void mergeResponseJson(nlohmann::json& into, const nlohmann::json& from)
+    {
+        if (from.contains("exact_months"))
+        {
+            into["exact_months"] = into.value("exact_months", true) && from["exact_months"].get<bool>();
+        }
+
+        if (from.contains("exact_elo"))
+        {
+            into["exact_elo"] = into.value("exact_elo", true) && from["exact_elo"].get<bool>();
+        }
+
+        auto& intoResults = into["results"];
+        const auto& fromResults = from["results"];
+        if (intoResults.size() != fromResults.size())
+        {
+            throw std::runtime_error("Responses have different numbers of results.");
+        }
+
+        for (std::size_t i = 0; i < intoResults.size(); ++i)
+        {
+            if (intoResults[i].is_null())
+            {
+                intoResults[i] = fromResults[i];
+            }
+            else if (!fromResults[i].is_null())
+            {
+                mergeResultJson(intoResults[i], fromResults[i]);
+            }
+        }
+    }
+
+    nlohmann::json routeRequestJson(
+        const std::string& request,
+        const std::vector<std::string>& backendAddresses,
+        const std::function<std::string(std::size_t, const std::string&)>& sendToBackend
+        )
+    {
+        struct BackendResponse
+        {
+            std::string response;
+            std::chrono::microseconds time;
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::future<BackendResponse>> futures;
+        for (std::size_t i = 0; i < backendAddresses.size(); ++i)
+        {
+            futures.emplace_back(std::async(std::launch::async, [i, &request, &sendToBackend]() {
+                const auto backendStart = std::chrono::steady_clock::now();
+                auto response = sendToBackend(i, request);
+                const auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - backendStart);
+                return BackendResponse{ std::move(response), time };
+                }));
+        }
+
+        nlohmann::json merged;
+        auto backendsJson = nlohmann::json::array();
+        std::optional<nlohmann::json> errorJson;
+        for (std::size_t i = 0; i < backendAddresses.size(); ++i)
+        {
+            try
+            {
+                auto backendResponse = futures[i].get();
+                auto json = nlohmann::json::parse(backendResponse.response);
+                if (json.contains("error"))
+                {
+                    throw std::runtime_error(json["error"].get<std::string>());
+                }
+
+                if (i == 0)
+                {
+                    merged = std::move(json);
+                }
+                else
+                {
+                    mergeResponseJson(merged, json);
+                }
+
+                backendsJson.push_back(nlohmann::json{
+                    { "address", backendAddresses[i] },
+                    { "time_us", backendResponse.time.count() }
+                    });
+            }
+            catch (std::exception& ex)
+            {
+                if (!errorJson.has_value())
+                {
+                    errorJson = nlohmann::json::object({ { "error", ex.what() }, { "backend", backendAddresses[i] } });
+                }
+            }
+        }
+
+        if (errorJson.has_value())
+        {
+            return std::move(*errorJson);
+        }
+
+        const auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        merged["router"] = nlohmann::json{
+            { "backends", std::move(backendsJson) },
+            { "time_us", time.count() }
+        };
+
+        return merged;
+    }
+
+    // NOTE: Objects are written with keys in sorted order
+    //       because that's how the json library stores them.
+
+    std::string_view ResponseWriter::write(const Response& response)
+    {
+        m_out.clear();
+
+        m_out += '{';
+        if (response.exactElo.has_value())
+        {
+            m_out += *response.exactElo ? "\"exact_elo\":true," : "\"exact_elo\":false,";
+        }
+        if (response.exactMonths.has_value())
+        {
+            m_out += *response.exactMonths ? "\"exact_months\":true," : "\"exact_months\":false,";
+        }
+        m_out += "\"query\":";
+        m_out += nlohmann::json(response.query).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        m_out += ",\"results\":[";
+        bool first = true;
+        for (auto&& result : response.results)
+        {
+            if (!first) m_out += ',';
+            first = false;
+
+            writeResult(result);
+        }
+        m_out += "]}";
+
+        return m_out;
+    }
+
+    void ResponseWriter::writeResult(const ResultForRoot& result)
+    {
+        const std::optional<Position> positionOpt = result.position.tryGet();
+        if (!positionOpt.has_value())
+        {
+            m_out += "null";
+            return;
+        }
+
+        const auto& position = *positionOpt;
+
+        constexpr std::string_view positionKey = "position";
+        constexpr std::string_view retractionsKey = "retractions";
+
+        std::array<std::string_view, cardinality<Select>() + 2> keys{};
+        std::size_t numKeys = 0;
+        keys[numKeys++] = positionKey;
+        if (!result.retractionsResults.retractions.empty())
+        {
+            keys[numKeys++] = retractionsKey;
+        }
+        for (auto&& [select, subresult] : result.resultsBySelect)
+        {
+            keys[numKeys++] = toString(select);
+        }
+        std::sort(keys.begin(), keys.begin() + numKeys);
+
+        m_out += '{';
+        for (std::size_t i = 0; i < numKeys; ++i)
+        {
+            if (i != 0) m_out += ',';
+
+            writeString(keys[i]);
+            m_out += ':';
+
+            if (keys[i] == positionKey)
+            {
+                m_out += "{\"fen\":";
+                writeString(result.position.fen);
+                if (result.position.move.has_value())
+                {
+                    m_out += ",\"move\":";
+                    writeString(*result.position.move);
+                }
+                m_out += '}';
+            }
+            else if (keys[i] == retractionsKey)
+            {
+                m_keyedEntries.clear();
+                for (auto&& [rmove, entries] : result.retractionsResults.retractions)
+                {
+                    m_keyedEntries.emplace_back(eran::reverseMoveToEran(position, rmove), &entries);
+                }
+                writeKeyedEntries();
+            }
+            else
+            {
+                const auto& subresult = result.resultsBySelect.at(*fromString<Select>(keys[i]));
+
+                m_keyedEntries.clear();
+                m_keyedEntries.emplace_back("--", &subresult.root);
+                for (auto&& [move, entries] : subresult.children)
+                {
+                    m_keyedEntries.emplace_back(
+                        san::moveToSan<san::SanSpec::Capture | san::SanSpec::Check | san::SanSpec::Compact>(position, move),
+                        &entries
+                    );
+                }
+                writeKeyedEntries();
+            }
+        }
+        m_out += '}';
+    }
+
+    void ResponseWriter::writeKeyedEntries()
+    {
+        std::sort(
+            m_keyedEntries.begin(),
+            m_keyedEntries.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; }
+        );
+
+        m_out += '{';
+        bool first = true;
+        for (auto&& [key, entries] : m_keyedEntries)
+        {
+            if (!first) m_out += ',';
+            first = false;
+
+            writeString(key);
+            m_out += ':';
+            writeEntries(*entries);
+        }
+        m_out += '}';
+    }
+
+    void ResponseWriter::writeEntries(const SegregatedEntries& entries)
+    {
+        struct KeyedEntry
+        {
+            std::string_view level;
+            std::string_view result;
+            const Entry* entry;
+        };
+
+        // Later entries for the same origin replace earlier ones, as in to_json.
+        std::array<KeyedEntry, cardinality<GameLevel>() * cardinality<GameResult>()> keyedEntries{};
+        std::size_t numEntries = 0;
+        for (auto&& [origin, entry] : entries)
+        {
+            const KeyedEntry keyedEntry{
+                toString(origin.level),
+                toString(GameResultWordFormat{}, origin.result),
+                &entry
+            };
+
+            auto it = std::find_if(
+                keyedEntries.begin(),
+                keyedEntries.begin() + numEntries,
+                [&keyedEntry](const KeyedEntry& e) { return e.level == keyedEntry.level && e.result == keyedEntry.result; }
+            );
+            if (it == keyedEntries.begin() + numEntries)
+            {
+                ++numEntries;
+            }
+            *it = keyedEntry;
+        }
+
+        std::sort(
+            keyedEntries.begin(),
+            keyedEntries.begin() + numEntries,
+            [](const KeyedEntry& lhs, const KeyedEntry& rhs) {
+                return std::tie(lhs.level, lhs.result) < std::tie(rhs.level, rhs.result);
+            }
+        );
+
+        m_out += '{';
+        for (std::size_t i = 0; i < numEntries; ++i)
+        {
+            const bool isFirstOfLevel = i == 0 || keyedEntries[i - 1].level != keyedEntries[i].level;
+            if (isFirstOfLevel)
+            {
+                if (i != 0) m_out += "},";
+                writeString(keyedEntries[i].level);
+                m_out += ":{";
+            }
+            else
+            {
+                m_out += ',';
+            }
+
+            writeString(keyedEntries[i].result);
+            m_out += ':';
+            writeEntry(*keyedEntries[i].entry);
+        }
+        if (numEntries != 0) m_out += '}';
+        m_out += '}';
+    }
+
+    void ResponseWriter::writeEntry(const Entry& entry)
+    {
+        m_out += '{';
+
+        if (entry.blackElo.has_value())
+        {
+            m_out += "\"black_elo\":";
+            writeInt(*entry.blackElo);
+            m_out += ',';
+        }
+
+        m_out += "\"count\":";
+        writeInt(entry.count);
+
+        if (entry.countWithElo.has_value())
+        {
+            m_out += ",\"count_with_elo\":";
+            writeInt(*entry.countWithElo);
+        }
+
+        if (entry.eloDiff.has_value())
+        {
+            m_out += ",\"elo_diff\":";
+            writeInt(*entry.eloDiff);
+        }
+
+        if (entry.firstGame.has_value())
+        {
+            m_out += ",\"first_game\":";
+            writeGameHeader(*entry.firstGame);
+        }
+
+        if (entry.lastGame.has_value())
+        {
+            m_out += ",\"last_game\":";
+            writeGameHeader(*entry.lastGame);
+        }
+
+        if (entry.whiteElo.has_value())
+        {
+            m_out += ",\"white_elo\":";
+            writeInt(*entry.whiteElo);
+        }
+
+        m_out += '}';
+    }
+
+    void ResponseWriter::writeGameHeader(const persistence::GameHeader& header)
+    {
+        m_out += "{\"black\":";
+        writeString(header.black());
+        m_out += ",\"date\":";
+        writeString(header.date().toString());
+        m_out += ",\"eco\":";
+        writeString(header.eco().toString());
+        m_out += ",\"event\":";
+        writeString(header.event());
+        m_out += ",\"game_id\":";
+        writeInt(header.gameIdx());
+
+        const auto plyCount = header.plyCount();
+        if (plyCount.has_value())
+        {
+            m_out += ",\"ply_count\":";
+            writeInt(*plyCount);
+        }
+
+        m_out += ",\"result\":";
+        writeString(toString(GameResultPgnFormat{}, header.result()));
+        m_out += ",\"white\":";
+        writeString(header.white());
+        m_out += '}';
+    }
+
+    void ResponseWriter::writeString(std::string_view str)
+    {
+        const bool isAscii = std::all_of(str.begin(), str.end(), [](char c) {
+            return static_cast<unsigned char>(c) < 0x80;
+            });
+
+        if (!isAscii)
+        {
+            // Let the json library deal with invalid UTF-8.
+            m_out += nlohmann::json(std::string(str)).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+            return;
+        }
+
+        m_out += '"';
+        for (char c : str)
+        {
+            switch (c)
+            {
+            case '"':
+                m_out += "\\\"";
+                break;
+            case '\\':
+                m_out += "\\\\";
+                break;
+            case '\b':
+                m_out += "\\b";
+                break;
+            case '\f':
+                m_out += "\\f";
+                break;
+            case '\n':
+                m_out += "\\n";
+                break;
+            case '\r':
+                m_out += "\\r";
+                break;
+            case '\t':
+                m_out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    constexpr char hex[] = "0123456789abcdef";
+                    m_out += "\\u00";
+                    m_out += hex[(c >> 4) & 0xF];
+                    m_out += hex[c & 0xF];
+                }
+                else
+                {
+                    m_out += c;
+                }
+            }
+        }
+        m_out += '"';
+    }
+
+    template <typename IntT>
+    void ResponseWriter::writeInt(IntT value)
+    {
+        char buffer[24];
+        const auto [end, ec] = std::to_chars(std::begin(buffer), std::end(buffer), value);
+        ASSERT(ec == std::errc());
+        m_out.append(buffer, end);
     }
 
     [[nodiscard]] SelectMask selectMask(const Request& query)
@@ -498,9 +1132,13 @@ namespace query
     {
     }
 
-    [[nodiscard]] PositionQueries gatherPositionQueries(const std::vector<RootPosition>& rootPositions, bool fetchChildren)
+    [[nodiscard]] PositionQueries gatherPositionQueries(
+        const std::vector<RootPosition>& rootPositions,
+        bool fetchChildren,
+        std::pmr::memory_resource* resource
+    )
     {
-        PositionQueries queries;
+        PositionQueries queries(resource);
         for (std::size_t i = 0; i < rootPositions.size(); ++i)
         {
             const auto& rootPos = rootPositions[i];
@@ -526,19 +1164,30 @@ namespace query
         return queries;
     }
 
-    [[nodiscard]] PositionQueries gatherPositionQueries(const Request& query)
+    [[nodiscard]] PositionQueries gatherPositionQueries(
+        const Request& query,
+        std::pmr::memory_resource* resource
+    )
     {
         const bool fetchChildren = std::any_of(
             query.fetchingOptions.begin(),
             query.fetchingOptions.end(),
             [](auto&& v) {return v.second.fetchChildren; }
         );
-        return gatherPositionQueries(query.positions, fetchChildren);
+        return gatherPositionQueries(query.positions, fetchChildren, resource);
+    }
+
+    [[nodiscard]] EnumArray<Select, SegregatedEntries> makeEntriesBySelect(const SegregatedEntries::allocator_type& alloc)
+    {
+        static_assert(cardinality<Select>() == 3);
+
+        return { { SegregatedEntries(alloc), SegregatedEntries(alloc), SegregatedEntries(alloc) } };
     }
 
-    [[nodiscard]] std::vector<ResultForRoot> unflatten(PositionQueryResults&& raw, const Request& query, const PositionQueries& individialQueries)
+    [[nodiscard]] std::pmr::vector<ResultForRoot> unflatten(PositionQueryResults&& raw, const Request& query, const PositionQueries& individialQueries)
     {
-        std::vector<ResultForRoot> results;
+        std::pmr::vector<ResultForRoot> results(raw.get_allocator());
+        results.reserve(query.positions.size());
         for (auto&& rootPosition : query.positions)
         {
             results.emplace_back(rootPosition);
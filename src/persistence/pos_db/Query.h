@@ -7,10 +7,14 @@
 
 #include "enum/Enum.h"
 
+#include <functional>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "json/json.hpp"
@@ -31,11 +35,25 @@ namespace query
     // is considered to have a history.
     struct RootPosition
     {
-        std::string fen;
+        using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+        std::pmr::string fen;
 
         // NOTE: If move is specified then the query is made on a 
         // position that arises from fen after the move is made.
-        std::optional<std::string> move;
+        std::optional<std::pmr::string> move;
+
+        RootPosition() = default;
+
+        RootPosition(std::string_view fen, std::optional<std::string_view> move, const allocator_type& alloc = {});
+
+        RootPosition(const RootPosition& other) = default;
+        RootPosition(RootPosition&& other) = default;
+
+        RootPosition(const RootPosition& other, const allocator_type& alloc);
+
+        RootPosition& operator=(const RootPosition& other) = default;
+        RootPosition& operator=(RootPosition&& other) = default;
 
         friend void to_json(nlohmann::json& j, const RootPosition& query);
 
@@ -145,6 +163,12 @@ namespace query
         bool includeUnknownElo = false;
         bool includeUnknownMonth = false;
 
+        // Restricts the query to games of this player.
+        // If the color is not specified then games with either color count.
+        // Requires a database with the player index, the player has to be in it.
+        std::optional<std::string> player;
+        std::optional<Color> playerColor;
+
         friend void to_json(nlohmann::json& j, const QueryFilters& filters);
 
         friend void from_json(const nlohmann::json& j, QueryFilters& filters);
@@ -201,8 +225,21 @@ namespace query
         };
 
     public:
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
         SegregatedEntries() = default;
 
+        explicit SegregatedEntries(const allocator_type& alloc);
+
+        SegregatedEntries(const SegregatedEntries& other) = default;
+        SegregatedEntries(SegregatedEntries&& other) = default;
+
+        SegregatedEntries(const SegregatedEntries& other, const allocator_type& alloc);
+        SegregatedEntries(SegregatedEntries&& other, const allocator_type& alloc);
+
+        SegregatedEntries& operator=(const SegregatedEntries& other) = default;
+        SegregatedEntries& operator=(SegregatedEntries&& other) = default;
+
         template <typename... Args>
         decltype(auto) emplace(GameLevel level, GameResult result, Args&& ... args)
         {
@@ -240,39 +277,149 @@ namespace query
         const Entry& at(GameLevel level, GameResult result) const;
 
     private:
-        std::vector<std::pair<Origin, Entry>> m_entries;
+        std::pmr::vector<std::pair<Origin, Entry>> m_entries;
     };
 
+    // Results are allocator aware so that all of them can be
+    // allocated from the memory of the response.
     struct ResultForRoot
     {
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
         struct SelectResult
         {
+            using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
             SegregatedEntries root;
-            std::map<Move, SegregatedEntries, MoveCompareLess> children;
+            std::pmr::map<Move, SegregatedEntries, MoveCompareLess> children;
+
+            SelectResult() = default;
+
+            explicit SelectResult(const allocator_type& alloc);
+
+            SelectResult(const SelectResult& other) = default;
+            SelectResult(SelectResult&& other) = default;
+
+            SelectResult(const SelectResult& other, const allocator_type& alloc);
+            SelectResult(SelectResult&& other, const allocator_type& alloc);
+
+            SelectResult& operator=(const SelectResult& other) = default;
+            SelectResult& operator=(SelectResult&& other) = default;
         };
 
         struct RetractionsResult
         {
-            std::map<ReverseMove, SegregatedEntries, ReverseMoveCompareLess> retractions;
+            std::pmr::map<ReverseMove, SegregatedEntries, ReverseMoveCompareLess> retractions;
         };
 
         RootPosition position;
-        std::map<Select, SelectResult> resultsBySelect;
+        std::pmr::map<Select, SelectResult> resultsBySelect;
         RetractionsResult retractionsResults;
 
-        ResultForRoot(const RootPosition& pos);
+        ResultForRoot(const RootPosition& pos, const allocator_type& alloc = {});
+
+        ResultForRoot(const ResultForRoot& other) = default;
+        ResultForRoot(ResultForRoot&& other) = default;
+
+        ResultForRoot(const ResultForRoot& other, const allocator_type& alloc);
+        ResultForRoot(ResultForRoot&& other, const allocator_type& alloc);
+
+        ResultForRoot& operator=(const ResultForRoot& other) = default;
+        ResultForRoot& operator=(ResultForRoot&& other) = default;
 
         friend void to_json(nlohmann::json& j, const ResultForRoot& result);
     };
 
     struct Response
     {
+        Response() = default;
+
+        // The results are allocated from the memory,
+        // which is owned by the response from then on.
+        Response(
+            std::unique_ptr<std::pmr::memory_resource> memory,
+            Request query,
+            std::pmr::vector<ResultForRoot> results
+        );
+
+        Response(Response&& other) = default;
+
+        // Not assignable, because the memory would be replaced
+        // before the results allocated from it are released.
+        Response& operator=(Response&& other) = delete;
+
+    private:
+        // Declared first so that it outlives the results.
+        std::unique_ptr<std::pmr::memory_resource> m_memory;
+
+    public:
         Request query;
-        std::vector<ResultForRoot> results;
+        std::pmr::vector<ResultForRoot> results;
+
+        // Only present when the request has a month filter. Databases that skip
+        // whole data files by the months of their games count all games of the
+        // files that are searched, so it's false when some of them are from
+        // outside the requested months.
+        std::optional<bool> exactMonths;
+
+        // Same for the elo filter. Databases that skip whole elo bands count
+        // all games of the bands that are searched.
+        std::optional<bool> exactElo;
 
         friend void to_json(nlohmann::json& j, const Response& response);
     };
 
+    // Adds the results of a serialized response to the results of another
+    // response to the same request, as if they came from a single database.
+    // Used to combine responses of databases with different games or positions.
+    // Counts and elo sums are added. The first and last games are chosen by date,
+    // ties go to the first and the second response respectively.
+    void mergeResponseJson(nlohmann::json& into, const nlohmann::json& from);
+
+    // Sends a serialized request to all backends at once, sendToBackend(i, request)
+    // returning the serialized response of the i-th one, and merges the responses
+    // with mergeResponseJson. The address and the time taken by each backend are
+    // added under "router". If a backend fails or responds with an error the result
+    // is an error naming the first such backend. All backends are waited for.
+    [[nodiscard]] nlohmann::json routeRequestJson(
+        const std::string& request,
+        const std::vector<std::string>& backendAddresses,
+        const std::function<std::string(std::size_t, const std::string&)>& sendToBackend
+        );
+
+    // Serializes responses to the same text as dumping to_json(response),
+    // but writes it directly without building the json value first.
+    // The output buffer and scratch space are reused between calls,
+    // so once they have grown large enough serialization of results
+    // doesn't allocate at all. Only the echoed request and strings
+    // with non ASCII characters go through the json library.
+    struct ResponseWriter
+    {
+        ResponseWriter() = default;
+
+        // The returned view is valid until the next call.
+        [[nodiscard]] std::string_view write(const Response& response);
+
+    private:
+        std::string m_out;
+        std::vector<std::pair<std::string, const SegregatedEntries*>> m_keyedEntries;
+
+        void writeResult(const ResultForRoot& result);
+
+        void writeKeyedEntries();
+
+        void writeEntries(const SegregatedEntries& entries);
+
+        void writeEntry(const Entry& entry);
+
+        void writeGameHeader(const persistence::GameHeader& header);
+
+        void writeString(std::string_view str);
+
+        template <typename IntT>
+        void writeInt(IntT value);
+    };
+
     enum struct PositionQueryOrigin
     {
         Root,
@@ -399,18 +546,32 @@ namespace query
         PositionQuery(const Position& pos, const ReverseMove& rev, std::size_t rootId, PositionQueryOrigin origin);
     };
 
-    using PositionQueries = std::vector<PositionQuery>;
+    using PositionQueries = std::pmr::vector<PositionQuery>;
 
-    [[nodiscard]] PositionQueries gatherPositionQueries(const std::vector<RootPosition>& rootPositions, bool fetchChildren);
+    [[nodiscard]] PositionQueries gatherPositionQueries(
+        const std::vector<RootPosition>& rootPositions,
+        bool fetchChildren,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    );
 
-    [[nodiscard]] PositionQueries gatherPositionQueries(const Request& query);
+    [[nodiscard]] PositionQueries gatherPositionQueries(
+        const Request& query,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource()
+    );
 
     // This is the result type to be used by databases' query functions
     // It is flatter, allows easier in memory manipulation.
-    using PositionQueryResults = std::vector<EnumArray<Select, SegregatedEntries>>;
-    using RetractionsQueryResults = std::map<ReverseMove, query::SegregatedEntries, ReverseMoveCompareLess>;
+    // The entries are moved to the unflattened results, so they
+    // should be allocated from the same memory resource.
+    using PositionQueryResults = std::pmr::vector<EnumArray<Select, SegregatedEntries>>;
+    using RetractionsQueryResults = std::pmr::map<ReverseMove, query::SegregatedEntries, ReverseMoveCompareLess>;
+
+    // EnumArray is not allocator aware, so the entries have to be
+    // given the allocator when the array is constructed.
+    [[nodiscard]] EnumArray<Select, SegregatedEntries> makeEntriesBySelect(const SegregatedEntries::allocator_type& alloc);
 
-    [[nodiscard]] std::vector<ResultForRoot> unflatten(PositionQueryResults&& raw, const Request& query, const PositionQueries& individialQueries);
+    // The results are allocated from the same memory resource as raw.
+    [[nodiscard]] std::pmr::vector<ResultForRoot> unflatten(PositionQueryResults&& raw, const Request& query, const PositionQueries& individialQueries);
 
     struct GameHeaderDestination
     {
@@ -440,8 +601,8 @@ namespace query
     template <typename GameHeaderT>
     void assignGameHeaders(
         PositionQueryResults& raw, 
-        const std::vector<GameHeaderDestination>& destinations, 
-        std::vector<GameHeaderT>&& headers
+        const std::pmr::vector<GameHeaderDestination>& destinations, 
+        std::pmr::vector<GameHeaderT>&& headers
     )
     {
         ASSERT(destinations.size() == headers.size());
@@ -459,8 +620,8 @@ namespace query
     template <typename GameHeaderT>
     void assignGameHeaders(
         RetractionsQueryResults& raw, 
-        const std::vector<GameHeaderDestinationForRetraction>& destinations, 
-        std::vector<GameHeaderT>&& headers
+        const std::pmr::vector<GameHeaderDestinationForRetraction>& destinations, 
+        std::pmr::vector<GameHeaderT>&& headers
     )
     {
         ASSERT(destinations.size() == headers.size());
@@ -10,6 +10,7 @@
 #include "util/ArithmeticUtility.h"
 #include "util/SemanticVersion.h"
 
+#include <array>
 #include <cstdint>
 
 namespace persistence
@@ -402,6 +403,16 @@ namespace persistence
             Entry& operator=(const Entry&) = default;
             Entry& operator=(Entry&&) = default;
 
+            // The bits of the first 16 bytes of the entry, viewed as four 32 bit words,
+            // that are compared by CompareEqualWithReverseMove and CompareEqualWithoutReverseMove.
+            // Allows comparing multiple entries at once.
+            static constexpr std::array<std::uint32_t, 4> equalWithReverseMoveMask{
+                0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, PackedReverseMove::mask << Key::reverseMoveShift
+            };
+            static constexpr std::array<std::uint32_t, 4> equalWithoutReverseMoveMask{
+                0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0
+            };
+
             struct CompareLessWithoutReverseMove
             {
                 [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
@@ -14,6 +14,7 @@
 #include "util/ArithmeticUtility.h"
 #include "util/BitPacking.h"
 
+#include <array>
 #include <cstdint>
 
 namespace persistence
@@ -325,6 +326,16 @@ namespace persistence
             SmearedEntry& operator=(const SmearedEntry&) = default;
             SmearedEntry& operator=(SmearedEntry&&) = default;
 
+            // The bits of the first 16 bytes of the entry (and the key), viewed as four 32 bit words,
+            // that are compared by CompareEqualWithReverseMove and CompareEqualWithoutReverseMove.
+            // Allows comparing multiple entries at once.
+            static constexpr std::array<std::uint32_t, 4> equalWithReverseMoveMask{
+                0xFFFFFFFFu, 0xFFFFFFFFu, HashLast::mask | PackedReverseMove::mask, 0
+            };
+            static constexpr std::array<std::uint32_t, 4> equalWithoutReverseMoveMask{
+                0xFFFFFFFFu, 0xFFFFFFFFu, HashLast::mask, 0
+            };
+
             [[nodiscard]] GameLevel level() const
             {
                 return fromOrdinal<GameLevel>(static_cast<int>(m_packed1.get<Level>()));
@@ -550,6 +561,9 @@ namespace persistence
         {
             using SmearedEntryType = SmearedEntry;
 
+            // The count is the longest field, split into 1 bit parts.
+            static constexpr std::size_t maxRunLength = 64 / SmearedEntry::Count::size;
+
             struct Sentinel { };
 
             struct Iterator
@@ -652,6 +666,33 @@ namespace persistence
                 m_firstGameIndex = smeared.m_firstGameIndex;
             }
 
+            // Decodes all smeared entries of an unsmeared entry at once, the first one
+            // has to be the one with isFirst(). Every part has its bits at a known
+            // position, so there is no state carried from one part to the next.
+            UnsmearedEntry(const SmearedEntry* run, std::size_t length) :
+                UnsmearedEntry(run[0])
+            {
+                ASSERT(length >= 1);
+                ASSERT(length <= maxRunLength);
+
+                for (std::size_t i = 1; i < length; ++i)
+                {
+                    ASSERT(!run[i].isFirst());
+
+                    m_countWithElo += static_cast<std::uint64_t>(run[i].countWithElo()) << (i * SmearedEntry::CountWithElo::size);
+                    m_count += static_cast<std::uint64_t>(run[i].count()) << (i * SmearedEntry::Count::size);
+                    m_firstGameIndex = std::min(m_firstGameIndex, run[i].m_firstGameIndex);
+                }
+
+                // Further parts can only have count bits.
+                const std::size_t numEloParts = std::min<std::size_t>(length, (64 + SmearedEntry::TotalWhiteElo::size - 1) / SmearedEntry::TotalWhiteElo::size);
+                for (std::size_t i = 1; i < numEloParts; ++i)
+                {
+                    m_totalWhiteElo += static_cast<std::uint64_t>(run[i].totalWhiteElo()) << (i * SmearedEntry::TotalWhiteElo::size);
+                    m_totalBlackElo += static_cast<std::uint64_t>(run[i].totalBlackElo()) << (i * SmearedEntry::TotalBlackElo::size);
+                }
+            }
+
             void combine(const UnsmearedEntry& other)
             {
                 m_totalWhiteElo += other.m_totalWhiteElo;
@@ -663,17 +704,6 @@ namespace persistence
                 m_firstGameIndex = std::min(m_firstGameIndex, other.m_firstGameIndex);
             }
 
-            void add(const SmearedEntry& smeared, std::uint32_t position)
-            {
-                m_totalWhiteElo += static_cast<std::uint64_t>(smeared.totalWhiteElo()) << (position * SmearedEntry::TotalWhiteElo::size);
-                m_totalBlackElo += static_cast<std::uint64_t>(smeared.totalBlackElo()) << (position * SmearedEntry::TotalBlackElo::size);
-
-                m_countWithElo += static_cast<std::uint64_t>(smeared.countWithElo()) << (position * SmearedEntry::CountWithElo::size);
-                m_count += static_cast<std::uint64_t>(smeared.count()) << (position * SmearedEntry::Count::size);
-
-                m_firstGameIndex = std::min(m_firstGameIndex, smeared.m_firstGameIndex);
-            }
-
             [[nodiscard]] GameLevel level() const
             {
                 return m_level;
@@ -5,9 +5,15 @@ namespace persistence
     namespace db_epsilon
     {
         template struct persistence::pos_db::OrderedEntrySetPositionDatabase<
-            Key,
-            Entry,
-            Traits
+            BasicKey<72>,
+            BasicEntry<72>,
+            BasicTraits<72>
+        >;
+
+        template struct persistence::pos_db::OrderedEntrySetPositionDatabase<
+            BasicKey<48>,
+            BasicEntry<48>,
+            BasicTraits<48>
         >;
     }
 }
\ No newline at end of file
@@ -10,6 +10,8 @@
 
 #include "util/ArithmeticUtility.h"
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 
 namespace persistence
@@ -206,14 +208,30 @@ namespace persistence
             }
         }
 
-        struct Key
+        // Hash bits of the key. Each extra bit halves the expected number
+        // of hash collisions, see docs/persistence/epsilon.md.
+        // Bits not covered by the hash are always zero, so they cost almost
+        // nothing in block compressed data files.
+        template <std::size_t HashBitsV>
+        struct BasicKey
         {
-            // Hash:72, ReverseMovePerfectHash:20, GameLevel:2, GameResult:2
+            // Hash:HashBitsV (up to 72), ReverseMovePerfectHash:20, GameLevel:2, GameResult:2
+
+            static_assert(HashBitsV >= 40 && HashBitsV <= 72 && HashBitsV % 8 == 0);
+
+            static constexpr std::size_t hashBits = HashBitsV;
 
             static constexpr std::size_t levelBits = 2;
             static constexpr std::size_t resultBits = 2;
 
-            static constexpr std::uint32_t lastHashPartMask = 0xFF000000u;
+            // The first 32 bits of the hash fill the first word. Up to 32 next bits
+            // go to the low bits of the second word, so that the unused high bits
+            // form a prefix shared by all entries. The rest are the highest bits of the last word.
+            static constexpr std::uint32_t middleHashPartBits = static_cast<std::uint32_t>(std::min<std::size_t>(hashBits - 32, 32));
+            static constexpr std::uint32_t lastHashPartBits = static_cast<std::uint32_t>(hashBits - 32 - middleHashPartBits);
+
+            static constexpr std::uint32_t middleHashPartMask = static_cast<std::uint32_t>((1ull << middleHashPartBits) - 1);
+            static constexpr std::uint32_t lastHashPartMask = static_cast<std::uint32_t>(((1ull << lastHashPartBits) - 1) << (32 - lastHashPartBits));
             static constexpr std::uint32_t reverseMoveMask = 0x00FFFFF0u;
             static constexpr std::uint32_t levelMask = 0x0000000Cu;
             static constexpr std::uint32_t resultMask = 0x00000003u;
@@ -223,29 +241,40 @@ namespace persistence
 
             using StorageType = std::array<std::uint32_t, 3>;
 
-            Key() = default;
+            BasicKey() = default;
 
-            Key(const PositionWithZobrist& pos, const ReverseMove& reverseMove = ReverseMove{})
+            BasicKey(const PositionWithZobrist& pos, const ReverseMove& reverseMove = ReverseMove{})
             {
                 const auto zobrist = pos.zobrist();
                 m_hash[0] = zobrist.high >> 32;
-                m_hash[1] = zobrist.high & 0xFFFFFFFFull;
+                m_hash[1] = static_cast<std::uint32_t>((zobrist.high & 0xFFFFFFFFull) >> (32 - middleHashPartBits));
                 m_hash[2] = zobrist.low & lastHashPartMask;
                 m_hash[2] |= detail::packReverseMove(pos, reverseMove) << reverseMoveShift;
             }
 
-            Key(const PositionWithZobrist& pos, const ReverseMove& reverseMove, GameLevel level, GameResult result) :
-                Key(pos, reverseMove)
+            BasicKey(const PositionWithZobrist& pos, const ReverseMove& reverseMove, GameLevel level, GameResult result) :
+                BasicKey(pos, reverseMove)
             {
                 m_hash[2] |=
                     ((ordinal(level) & levelMask) << levelShift)
                     | ((ordinal(result) & resultMask));
             }
 
-            Key(const Key&) = default;
-            Key(Key&&) = default;
-            Key& operator=(const Key&) = default;
-            Key& operator=(Key&&) = default;
+            // Keys with more hash bits are converted by dropping the extra bits.
+            // The order of positions is preserved, see convert_db.
+            template <std::size_t OtherHashBitsV, typename = std::enable_if_t<(OtherHashBitsV > HashBitsV)>>
+            explicit BasicKey(const BasicKey<OtherHashBitsV>& other)
+            {
+                const auto& hash = other.hash();
+                m_hash[0] = hash[0];
+                m_hash[1] = hash[1] >> (BasicKey<OtherHashBitsV>::middleHashPartBits - middleHashPartBits);
+                m_hash[2] = hash[2] & (lastHashPartMask | reverseMoveMask | levelMask | resultMask);
+            }
+
+            BasicKey(const BasicKey&) = default;
+            BasicKey(BasicKey&&) = default;
+            BasicKey& operator=(const BasicKey&) = default;
+            BasicKey& operator=(BasicKey&&) = default;
 
             [[nodiscard]] const StorageType& hash() const
             {
@@ -270,7 +299,7 @@ namespace persistence
 
             struct CompareLessWithReverseMove
             {
-                [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicKey& lhs, const BasicKey& rhs) const noexcept
                 {
                     if (lhs.m_hash[0] < rhs.m_hash[0]) return true;
                     else if (lhs.m_hash[0] > rhs.m_hash[0]) return false;
@@ -286,7 +315,7 @@ namespace persistence
 
             struct CompareLessWithoutReverseMove
             {
-                [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicKey& lhs, const BasicKey& rhs) const noexcept
                 {
                     if (lhs.m_hash[0] < rhs.m_hash[0]) return true;
                     else if (lhs.m_hash[0] > rhs.m_hash[0]) return false;
@@ -300,7 +329,7 @@ namespace persistence
 
             struct CompareLessFull
             {
-                [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicKey& lhs, const BasicKey& rhs) const noexcept
                 {
                     if (lhs.m_hash[0] < rhs.m_hash[0]) return true;
                     else if (lhs.m_hash[0] > rhs.m_hash[0]) return false;
@@ -314,7 +343,7 @@ namespace persistence
 
             struct CompareEqualWithReverseMove
             {
-                [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicKey& lhs, const BasicKey& rhs) const noexcept
                 {
                     return
                         lhs.m_hash[0] == rhs.m_hash[0]
@@ -327,7 +356,7 @@ namespace persistence
 
             struct CompareEqualWithoutReverseMove
             {
-                [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicKey& lhs, const BasicKey& rhs) const noexcept
                 {
                     return
                         lhs.m_hash[0] == rhs.m_hash[0]
@@ -338,7 +367,7 @@ namespace persistence
 
             struct CompareEqualFull
             {
-                [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicKey& lhs, const BasicKey& rhs) const noexcept
                 {
                     return
                         lhs.m_hash[0] == rhs.m_hash[0]
@@ -352,159 +381,186 @@ namespace persistence
             // Elements ordered from least significant to most significant are [2][1][0]
             StorageType m_hash;
         };
+        using Key = BasicKey<72>;
+
         static_assert(sizeof(Key) == 12);
 
-        struct Entry
+        template <std::size_t HashBitsV>
+        struct BasicEntry
         {
-            Entry() = default;
+            using Key = BasicKey<HashBitsV>;
 
-            Entry(const EntryConstructionParameters& params) :
+            // Counts that don't fit are in the count overflow table of the data file,
+            // the entry only has this value. Almost all counts are small,
+            // so they take only a few bits in block compressed data files.
+            static constexpr std::uint32_t overflowCount = std::numeric_limits<std::uint32_t>::max();
+
+            BasicEntry() = default;
+
+            BasicEntry(const EntryConstructionParameters& params) :
                 m_key(params.position, params.reverseMove, params.level, params.result),
                 m_count(1)
             {
             }
 
-            Entry(const Entry&) = default;
-            Entry(Entry&&) = default;
-            Entry& operator=(const Entry&) = default;
-            Entry& operator=(Entry&&) = default;
+            template <std::size_t OtherHashBitsV, typename = std::enable_if_t<(OtherHashBitsV > HashBitsV)>>
+            explicit BasicEntry(const BasicEntry<OtherHashBitsV>& other) :
+                m_key(other.key()),
+                m_count(other.count())
+            {
+            }
+
+            BasicEntry(const BasicEntry&) = default;
+            BasicEntry(BasicEntry&&) = default;
+            BasicEntry& operator=(const BasicEntry&) = default;
+            BasicEntry& operator=(BasicEntry&&) = default;
+
+            // The bits of the first 16 bytes of the entry, viewed as four 32 bit words,
+            // that are compared by CompareEqualWithReverseMove and CompareEqualWithoutReverseMove.
+            // Allows comparing multiple entries at once.
+            static constexpr std::array<std::uint32_t, 4> equalWithReverseMoveMask{
+                0xFFFFFFFFu, Key::middleHashPartMask, Key::lastHashPartMask | Key::reverseMoveMask, 0
+            };
+            static constexpr std::array<std::uint32_t, 4> equalWithoutReverseMoveMask{
+                0xFFFFFFFFu, Key::middleHashPartMask, Key::lastHashPartMask, 0
+            };
 
             struct CompareLessWithoutReverseMove
             {
-                [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareLessWithoutReverseMove{}(lhs.m_key, rhs.m_key);
+                    return typename Key::CompareLessWithoutReverseMove{}(lhs.m_key, rhs.m_key);
                 }
 
-                [[nodiscard]] bool operator()(const Entry& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareLessWithoutReverseMove{}(lhs.m_key, rhs);
+                    return typename Key::CompareLessWithoutReverseMove{}(lhs.m_key, rhs);
                 }
 
-                [[nodiscard]] bool operator()(const Key& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const Key& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareLessWithoutReverseMove{}(lhs, rhs.m_key);
+                    return typename Key::CompareLessWithoutReverseMove{}(lhs, rhs.m_key);
                 }
 
                 [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareLessWithoutReverseMove{}(lhs, rhs);
+                    return typename Key::CompareLessWithoutReverseMove{}(lhs, rhs);
                 }
             };
 
             struct CompareEqualWithoutReverseMove
             {
-                [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithoutReverseMove{}(lhs.m_key, rhs.m_key);
+                    return typename Key::CompareEqualWithoutReverseMove{}(lhs.m_key, rhs.m_key);
                 }
 
-                [[nodiscard]] bool operator()(const Entry& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithoutReverseMove{}(lhs.m_key, rhs);
+                    return typename Key::CompareEqualWithoutReverseMove{}(lhs.m_key, rhs);
                 }
 
-                [[nodiscard]] bool operator()(const Key& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const Key& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithoutReverseMove{}(lhs, rhs.m_key);
+                    return typename Key::CompareEqualWithoutReverseMove{}(lhs, rhs.m_key);
                 }
 
                 [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithoutReverseMove{}(lhs, rhs);
+                    return typename Key::CompareEqualWithoutReverseMove{}(lhs, rhs);
                 }
             };
 
             struct CompareLessWithReverseMove
             {
-                [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareLessWithReverseMove{}(lhs.m_key, rhs.m_key);
+                    return typename Key::CompareLessWithReverseMove{}(lhs.m_key, rhs.m_key);
                 }
 
-                [[nodiscard]] bool operator()(const Entry& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareLessWithReverseMove{}(lhs.m_key, rhs);
+                    return typename Key::CompareLessWithReverseMove{}(lhs.m_key, rhs);
                 }
 
-                [[nodiscard]] bool operator()(const Key& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const Key& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareLessWithReverseMove{}(lhs, rhs.m_key);
+                    return typename Key::CompareLessWithReverseMove{}(lhs, rhs.m_key);
                 }
 
                 [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareLessWithReverseMove{}(lhs, rhs);
+                    return typename Key::CompareLessWithReverseMove{}(lhs, rhs);
                 }
             };
 
             struct CompareEqualWithReverseMove
             {
-                [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithReverseMove{}(lhs.m_key, rhs.m_key);
+                    return typename Key::CompareEqualWithReverseMove{}(lhs.m_key, rhs.m_key);
                 }
 
-                [[nodiscard]] bool operator()(const Entry& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithReverseMove{}(lhs.m_key, rhs);
+                    return typename Key::CompareEqualWithReverseMove{}(lhs.m_key, rhs);
                 }
 
-                [[nodiscard]] bool operator()(const Key& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const Key& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithReverseMove{}(lhs, rhs.m_key);
+                    return typename Key::CompareEqualWithReverseMove{}(lhs, rhs.m_key);
                 }
 
                 [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareEqualWithReverseMove{}(lhs, rhs);
+                    return typename Key::CompareEqualWithReverseMove{}(lhs, rhs);
                 }
             };
 
             // This behaves like the old operator<
             struct CompareLessFull
             {
-                [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareLessFull{}(lhs.m_key, rhs.m_key);
+                    return typename Key::CompareLessFull{}(lhs.m_key, rhs.m_key);
                 }
 
-                [[nodiscard]] bool operator()(const Entry& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareLessFull{}(lhs.m_key, rhs);
+                    return typename Key::CompareLessFull{}(lhs.m_key, rhs);
                 }
 
-                [[nodiscard]] bool operator()(const Key& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const Key& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareLessFull{}(lhs, rhs.m_key);
+                    return typename Key::CompareLessFull{}(lhs, rhs.m_key);
                 }
 
                 [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareLessFull{}(lhs, rhs);
+                    return typename Key::CompareLessFull{}(lhs, rhs);
                 }
             };
 
             struct CompareEqualFull
             {
-                [[nodiscard]] bool operator()(const Entry& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareEqualFull{}(lhs.m_key, rhs.m_key);
+                    return typename Key::CompareEqualFull{}(lhs.m_key, rhs.m_key);
                 }
 
-                [[nodiscard]] bool operator()(const Entry& lhs, const Key& rhs) const noexcept
+                [[nodiscard]] bool operator()(const BasicEntry& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareEqualFull{}(lhs.m_key, rhs);
+                    return typename Key::CompareEqualFull{}(lhs.m_key, rhs);
                 }
 
-                [[nodiscard]] bool operator()(const Key& lhs, const Entry& rhs) const noexcept
+                [[nodiscard]] bool operator()(const Key& lhs, const BasicEntry& rhs) const noexcept
                 {
-                    return Key::CompareEqualFull{}(lhs, rhs.m_key);
+                    return typename Key::CompareEqualFull{}(lhs, rhs.m_key);
                 }
 
                 [[nodiscard]] bool operator()(const Key& lhs, const Key& rhs) const noexcept
                 {
-                    return Key::CompareEqualFull{}(lhs, rhs);
+                    return typename Key::CompareEqualFull{}(lhs, rhs);
                 }
             };
 
@@ -518,6 +574,16 @@ namespace persistence
                 return m_count;
             }
 
+            [[nodiscard]] bool hasOverflowedCount() const
+            {
+                return m_count == overflowCount;
+            }
+
+            void setCount(std::uint32_t count)
+            {
+                m_count = count;
+            }
+
             [[nodiscard]] GameLevel level() const
             {
                 return m_key.level();
@@ -528,7 +594,7 @@ namespace persistence
                 return m_key.result();
             }
 
-            void combine(const Entry& rhs)
+            void combine(const BasicEntry& rhs)
             {
                 m_count += rhs.m_count;
             }
@@ -543,20 +609,42 @@ namespace persistence
             std::uint32_t m_count;
         };
 
+        using Entry = BasicEntry<72>;
+
         static_assert(sizeof(Entry) == 16);
         static_assert(std::is_trivially_copyable_v<Entry>);
 
-        struct Traits
+        namespace detail
+        {
+            [[nodiscard]] constexpr const char* formatName(std::size_t hashBits)
+            {
+                switch (hashBits)
+                {
+                case 48:
+                    return "db_epsilon_48";
+                case 72:
+                    return "db_epsilon";
+                default:
+                    return nullptr;
+                }
+            }
+        }
+
+        template <std::size_t HashBitsV>
+        struct BasicTraits
         {
-            static constexpr const char* name = "db_epsilon";
+            static constexpr const char* name = detail::formatName(HashBitsV);
+            static_assert(name != nullptr);
 
             static constexpr std::uint64_t maxGames = 1ull << 32ull;
             static constexpr std::uint64_t maxPositions = 1ull << 40ull;
-            static constexpr std::uint64_t maxInstancesOfSinglePosition = 1ull << 32ull;
+            static constexpr std::uint64_t maxInstancesOfSinglePosition = std::numeric_limits<std::uint64_t>::max();
 
             static constexpr bool hasOneWayKey = true;
-            static constexpr std::uint64_t estimatedMaxCollisions = 100;
-            static constexpr std::uint64_t estimatedMaxPositionsWithNoCollisions = 80'000'000'000ull;
+            // The expected number of colliding pairs is n^2 / 2^(hashBits+1).
+            // A collision becomes likely at around 1.18 * 2^(hashBits/2) positions.
+            static constexpr std::uint64_t estimatedMaxCollisions = (maxPositions >> (HashBitsV / 2)) * (maxPositions >> (HashBitsV / 2 + 1));
+            static constexpr std::uint64_t estimatedMaxPositionsWithNoCollisions = (1ull << (HashBitsV / 2)) * 1177 / 1000;
 
             static constexpr bool hasCount = true;
 
@@ -589,16 +677,27 @@ namespace persistence
             static constexpr util::SemanticVersion minimumSupportedVersion{ 1, 0, 0 };
         };
 
-        using Database = persistence::pos_db::OrderedEntrySetPositionDatabase<
-            Key,
-            Entry,
-            Traits
+        template <std::size_t HashBitsV>
+        using BasicDatabase = persistence::pos_db::OrderedEntrySetPositionDatabase<
+            BasicKey<HashBitsV>,
+            BasicEntry<HashBitsV>,
+            BasicTraits<HashBitsV>
+        >;
+
+        using Traits = BasicTraits<72>;
+
+        using Database = BasicDatabase<72>;
+
+        extern template struct persistence::pos_db::OrderedEntrySetPositionDatabase<
+            BasicKey<72>,
+            BasicEntry<72>,
+            BasicTraits<72>
         >;
 
         extern template struct persistence::pos_db::OrderedEntrySetPositionDatabase<
-            Key,
-            Entry,
-            Traits
+            BasicKey<48>,
+            BasicEntry<48>,
+            BasicTraits<48>
         >;
 
         static_assert(!Database::hasEloDiff);
@@ -614,4 +713,22 @@ namespace persistence
         static_assert(!Database::allowsFilteringByEloRange);
         static_assert(!Database::allowsFilteringByMonthRange);
     }
+
+    // Same layout as db_epsilon, but with only 48 bits of the hash.
+    // Meant for smaller databases, for example of engine games,
+    // where the collisions are unlikely to matter.
+    // The entries are still 16B, the files are only smaller
+    // when they are block compressed.
+    namespace db_epsilon_48
+    {
+        using Key = db_epsilon::BasicKey<48>;
+        using Entry = db_epsilon::BasicEntry<48>;
+        using Traits = db_epsilon::BasicTraits<48>;
+
+        using Database = db_epsilon::BasicDatabase<48>;
+
+        static_assert(sizeof(Key) == 12);
+        static_assert(sizeof(Entry) == 16);
+        static_assert(std::is_trivially_copyable_v<Entry>);
+    }
 }
@@ -14,6 +14,7 @@
 #include "util/ArithmeticUtility.h"
 #include "util/BitPacking.h"
 
+#include <array>
 #include <cstdint>
 
 namespace persistence
@@ -301,6 +302,22 @@ namespace persistence
             SmearedEntry& operator=(const SmearedEntry&) = default;
             SmearedEntry& operator=(SmearedEntry&&) = default;
 
+            // The bits of the first 16 bytes of the entry (and the key), viewed as four 32 bit words,
+            // that are compared by CompareEqualWithReverseMove and CompareEqualWithoutReverseMove.
+            // Allows comparing multiple entries at once.
+            static constexpr std::array<std::uint32_t, 4> equalWithReverseMoveMask{
+                0xFFFFFFFFu,
+                0xFFFFFFFFu,
+                static_cast<std::uint32_t>((HashLow::mask | PackedReverseMove::mask) & 0xFFFFFFFFu),
+                static_cast<std::uint32_t>((HashLow::mask | PackedReverseMove::mask) >> 32)
+            };
+            static constexpr std::array<std::uint32_t, 4> equalWithoutReverseMoveMask{
+                0xFFFFFFFFu,
+                0xFFFFFFFFu,
+                static_cast<std::uint32_t>(HashLow::mask & 0xFFFFFFFFu),
+                static_cast<std::uint32_t>(HashLow::mask >> 32)
+            };
+
             [[nodiscard]] GameLevel level() const
             {
                 return fromOrdinal<GameLevel>(static_cast<int>(m_rest.get<Level>()));
@@ -482,6 +499,9 @@ namespace persistence
         {
             using SmearedEntryType = SmearedEntry;
 
+            // The count is the longest field, split into 2 bit parts.
+            static constexpr std::size_t maxRunLength = 64 / SmearedEntry::Count::size;
+
             struct Sentinel { };
 
             struct Iterator
@@ -574,24 +594,36 @@ namespace persistence
                 m_result = smeared.result();
             }
 
-            void combine(const UnsmearedEntry& other)
+            // Decodes all smeared entries of an unsmeared entry at once, the first one
+            // has to be the one with isFirst(). Every part has its bits at a known
+            // position, so there is no state carried from one part to the next.
+            UnsmearedEntry(const SmearedEntry* run, std::size_t length) :
+                UnsmearedEntry(run[0])
             {
-                m_count += other.m_count;
-                m_eloDiff += other.m_eloDiff;
-            }
+                ASSERT(length >= 1);
+                ASSERT(length <= maxRunLength);
 
-            void add(const SmearedEntry& smeared, std::uint32_t position)
-            {
-                m_count += static_cast<std::uint64_t>(smeared.countMinusOne() + smeared.isFirst()) << (position * SmearedEntry::Count::size);
-                const auto absEloDiffChange = static_cast<std::int64_t>(smeared.absEloDiff()) << (position * SmearedEntry::AbsEloDiff::size);
-                if (m_eloDiff < 0)
+                for (std::size_t i = 1; i < length; ++i)
                 {
-                    m_eloDiff -= absEloDiffChange;
+                    ASSERT(!run[i].isFirst());
+
+                    m_count += static_cast<std::uint64_t>(run[i].countMinusOne()) << (i * SmearedEntry::Count::size);
                 }
-                else
+
+                // Further parts can only have count bits.
+                const std::size_t numEloParts = std::min<std::size_t>(length, (64 + SmearedEntry::AbsEloDiff::size - 1) / SmearedEntry::AbsEloDiff::size);
+                std::int64_t absEloDiff = static_cast<std::int64_t>(run[0].absEloDiff());
+                for (std::size_t i = 1; i < numEloParts; ++i)
                 {
-                    m_eloDiff += absEloDiffChange;
+                    absEloDiff += static_cast<std::int64_t>(run[i].absEloDiff()) << (i * SmearedEntry::AbsEloDiff::size);
                 }
+                m_eloDiff = run[0].isEloNegative() ? -absEloDiff : absEloDiff;
+            }
+
+            void combine(const UnsmearedEntry& other)
+            {
+                m_count += other.m_count;
+                m_eloDiff += other.m_eloDiff;
             }
 
             [[nodiscard]] GameLevel level() const
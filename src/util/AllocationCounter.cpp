@@ -0,0 +1,53 @@
+#include "AllocationCounter.h"
+
+#include <cstdint>
+#include <optional>
+
+#if defined(COUNT_ALLOCATIONS)
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<std::uint64_t> g_numAllocations{ 0 };
+}
+
+void* operator new(std::size_t size)
+{
+    g_numAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    // malloc(0) is allowed to return nullptr
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+namespace util
+{
+    [[nodiscard]] std::optional<std::uint64_t> numAllocations()
+    {
+        return g_numAllocations.load(std::memory_order_relaxed);
+    }
+}
+
+#else
+
+namespace util
+{
+    [[nodiscard]] std::optional<std::uint64_t> numAllocations()
+    {
+        return {};
+    }
+}
+
+#endif
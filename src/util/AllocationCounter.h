@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+namespace util
+{
+    // Number of calls to the global operator new since the start of the program.
+    // Allocations are only counted when built with COUNT_ALLOCATIONS defined,
+    // which replaces the global operator new, otherwise this is always empty.
+    [[nodiscard]] std::optional<std::uint64_t> numAllocations();
+}
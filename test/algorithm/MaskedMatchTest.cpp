@@ -0,0 +1,207 @@
+#include "catch2/catch.hpp"
+
+#include "algorithm/MaskedMatch.h"
+
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+
+#include "persistence/pos_db/beta/DatabaseFormatBeta.h"
+#include "persistence/pos_db/delta/DatabaseFormatDeltaSmeared.h"
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilon.h"
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilonSmeared.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+    void checkMaskedMatch(std::size_t stride, std::size_t count)
+    {
+        std::mt19937_64 rng(1234);
+
+        const MaskedMatch128::Words key{ 0x12345678u, 0x9ABCDEF0u, 0x0F0F0F0Fu, 0xF0F0F0F0u };
+        const MaskedMatch128::Words maskA{ 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFF000000u, 0 };
+        const MaskedMatch128::Words maskB{ 0xFFFFFFFFu, 0, 0xFFFFFFF0u, 0x0000FFFFu };
+
+        std::vector<unsigned char> records(count * stride);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            MaskedMatch128::Words words = key;
+            // Flip some bits so that there are matches only under maskA, only under maskB, under both, and neither.
+            for (auto& word : words)
+            {
+                if (rng() % 4 == 0)
+                {
+                    word ^= static_cast<std::uint32_t>(1) << (rng() % 32);
+                }
+            }
+            std::memcpy(records.data() + i * stride, words.data(), sizeof(words));
+        }
+
+        std::vector<std::uint64_t> matchesA(MaskedMatch128::numWordsFor(count), ~std::uint64_t(0));
+        std::vector<std::uint64_t> matchesB(MaskedMatch128::numWordsFor(count), ~std::uint64_t(0));
+        MaskedMatch128(key, maskA, maskB)(records.data(), count, stride, matchesA.data(), matchesB.data());
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            MaskedMatch128::Words words;
+            std::memcpy(words.data(), records.data() + i * stride, sizeof(words));
+
+            bool expectedA = true;
+            bool expectedB = true;
+            for (std::size_t j = 0; j < 4; ++j)
+            {
+                expectedA = expectedA && ((words[j] ^ key[j]) & maskA[j]) == 0;
+                expectedB = expectedB && ((words[j] ^ key[j]) & maskB[j]) == 0;
+            }
+
+            REQUIRE(static_cast<bool>((matchesA[i / 64] >> (i % 64)) & 1) == expectedA);
+            REQUIRE(static_cast<bool>((matchesB[i / 64] >> (i % 64)) & 1) == expectedB);
+        }
+
+        // Bits past the end are cleared.
+        if (count % 64 != 0)
+        {
+            REQUIRE((matchesA.back() >> (count % 64)) == 0);
+            REQUIRE((matchesB.back() >> (count % 64)) == 0);
+        }
+
+        // The same records as columns give the same results.
+        const std::size_t columnStride = count + 5;
+        std::vector<std::uint32_t> columns(4 * columnStride);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            MaskedMatch128::Words words;
+            std::memcpy(words.data(), records.data() + i * stride, sizeof(words));
+            for (std::size_t j = 0; j < 4; ++j)
+            {
+                columns[j * columnStride + i] = words[j];
+            }
+        }
+
+        std::vector<std::uint64_t> columnMatchesA(MaskedMatch128::numWordsFor(count), ~std::uint64_t(0));
+        std::vector<std::uint64_t> columnMatchesB(MaskedMatch128::numWordsFor(count), ~std::uint64_t(0));
+        MaskedMatch128(key, maskA, maskB).matchColumns(columns.data(), columnStride, count, columnMatchesA.data(), columnMatchesB.data());
+        REQUIRE(columnMatchesA == matchesA);
+        REQUIRE(columnMatchesB == matchesB);
+    }
+
+    // Entries from random games, so that there are repeated positions
+    // reached both with the same and with different reverse moves.
+    template <typename DatabaseT, typename KeyT, typename EntryT>
+    void checkEqualityMasks()
+    {
+        std::mt19937_64 rng(4321);
+
+        std::pmr::vector<EntryT> entries;
+        std::vector<KeyT> keys;
+        for (int game = 0; game < 50; ++game)
+        {
+            auto pos = Position::startPosition();
+            ReverseMove reverseMove{};
+            for (int ply = 0; ply < 6; ++ply)
+            {
+                persistence::EntryConstructionParameters params{};
+                params.position = PositionWithZobrist(pos);
+                params.reverseMove = reverseMove;
+                params.level = GameLevel::Human;
+                params.result = GameResult::Draw;
+
+                entries.emplace_back(params);
+                keys.emplace_back(PositionWithZobrist(pos), reverseMove);
+
+                const auto moves = movegen::generateLegalMoves(pos);
+                // Few candidate moves give many transpositions.
+                reverseMove = pos.doMove(moves[rng() % std::min<std::size_t>(moves.size(), 3)]);
+            }
+        }
+
+        typename DatabaseT::EntryMatches matches;
+        for (auto&& key : keys)
+        {
+            matches.compute(entries, key);
+
+            for (query::Select select : { query::Select::Continuations, query::Select::Transpositions, query::Select::All })
+            {
+                std::vector<std::size_t> expected;
+                for (std::size_t i = 0; i < entries.size(); ++i)
+                {
+                    const bool withReverseMove = typename EntryT::CompareEqualWithReverseMove{}(entries[i], key);
+                    const bool withoutReverseMove = typename EntryT::CompareEqualWithoutReverseMove{}(entries[i], key);
+
+                    if ((select == query::Select::Continuations && withReverseMove)
+                        || (select == query::Select::Transpositions && withoutReverseMove && !withReverseMove)
+                        || (select == query::Select::All && withoutReverseMove))
+                    {
+                        expected.emplace_back(i);
+                    }
+                }
+
+                std::vector<std::size_t> actual;
+                matches.forEach(select, [&actual](std::size_t i) { actual.emplace_back(i); });
+
+                REQUIRE(actual == expected);
+            }
+
+            matches.forEachMatch([&](std::size_t i, bool isContinuation) {
+                REQUIRE(typename EntryT::CompareEqualWithoutReverseMove{}(entries[i], key));
+                REQUIRE(isContinuation == typename EntryT::CompareEqualWithReverseMove{}(entries[i], key));
+                });
+        }
+
+        // Matching the leading words of the entries stored as columns.
+        std::vector<std::uint32_t> columns(4 * entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            std::array<std::uint32_t, 4> words;
+            std::memcpy(words.data(), &entries[i], sizeof(words));
+            for (std::size_t j = 0; j < 4; ++j)
+            {
+                columns[j * entries.size() + i] = words[j];
+            }
+        }
+
+        typename DatabaseT::EntryMatches columnMatches;
+        for (auto&& key : keys)
+        {
+            matches.compute(entries, key);
+            columnMatches.computeFromColumns(columns.data(), entries.size(), entries.size(), key);
+
+            for (query::Select select : { query::Select::Continuations, query::Select::Transpositions, query::Select::All })
+            {
+                std::vector<std::size_t> expected;
+                matches.forEach(select, [&expected](std::size_t i) { expected.emplace_back(i); });
+
+                std::vector<std::size_t> actual;
+                columnMatches.forEach(select, [&actual](std::size_t i) { actual.emplace_back(i); });
+
+                REQUIRE(actual == expected);
+            }
+
+            REQUIRE(columnMatches.anyMatch(0, entries.size()));
+        }
+    }
+}
+
+TEST_CASE("Masked match", "[algorithm]")
+{
+    for (std::size_t stride : { 16, 20, 24, 32 })
+    {
+        for (std::size_t count : { 0, 1, 3, 8, 63, 64, 65, 200 })
+        {
+            checkMaskedMatch(stride, count);
+        }
+    }
+}
+
+TEST_CASE("Entry equality masks", "[algorithm]")
+{
+    checkEqualityMasks<persistence::db_beta::Database, persistence::db_beta::Key, persistence::db_beta::Entry>();
+    checkEqualityMasks<persistence::db_epsilon::Database, persistence::db_epsilon::Key, persistence::db_epsilon::Entry>();
+    checkEqualityMasks<persistence::db_epsilon_48::Database, persistence::db_epsilon_48::Key, persistence::db_epsilon_48::Entry>();
+    checkEqualityMasks<persistence::db_delta_smeared::Database, persistence::db_delta_smeared::Key, persistence::db_delta_smeared::SmearedEntry>();
+    checkEqualityMasks<persistence::db_epsilon_smeared::Database, persistence::db_epsilon_smeared::Key, persistence::db_epsilon_smeared::SmearedEntry>();
+}
@@ -0,0 +1,59 @@
+#include "catch2/catch.hpp"
+
+#include "data_structure/BlockedBloomFilter.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+TEST_CASE("Blocked bloom filter", "[data_structure]")
+{
+    std::mt19937_64 rng(1234);
+
+    std::vector<std::uint64_t> keys(10000);
+    for (auto& key : keys)
+    {
+        key = rng();
+    }
+
+    BlockedBloomFilter filter(keys.size(), 10);
+    for (auto key : keys)
+    {
+        filter.insert(key);
+    }
+
+    REQUIRE(filter.numKeys() == keys.size());
+
+    for (auto key : keys)
+    {
+        REQUIRE(filter.mayContain(key));
+    }
+
+    std::size_t numFalsePositives = 0;
+    const std::size_t numAbsentKeys = 100000;
+    for (std::size_t i = 0; i < numAbsentKeys; ++i)
+    {
+        numFalsePositives += filter.mayContain(rng());
+    }
+
+    // ~1% expected for 10 bits per key
+    REQUIRE(numFalsePositives < numAbsentKeys / 30);
+
+    SECTION("Roundtrip through raw data")
+    {
+        BlockedBloomFilter copy(std::vector<std::uint64_t>(filter.data(), filter.data() + filter.size()));
+
+        REQUIRE(copy.numKeys() == filter.numKeys());
+        REQUIRE(copy.numBlocks() == filter.numBlocks());
+        for (auto key : keys)
+        {
+            REQUIRE(copy.mayContain(key));
+        }
+    }
+
+    SECTION("Empty filter contains everything")
+    {
+        BlockedBloomFilter empty{};
+        REQUIRE(empty.mayContain(keys[0]));
+    }
+}
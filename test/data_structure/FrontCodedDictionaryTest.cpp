@@ -0,0 +1,82 @@
+#include "catch2/catch.hpp"
+
+#include "data_structure/FrontCodedDictionary.h"
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Names with long shared prefixes, and some duplicates.
+    std::vector<std::string> makeNames(std::size_t count, std::mt19937_64& rng)
+    {
+        static const std::vector<std::string> prefixes{ "", "Carlsen, ", "Carlsen, Magnus ", "Caruana", "lichess ", "Rated Blitz game" };
+
+        std::vector<std::string> names;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::string name = prefixes[rng() % prefixes.size()];
+            const std::size_t length = rng() % 4;
+            for (std::size_t j = 0; j < length; ++j)
+            {
+                name += static_cast<char>('a' + rng() % 3);
+            }
+            names.emplace_back(std::move(name));
+        }
+        return names;
+    }
+
+    void checkContents(const FrontCodedDictionary& dict, const std::vector<std::string>& idToName)
+    {
+        REQUIRE(dict.size() == idToName.size());
+        for (std::size_t id = 0; id < idToName.size(); ++id)
+        {
+            REQUIRE(dict.at(static_cast<FrontCodedDictionary::IdType>(id)) == idToName[id]);
+            REQUIRE(dict.find(idToName[id]) == id);
+        }
+    }
+}
+
+TEST_CASE("Front coded dictionary", "[data_structure]")
+{
+    std::mt19937_64 rng(1234);
+
+    FrontCodedDictionary dict;
+    REQUIRE(dict.empty());
+    REQUIRE(dict.find("") == FrontCodedDictionary::invalidId);
+
+    std::vector<std::string> idToName;
+    const auto insertAll = [&](const std::vector<std::string>& names) {
+        for (auto&& name : names)
+        {
+            const auto id = dict.insert(name);
+            if (id == idToName.size())
+            {
+                idToName.emplace_back(name);
+            }
+            REQUIRE(idToName[id] == name);
+        }
+    };
+
+    insertAll(makeNames(1000, rng));
+    checkContents(dict, idToName);
+
+    dict = FrontCodedDictionary(dict.serialize());
+    REQUIRE(!dict.hasPendingStrings());
+    checkContents(dict, idToName);
+
+    // Ids of the persisted strings don't change when more are added.
+    insertAll(makeNames(1000, rng));
+    checkContents(dict, idToName);
+
+    dict = FrontCodedDictionary(dict.serialize());
+    checkContents(dict, idToName);
+
+    REQUIRE(dict.find("Not a name") == FrontCodedDictionary::invalidId);
+    REQUIRE(dict.find("Carlsen, Magnus zzz") == FrontCodedDictionary::invalidId);
+
+    REQUIRE_THROWS_AS(FrontCodedDictionary(std::vector<char>(3)), std::runtime_error);
+}
@@ -0,0 +1,214 @@
+#include "catch2/catch.hpp"
+
+#include "persistence/pos_db/BlockCompressedEntries.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+    struct TestEntry
+    {
+        std::uint64_t hash;
+        std::uint32_t info;
+        std::uint32_t count;
+        std::uint32_t firstGameIndex;
+        std::uint32_t lastGameIndex;
+    };
+
+    [[nodiscard]] bool operator==(const TestEntry& lhs, const TestEntry& rhs)
+    {
+        return std::memcmp(&lhs, &rhs, sizeof(TestEntry)) == 0;
+    }
+
+    [[nodiscard]] std::vector<TestEntry> makeSortedEntries(std::mt19937_64& rng, std::size_t count)
+    {
+        std::vector<TestEntry> entries;
+        while (entries.size() < count)
+        {
+            // Some positions have many entries.
+            const std::uint64_t hash = rng();
+            const std::size_t numEntries = 1 + (rng() % 4 == 0 ? rng() % 16 : 0);
+            for (std::size_t i = 0; i < numEntries && entries.size() < count; ++i)
+            {
+                const auto firstGameIndex = static_cast<std::uint32_t>(rng() % 1000000);
+                entries.push_back(TestEntry{
+                    hash,
+                    static_cast<std::uint32_t>(rng() % 64) << 26,
+                    static_cast<std::uint32_t>(1 + rng() % 3),
+                    firstGameIndex,
+                    firstGameIndex + static_cast<std::uint32_t>(rng() % 100)
+                });
+            }
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const TestEntry& lhs, const TestEntry& rhs) {
+            return std::tie(lhs.hash, lhs.info) < std::tie(rhs.hash, rhs.info);
+        });
+
+        return entries;
+    }
+}
+
+TEST_CASE("Entry block codec", "[persistence]")
+{
+    using Codec = persistence::pos_db::EntryBlockCodec<TestEntry>;
+
+    std::mt19937_64 rng(1234);
+    bit::BitStream<> scratch;
+
+    for (std::size_t count : { 1, 2, 7, 64, 1000 })
+    {
+        const auto entries = makeSortedEntries(rng, count);
+
+        std::vector<std::byte> block;
+        Codec::encode(entries.data(), entries.size(), block);
+
+        std::vector<TestEntry> decoded(entries.size());
+        Codec::decode(block.data(), block.size(), decoded.size(), decoded.data(), scratch);
+        REQUIRE(decoded == entries);
+    }
+
+    {
+        // Blocks are appended and can be decoded separately.
+        const auto a = makeSortedEntries(rng, 100);
+        const auto b = makeSortedEntries(rng, 50);
+
+        std::vector<std::byte> blocks;
+        Codec::encode(a.data(), a.size(), blocks);
+        const std::size_t sizeA = blocks.size();
+        Codec::encode(b.data(), b.size(), blocks);
+
+        std::vector<TestEntry> decoded(b.size());
+        Codec::decode(blocks.data() + sizeA, blocks.size() - sizeA, decoded.size(), decoded.data(), scratch);
+        REQUIRE(decoded == b);
+    }
+
+    {
+        // Incompressible words are stored raw, with only a few bits of overhead.
+        std::vector<TestEntry> entries(256);
+        for (auto& entry : entries)
+        {
+            entry = TestEntry{ rng(), static_cast<std::uint32_t>(rng()), static_cast<std::uint32_t>(rng()), static_cast<std::uint32_t>(rng()), static_cast<std::uint32_t>(rng()) };
+        }
+
+        std::vector<std::byte> block;
+        Codec::encode(entries.data(), entries.size(), block);
+        REQUIRE(block.size() <= entries.size() * sizeof(TestEntry) + 8);
+
+        std::vector<TestEntry> decoded(entries.size());
+        Codec::decode(block.data(), block.size(), decoded.size(), decoded.data(), scratch);
+        REQUIRE(decoded == entries);
+    }
+
+    {
+        const auto entries = makeSortedEntries(rng, 1024);
+
+        std::vector<std::byte> block;
+        Codec::encode(entries.data(), entries.size(), block);
+        REQUIRE(block.size() < entries.size() * sizeof(TestEntry) * 2 / 3);
+    }
+
+    {
+        // Only the bits after the prefix shared by the whole block are stored,
+        // even when the words are not ordered.
+        std::vector<TestEntry> entries(256);
+        for (auto& entry : entries)
+        {
+            entry = TestEntry{ (0xABCDEull << 44) | (rng() & 0xFFFFFFFFFFFull), 0, 0, 0, 0 };
+        }
+
+        std::vector<std::byte> block;
+        Codec::encode(entries.data(), entries.size(), block);
+        REQUIRE(block.size() <= entries.size() * (12 + 32 + 4) / 8 + 16);
+
+        std::vector<TestEntry> decoded(entries.size());
+        Codec::decode(block.data(), block.size(), decoded.size(), decoded.data(), scratch);
+        REQUIRE(decoded == entries);
+    }
+}
+
+TEST_CASE("Entry block codec stores sorted hashes succinctly", "[persistence]")
+{
+    using Codec = persistence::pos_db::EntryBlockCodec<TestEntry>;
+
+    std::mt19937_64 rng(5678);
+    bit::BitStream<> scratch;
+
+    // Gaps between consecutive hashes of about 2^20 need
+    // little more than 20 bits each.
+    std::vector<TestEntry> entries(1024);
+    std::uint64_t hash = rng();
+    for (auto& entry : entries)
+    {
+        hash += rng() % (1 << 21);
+        entry = TestEntry{ hash << 32 | (hash >> 32), 0, 1, 0, 0 };
+    }
+
+    std::vector<std::byte> block;
+    Codec::encode(entries.data(), entries.size(), block);
+    REQUIRE(block.size() <= entries.size() * (24 + 4) / 8 + 16);
+
+    std::vector<TestEntry> decoded(entries.size());
+    Codec::decode(block.data(), block.size(), decoded.size(), decoded.data(), scratch);
+    REQUIRE(decoded == entries);
+}
+
+TEST_CASE("Entry block column decoder", "[persistence]")
+{
+    using Codec = persistence::pos_db::EntryBlockCodec<TestEntry>;
+
+    std::mt19937_64 rng(91011);
+    bit::BitStream<> scratch;
+
+    const auto entries = makeSortedEntries(rng, 300);
+
+    std::vector<std::byte> block;
+    Codec::encode(entries.data(), entries.size(), block);
+
+    // Columns are decoded in parts, with other blocks decoded in between.
+    const std::size_t columnStride = entries.size() + 7;
+    std::vector<std::uint32_t> columns(Codec::numColumns * columnStride);
+    Codec::ColumnDecoder decoder(block.data(), block.size(), entries.size());
+    decoder.decodeColumns(2, columns.data(), columnStride, scratch);
+    REQUIRE(decoder.numDecodedColumns() == 2);
+
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        std::uint32_t words[2];
+        std::memcpy(words, &entries[i], sizeof(words));
+        REQUIRE(columns[i] == words[0]);
+        REQUIRE(columns[columnStride + i] == words[1]);
+    }
+
+    std::vector<TestEntry> other(entries.size());
+    Codec::decode(block.data(), block.size(), other.size(), other.data(), scratch);
+
+    decoder.decodeColumns(1, columns.data(), columnStride, scratch);
+    decoder.decodeColumns(Codec::numColumns - 3, columns.data(), columnStride, scratch);
+    REQUIRE(decoder.numDecodedColumns() == Codec::numColumns);
+
+    for (std::size_t i = 0; i < entries.size(); ++i)
+    {
+        REQUIRE(Codec::entryFromColumns(columns.data(), columnStride, i) == entries[i]);
+    }
+}
+
+TEST_CASE("Block table", "[persistence]")
+{
+    persistence::pos_db::BlockTable table;
+    table.numEntries = 123;
+    table.offsets = { 0, 10, 25, 40 };
+
+    const auto restored = persistence::pos_db::BlockTable::fromWords(table.toWords());
+    REQUIRE(restored.numEntries == 123);
+    REQUIRE(restored.offsets == table.offsets);
+    REQUIRE(restored.numBlocks() == 3);
+    REQUIRE(restored.dataSize() == 40);
+
+    REQUIRE_THROWS(persistence::pos_db::BlockTable::fromWords({ 5 }));
+}
@@ -0,0 +1,79 @@
+#include "catch2/catch.hpp"
+
+#include "persistence/pos_db/CountOverflowTable.h"
+
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilon.h"
+
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+
+#include <cstdint>
+#include <vector>
+
+TEST_CASE("Count overflow table", "[persistence]")
+{
+    using Key = persistence::db_epsilon::Key;
+    using Table = persistence::pos_db::CountOverflowTable<Key>;
+    using Record = Table::RecordType;
+
+    // Keys of the positions after the first move, with every result.
+    std::vector<Key> keys;
+    const Position start = Position::startPosition();
+    movegen::forEachLegalMove(start, [&](Move move) {
+        const PositionWithZobrist pos(start.afterMove(move));
+        for (GameResult result : values<GameResult>())
+        {
+            keys.emplace_back(pos, ReverseMove{}, GameLevel::Human, result);
+        }
+        });
+    REQUIRE(keys.size() == 20 * 3);
+
+    const std::uint64_t big = 1ull << 40;
+
+    // Every third key, some of them twice. Records are not sorted.
+    std::vector<Record> records;
+    for (std::size_t i = keys.size(); i-- > 0;)
+    {
+        if (i % 3 != 0) continue;
+
+        records.push_back(Record{ keys[i], big + i });
+        if (i % 2 == 0)
+        {
+            records.push_back(Record{ keys[i], 1 });
+        }
+    }
+
+    Table table(records);
+    REQUIRE(table.size() == keys.size() / 3);
+
+    for (std::size_t i = 0; i < keys.size(); ++i)
+    {
+        if (i % 3 != 0)
+        {
+            REQUIRE(table.count(keys[i]) == 0);
+        }
+        else
+        {
+            REQUIRE(table.count(keys[i]) == big + i + (i % 2 == 0));
+        }
+    }
+
+    // Tables of merged files are summed.
+    Table other(std::vector<Record>{ Record{ keys[0], big }, Record{ keys[1], big } });
+    table.add(other);
+    REQUIRE(table.size() == keys.size() / 3 + 1);
+    REQUIRE(table.count(keys[0]) == 2 * big + 1);
+    REQUIRE(table.count(keys[1]) == big);
+    REQUIRE(table.count(keys[2]) == 0);
+
+    // Stored without the padding of the records.
+    const auto words = table.toWords();
+    REQUIRE(words.size() == table.size() * (sizeof(Key) / sizeof(std::uint32_t) + 2));
+    const Table read = Table::fromWords(words);
+    REQUIRE(read.size() == table.size());
+    REQUIRE(read.toWords() == words);
+    for (auto&& key : keys)
+    {
+        REQUIRE(read.count(key) == table.count(key));
+    }
+}
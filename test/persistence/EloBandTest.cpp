@@ -0,0 +1,69 @@
+#include "catch2/catch.hpp"
+
+#include "persistence/pos_db/OrderedEntrySetPositionDatabase.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+TEST_CASE("Elo band", "[persistence]")
+{
+    using persistence::pos_db::detail::EloBand;
+    using persistence::pos_db::detail::normalizeEloBandBounds;
+
+    const std::vector<std::uint16_t> bounds = normalizeEloBandBounds({ 2200, 1800, 2200, 2500 });
+    REQUIRE(bounds == std::vector<std::uint16_t>{ 1800, 2200, 2500 });
+
+    SECTION("Bands of elos")
+    {
+        REQUIRE(EloBand::of(0, bounds) == EloBand{ false, 0, 1799 });
+        REQUIRE(EloBand::of(1799, bounds) == EloBand{ false, 0, 1799 });
+        REQUIRE(EloBand::of(1800, bounds) == EloBand{ false, 1800, 2199 });
+        REQUIRE(EloBand::of(2499, bounds) == EloBand{ false, 2200, 2499 });
+        REQUIRE(EloBand::of(2500, bounds) == EloBand{ false, 2500, std::numeric_limits<std::uint16_t>::max() });
+        REQUIRE(EloBand::of(3000, {}) == EloBand{ false, 0, std::numeric_limits<std::uint16_t>::max() });
+    }
+
+    SECTION("Partition names")
+    {
+        for (const EloBand& band : { EloBand::of(1900, bounds), EloBand::of(2600, bounds), EloBand::unknown() })
+        {
+            const auto parsed = EloBand::fromPartitionName(band.partitionName());
+            REQUIRE(parsed.has_value());
+            REQUIRE(*parsed == band);
+        }
+
+        REQUIRE(EloBand::of(1900, bounds).partitionName() == "elo_1800_2199");
+        REQUIRE(EloBand::unknown().partitionName() == "elo_unknown");
+
+        REQUIRE_FALSE(EloBand::fromPartitionName("human").has_value());
+        REQUIRE_FALSE(EloBand::fromPartitionName("elo_1800").has_value());
+        REQUIRE_FALSE(EloBand::fromPartitionName("elo_2200_1800").has_value());
+        REQUIRE_FALSE(EloBand::fromPartitionName("elo_x_1800").has_value());
+    }
+
+    SECTION("Intersection")
+    {
+        const EloBand band = EloBand::of(1900, bounds);
+        REQUIRE(band.intersects(2000, 2100, false));
+        REQUIRE(band.intersects(0, 1800, false));
+        REQUIRE(band.intersects(2199, 3000, false));
+        REQUIRE_FALSE(band.intersects(0, 1799, true));
+        REQUIRE_FALSE(band.intersects(2200, 3000, true));
+
+        REQUIRE(EloBand::unknown().intersects(2000, 2100, true));
+        REQUIRE_FALSE(EloBand::unknown().intersects(0, std::numeric_limits<std::uint16_t>::max(), false));
+    }
+
+    SECTION("Containment")
+    {
+        const EloBand band = EloBand::of(1900, bounds);
+        REQUIRE(band.isWithin(1800, 2199, false));
+        REQUIRE(band.isWithin(0, std::numeric_limits<std::uint16_t>::max(), false));
+        REQUIRE_FALSE(band.isWithin(1801, 2199, true));
+        REQUIRE_FALSE(band.isWithin(1800, 2198, true));
+
+        REQUIRE(EloBand::unknown().isWithin(2000, 2100, true));
+        REQUIRE_FALSE(EloBand::unknown().isWithin(2000, 2100, false));
+    }
+}
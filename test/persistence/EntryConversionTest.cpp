@@ -0,0 +1,60 @@
+#include "catch2/catch.hpp"
+
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilon.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+TEST_CASE("Entry conversion to fewer hash bits", "[persistence]")
+{
+    using SourceEntry = persistence::db_epsilon::Entry;
+    using TargetEntry = persistence::db_epsilon_48::Entry;
+
+    std::mt19937_64 rng(2468);
+
+    // Entries from random games, so that there are repeated positions
+    // reached both with the same and with different reverse moves.
+    std::vector<SourceEntry> sourceEntries;
+    std::vector<TargetEntry> expectedEntries;
+    for (int game = 0; game < 200; ++game)
+    {
+        auto pos = Position::startPosition();
+        ReverseMove reverseMove{};
+        const auto result = fromOrdinal<GameResult>(static_cast<int>(rng() % 3));
+        for (int ply = 0; ply < 8; ++ply)
+        {
+            persistence::EntryConstructionParameters params{};
+            params.position = PositionWithZobrist(pos);
+            params.reverseMove = reverseMove;
+            params.level = GameLevel::Engine;
+            params.result = result;
+
+            sourceEntries.emplace_back(params);
+            expectedEntries.emplace_back(params);
+
+            const auto moves = movegen::generateLegalMoves(pos);
+            reverseMove = pos.doMove(moves[rng() % std::min<std::size_t>(moves.size(), 4)]);
+        }
+    }
+
+    for (std::size_t i = 0; i < sourceEntries.size(); ++i)
+    {
+        const TargetEntry converted(sourceEntries[i]);
+        REQUIRE(std::memcmp(&converted, &expectedEntries[i], sizeof(TargetEntry)) == 0);
+    }
+
+    // Converted entries stay ordered by position, so data files
+    // can be converted without sorting them again.
+    std::sort(sourceEntries.begin(), sourceEntries.end(), SourceEntry::CompareLessFull{});
+    for (std::size_t i = 1; i < sourceEntries.size(); ++i)
+    {
+        const TargetEntry previous(sourceEntries[i - 1]);
+        const TargetEntry current(sourceEntries[i]);
+        REQUIRE(!TargetEntry::CompareLessWithoutReverseMove{}(current, previous));
+    }
+}
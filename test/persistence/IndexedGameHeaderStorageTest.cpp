@@ -0,0 +1,102 @@
+#include "catch2/catch.hpp"
+
+#include "persistence/pos_db/IndexedGameHeaderStorage.h"
+
+#include "chess/Pgn.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using Storage = persistence::IndexedGameHeaderStorage<persistence::PackedGameHeader64>;
+
+    void addGame(Storage& storage, const std::string& white, const std::string& black)
+    {
+        const std::string tags =
+            "[Event \"Open\"]\n"
+            "[White \"" + white + "\"]\n"
+            "[Black \"" + black + "\"]\n"
+            "[Result \"1-0\"]\n";
+
+        (void)storage.addGame(pgn::UnparsedGame(tags, "1. e4 1-0"));
+    }
+
+    void checkPlayers(Storage& storage, const std::vector<std::pair<std::string, std::string>>& players)
+    {
+        std::pmr::vector<std::uint64_t> indices;
+        for (std::size_t i = 0; i < players.size(); ++i)
+        {
+            indices.emplace_back(i);
+        }
+
+        const auto headers = storage.queryByIndices(indices);
+        REQUIRE(headers.size() == players.size());
+        for (std::size_t i = 0; i < players.size(); ++i)
+        {
+            REQUIRE(headers[i].event() == "Open");
+            REQUIRE(headers[i].white() == players[i].first);
+            REQUIRE(headers[i].black() == players[i].second);
+        }
+    }
+}
+
+TEST_CASE("Game header names", "[persistence]")
+{
+    namespace fs = std::filesystem;
+
+    const fs::path root = fs::temp_directory_path() / "chess_pos_db_header_names_test";
+    fs::remove_all(root);
+
+    const fs::path namesPath = root / "names";
+    const fs::path namesLogPath = root / "names_log";
+
+    const std::vector<std::pair<std::string, std::string>> players = {
+        { "alice", "bob" },
+        { "carol", "alice" }
+    };
+
+    {
+        Storage storage(root);
+        addGame(storage, players[0].first, players[0].second);
+        storage.flush();
+
+        // The names file is rewritten when it has fewer names than the log would have.
+        REQUIRE_FALSE(fs::exists(namesLogPath));
+        const auto namesFileSize = fs::file_size(namesPath);
+
+        addGame(storage, players[1].first, players[1].second);
+        storage.flush();
+
+        // Otherwise only the new name is appended to the log.
+        REQUIRE(fs::file_size(namesPath) == namesFileSize);
+        REQUIRE(fs::file_size(namesLogPath) == 1 + players[1].first.size());
+    }
+
+    {
+        Storage storage(root);
+        checkPlayers(storage, players);
+    }
+
+    // A name cut short by an interrupted flush.
+    {
+        std::ofstream log(namesLogPath, std::ios::binary | std::ios::app);
+        log << '\x05' << "da";
+    }
+
+    {
+        Storage storage(root);
+        checkPlayers(storage, players);
+
+        // All names are in the names file now.
+        REQUIRE_FALSE(fs::exists(namesLogPath));
+
+        storage.clear();
+    }
+
+    fs::remove_all(root);
+}
@@ -0,0 +1,98 @@
+#include "catch2/catch.hpp"
+
+#include "persistence/pos_db/OrderedEntrySetPositionDatabase.h"
+
+#include "chess/Date.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+TEST_CASE("Month range", "[persistence]")
+{
+    using MonthRange = persistence::pos_db::detail::MonthRange;
+
+    const std::uint32_t jan2000 = Date(2000, 1, 1).monthSinceYear0();
+    const std::uint32_t dec2000 = Date(2000, 12, 1).monthSinceYear0();
+
+    SECTION("Adding dates")
+    {
+        MonthRange range;
+        range.add(Date(2000, 3, 15));
+        REQUIRE(range.min == jan2000 + 2);
+        REQUIRE(range.max == jan2000 + 2);
+        REQUIRE_FALSE(range.hasUnknown);
+
+        // Unknown month covers the whole year.
+        range.add(Date(2000, 0, 0));
+        REQUIRE(range.min == jan2000);
+        REQUIRE(range.max == dec2000);
+        REQUIRE_FALSE(range.hasUnknown);
+
+        range.add(Date(0, 0, 0));
+        REQUIRE(range.min == jan2000);
+        REQUIRE(range.max == dec2000);
+        REQUIRE(range.hasUnknown);
+
+        MonthRange other;
+        other.add(Date(2005, 6, 1));
+        other.add(range);
+        REQUIRE(other.min == jan2000);
+        REQUIRE(other.max == Date(2005, 6, 1).monthSinceYear0());
+        REQUIRE(other.hasUnknown);
+    }
+
+    SECTION("Intersection and containment")
+    {
+        MonthRange range;
+        range.add(Date(2000, 3, 1));
+        range.add(Date(2000, 5, 1));
+
+        REQUIRE(range.intersects(jan2000, dec2000, false));
+        REQUIRE(range.intersects(jan2000 + 4, jan2000 + 4, false));
+        REQUIRE_FALSE(range.intersects(jan2000 + 5, dec2000, false));
+        REQUIRE_FALSE(range.intersects(jan2000, jan2000 + 1, true));
+
+        REQUIRE(range.isWithin(jan2000, dec2000, false));
+        REQUIRE(range.isWithin(jan2000 + 2, jan2000 + 4, false));
+        REQUIRE_FALSE(range.isWithin(jan2000 + 3, dec2000, false));
+        REQUIRE_FALSE(range.isWithin(jan2000, jan2000 + 3, false));
+
+        range.add(Date(0, 0, 0));
+        REQUIRE(range.intersects(jan2000, jan2000 + 1, true));
+        REQUIRE_FALSE(range.intersects(jan2000, jan2000 + 1, false));
+        REQUIRE(range.isWithin(jan2000, dec2000, true));
+        REQUIRE_FALSE(range.isWithin(jan2000, dec2000, false));
+    }
+
+    SECTION("Only unknown dates")
+    {
+        MonthRange range;
+        range.add(Date(0, 0, 0));
+        REQUIRE_FALSE(range.intersects(0, std::numeric_limits<std::uint32_t>::max(), false));
+        REQUIRE(range.intersects(jan2000, dec2000, true));
+        REQUIRE(range.isWithin(jan2000, dec2000, true));
+        REQUIRE_FALSE(range.isWithin(jan2000, dec2000, false));
+    }
+
+    SECTION("Serialization")
+    {
+        MonthRange range;
+        range.add(Date(1999, 7, 1));
+        range.add(Date(0, 0, 0));
+
+        const auto words = range.toWords();
+        const MonthRange read = MonthRange::fromWords(std::vector<std::uint32_t>(words.begin(), words.end()));
+        REQUIRE(read.min == range.min);
+        REQUIRE(read.max == range.max);
+        REQUIRE(read.hasUnknown == range.hasUnknown);
+
+        // A missing or malformed range matches everything
+        // and is never within a filter.
+        const MonthRange missing = MonthRange::fromWords({});
+        REQUIRE(missing.intersects(jan2000, jan2000, false));
+        REQUIRE(missing.intersects(jan2000, jan2000, true));
+        REQUIRE_FALSE(missing.isWithin(jan2000, dec2000, true));
+        REQUIRE(missing.isWithin(0, std::numeric_limits<std::uint32_t>::max(), true));
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "persistence/pos_db/Query.h"
+
+#include "chess/GameClassification.h"
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+#include "chess/San.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Fixtures shared by the tests of databases.
+namespace persistence_test
+{
+    struct TestGame
+    {
+        std::string event;
+        std::string date;
+        std::string white;
+        std::string black;
+        std::string result;
+
+        // Movetext without the result.
+        std::string moves;
+    };
+
+    inline void writeGames(const std::filesystem::path& path, const std::vector<TestGame>& games)
+    {
+        std::ofstream pgn(path);
+        for (auto&& game : games)
+        {
+            pgn << "[Event \"" << game.event << "\"]\n"
+                << "[Site \"?\"]\n"
+                << "[Date \"" << game.date << "\"]\n"
+                << "[Round \"?\"]\n"
+                << "[White \"" << game.white << "\"]\n"
+                << "[Black \"" << game.black << "\"]\n"
+                << "[Result \"" << game.result << "\"]\n\n"
+                << game.moves << ' ' << game.result << "\n\n";
+        }
+    }
+
+    // Random games that are the same for every run.
+    // Returns the positions reached in the first plies of the games.
+    inline std::vector<std::string> writeRandomGames(const std::filesystem::path& path, std::size_t numGames, std::size_t numPlies)
+    {
+        std::mt19937_64 rng(4321);
+        std::vector<std::string> fens;
+        std::vector<TestGame> games;
+
+        for (std::size_t i = 0; i < numGames; ++i)
+        {
+            auto& game = games.emplace_back();
+            game.event = "?";
+            game.date = std::to_string(2000 + i % 5) + ".0" + std::to_string(1 + i % 9) + ".01";
+            game.white = "w" + std::to_string(i % 7);
+            game.black = "b" + std::to_string(i % 5);
+            game.result = i % 3 == 0 ? "1-0" : i % 3 == 1 ? "0-1" : "1/2-1/2";
+
+            Position pos = Position::startPosition();
+            for (std::size_t ply = 0; ply < numPlies; ++ply)
+            {
+                if (ply < 3 && i % 10 == 0)
+                {
+                    fens.emplace_back(pos.fen());
+                }
+
+                const auto moves = movegen::generateLegalMoves(pos);
+                if (moves.empty())
+                {
+                    break;
+                }
+
+                const Move move = moves[rng() % moves.size()];
+                if (ply % 2 == 0)
+                {
+                    game.moves += std::to_string(ply / 2 + 1) + ". ";
+                }
+                game.moves += san::moveToSan<san::SanSpec::Full>(pos, move);
+                game.moves += ' ';
+                pos.doMove(move);
+            }
+
+            // The separator before the result is added when writing.
+            if (!game.moves.empty())
+            {
+                game.moves.pop_back();
+            }
+        }
+
+        writeGames(path, games);
+
+        return fens;
+    }
+
+    // A request for all results of the positions on the levels,
+    // with the same fetching options for each of the selects.
+    [[nodiscard]] inline query::Request makeRequest(
+        const std::vector<std::string>& fens,
+        const std::vector<GameLevel>& levels,
+        const std::vector<query::Select>& selects,
+        const query::AdditionalFetchingOptions& options
+    )
+    {
+        query::Request query;
+        query.token = "t";
+        for (auto&& fen : fens)
+        {
+            query.positions.push_back({ fen, std::nullopt });
+        }
+        query.levels = levels;
+        query.results = { GameResult::WhiteWin, GameResult::BlackWin, GameResult::Draw };
+        for (auto&& select : selects)
+        {
+            query.fetchingOptions[select] = options;
+        }
+        return query;
+    }
+}
@@ -0,0 +1,172 @@
+#include "catch2/catch.hpp"
+
+#include "PersistenceTestUtility.h"
+
+#include "persistence/pos_db/OrderedEntrySetPositionDatabase.h"
+#include "persistence/pos_db/Query.h"
+
+#include "persistence/pos_db/delta/DatabaseFormatDelta.h"
+
+#include "chess/Position.h"
+
+#include "json/json.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const std::vector<persistence_test::TestGame> testGames = {
+        { "Open", "2020.01.01", "alice", "bob", "1-0", "1. e4 e5" },
+        { "Open", "2020.01.01", "bob", "alice", "0-1", "1. d4 d5" },
+        { "Open", "2020.01.01", "carol", "alice", "1/2-1/2", "1. e4 c5" },
+        { "Open", "2020.01.01", "bob", "carol", "1-0", "1. e4 e5" }
+    };
+
+    [[nodiscard]] query::Request makeRequest(std::optional<std::string> player, std::optional<Color> playerColor)
+    {
+        query::Request query = persistence_test::makeRequest(
+            { Position::startPosition().fen() },
+            { GameLevel::Human },
+            { query::Select::Continuations },
+            query::AdditionalFetchingOptions{ true, false, false, false, false }
+        );
+        if (player.has_value())
+        {
+            query.filters = query::QueryFilters{};
+            query.filters->player = std::move(player);
+            query.filters->playerColor = playerColor;
+        }
+        return query;
+    }
+
+    // Number of human games with the result after the move ("--" for the root).
+    [[nodiscard]] std::size_t countOf(const nlohmann::json& response, const char* move, const char* result)
+    {
+        const auto& continuations = response["results"][0]["continuations"];
+        if (!continuations.contains(move) || !continuations[move].contains("human") || !continuations[move]["human"].contains(result))
+        {
+            return 0;
+        }
+
+        return continuations[move]["human"][result]["count"].get<std::size_t>();
+    }
+}
+
+TEST_CASE("Player salt", "[persistence]")
+{
+    using persistence::pos_db::detail::playerSalt;
+
+    // Stable and depends on both the name and the color.
+    REQUIRE(playerSalt("alice", Color::White) == playerSalt("alice", Color::White));
+    REQUIRE_FALSE(playerSalt("alice", Color::White) == playerSalt("alice", Color::Black));
+    REQUIRE_FALSE(playerSalt("alice", Color::White) == playerSalt("alicf", Color::White));
+    REQUIRE_FALSE(playerSalt("", Color::White) == playerSalt("", Color::Black));
+
+    // Only the first 255 characters are used.
+    const std::string longName(300, 'x');
+    REQUIRE(playerSalt(longName, Color::White) == playerSalt(longName.substr(0, 255), Color::White));
+    REQUIRE_FALSE(playerSalt(longName, Color::White) == playerSalt(longName.substr(0, 254), Color::White));
+
+    // The salt persists through moves and can be removed.
+    const ZobristKey salt = playerSalt("alice", Color::Black);
+    PositionWithZobrist pos = PositionWithZobrist::startPosition();
+    PositionWithZobrist salted = pos;
+    salted.saltZobrist(salt);
+    REQUIRE_FALSE(salted.zobrist() == pos.zobrist());
+
+    const Move move = Move::normal(e2, e4);
+    REQUIRE(salted.afterMove(move).zobrist() == (pos.afterMove(move).zobrist() ^ salt));
+
+    salted.saltZobrist(salt);
+    REQUIRE(salted.zobrist() == pos.zobrist());
+}
+
+TEST_CASE("Player filter", "[persistence]")
+{
+    namespace fs = std::filesystem;
+    using Database = persistence::db_delta::Database;
+
+    const fs::path root = fs::temp_directory_path() / "chess_pos_db_player_filter_test";
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    const fs::path pgnPath = root / "games.pgn";
+    persistence_test::writeGames(pgnPath, testGames);
+
+    persistence::ImportableFiles files;
+    files.emplace_back(pgnPath, GameLevel::Human);
+
+    SECTION("With the player index")
+    {
+        // The index is kept for every storage that has the file,
+        // regardless of the configuration.
+        const fs::path dbPath = root / "indexed";
+        fs::create_directories(dbPath);
+        for (const char* level : { "_human", "_engine", "_server" })
+        {
+            std::ofstream((dbPath / "players") += level);
+        }
+
+        nlohmann::json alice;
+        {
+            Database db(dbPath);
+            (void)db.import(files, 1ull << 20);
+
+            // The salted entries are not visible without the filter.
+            const auto all = nlohmann::json(db.executeQuery(makeRequest(std::nullopt, std::nullopt)));
+            REQUIRE(countOf(all, "--", "win") == 2);
+            REQUIRE(countOf(all, "--", "loss") == 1);
+            REQUIRE(countOf(all, "--", "draw") == 1);
+            REQUIRE(countOf(all, "e4", "win") == 2);
+
+            alice = nlohmann::json(db.executeQuery(makeRequest("alice", std::nullopt)));
+            REQUIRE(countOf(alice, "--", "win") == 1);
+            REQUIRE(countOf(alice, "--", "loss") == 1);
+            REQUIRE(countOf(alice, "--", "draw") == 1);
+            REQUIRE(countOf(alice, "e4", "win") == 1);
+            REQUIRE(countOf(alice, "e4", "draw") == 1);
+            REQUIRE(countOf(alice, "d4", "loss") == 1);
+
+            const auto aliceWhite = nlohmann::json(db.executeQuery(makeRequest("alice", Color::White)));
+            REQUIRE(countOf(aliceWhite, "--", "win") == 1);
+            REQUIRE(countOf(aliceWhite, "--", "loss") == 0);
+            REQUIRE(countOf(aliceWhite, "--", "draw") == 0);
+            REQUIRE(countOf(aliceWhite, "e4", "win") == 1);
+            REQUIRE(countOf(aliceWhite, "d4", "loss") == 0);
+
+            const auto aliceBlack = nlohmann::json(db.executeQuery(makeRequest("alice", Color::Black)));
+            REQUIRE(countOf(aliceBlack, "--", "win") == 0);
+            REQUIRE(countOf(aliceBlack, "d4", "loss") == 1);
+            REQUIRE(countOf(aliceBlack, "e4", "draw") == 1);
+
+            const auto bobWhite = nlohmann::json(db.executeQuery(makeRequest("bob", Color::White)));
+            REQUIRE(countOf(bobWhite, "--", "win") == 1);
+            REQUIRE(countOf(bobWhite, "--", "loss") == 1);
+            REQUIRE(countOf(bobWhite, "e4", "win") == 1);
+            REQUIRE(countOf(bobWhite, "d4", "loss") == 1);
+
+            // Event names are in the same dictionary as the players.
+            REQUIRE_THROWS_WITH(db.executeQuery(makeRequest("Open", std::nullopt)), Catch::Contains("Unknown player"));
+            REQUIRE_THROWS_WITH(db.executeQuery(makeRequest("dave", Color::White)), Catch::Contains("Unknown player"));
+        }
+
+        // The index is persisted.
+        Database reopened(dbPath);
+        REQUIRE(nlohmann::json(reopened.executeQuery(makeRequest("alice", std::nullopt))) == alice);
+        REQUIRE_THROWS_WITH(reopened.executeQuery(makeRequest("Open", std::nullopt)), Catch::Contains("Unknown player"));
+    }
+
+    SECTION("Without the player index")
+    {
+        Database db(root / "plain");
+        (void)db.import(files, 1ull << 20);
+
+        REQUIRE_THROWS_WITH(db.executeQuery(makeRequest("alice", std::nullopt)), Catch::Contains("player index"));
+    }
+
+    fs::remove_all(root);
+}
@@ -0,0 +1,202 @@
+#include "catch2/catch.hpp"
+
+#include "persistence/pos_db/PositionTable.h"
+
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+
+#include "external_storage/External.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // Distinct positions up to 2 plies from the start position.
+    [[nodiscard]] std::vector<CompressedPosition> makePositions()
+    {
+        std::vector<CompressedPosition> positions;
+        const Position start = Position::startPosition();
+        movegen::forEachLegalMove(start, [&](Move move1) {
+            const Position pos1 = start.afterMove(move1);
+            positions.push_back(pos1.compress());
+            movegen::forEachLegalMove(pos1, [&](Move move2) {
+                positions.push_back(pos1.afterMove(move2).compress());
+            });
+        });
+        return positions;
+    }
+
+    [[nodiscard]] std::filesystem::path tempTablePath(const char* name)
+    {
+        return std::filesystem::temp_directory_path() / name;
+    }
+
+    [[nodiscard]] persistence::pos_db::PositionTable readTable(const std::filesystem::path& path)
+    {
+        using namespace persistence::pos_db;
+        return PositionTable(ext::ImmutableSpan<PositionRecord>(ext::ImmutableBinaryFile(ext::Pooled{}, path)));
+    }
+}
+
+TEST_CASE("Position table", "[persistence]")
+{
+    using namespace persistence::pos_db;
+
+    const auto positions = makePositions();
+    REQUIRE(positions.size() == 420);
+
+    // Pairs of different positions share a hash. Only every third pair is stored
+    // whole, of the others only the first position is stored.
+    std::vector<PositionRecord> stored;
+    std::vector<PositionRecord> absent;
+    for (std::size_t i = 0; i < positions.size(); ++i)
+    {
+        const std::uint64_t hash = (i / 2) * 0x9E3779B97F4A7C15ull;
+        const PositionRecord record{ hash, positions[i] };
+        if (i % 2 == 0 || (i / 2) % 3 == 0)
+        {
+            stored.push_back(record);
+        }
+        else
+        {
+            absent.push_back(record);
+        }
+    }
+
+    // Duplicates are removed.
+    std::vector<PositionRecord> records = stored;
+    records.insert(records.end(), stored.begin(), stored.begin() + 10);
+    sortDistinctPositionRecords(records);
+    REQUIRE(records.size() == stored.size());
+
+    const auto path = tempTablePath("chess_pos_db_position_table_test");
+    {
+        PositionTableWriter writer(path);
+        writer.append(records);
+        writer.end();
+        REQUIRE(writer.numRecords() == stored.size());
+        REQUIRE(writer.numCollisions() == 70);
+    }
+
+    {
+        const auto table = readTable(path);
+        REQUIRE(table.size() == stored.size());
+
+        for (auto&& record : stored)
+        {
+            REQUIRE(table.contains(record.hash, record.position));
+        }
+
+        for (auto&& record : absent)
+        {
+            REQUIRE(!table.contains(record.hash, record.position));
+        }
+
+        // Hashes not in the table at all, before, between, and after the stored ones.
+        REQUIRE(!table.contains(records.front().hash - 1, records.front().position));
+        REQUIRE(!table.contains(records[100].hash + 1, records[100].position));
+        REQUIRE(!table.contains(records.back().hash + 1, records.back().position));
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Position table lookup in a large table", "[persistence]")
+{
+    using namespace persistence::pos_db;
+
+    const auto positions = makePositions();
+
+    std::mt19937_64 rng(1234);
+    std::vector<PositionRecord> records;
+    for (std::size_t i = 0; i < 20000; ++i)
+    {
+        records.push_back({ rng(), positions[i % positions.size()] });
+    }
+    sortDistinctPositionRecords(records);
+
+    const auto path = tempTablePath("chess_pos_db_position_table_large_test");
+    {
+        PositionTableWriter writer(path);
+        writer.append(records);
+        writer.end();
+        REQUIRE(writer.numCollisions() == 0);
+    }
+
+    {
+        const auto table = readTable(path);
+        for (auto&& record : records)
+        {
+            REQUIRE(table.contains(record.hash, record.position));
+            REQUIRE(!table.contains(record.hash ^ 1, record.position));
+        }
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Position table merge", "[persistence]")
+{
+    using namespace persistence::pos_db;
+
+    const auto positions = makePositions();
+
+    std::mt19937_64 rng(5678);
+    std::vector<std::vector<PositionRecord>> parts(3);
+    std::vector<PositionRecord> all;
+    for (std::size_t i = 0; i < positions.size(); ++i)
+    {
+        // Some records are in multiple parts, some hashes collide.
+        const PositionRecord record{ rng() % 300, positions[i] };
+        all.push_back(record);
+        parts[i % 3].push_back(record);
+        if (i % 5 == 0)
+        {
+            parts[(i + 1) % 3].push_back(record);
+        }
+    }
+    sortDistinctPositionRecords(all);
+
+    std::vector<std::filesystem::path> paths;
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+        sortDistinctPositionRecords(parts[i]);
+        paths.emplace_back(tempTablePath("chess_pos_db_position_table_merge_test_") += std::to_string(i));
+
+        PositionTableWriter writer(paths.back());
+        writer.append(parts[i]);
+        writer.end();
+    }
+
+    const auto mergedPath = tempTablePath("chess_pos_db_position_table_merge_test");
+    {
+        std::vector<ext::ImmutableSpan<PositionRecord>> tables;
+        for (auto&& path : paths)
+        {
+            tables.emplace_back(ext::ImmutableBinaryFile(ext::Pooled{}, path));
+        }
+
+        PositionTableWriter writer(mergedPath);
+        mergePositionTables(tables, writer);
+        writer.end();
+        REQUIRE(writer.numRecords() == all.size());
+    }
+
+    {
+        const auto table = readTable(mergedPath);
+        REQUIRE(table.size() == all.size());
+
+        std::vector<PositionRecord> merged(table.size());
+        table.records().read(merged.data(), 0, merged.size());
+        REQUIRE(merged == all);
+    }
+
+    for (auto&& path : paths)
+    {
+        std::filesystem::remove(path);
+    }
+    std::filesystem::remove(mergedPath);
+}
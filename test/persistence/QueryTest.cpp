@@ -0,0 +1,253 @@
+#include "catch2/catch.hpp"
+
+#include "PersistenceTestUtility.h"
+
+#include "chess/GameClassification.h"
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+#include "chess/ReverseMoveGenerator.h"
+
+#include "persistence/pos_db/GameHeader.h"
+#include "persistence/pos_db/Query.h"
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json/json.hpp"
+
+namespace
+{
+    persistence::GameHeader makeHeader(std::mt19937_64& rng)
+    {
+        static const std::vector<std::string> names{ "Carlsen, Magnus", "M\xc3\xbcller", "\"quoted\"\t\\", "bad \xff utf8", "" };
+
+        return persistence::GameHeader(
+            rng() % 1000000,
+            GameResult::Draw,
+            Date(2020, 1 + rng() % 12, 0),
+            Eco('B', 12),
+            static_cast<std::uint16_t>(rng() % 200),
+            names[rng() % names.size()],
+            names[rng() % names.size()],
+            names[rng() % names.size()]
+        );
+    }
+
+    void fillEntries(query::SegregatedEntries& entries, std::mt19937_64& rng)
+    {
+        for (auto&& level : { GameLevel::Server, GameLevel::Human, GameLevel::Engine })
+        {
+            for (auto&& result : { GameResult::Draw, GameResult::WhiteWin, GameResult::BlackWin })
+            {
+                if (rng() % 3 == 0)
+                {
+                    continue;
+                }
+
+                auto& entry = entries.emplace(level, result, rng() % 100000).second;
+                if (rng() % 2)
+                {
+                    entry.firstGame = makeHeader(rng);
+                    entry.lastGame = makeHeader(rng);
+                }
+                if (rng() % 2)
+                {
+                    entry.eloDiff = static_cast<std::int64_t>(rng() % 1000) - 500;
+                    entry.countWithElo = rng() % 100;
+                    entry.whiteElo = rng() % 300000;
+                    entry.blackElo = rng() % 300000;
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Response writer", "[persistence]")
+{
+    std::mt19937_64 rng(1234);
+
+    query::Response response;
+    response.query = persistence_test::makeRequest(
+        {},
+        { GameLevel::Human, GameLevel::Engine },
+        { query::Select::All },
+        query::AdditionalFetchingOptions{ true, true, true, true, true }
+    );
+    response.query.token = "toke\"n";
+    response.query.results = { GameResult::WhiteWin };
+
+    const std::vector<query::RootPosition> roots{
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", std::nullopt },
+        { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", std::string("e4") },
+        { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", std::nullopt },
+        { "not a fen", std::nullopt }
+    };
+
+    for (auto&& root : roots)
+    {
+        response.query.positions.emplace_back(root);
+
+        auto& result = response.results.emplace_back(root);
+        const auto positionOpt = root.tryGet();
+        if (!positionOpt.has_value())
+        {
+            continue;
+        }
+
+        for (auto&& select : { query::Select::All, query::Select::Continuations, query::Select::Transpositions })
+        {
+            auto& subresult = result.resultsBySelect[select];
+            fillEntries(subresult.root, rng);
+            movegen::forEachLegalMove(*positionOpt, [&](Move move) {
+                fillEntries(subresult.children[move], rng);
+                });
+        }
+
+        movegen::forEachPseudoLegalReverseMove(*positionOpt, movegen::PieceSet::standardPieceSet(), [&](const ReverseMove& rmove) {
+            fillEntries(result.retractionsResults.retractions[rmove], rng);
+            });
+    }
+
+    const std::string expected = nlohmann::json(response).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+
+    query::ResponseWriter writer;
+    REQUIRE(writer.write(response) == expected);
+
+    // The buffers are reused.
+    REQUIRE(writer.write(response) == expected);
+
+    response.results.clear();
+    REQUIRE(writer.write(response) == nlohmann::json(response).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+
+    response.exactMonths = false;
+    REQUIRE(writer.write(response) == nlohmann::json(response).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+
+    response.exactElo = true;
+    REQUIRE(writer.write(response) == nlohmann::json(response).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+}
+
+TEST_CASE("Response json merge", "[persistence]")
+{
+    const auto header = [](std::uint32_t gameId, const char* date) {
+        return nlohmann::json{ { "game_id", gameId }, { "date", date } };
+    };
+
+    nlohmann::json into = nlohmann::json::parse(R"({
+        "query": { "token": "t" },
+        "results": [
+            {
+                "position": { "fen": "a" },
+                "continuations": {
+                    "--": { "human": { "draw": { "count": 3, "elo_diff": -10, "count_with_elo": 2, "white_elo": 4000, "black_elo": 4010 } } },
+                    "e4": { "human": { "win": { "count": 1 } } }
+                }
+            },
+            null
+        ]
+    })");
+    into["results"][0]["continuations"]["--"]["human"]["draw"]["first_game"] = header(1, "2010.05.01");
+    into["results"][0]["continuations"]["--"]["human"]["draw"]["last_game"] = header(2, "2012.01.01");
+
+    nlohmann::json from = nlohmann::json::parse(R"({
+        "query": { "token": "t" },
+        "results": [
+            {
+                "position": { "fen": "a" },
+                "continuations": {
+                    "--": { "human": { "draw": { "count": 2, "elo_diff": 4, "count_with_elo": 1, "white_elo": 2100, "black_elo": 1900 } } },
+                    "d4": { "engine": { "loss": { "count": 5 } } }
+                },
+                "retractions": { "Pe2-e4": { "human": { "draw": { "count": 7 } } } }
+            },
+            null
+        ]
+    })");
+    from["results"][0]["continuations"]["--"]["human"]["draw"]["first_game"] = header(7, "2009.12.31");
+    from["results"][0]["continuations"]["--"]["human"]["draw"]["last_game"] = header(8, "2012.01.01");
+
+    into["exact_months"] = true;
+    from["exact_months"] = false;
+    from["exact_elo"] = true;
+
+    query::mergeResponseJson(into, from);
+
+    REQUIRE(into["exact_months"] == false);
+    REQUIRE(into["exact_elo"] == true);
+
+    const auto& result = into["results"][0];
+    REQUIRE(result["position"]["fen"] == "a");
+
+    const auto& root = result["continuations"]["--"]["human"]["draw"];
+    REQUIRE(root["count"] == 5);
+    REQUIRE(root["elo_diff"] == -6);
+    REQUIRE(root["count_with_elo"] == 3);
+    REQUIRE(root["white_elo"] == 6100);
+    REQUIRE(root["black_elo"] == 5910);
+    REQUIRE(root["first_game"]["game_id"] == 7);
+    REQUIRE(root["last_game"]["game_id"] == 8);
+
+    REQUIRE(result["continuations"]["e4"]["human"]["win"]["count"] == 1);
+    REQUIRE(result["continuations"]["d4"]["engine"]["loss"]["count"] == 5);
+    REQUIRE(result["retractions"]["Pe2-e4"]["human"]["draw"]["count"] == 7);
+    REQUIRE(into["results"][1].is_null());
+
+    from["results"].erase(1);
+    REQUIRE_THROWS(query::mergeResponseJson(into, from));
+}
+
+TEST_CASE("Request routing", "[persistence]")
+{
+    const std::string request = R"({"token":"t","positions":[{"fen":"a"}]})";
+    const std::vector<std::string> addresses{ "127.0.0.1:1000", "127.0.0.1:1001", "127.0.0.1:1002" };
+
+    // Each backend has different games of the same position.
+    const auto responseWithCount = [](int count) {
+        return nlohmann::json{
+            { "query", { { "token", "t" } } },
+            { "results", { { { "position", { { "fen", "a" } } }, { "continuations", { { "--", { { "human", { { "draw", { { "count", count } } } } } } } } } } } }
+        }.dump();
+    };
+
+    std::vector<std::string> received(addresses.size());
+    auto merged = query::routeRequestJson(request, addresses, [&](std::size_t i, const std::string& message) {
+        received[i] = message;
+        return responseWithCount(static_cast<int>(i) + 1);
+        });
+
+    // Every backend gets the whole request.
+    for (auto&& message : received)
+    {
+        REQUIRE(message == request);
+    }
+
+    REQUIRE(merged["results"][0]["continuations"]["--"]["human"]["draw"]["count"] == 6);
+    REQUIRE(merged["router"]["backends"].size() == addresses.size());
+    for (std::size_t i = 0; i < addresses.size(); ++i)
+    {
+        REQUIRE(merged["router"]["backends"][i]["address"] == addresses[i]);
+        REQUIRE(merged["router"]["backends"][i].contains("time_us"));
+    }
+
+    // The first failing backend is reported, but all are waited for.
+    std::vector<bool> called(addresses.size());
+    merged = query::routeRequestJson(request, addresses, [&](std::size_t i, const std::string&) -> std::string {
+        called[i] = true;
+        if (i == 0) return responseWithCount(1);
+        if (i == 1) return R"({"error":"InvalidRequest"})";
+        throw std::runtime_error("Cannot connect");
+        });
+
+    REQUIRE(called == std::vector<bool>(addresses.size(), true));
+    REQUIRE(merged["error"] == "InvalidRequest");
+    REQUIRE(merged["backend"] == addresses[1]);
+    REQUIRE(!merged.contains("results"));
+
+    // Responses that are not json are errors too.
+    merged = query::routeRequestJson(request, { addresses[0] }, [&](std::size_t, const std::string&) {
+        return std::string("{\"error\":\"unterminated\"");
+        });
+    REQUIRE(merged["backend"] == addresses[0]);
+}
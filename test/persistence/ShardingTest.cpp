@@ -0,0 +1,171 @@
+#include "catch2/catch.hpp"
+
+#include "PersistenceTestUtility.h"
+
+#include "persistence/pos_db/OrderedEntrySetPositionDatabase.h"
+#include "persistence/pos_db/Query.h"
+
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilon.h"
+
+#include "chess/MoveGenerator.h"
+#include "chess/Position.h"
+
+#include "json/json.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+    [[nodiscard]] query::Request makeRequest(const std::vector<std::string>& fens)
+    {
+        return persistence_test::makeRequest(
+            fens,
+            { GameLevel::Human, GameLevel::Engine, GameLevel::Server },
+            { query::Select::All, query::Select::Continuations },
+            query::AdditionalFetchingOptions{ true, true, true, false, false }
+        );
+    }
+}
+
+TEST_CASE("Shard of position hash", "[persistence]")
+{
+    using persistence::pos_db::detail::shardOfPositionHash;
+
+    constexpr std::uint64_t maxHash = std::numeric_limits<std::uint64_t>::max();
+
+    for (std::size_t numShards : { 1, 2, 3, 4, 7 })
+    {
+        REQUIRE(shardOfPositionHash(0, numShards) == 0);
+        REQUIRE(shardOfPositionHash(maxHash, numShards) == numShards - 1);
+
+        // The shard changes exactly once at each boundary,
+        // and the low 32 bits don't matter.
+        std::uint64_t top = 0;
+        for (std::size_t shard = 1; shard < numShards; ++shard)
+        {
+            while (((top * numShards) >> 32) < shard)
+            {
+                ++top;
+            }
+
+            REQUIRE(shardOfPositionHash(((top - 1) << 32) | 0xFFFFFFFFull, numShards) == shard - 1);
+            REQUIRE(shardOfPositionHash(top << 32, numShards) == shard);
+        }
+    }
+
+    // Powers of two select by the top bits.
+    REQUIRE(shardOfPositionHash(0x7FFFFFFFFFFFFFFFull, 2) == 0);
+    REQUIRE(shardOfPositionHash(0x8000000000000000ull, 2) == 1);
+    REQUIRE(shardOfPositionHash(0xBFFFFFFFFFFFFFFFull, 4) == 2);
+    REQUIRE(shardOfPositionHash(0xC000000000000000ull, 4) == 3);
+}
+
+TEST_CASE("Sharded database", "[persistence]")
+{
+    namespace fs = std::filesystem;
+    using Database = persistence::db_epsilon::Database;
+    using Key = persistence::db_epsilon::Key;
+
+    constexpr std::size_t numShards = 3;
+
+    const fs::path root = fs::temp_directory_path() / "chess_pos_db_sharding_test";
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    const fs::path pgnPath = root / "games.pgn";
+    const auto fens = persistence_test::writeRandomGames(pgnPath, 200, 40);
+    REQUIRE(!fens.empty());
+
+    const fs::path singlePath = root / "single";
+    const fs::path shardedPath = root / "sharded";
+
+    // The shards file is read when the database is opened.
+    std::vector<std::string> shardPaths;
+    for (std::size_t i = 0; i < numShards; ++i)
+    {
+        shardPaths.emplace_back(fs::absolute(root / ("shard_" + std::to_string(i))).string());
+    }
+    fs::create_directories(shardedPath);
+    {
+        std::ofstream shardsFile(shardedPath / "shards");
+        shardsFile << nlohmann::json(shardPaths).dump(4);
+    }
+
+    const query::Request query = makeRequest(fens);
+
+    // The continuations of a position are spread over all shards,
+    // so the queried keys have to be split at the shard boundaries.
+    {
+        std::set<std::size_t> shardsOfKeys;
+        for (auto&& fen : fens)
+        {
+            const Position pos = Position::fromFen(fen.c_str());
+            movegen::forEachLegalMove(pos, [&](Move move) {
+                const Key key(PositionWithZobrist(pos.afterMove(move)));
+                shardsOfKeys.insert(persistence::pos_db::detail::shardOfPositionHash(persistence::pos_db::detail::positionHashOf(key), numShards));
+                });
+        }
+        REQUIRE(shardsOfKeys.size() == numShards);
+    }
+
+    persistence::ImportableFiles files;
+    files.emplace_back(pgnPath, GameLevel::Human);
+
+    {
+        Database single(singlePath);
+        Database sharded(shardedPath);
+
+        const auto singleStats = single.import(files, 1ull << 20);
+        const auto shardedStats = sharded.import(files, 1ull << 20);
+        REQUIRE(singleStats.total().numGames == 200);
+        REQUIRE(shardedStats.total().numGames == 200);
+        REQUIRE(singleStats.total().numPositions == shardedStats.total().numPositions);
+
+        // A second import gives the merges something to do.
+        (void)single.import(files, 1ull << 20);
+        (void)sharded.import(files, 1ull << 20);
+
+        // Every shard gets some of the entries.
+        for (auto&& shardPath : shardPaths)
+        {
+            std::uintmax_t size = 0;
+            for (auto&& entry : fs::recursive_directory_iterator(shardPath))
+            {
+                if (entry.is_regular_file())
+                {
+                    size += entry.file_size();
+                }
+            }
+            REQUIRE(size > 0);
+        }
+
+        const std::string expected = nlohmann::json(single.executeQuery(query)).dump();
+        REQUIRE(expected.find("\"count\"") != std::string::npos);
+        REQUIRE(nlohmann::json(sharded.executeQuery(query)).dump() == expected);
+
+        const fs::path tempPath = root / "tmp";
+        fs::create_directories(tempPath);
+        single.mergeAll({ tempPath }, std::nullopt);
+
+        // Shards are merged concurrently without temporary directories.
+        sharded.mergeAll({}, std::nullopt);
+
+        REQUIRE(nlohmann::json(single.executeQuery(query)).dump() == expected);
+        REQUIRE(nlohmann::json(sharded.executeQuery(query)).dump() == expected);
+    }
+
+    // The shards are found again after reopening.
+    {
+        Database single(singlePath);
+        Database sharded(shardedPath);
+        REQUIRE(nlohmann::json(sharded.executeQuery(query)).dump() == nlohmann::json(single.executeQuery(query)).dump());
+    }
+
+    fs::remove_all(root);
+}
@@ -0,0 +1,64 @@
+#include "catch2/catch.hpp"
+
+#include "PersistenceTestUtility.h"
+
+#include "persistence/pos_db/OrderedEntrySetPositionDatabase.h"
+#include "persistence/pos_db/Query.h"
+
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilon.h"
+
+#include "json/json.hpp"
+
+#include <filesystem>
+#include <string>
+
+TEST_CASE("Merging a database open in another instance", "[persistence]")
+{
+    namespace fs = std::filesystem;
+    using Database = persistence::db_epsilon::Database;
+
+    const fs::path root = fs::temp_directory_path() / "chess_pos_db_shared_database_test";
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    const fs::path pgnPath = root / "games.pgn";
+    const auto fens = persistence_test::writeRandomGames(pgnPath, 100, 30);
+
+    const fs::path dbPath = root / "db";
+
+    const query::Request query = persistence_test::makeRequest(
+        fens,
+        { GameLevel::Human },
+        { query::Select::Continuations },
+        query::AdditionalFetchingOptions{ true, false, false, false, false }
+    );
+
+    persistence::ImportableFiles files;
+    files.emplace_back(pgnPath, GameLevel::Human);
+
+    std::string expected;
+    {
+        Database db(dbPath);
+
+        // Two imports give the merge more than one file.
+        (void)db.import(files, 1ull << 20);
+        (void)db.import(files, 1ull << 20);
+
+        // Queries map the indexes of the files that are searched.
+        Database other(dbPath);
+        expected = nlohmann::json(other.executeQuery(query)).dump();
+        REQUIRE(expected.find("\"count\"") != std::string::npos);
+        REQUIRE(nlohmann::json(db.executeQuery(query)).dump() == expected);
+
+        // Removing and replacing the mapped index files must not fail.
+        REQUIRE_NOTHROW(db.mergeAll({}, std::nullopt));
+        REQUIRE(nlohmann::json(db.executeQuery(query)).dump() == expected);
+    }
+
+    {
+        Database reopened(dbPath);
+        REQUIRE(nlohmann::json(reopened.executeQuery(query)).dump() == expected);
+    }
+
+    fs::remove_all(root);
+}
@@ -0,0 +1,102 @@
+#include "catch2/catch.hpp"
+
+#include "chess/Position.h"
+
+#include "persistence/pos_db/delta/DatabaseFormatDeltaSmeared.h"
+#include "persistence/pos_db/epsilon/DatabaseFormatEpsilonSmeared.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    [[nodiscard]] persistence::EntryConstructionParameters makeParams(std::uint16_t whiteElo, std::uint16_t blackElo, std::uint64_t gameIndex)
+    {
+        persistence::EntryConstructionParameters params{};
+        params.position = PositionWithZobrist(Position::startPosition());
+        params.gameIndexOrOffset = gameIndex;
+        params.whiteElo = whiteElo;
+        params.blackElo = blackElo;
+        params.level = GameLevel::Human;
+        params.result = GameResult::WhiteWin;
+        return params;
+    }
+
+    // Combines entries of single games, smears the result, and decodes it back as one run.
+    template <typename UnsmearedEntryT>
+    [[nodiscard]] std::pair<UnsmearedEntryT, UnsmearedEntryT> smearAndDecode(
+        const std::vector<std::pair<std::uint16_t, std::uint16_t>>& elos
+        )
+    {
+        using SmearedEntryT = typename UnsmearedEntryT::SmearedEntryType;
+
+        UnsmearedEntryT unsmeared{};
+        for (std::size_t i = 0; i < elos.size(); ++i)
+        {
+            const SmearedEntryT single(makeParams(elos[i].first, elos[i].second, i + 1));
+            if (i == 0)
+            {
+                unsmeared = UnsmearedEntryT(&single, 1);
+            }
+            else
+            {
+                unsmeared.combine(UnsmearedEntryT(&single, 1));
+            }
+        }
+
+        std::vector<SmearedEntryT> run;
+        for (auto&& smeared : unsmeared)
+        {
+            run.emplace_back(smeared);
+        }
+
+        REQUIRE(!run.empty());
+        REQUIRE(run.size() <= UnsmearedEntryT::maxRunLength);
+
+        return { unsmeared, UnsmearedEntryT(run.data(), run.size()) };
+    }
+}
+
+TEST_CASE("Smeared entry run decoding", "[persistence]")
+{
+    SECTION("epsilon")
+    {
+        using UnsmearedEntry = persistence::db_epsilon_smeared::UnsmearedEntry;
+
+        // Negative elo difference with the lowest part equal to 0.
+        std::vector<std::pair<std::uint16_t, std::uint16_t>> elos(5, { 1600, 2400 });
+        elos.emplace_back(2000, 2096);
+        {
+            const auto [expected, decoded] = smearAndDecode<UnsmearedEntry>(elos);
+            REQUIRE(expected.eloDiff() == -4096);
+            REQUIRE(decoded.count() == expected.count());
+            REQUIRE(decoded.eloDiff() == expected.eloDiff());
+        }
+
+        // Many parts in the count and in the elo difference.
+        elos.assign(12345, { 2300, 2000 });
+        {
+            const auto [expected, decoded] = smearAndDecode<UnsmearedEntry>(elos);
+            REQUIRE(expected.count() == 12345);
+            REQUIRE(decoded.count() == expected.count());
+            REQUIRE(decoded.eloDiff() == expected.eloDiff());
+        }
+    }
+
+    SECTION("delta")
+    {
+        using UnsmearedEntry = persistence::db_delta_smeared::UnsmearedEntry;
+
+        std::vector<std::pair<std::uint16_t, std::uint16_t>> elos(1000, { 2500, 2100 });
+        elos.emplace_back(1000, 3000);
+        elos.emplace_back(0, 0);
+
+        const auto [expected, decoded] = smearAndDecode<UnsmearedEntry>(elos);
+        REQUIRE(decoded.count() == expected.count());
+        REQUIRE(decoded.countWithElo() == expected.countWithElo());
+        REQUIRE(decoded.whiteElo() == expected.whiteElo());
+        REQUIRE(decoded.blackElo() == expected.blackElo());
+        REQUIRE(decoded.firstGameIndex() == expected.firstGameIndex());
+    }
+}